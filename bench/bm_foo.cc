@@ -1,10 +1,32 @@
 // ---------------------------------------------------------------------------
 // IMLAB
 // ---------------------------------------------------------------------------
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <new>
+#include <optional>
+#include <random>
+#include <utility>
+#include <vector>
 #include "benchmark/benchmark.h"
 #include "imlab/buffer_manager.h"
 #include "imlab/betree.h"
+#include "imlab/btree.h"
 // ---------------------------------------------------------------------------
+namespace {
+struct Order {
+    uint64_t customer;
+    uint64_t date;
+    uint32_t quantity;
+    double price;
+};
+}  // namespace
+
+template<> struct imlab::Columns<Order> {
+    static constexpr auto members = std::make_tuple(&Order::customer, &Order::date, &Order::quantity, &Order::price);
+};
+
 namespace {
 // ---------------------------------------------------------------------------
 void BM_MeaningfulName(benchmark::State &state) {
@@ -35,11 +57,368 @@ void BM_BeTreeLinearInsert(benchmark::State &state) {
         benchmark::DoNotOptimize(tree);
     }
 };
+
+void BM_BTreeBulkLoad(benchmark::State &state) {
+    std::vector<std::pair<uint64_t, uint64_t>> pairs;
+    for (uint64_t i = 0; i < static_cast<uint64_t>(state.range(0)); ++i)
+        pairs.emplace_back(i, i);
+
+    imlab::BufferManager<1024> manager{10};
+    for (auto _ : state) {
+        imlab::BTree<uint64_t, uint64_t, 1024> tree{imlab::temporary, 2, manager};
+        tree.bulk_load(pairs.begin(), pairs.end());
+        benchmark::DoNotOptimize(tree);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// sum of all values, by iterator or by leaf runs
+template<bool runs> void BM_BTreeScan(benchmark::State &state) {
+    std::vector<std::pair<uint64_t, uint64_t>> pairs;
+    for (uint64_t i = 0; i < static_cast<uint64_t>(state.range(0)); ++i)
+        pairs.emplace_back(i, i);
+
+    imlab::BufferManager<4096> manager{8192};
+    imlab::BTree<uint64_t, uint64_t, 4096> tree{imlab::temporary, 2, manager};
+    tree.bulk_load(pairs.begin(), pairs.end());
+    const auto &const_tree = tree;
+
+    for (auto _ : state) {
+        uint64_t sum = 0;
+        if (runs) {
+            const_tree.scan(0, pairs.size(), [&sum](const uint64_t *, const uint64_t *values, uint32_t n) {
+                for (uint32_t i = 0; i < n; ++i)
+                    sum += values[i];
+                return true;
+            });
+        } else {
+            for (auto value : const_tree)
+                sum += value;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// keys in a range of state.range(0) keys, from the subtree sizes or by scanning the leaves
+template<bool counted> void BM_BTreeCountRange(benchmark::State &state) {
+    constexpr uint64_t amount = 1 << 20;
+    std::vector<std::pair<uint64_t, uint64_t>> pairs;
+    for (uint64_t i = 0; i < amount; ++i)
+        pairs.emplace_back(i, i);
+
+    imlab::BufferManager<4096> manager{8192};
+    imlab::BTree<uint64_t, uint64_t, 4096, std::less<uint64_t>, imlab::InnerLayout::Sorted, counted> tree{
+        imlab::temporary, 2, manager};
+    tree.bulk_load(pairs.begin(), pairs.end());
+    const auto &const_tree = tree;
+
+    std::mt19937_64 random(0);
+    for (auto _ : state) {
+        uint64_t lo = random() % (amount - state.range(0));
+        uint64_t hi = lo + state.range(0) - 1;
+        uint64_t n = 0;
+        if constexpr (counted) {
+            n = const_tree.count_range(lo, hi);
+        } else {
+            const_tree.scan(lo, hi, [&n](const uint64_t *, const uint64_t *, uint32_t run) {
+                n += run;
+                return true;
+            });
+        }
+        benchmark::DoNotOptimize(n);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// random probes into a large tree, one batch or independent lookups
+template<bool batch> void BM_BTreeFindBatch(benchmark::State &state) {
+    constexpr uint64_t amount = 1 << 20;
+    std::vector<std::pair<uint64_t, uint64_t>> pairs;
+    for (uint64_t i = 0; i < amount; ++i)
+        pairs.emplace_back(2 * i, i);
+
+    imlab::BufferManager<4096> manager{8192};
+    imlab::BTree<uint64_t, uint64_t, 4096> tree{imlab::temporary, 2, manager};
+    tree.bulk_load(pairs.begin(), pairs.end());
+
+    std::mt19937_64 random(0);
+    std::vector<uint64_t> keys(state.range(0));
+    std::vector<std::optional<uint64_t>> values(keys.size());
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (auto &key : keys)
+            key = random() % (2 * amount);
+        state.ResumeTiming();
+
+        if (batch) {
+            tree.find_batch(keys.data(), keys.size(), values.data());
+        } else {
+            for (size_t i = 0; i < keys.size(); ++i)
+                values[i] = tree.lookup(keys[i]);
+        }
+        benchmark::DoNotOptimize(values.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// random inserts into a loaded tree, one batch or one by one
+template<bool batch> void BM_BTreeInsertBatch(benchmark::State &state) {
+    constexpr uint64_t amount = 1 << 18;
+    std::vector<std::pair<uint64_t, uint64_t>> pairs;
+    for (uint64_t i = 0; i < amount; ++i)
+        pairs.emplace_back(2 * amount * i, i);
+
+    std::mt19937_64 random(0);
+    std::vector<std::pair<uint64_t, uint64_t>> inserts(state.range(0));
+    imlab::BufferManager<4096> manager{8192};
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto tree = std::make_unique<imlab::BTree<uint64_t, uint64_t, 4096>>(imlab::temporary, 2, manager);
+        tree->bulk_load(pairs.begin(), pairs.end(), 0.7);
+        for (auto &insert : inserts)
+            insert = {random() % (2 * amount * amount), 0};
+        state.ResumeTiming();
+
+        if (batch) {
+            tree->insert_batch(inserts.data(), inserts.size());
+        } else {
+            for (const auto &[key, value] : inserts)
+                tree->insert(key, value);
+        }
+
+        state.PauseTiming();
+        tree.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// search in one of many inner nodes, so the keys are usually not cached
+template<size_t page_size, bool vectorized> void BM_NodeSearch(benchmark::State &state) {
+    constexpr uint32_t capacity = imlab::BTree<uint64_t, uint64_t, page_size>::InnerNode::kCapacity;
+    constexpr uint32_t nodes = (64 << 20) / page_size;
+
+    std::vector<uint64_t> keys(uint64_t{nodes} * capacity);
+    for (uint64_t i = 0; i < keys.size(); ++i)
+        keys[i] = 2 * (i % capacity);
+
+    std::mt19937_64 random(0);
+    uint64_t sum = 0;
+    for (auto _ : state) {
+        uint64_t r = random();
+        const uint64_t *node = keys.data() + (r % nodes) * capacity;
+        uint64_t key = (r >> 32) % (2 * capacity);
+        if (vectorized)
+            sum += imlab::search_lower_bound(node, capacity, key, std::less<uint64_t>());
+        else
+            sum += std::lower_bound(node, node + capacity, key) - node;
+    }
+    benchmark::DoNotOptimize(sum);
+    state.SetItemsProcessed(state.iterations());
+}
+
+// full inner nodes of `layout` in 64 MiB, searched like a descent that misses the cache
+// `skewed` separators grow with the cube of their index instead of evenly
+template<size_t page_size, imlab::InnerLayout layout, bool skewed = false> void BM_InnerLayout(benchmark::State &state) {
+    using InnerNode = typename imlab::BTree<uint64_t, uint64_t, page_size, std::less<uint64_t>, layout>::InnerNode;
+    constexpr uint32_t capacity = InnerNode::kCapacity;
+    constexpr uint32_t nodes = (64 << 20) / page_size;
+
+    struct alignas(64) Page {
+        std::byte data[page_size];
+    };
+    std::vector<Page> pages(nodes);
+    for (auto &page : pages) {
+        auto *node = new (page.data) InnerNode(1);
+        node->init(0);
+        for (uint64_t i = 0; i < capacity; ++i)
+            node->insert(skewed ? i * i * i : 2 * i, i + 1);
+    }
+    uint64_t max_key = skewed ? uint64_t{capacity} * capacity * capacity : 2 * capacity;
+
+    std::mt19937_64 random(0);
+    uint64_t sum = 0;
+    for (auto _ : state) {
+        uint64_t r = random();
+        const auto *node = reinterpret_cast<const InnerNode *>(pages[r % nodes].data);
+        sum += node->child_index((r >> 32) % max_key);
+    }
+    benchmark::DoNotOptimize(sum);
+    state.SetItemsProcessed(state.iterations());
+    state.counters["capacity"] = capacity;
+}
+
+// random inserts, then random lookups, with pages in a buffer manager or in an arena
+template<bool arena> void BM_BTreeStorage(benchmark::State &state) {
+    using Paged = imlab::BTree<uint64_t, uint64_t, 4096>;
+    using InMemory = imlab::BTree<uint64_t, uint64_t, 4096, std::less<uint64_t>, imlab::InnerLayout::Sorted, false,
+                                  imlab::LeafLayout::Plain, imlab::Arena>;
+    imlab::BufferManager<4096> manager{8192};
+    auto tree = [&manager] {
+        if constexpr (arena)
+            return std::make_unique<InMemory>();
+        else
+            return std::make_unique<Paged>(imlab::temporary, 2, manager);
+    }();
+
+    std::mt19937_64 random(0);
+    for (int64_t i = 0; i < state.range(0); ++i)
+        tree->insert(random(), i);
+
+    std::vector<uint64_t> keys(1 << 12);
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (auto &key : keys)
+            key = random();
+        state.ResumeTiming();
+
+        for (auto key : keys)
+            benchmark::DoNotOptimize(tree->lookup(key));
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+// clustered lookups, runs of consecutive keys from random starting points
+template<bool hinted> void BM_BTreeClustered(benchmark::State &state) {
+    using Tree = imlab::BTree<uint64_t, uint64_t, 4096>;
+    imlab::BufferManager<4096> manager{8192};
+    Tree tree(imlab::temporary, 2, manager);
+    constexpr uint64_t keys = 1 << 20;
+    for (uint64_t i = 0; i < keys; ++i)
+        tree.insert(i, i);
+
+    std::mt19937_64 random(0);
+    Tree::Hint hint;
+    for (auto _ : state) {
+        uint64_t start = random() % (keys - state.range(0));
+        for (uint64_t key = start; key < start + state.range(0); ++key) {
+            if constexpr (hinted)
+                benchmark::DoNotOptimize(tree.lookup(key, hint));
+            else
+                benchmark::DoNotOptimize(tree.lookup(key));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// sum of a single member of wide values, columnar leaves read only its column
+template<imlab::LeafLayout leaf_layout> void BM_LeafLayoutScan(benchmark::State &state) {
+    using Tree = imlab::BTree<uint64_t, Order, 4096, std::less<uint64_t>, imlab::InnerLayout::Sorted, false, leaf_layout>;
+    std::vector<std::pair<uint64_t, Order>> pairs;
+    for (uint64_t i = 0; i < static_cast<uint64_t>(state.range(0)); ++i)
+        pairs.push_back({i, Order{i % 1000, i / 100, static_cast<uint32_t>(i % 10), 0.25 * i}});
+
+    imlab::BufferManager<4096> manager{8192};
+    Tree tree{imlab::temporary, 2, manager};
+    tree.bulk_load(pairs.begin(), pairs.end());
+
+    for (auto _ : state) {
+        double sum = 0;
+        tree.template scan_field<&Order::price>(0, pairs.size(), [&sum](const uint64_t *, const double *prices, uint32_t n) {
+            for (uint32_t i = 0; i < n; ++i)
+                sum += prices[i];
+            return true;
+        });
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+using SharedBTree = imlab::BTree<uint64_t, uint64_t, 1024>;
+constexpr uint64_t kSharedKeys = 1 << 16;
+std::unique_ptr<imlab::BufferManager<1024>> shared_manager;
+std::unique_ptr<SharedBTree> shared_tree;
+
+// one tree shared by all threads, state.range(0) percent of the operations are inserts
+void BM_BTreeConcurrentMixed(benchmark::State &state) {
+    if (state.thread_index() == 0) {
+        shared_manager = std::make_unique<imlab::BufferManager<1024>>(1 << 12);
+        shared_tree = std::make_unique<SharedBTree>(imlab::temporary, 1, *shared_manager);
+        for (uint64_t i = 0; i < kSharedKeys; ++i)
+            shared_tree->insert(i, i);
+    }
+
+    std::mt19937_64 random(state.thread_index());
+    uint64_t next_key = kSharedKeys + state.thread_index();
+    for (auto _ : state) {
+        if (static_cast<int64_t>(random() % 100) < state.range(0)) {
+            shared_tree->insert(next_key, next_key);
+            next_key += state.threads();
+        } else {
+            // optimistic lookups never write to the pages they read
+            benchmark::DoNotOptimize(shared_tree->lookup(random() % kSharedKeys));
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+
+    if (state.thread_index() == 0) {
+        shared_tree.reset();
+        shared_manager.reset();
+    }
+}
 // ---------------------------------------------------------------------------
 }  // namespace
 // ---------------------------------------------------------------------------
 BENCHMARK(BM_BeTreeLinearInsert)
     -> Range(1 << 8, 1 << 20);
+BENCHMARK(BM_BTreeBulkLoad)
+    -> Range(1 << 8, 1 << 20);
+BENCHMARK_TEMPLATE(BM_BTreeScan, false)
+    -> Range(1 << 12, 1 << 20);
+BENCHMARK_TEMPLATE(BM_BTreeScan, true)
+    -> Range(1 << 12, 1 << 20);
+BENCHMARK_TEMPLATE(BM_BTreeCountRange, false)
+    -> Range(1 << 4, 1 << 18);
+BENCHMARK_TEMPLATE(BM_BTreeCountRange, true)
+    -> Range(1 << 4, 1 << 18);
+BENCHMARK_TEMPLATE(BM_BTreeFindBatch, false)
+    -> Range(1 << 6, 1 << 16);
+BENCHMARK_TEMPLATE(BM_BTreeFindBatch, true)
+    -> Range(1 << 6, 1 << 16);
+BENCHMARK_TEMPLATE(BM_BTreeInsertBatch, false)
+    -> Range(1 << 10, 1 << 18);
+BENCHMARK_TEMPLATE(BM_BTreeInsertBatch, true)
+    -> Range(1 << 10, 1 << 18);
+BENCHMARK_TEMPLATE(BM_NodeSearch, 1024, false);
+BENCHMARK_TEMPLATE(BM_NodeSearch, 1024, true);
+BENCHMARK_TEMPLATE(BM_NodeSearch, 4096, false);
+BENCHMARK_TEMPLATE(BM_NodeSearch, 4096, true);
+BENCHMARK_TEMPLATE(BM_NodeSearch, 16384, false);
+BENCHMARK_TEMPLATE(BM_NodeSearch, 16384, true);
+BENCHMARK_TEMPLATE(BM_NodeSearch, 65536, false);
+BENCHMARK_TEMPLATE(BM_NodeSearch, 65536, true);
+BENCHMARK_TEMPLATE(BM_InnerLayout, 1024, imlab::InnerLayout::Sorted);
+BENCHMARK_TEMPLATE(BM_InnerLayout, 1024, imlab::InnerLayout::Blocked);
+BENCHMARK_TEMPLATE(BM_InnerLayout, 4096, imlab::InnerLayout::Sorted);
+BENCHMARK_TEMPLATE(BM_InnerLayout, 4096, imlab::InnerLayout::Blocked);
+BENCHMARK_TEMPLATE(BM_InnerLayout, 16384, imlab::InnerLayout::Sorted);
+BENCHMARK_TEMPLATE(BM_InnerLayout, 16384, imlab::InnerLayout::Blocked);
+BENCHMARK_TEMPLATE(BM_InnerLayout, 65536, imlab::InnerLayout::Sorted);
+BENCHMARK_TEMPLATE(BM_InnerLayout, 65536, imlab::InnerLayout::Blocked);
+BENCHMARK_TEMPLATE(BM_InnerLayout, 4096, imlab::InnerLayout::Learned);
+BENCHMARK_TEMPLATE(BM_InnerLayout, 16384, imlab::InnerLayout::Learned);
+BENCHMARK_TEMPLATE(BM_InnerLayout, 4096, imlab::InnerLayout::Sorted, true);
+BENCHMARK_TEMPLATE(BM_InnerLayout, 4096, imlab::InnerLayout::Blocked, true);
+BENCHMARK_TEMPLATE(BM_InnerLayout, 4096, imlab::InnerLayout::Learned, true);
+BENCHMARK_TEMPLATE(BM_InnerLayout, 16384, imlab::InnerLayout::Sorted, true);
+BENCHMARK_TEMPLATE(BM_InnerLayout, 16384, imlab::InnerLayout::Learned, true);
+BENCHMARK_TEMPLATE(BM_BTreeStorage, false)
+    -> Range(1 << 12, 1 << 20);
+BENCHMARK_TEMPLATE(BM_BTreeStorage, true)
+    -> Range(1 << 12, 1 << 20);
+BENCHMARK_TEMPLATE(BM_BTreeClustered, false)
+    -> Range(1 << 4, 1 << 12);
+BENCHMARK_TEMPLATE(BM_BTreeClustered, true)
+    -> Range(1 << 4, 1 << 12);
+BENCHMARK_TEMPLATE(BM_LeafLayoutScan, imlab::LeafLayout::Plain)
+    -> Range(1 << 12, 1 << 18);
+BENCHMARK_TEMPLATE(BM_LeafLayoutScan, imlab::LeafLayout::Columnar)
+    -> Range(1 << 12, 1 << 18);
+BENCHMARK(BM_BTreeConcurrentMixed)
+    -> Arg(0) -> Arg(10) -> Arg(50)
+    -> ThreadRange(1, 8)
+    -> UseRealTime();
 // ---------------------------------------------------------------------------
 int main(int argc, char **argv) {
     // Your could load TPCH into global vectors here
@@ -0,0 +1,179 @@
+// ---------------------------------------------------------------------------------------------------
+// IMLAB
+// ---------------------------------------------------------------------------------------------------
+#ifndef INCLUDE_IMLAB_ARENA_H_
+#define INCLUDE_IMLAB_ARENA_H_
+
+#include "imlab/segment.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+// ---------------------------------------------------------------------------------------------------
+namespace imlab {
+
+#define ARENA_TEMPL \
+    template<size_t page_size>
+#define ARENA_CLASS \
+    Arena<page_size>
+
+// In-memory page store with the interface of Segment, for data structures that fit in memory.
+// Pages are found through a two-level directory indexed by the page id and stay in place until
+// the arena is destroyed. There is no hashing, no replacement and no global mutex, every page only
+// carries its own latch and the version for optimistic reads.
+// Pages are created zeroed on their first fix. `spill` copies them to a segment of a buffer manager.
+ARENA_TEMPL class Arena {
+    struct Page;
+ public:
+    class Fix;
+    class ExclusiveFix;
+    class OptimisticFix;
+
+    // ids below this limit can be fixed
+    static constexpr uint64_t kChunkBits = 12;
+    static constexpr uint64_t kMaxPages = 1ull << (2 * kChunkBits);
+
+    Arena();
+    ~Arena();
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    // same semantics as the fixes of Segment and BufferManager, shared fixes may be held
+    // several times by the same thread, fixes wait for conflicting ones to be released
+    // ids of kMaxPages and above throw arena_full_error
+    Fix fix(uint64_t page_id) const;
+    ExclusiveFix fix_exclusive(uint64_t page_id);
+    // empty instead of waiting for other fixes of the page
+    ExclusiveFix try_fix_exclusive(uint64_t page_id);
+    // invalid if the page does not exist yet or is fixed exclusively
+    OptimisticFix fix_optimistic(uint64_t page_id) const;
+    // empty if the page changed since the optimistic fix
+    Fix fix(const OptimisticFix &page) const;
+    ExclusiveFix fix_exclusive(const OptimisticFix &page);
+
+    uint64_t page_id(const Fix &fix) const;
+    uint64_t page_id(const OptimisticFix &fix) const;
+
+    // all pages are resident and never written back, so changing them costs no i/o like for dirty pages
+    bool is_dirty(uint64_t page_id) const;
+    void commit() {}
+    // the pages are discarded on destruction
+    bool is_temporary() const { return true; }
+
+    // one above the highest page id fixed so far
+    uint64_t page_count() const;
+    // copy all pages to segment `segment_id` of `manager` and commit it
+    // the arena must not be changed concurrently
+    void spill(uint16_t segment_id, BufferManager<page_size> &manager) const;
+
+ private:
+    struct Chunk {
+        std::atomic<Page *> pages[1ull << kChunkBits];
+    };
+
+    // chunks and pages are only added, readers find them without any lock
+    std::unique_ptr<std::atomic<Chunk *>[]> directory;
+    mutable std::atomic<uint64_t> pages{0};
+
+    // the page with `page_id`, created if it does not exist yet, throws for ids past the directory
+    Page &get(uint64_t page_id) const;
+    // nullptr if the page does not exist yet
+    Page *find(uint64_t page_id) const;
+};
+
+ARENA_TEMPL struct ARENA_CLASS::Page {
+    explicit Page(uint64_t page_id) : page_id(page_id) {}
+
+    // latch without touching the version, waits for conflicting fixes
+    void lock_shared();
+    void lock();
+    bool try_lock();
+    // releases either latch, bumps the version after an exclusive one
+    void unfix();
+
+    const uint64_t page_id;
+    // shared fixes, -1 while the page is fixed exclusively
+    std::atomic<int32_t> fix_count{0};
+    // odd while the page is fixed exclusively, every exclusive fix bumps it twice
+    std::atomic<uint64_t> version{0};
+
+    alignas(64) std::byte data[page_size] = {};
+};
+
+ARENA_TEMPL class ARENA_CLASS::Fix {
+    friend class Arena;
+ public:
+    Fix() = default;
+
+    Fix(const Fix &) = delete;
+    Fix &operator=(const Fix &) = delete;
+
+    Fix(Fix &&o) noexcept;
+    Fix &operator=(Fix &&o) noexcept;
+
+    ~Fix();
+    void unfix();
+
+    uint64_t page_id() const;
+
+    const std::byte *data() const;
+    template<typename T> const T *as() const;
+
+ protected:
+    explicit Fix(Page *page) noexcept : page(page) {}
+    Page *page = nullptr;
+};
+
+ARENA_TEMPL class ARENA_CLASS::ExclusiveFix : public Fix {
+    friend class Arena;
+ public:
+    ExclusiveFix() = default;
+
+    using Fix::data;
+    std::byte *data();
+    template<typename T> T *as();
+
+    // pages are never written back, kept for the interface of the buffer manager
+    void set_dirty() {}
+
+ private:
+    explicit ExclusiveFix(Page *page) noexcept : Fix(page) {}
+};
+
+ARENA_TEMPL class ARENA_CLASS::OptimisticFix {
+    friend class Arena;
+ public:
+    OptimisticFix() = default;
+
+    bool valid() const;
+    uint64_t page_id() const;
+
+    // the contents may change at any time, only trust what was read before a successful `validate`
+    const std::byte *data() const;
+    template<typename T> const T *as() const;
+
+    // true if the page did not change since the optimistic fix
+    bool validate() const;
+
+ private:
+    OptimisticFix(const Page *page, uint64_t version) noexcept : page(page), version(version) {}
+
+    const Page *page = nullptr;
+    uint64_t version = 0;
+};
+
+class arena_full_error : public std::exception {
+ public:
+    const char* what() const noexcept override {
+        return "arena is full";
+    }
+};
+
+}  // namespace imlab
+// ---------------------------------------------------------------------------------------------------
+#include "arena.hpp"
+// ---------------------------------------------------------------------------------------------------
+#endif  // INCLUDE_IMLAB_ARENA_H_
@@ -4,6 +4,8 @@
 #ifndef INCLUDE_IMLAB_BETREE_H_
 #define INCLUDE_IMLAB_BETREE_H_
 
+#include "imlab/arena.h"
+#include "imlab/node_search.h"
 #include "imlab/rbtree.h"
 #include "imlab/segment.h"
 
@@ -17,15 +19,18 @@
 namespace imlab {
 
 #define IMLAB_BETREE_TEMPL \
-    template<typename Key, typename T, size_t page_size, size_t epsilon, typename Compare>
+    template<typename Key, typename T, size_t page_size, size_t epsilon, typename Compare, \
+             template<size_t> class Storage>
 #define IMLAB_BETREE_CLASS \
-    BeTree<Key, T, page_size, epsilon, Compare>
+    BeTree<Key, T, page_size, epsilon, Compare, Storage>
 
-template<typename Key, typename T, size_t page_size, size_t epsilon, typename Compare = std::less<Key>>
-class BeTree : private Segment<page_size> {
+// `Storage` holds the pages like for BTree, an Arena keeps the tree in memory
+template<typename Key, typename T, size_t page_size, size_t epsilon, typename Compare = std::less<Key>,
+         template<size_t> class Storage = Segment>
+class BeTree : private Storage<page_size> {
     struct CoupledFixes;
-    using Fix = typename BufferManager<page_size>::Fix;
-    using ExclusiveFix = typename BufferManager<page_size>::ExclusiveFix;
+    using Fix = typename Storage<page_size>::Fix;
+    using ExclusiveFix = typename Storage<page_size>::ExclusiveFix;
 
  public:
     using key_type = Key;
@@ -51,8 +56,18 @@ class BeTree : private Segment<page_size> {
     // class iterator;
     class const_iterator;
 
+    // in-memory tree, for storage without a buffer manager such as Arena
+    BeTree() = default;
     BeTree(uint16_t segment_id, BufferManager<page_size> &manager)
-        : Segment<page_size>(segment_id, manager) {}
+        : Storage<page_size>(segment_id, manager) {}
+    // attach to the tree stored in the segment by the last `checkpoint`
+    // throws stale_metadata_error if the tree changed after it, e.g. before a crash
+    BeTree(reopen_t, uint16_t segment_id, BufferManager<page_size> &manager);
+    // scratch tree, dropped without any writeback on destruction
+    BeTree(temporary_t, uint16_t segment_id, BufferManager<page_size> &manager)
+        : Storage<page_size>(temporary, segment_id, manager) {}
+    // tries to store the metadata for a later reopen, errors are ignored
+    ~BeTree();
 
     const_iterator begin() const;
     const_iterator end() const;
@@ -72,19 +87,32 @@ class BeTree : private Segment<page_size> {
     uint64_t capacity() const;
     uint16_t depth() const;
 
+    // store the tree metadata in the segment header page and commit the buffer manager
+    void checkpoint();
+    // in-memory trees: copy all pages with the metadata to segment `segment_id` of `manager`, where a
+    // tree with the default storage and otherwise the same parameters reopens it
+    void spill(uint16_t segment_id, BufferManager<page_size> &manager);
 
     // testing interface, not linked in prod code
     void check_be_invariants() const;
 
  private:
+    struct Metadata;
     static constexpr Compare comp{};
+    static constexpr uint64_t kMetadataPage = 0;
 
     std::optional<uint64_t> root;
-    uint64_t next_page_id = 0;
+    uint64_t next_page_id = kMetadataPage + 1;
     uint64_t next_timestamp = 1;
 
     uint64_t count = 0, leaf_count = 0;
     int64_t pending = 0;
+    // set while the metadata page matches the tree, the first insert after that clears it on the page
+    bool metadata_current = false;
+
+    void write_metadata();
+    // mark the stored metadata as outdated, logged before the insert changes any node
+    void invalidate_metadata();
 
     // get exclusive fix, will always return fix of valid node
     ExclusiveFix root_fix_exclusive();
@@ -111,8 +139,18 @@ IMLAB_BETREE_TEMPL struct IMLAB_BETREE_CLASS::Node {
 IMLAB_BETREE_TEMPL class IMLAB_BETREE_CLASS::InnerNode : public Node {
  public:
     static_assert(epsilon < page_size);
-    static constexpr uint32_t kCapacity =
-        (page_size - sizeof(Node) - sizeof(uint64_t) - epsilon) / (sizeof(Key) + sizeof(uint64_t));
+    // largest entry count whose message buffer, keys and children fit the page
+    static constexpr uint32_t kCapacity = [] {
+        constexpr auto align = [](size_t offset, size_t alignment) {
+            return (offset + alignment - 1) / alignment * alignment;
+        };
+        constexpr size_t alignment = std::max({alignof(Node), alignof(MessageMap), alignof(Key)});
+        constexpr size_t keys = align(align(sizeof(Node), alignof(MessageMap)) + sizeof(MessageMap), alignof(Key));
+        uint32_t n = (page_size - sizeof(Node) - epsilon) / (sizeof(Key) + sizeof(PageRef));
+        while (n > 0 && align(keys + sizeof(Key) * n + sizeof(PageRef) * (n + 1), alignment) > page_size)
+            --n;
+        return n;
+    }();
 
     constexpr InnerNode(uint16_t level);
 
@@ -143,7 +181,7 @@ IMLAB_BETREE_TEMPL class IMLAB_BETREE_CLASS::InnerNode : public Node {
  private:
     MessageMap msgs;
     Key keys[kCapacity];
-    uint64_t children[kCapacity + 1];
+    PageRef children[kCapacity + 1];
 };
 
 IMLAB_BETREE_TEMPL class IMLAB_BETREE_CLASS::LeafNode : public Node {
@@ -178,10 +216,32 @@ IMLAB_BETREE_TEMPL class IMLAB_BETREE_CLASS::LeafNode : public Node {
     T values[kCapacity];
 };
 
+IMLAB_BETREE_TEMPL struct IMLAB_BETREE_CLASS::Metadata {
+    static constexpr uint64_t kMagic = 0x33305f6565727465;  // "etree_03"
+
+    uint64_t magic;
+    uint32_t page_bytes;
+    uint16_t key_size;
+    uint16_t value_size;
+    uint64_t epsilon_bytes;
+    // cleared by the first change after the fields were stored
+    uint64_t checkpointed;
+
+    uint64_t root;
+    uint64_t has_root;
+    uint64_t next_page_id;
+    uint64_t next_timestamp;
+    uint64_t count;
+    uint64_t leaf_count;
+    int64_t pending;
+
+    bool matches() const;
+};
+
 IMLAB_BETREE_TEMPL struct IMLAB_BETREE_CLASS::CoupledFixes {
-    typename BufferManager<page_size>::ExclusiveFix fix, prev;
+    ExclusiveFix fix, prev;
 
-    void advance(typename BufferManager<page_size>::ExclusiveFix next);
+    void advance(ExclusiveFix next);
 };
 
 IMLAB_BETREE_TEMPL struct IMLAB_BETREE_CLASS::MessageKey {
@@ -214,12 +274,12 @@ IMLAB_BETREE_TEMPL class IMLAB_BETREE_CLASS::const_iterator {
     const_pointer operator->();
 
  private:
-    const_iterator(const Segment<page_size> &segment, std::vector<Fix> fixes, typename MessageMap::const_iterator it, uint32_t idx)
+    const_iterator(const Storage<page_size> &segment, std::vector<Fix> fixes, typename MessageMap::const_iterator it, uint32_t idx)
         : segment(segment), fixes(std::move(fixes)), it(it), idx(idx) {}
 
     typename MessageMap::const_iterator it;
     uint32_t idx;
-    const Segment<page_size> &segment;
+    const Storage<page_size> &segment;
     std::vector<Fix> fixes;
 };
 
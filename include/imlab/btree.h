@@ -4,26 +4,371 @@
 #ifndef INCLUDE_IMLAB_BTREE_H_
 #define INCLUDE_IMLAB_BTREE_H_
 
+#include "imlab/arena.h"
+#include "imlab/node_search.h"
 #include "imlab/segment.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <set>
+#include <shared_mutex>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 // ---------------------------------------------------------------------------------------------------
 namespace imlab {
 
 #define IMLAB_BTREE_TEMPL \
-    template<typename Key, typename T, size_t page_size, typename Compare>
+    template<typename Key, typename T, size_t page_size, typename Compare, InnerLayout layout, bool counted, \
+             LeafLayout leaf_layout, template<size_t> class Storage>
 #define IMLAB_BTREE_CLASS \
-    BTree<Key, T, page_size, Compare>
+    BTree<Key, T, page_size, Compare, layout, counted, leaf_layout, Storage>
+
+// Arrangement of the separators in inner nodes, both keep them sorted.
+// Sorted stores one flat array, so most probes of a binary search touch a different cache line.
+// Blocked aligns the array to cache lines and stacks index levels on top like a small B-tree,
+// every level holds the last key of each full line of the level below. A search reads a single
+// line per level.
+// Learned is for integer keys, it adds a LearnedModel of the separators to the header of the node,
+// which narrows the search to a small window around the guessed position. The model is rebuilt on
+// every change of the node, so it suits trees that are read much more often than they are split.
+enum class InnerLayout { Sorted, Blocked, Learned };
+
+// Storage of the keys in leaves. Plain stores them as they are. Packed is for integer keys, it
+// stores the distance of every key to a base key of the leaf in 1, 2, 4 or 8 bytes, whatever the
+// range of the leaf needs. The distances are searched with the same vectorized kernels as plain
+// keys. A packed leaf takes up to twice the entries of a plain one, so a single split always
+// makes room for another key. Values are stored as they are, since they are handed out by reference.
+// Columnar stores the keys as they are and every member of the values in a column of its own, the
+// members listed by `Columns<T>`. Scans over a single member with `scan_field` then only read that
+// column. Values are assembled from the columns on every read and handed out by a ValueRef.
+enum class LeafLayout { Plain, Packed, Columnar };
+
+// Members of an aggregate value type that columnar leaves store as columns, specialize it with
+// pointers to all members of `T` that should be kept, e.g.
+//   template<> struct Columns<Row> { static constexpr auto members = std::make_tuple(&Row::a, &Row::b); };
+template<typename T>
+struct Columns;
+
+template<typename Member>
+struct member_of;
+
+template<typename C, typename M>
+struct member_of<M C::*> {
+    using type = M;
+};
+
+// type of the member that the member pointer `member` refers to
+template<auto member>
+using member_t = typename member_of<decltype(member)>::type;
+
+// placement of the columns of `T` behind each other, every one aligned for its member
+template<typename T>
+struct ColumnLayout {
+    using Members = std::remove_cv_t<decltype(Columns<T>::members)>;
+    static constexpr size_t kCount = std::tuple_size_v<Members>;
+
+    template<size_t i>
+    using type = typename member_of<std::tuple_element_t<i, Members>>::type;
+
+    static constexpr std::array<size_t, kCount> kSizes = std::apply(
+        [](auto... members) { return std::array<size_t, kCount>{sizeof(typename member_of<decltype(members)>::type)...}; },
+        Members{});
+    static constexpr std::array<size_t, kCount> kAligns = std::apply(
+        [](auto... members) { return std::array<size_t, kCount>{alignof(typename member_of<decltype(members)>::type)...}; },
+        Members{});
+    static constexpr size_t kAlign = *std::max_element(kAligns.begin(), kAligns.end());
+    // bytes per entry in all columns, without the padding between them
+    static constexpr size_t kRowBytes = std::apply(
+        [](auto... members) { return (sizeof(typename member_of<decltype(members)>::type) + ...); }, Members{});
+
+    // bytes from the first column to column `i` with `n` entries each, the end of all for `kCount`
+    static constexpr size_t offset(size_t i, uint32_t n) {
+        size_t end = 0;
+        for (size_t j = 0; j < i; ++j)
+            end = (end + kAligns[j] - 1) / kAligns[j] * kAligns[j] + kSizes[j] * n;
+        return i < kCount ? (end + kAligns[i] - 1) / kAligns[i] * kAligns[i] : end;
+    }
+
+    // position of `member` in `Columns<T>::members`
+    template<auto member>
+    static constexpr size_t index() {
+        size_t i = 0, result = kCount;
+        std::apply([&](auto... members) {
+            ((result = same(members, member) && result == kCount ? i : result, ++i), ...);
+        }, Columns<T>::members);
+        return result;
+    }
+
+ private:
+    template<typename A, typename B>
+    static constexpr bool same(A a, B b) {
+        if constexpr (std::is_same_v<A, B>)
+            return a == b;
+        else
+            return false;
+    }
+};
+
+// separators and children of an inner node for `layout`, `Node` is the common node header
+// children are 6 byte page references, counted nodes store the subtree size of every child
+// right behind the header
+template<typename Node, typename Key, size_t page_size, InnerLayout layout, bool counted>
+struct InnerEntries;
+
+template<typename Node, uint32_t n, bool counted>
+struct InnerSizes : Node {
+    using Node::Node;
+};
+
+template<typename Node, uint32_t n>
+struct InnerSizes<Node, n, true> : Node {
+    using Node::Node;
+
+ protected:
+    uint64_t sizes[n];
+};
+
+// bytes taken by the header and subtree sizes of an inner node with `n` separators
+template<typename Node, bool counted>
+constexpr size_t inner_header_size(uint32_t n) {
+    if (!counted)
+        return sizeof(Node);
+    return (sizeof(Node) + alignof(uint64_t) - 1) / alignof(uint64_t) * alignof(uint64_t)
+        + sizeof(uint64_t) * (n + 1);
+}
+
+// largest entry count whose header, keys and children fit the page
+// a search model of `model_bytes` is stored between the header and the keys
+template<typename Node, typename Key, size_t page_size, bool counted, size_t model_bytes = 0, size_t model_align = 1>
+constexpr uint32_t sorted_inner_capacity() {
+    constexpr size_t alignment = std::max({alignof(Key), model_align, counted ? alignof(uint64_t) : alignof(Node)});
+    constexpr size_t child_bytes = sizeof(PageRef) + (counted ? sizeof(uint64_t) : 0);
+    uint32_t n = (page_size - sizeof(Node) - model_bytes) / (sizeof(Key) + child_bytes);
+    for (; n > 0; --n) {
+        size_t model = (inner_header_size<Node, counted>(n) + model_align - 1) / model_align * model_align;
+        size_t keys = (model + model_bytes + alignof(Key) - 1) / alignof(Key) * alignof(Key);
+        size_t end = keys + sizeof(Key) * n + sizeof(PageRef) * (n + 1);
+        if ((end + alignment - 1) / alignment * alignment <= page_size)
+            break;
+    }
+    return n;
+}
+
+template<typename Node, typename Key, size_t page_size, bool counted>
+struct InnerEntries<Node, Key, page_size, InnerLayout::Sorted, counted>
+    : InnerSizes<Node, sorted_inner_capacity<Node, Key, page_size, counted>() + 1, counted> {
+    static constexpr uint32_t kCapacity = sorted_inner_capacity<Node, Key, page_size, counted>();
+
+    using InnerSizes<Node, kCapacity + 1, counted>::InnerSizes;
+
+ protected:
+    Key keys[kCapacity];
+    PageRef children[kCapacity + 1];
+};
+
+template<typename Node, typename Key, size_t page_size, bool counted>
+struct InnerEntries<Node, Key, page_size, InnerLayout::Learned, counted>
+    : InnerSizes<Node, sorted_inner_capacity<Node, Key, page_size, counted, sizeof(LearnedModel<Key>),
+                                             alignof(LearnedModel<Key>)>() + 1, counted> {
+    static constexpr uint32_t kCapacity =
+        sorted_inner_capacity<Node, Key, page_size, counted, sizeof(LearnedModel<Key>), alignof(LearnedModel<Key>)>();
+
+    using InnerSizes<Node, kCapacity + 1, counted>::InnerSizes;
+
+ protected:
+    LearnedModel<Key> model;
+    Key keys[kCapacity];
+    PageRef children[kCapacity + 1];
+};
+
+// shape of the index of blocked inner nodes
+template<typename Key, size_t page_size, typename Node, bool counted>
+struct BlockedShape {
+    static constexpr uint32_t kCacheLine = 64;
+    static constexpr uint32_t kBlock = kCacheLine / sizeof(Key);
+    static_assert(kBlock >= 2 && kCacheLine % sizeof(Key) == 0,
+                  "blocked inner nodes need at least two keys that evenly fill a cache line");
+
+    // entries on index level `level` for `n` keys, level 0 are the keys themselves
+    static constexpr uint32_t level_size(uint32_t n, uint32_t level) {
+        for (; level > 0; --level)
+            n /= kBlock;
+        return n;
+    }
+    // index levels above `n` keys, the topmost one fits a single line
+    static constexpr uint32_t levels(uint32_t n) {
+        uint32_t level = 0;
+        while (level_size(n, level + 1) > 0)
+            ++level;
+        return level;
+    }
+    // first index entry of `level` >= 1, every level starts on a line
+    static constexpr uint32_t level_offset(uint32_t n, uint32_t level) {
+        uint32_t offset = 0;
+        for (uint32_t l = 1; l < level; ++l)
+            offset += (level_size(n, l) + kBlock - 1) / kBlock * kBlock;
+        return offset;
+    }
+    // largest entry count whose children, index and keys fit the page
+    static constexpr uint32_t capacity() {
+        uint32_t n = (page_size - sizeof(Node)) / (sizeof(Key) + sizeof(PageRef));
+        for (; n > 0; --n) {
+            size_t children = inner_header_size<Node, counted>(n) + sizeof(PageRef) * (n + 1);
+            size_t lines = (children + kCacheLine - 1) / kCacheLine;
+            size_t end = lines * kCacheLine + (level_offset(n, levels(n) + 1) + n) * sizeof(Key);
+            if (end <= page_size)
+                break;
+        }
+        return n;
+    }
+};
+
+template<typename Node, typename Key, size_t page_size, bool counted>
+struct InnerEntries<Node, Key, page_size, InnerLayout::Blocked, counted>
+    : InnerSizes<Node, BlockedShape<Key, page_size, Node, counted>::capacity() + 1, counted> {
+    using Shape = BlockedShape<Key, page_size, Node, counted>;
+    static constexpr uint32_t kCapacity = Shape::capacity();
+    static constexpr uint32_t kLevels = Shape::levels(kCapacity);
+    static_assert(kLevels > 0, "blocked inner nodes need pages of several cache lines");
+    // first index entry of every level, precomputed for the search
+    static constexpr auto kLevelOffsets = [] {
+        std::array<uint32_t, kLevels + 2> offsets{};
+        for (uint32_t level = 1; level <= kLevels + 1; ++level)
+            offsets[level] = Shape::level_offset(kCapacity, level);
+        return offsets;
+    }();
+
+    using InnerSizes<Node, kCapacity + 1, counted>::InnerSizes;
+
+ protected:
+    PageRef children[kCapacity + 1];
+    // all index levels from the lowest one up
+    alignas(Shape::kCacheLine) Key index[kLevelOffsets[kLevels + 1]];
+    alignas(Shape::kCacheLine) Key keys[kCapacity];
+};
+
+// keys and values of a leaf for `leaf_layout`, `Node` is the common node header
+template<typename Node, typename Key, typename T, size_t page_size, LeafLayout leaf_layout>
+struct LeafEntries;
+
+template<typename Node, typename Key, typename T, size_t page_size>
+struct LeafEntries<Node, Key, T, page_size, LeafLayout::Plain> : Node {
+    static constexpr uint32_t kCapacity =
+        (page_size - sizeof(Node) - sizeof(PageRef)) / (sizeof(Key) + sizeof(T));
+    static constexpr uint32_t kSpace = kCapacity;
+    static constexpr uint32_t kMinCapacity = kCapacity;
+
+    using Node::Node;
+
+ protected:
+    Key keys[kCapacity];
+    T values[kCapacity];
+    PageRef next;
+};
+
+template<typename Node, typename Key>
+struct PackedLeafHeader : Node {
+    using Node::Node;
+
+ protected:
+    PageRef next;
+    // not above the smallest key, all keys are stored as their distance to it
+    Key base{};
+    // bytes per distance
+    uint8_t width = 1;
+};
+
+template<typename Node, typename Key, typename T, size_t page_size>
+struct LeafEntries<Node, Key, T, page_size, LeafLayout::Packed> : PackedLeafHeader<Node, Key> {
+    static_assert(std::is_integral_v<Key> && sizeof(Key) <= sizeof(uint64_t), "packed leaves need integer keys");
+    static_assert(alignof(T) <= 8, "packed leaves align values to 8 bytes");
+
+    static constexpr uint32_t kBytes = (page_size - sizeof(PackedLeafHeader<Node, Key>)) / 8 * 8;
+    // twice the pairs that fit with full width distances
+    static constexpr uint32_t kCapacity = 2 * (kBytes / (sizeof(Key) + sizeof(T)) - 1);
+    static constexpr uint32_t kSpace = kBytes;
+    static constexpr uint32_t kMinCapacity = kBytes / (sizeof(Key) + sizeof(T));
+
+    using PackedLeafHeader<Node, Key>::PackedLeafHeader;
+
+ protected:
+    // the values from the front, the distances at the back
+    alignas(8) std::byte data[kBytes];
+};
+
+// largest entry count whose header, keys, columns and next pointer fit the page
+template<typename Node, typename Key, typename T, size_t page_size>
+constexpr uint32_t columnar_leaf_capacity() {
+    using Layout = ColumnLayout<T>;
+    constexpr size_t alignment = std::max({alignof(Node), alignof(Key), Layout::kAlign});
+    uint32_t n = (page_size - sizeof(Node) - sizeof(PageRef)) / (sizeof(Key) + Layout::kRowBytes);
+    for (; n > 0; --n) {
+        size_t keys = (sizeof(Node) + alignof(Key) - 1) / alignof(Key) * alignof(Key);
+        size_t columns = (keys + sizeof(Key) * n + Layout::kAlign - 1) / Layout::kAlign * Layout::kAlign;
+        size_t end = columns + Layout::offset(Layout::kCount, n) + sizeof(PageRef);
+        if ((end + alignment - 1) / alignment * alignment <= page_size)
+            break;
+    }
+    return n;
+}
+
+template<typename Node, typename Key, typename T, size_t page_size>
+struct LeafEntries<Node, Key, T, page_size, LeafLayout::Columnar> : Node {
+    using Layout = ColumnLayout<T>;
+    static_assert(std::is_aggregate_v<T> && std::is_trivially_copyable_v<T>,
+                  "columnar leaves store trivially copyable aggregates member by member");
+
+    static constexpr uint32_t kCapacity = columnar_leaf_capacity<Node, Key, T, page_size>();
+    static constexpr uint32_t kSpace = kCapacity;
+    static constexpr uint32_t kMinCapacity = kCapacity;
+
+    using Node::Node;
+
+ protected:
+    template<size_t i>
+    const typename Layout::template type<i> *column() const {
+        return reinterpret_cast<const typename Layout::template type<i> *>(columns + Layout::offset(i, kCapacity));
+    }
+    template<size_t i>
+    typename Layout::template type<i> *column() {
+        return const_cast<typename Layout::template type<i> *>(std::as_const(*this).template column<i>());
+    }
+
+    Key keys[kCapacity];
+    alignas(Layout::kAlign) std::byte columns[Layout::offset(Layout::kCount, kCapacity)];
+    PageRef next;
+};
+
+// A counted tree also stores the number of keys below every child of an inner node. Inserts and
+// erases then fix the whole path exclusively to update the sizes, in exchange `rank`, `select` and
+// `count_range` only visit a single path.
+// The pages live in a Segment of a buffer manager by default. With an Arena as `Storage` the tree
+// is kept in memory and reaches its nodes without the buffer manager, `spill` moves it to a segment.
+template<typename Key, typename T, size_t page_size, typename Compare = std::less<Key>,
+         InnerLayout layout = InnerLayout::Sorted, bool counted = false, LeafLayout leaf_layout = LeafLayout::Plain,
+         template<size_t> class Storage = Segment>
+class BTree : private Storage<page_size> {
+    static_assert(leaf_layout != LeafLayout::Packed || std::is_same_v<Compare, std::less<Key>>,
+                  "packed leaves order the keys by their distance to the base key");
+    static_assert(layout != InnerLayout::Learned || std::is_same_v<Compare, std::less<Key>>,
+                  "learned inner nodes model the positions of the keys by their distance");
 
-template<typename Key, typename T, size_t page_size, typename Compare = std::less<Key>>
-class BTree : private Segment<page_size> {
     struct CoupledFixes;
-    using Fix = typename BufferManager<page_size>::Fix;
-    using ExclusiveFix = typename BufferManager<page_size>::ExclusiveFix;
+    using Fix = typename Storage<page_size>::Fix;
+    using ExclusiveFix = typename Storage<page_size>::ExclusiveFix;
+    using OptimisticFix = typename Storage<page_size>::OptimisticFix;
 
-    using InsertResult = std::pair<ExclusiveFix, T&>;
+    static constexpr bool kColumnar = leaf_layout == LeafLayout::Columnar;
 
  public:
     using key_type = Key;
@@ -32,133 +377,559 @@ class BTree : private Segment<page_size> {
     struct Node;
     class InnerNode;
     class LeafNode;
+    class ValueRef;
 
     // TODO using value_type = std::pair<const Key, T> ?
-    using reference = T&;
-    // using const_reference = const T&;
+    // columnar leaves have no value objects, their values are read by copy and written through a ValueRef
+    using reference = std::conditional_t<kColumnar, ValueRef, T&>;
+    using const_reference = std::conditional_t<kColumnar, T, const T&>;
     using pointer = T*;
-    // using const_pointer = const T*;
+    using const_pointer = const T*;
     class iterator;
-    // class const_iterator;
+    class const_iterator;
+    class Snapshot;
+    class Hint;
 
+    // in-memory tree, for storage without a buffer manager such as Arena
+    BTree() = default;
     BTree(uint16_t segment_id, BufferManager<page_size> &manager)
-        : Segment<page_size>(segment_id, manager) {}
+        : Storage<page_size>(segment_id, manager) {}
+    // attach to the tree stored in the segment by the last `checkpoint`
+    // throws stale_metadata_error if the tree changed after it, e.g. before a crash
+    BTree(reopen_t, uint16_t segment_id, BufferManager<page_size> &manager);
+    // scratch tree, dropped without any writeback on destruction
+    BTree(temporary_t, uint16_t segment_id, BufferManager<page_size> &manager)
+        : Storage<page_size>(temporary, segment_id, manager) {}
+    // tries to store the metadata for a later reopen, errors are ignored
+    // all snapshots have to be released before
+    ~BTree();
 
+    // all operations are thread safe, readers only take shared fixes
+    // iterators fix their leaf exclusively, const iterators share it
+    // point lookups and inserts descend optimistically, inner nodes are read without fixing
+    // and validated against their page version, restarting on conflicts
     iterator begin();
     iterator end();
+    const_iterator begin() const;
+    const_iterator end() const;
 
     iterator lower_bound(const Key &key);
     iterator upper_bound(const Key &key);
     iterator find(const Key &key);
+    const_iterator lower_bound(const Key &key) const;
+    const_iterator upper_bound(const Key &key) const;
+    const_iterator find(const Key &key) const;
+    // copy of the value without fixing any page, unless conflicts force a fallback
+    std::optional<T> lookup(const Key &key) const;
+    // finger search for nearly sorted access streams, only the leaf of `hint` or its right neighbour
+    // is read if either covers the key, otherwise the leaf is found from the root and remembered
+    std::optional<T> lookup(const Key &key, Hint &hint) const;
+
+    // range scans over the keys in [lo, hi], the leaves are fixed shared one after the other
+    // `callback(const Key *keys, const T *values, uint32_t n)` gets the pairs in key order as one run
+    // per leaf, the arrays are only valid during the call, returning false stops the scan
+    template<typename Callback> void scan(const Key &lo, const Key &hi, Callback callback) const;
+    // copy up to `n` pairs to `out`, returns the number of pairs written
+    // a full batch is continued by scanning from above the last key
+    uint64_t scan_batch(const Key &lo, const Key &hi, std::pair<Key, T> *out, uint64_t n) const;
+    // same as `scan` for the single `member` of the values, `callback(const Key *keys,
+    // const member_t<member> *fields, uint32_t n)`, columnar leaves hand out their column directly
+    template<auto member, typename Callback> void scan_field(const Key &lo, const Key &hi, Callback callback) const;
+
+    // look up `n` keys at once, `out[i]` receives the value of `keys[i]` if present
+    // the keys are sorted and share a single descent that visits every page on the way once
+    // pages are read optimistically like in `lookup`, conflicts fall back to shared lock coupling
+    // returns the number of keys found
+    uint64_t find_batch(const Key *keys, uint64_t n, std::optional<T> *out) const;
 
     void insert(const Key &key, const T &value);
     void insert(const Key &key, T &&value);
     void insert_or_assign(const Key &key, const T &value);
     void insert_or_assign(const Key &key, T &&value);
+    // same finger search as the hinted `lookup`, leaves that have to be split are found from the root
+    void insert(const Key &key, const T &value, Hint &hint);
+    void insert_or_assign(const Key &key, const T &value, Hint &hint);
+    // underfull nodes on the path are refilled from or merged with a sibling, freed pages are reused
     void erase(const Key &key);
+    // erase all keys in [lo, hi], returns how many there were
+    // only the paths to `lo` and `hi` are rewritten, the subtrees between them are unlinked as a whole
+    // and their pages are reused by later allocations. Counted trees take the number of keys from the
+    // subtree sizes, plain trees read the node headers of the subtrees for it but never write them.
+    // Inserts and erases wait until the range is erased.
+    uint64_t erase_range(const Key &lo, const Key &hi);
+
+    // insert `n` (key, value) pairs, duplicates keep the first value and existing keys are kept
+    // the pairs are sorted and merged into each leaf in one pass, overflowing leaves are split into
+    // as many leaves as needed at once, returns the number of inserted pairs
+    // counted trees and packed leaves insert the sorted pairs one by one
+    uint64_t insert_batch(const std::pair<Key, T> *pairs, uint64_t n);
+
+    // counted trees only, shared lock coupling down a single path
+    // number of keys less than `key`
+    uint64_t rank(const Key &key) const;
+    // the key with rank `i`, end() if there are not as many keys
+    const_iterator select(uint64_t i) const;
+    // number of keys in [lo, hi]
+    uint64_t count_range(const Key &lo, const Key &hi) const;
+
+    // point-in-time view of the tree that stays unchanged while writers go on, see Snapshot
+    // waits until running inserts and erases are done, values changed through iterators that were
+    // dereferenced before are not covered
+    Snapshot snapshot();
+
+    // build the tree bottom up from (key, value) pairs sorted by key, duplicates keep the first value
+    // leaves are packed to `fill_factor` of their capacity, all pages are allocated in order
+    // throws std::invalid_argument unless 0 < `fill_factor` <= 1
+    // the tree must not be accessed concurrently, on a non-empty tree the pairs are inserted one by one
+    template<typename InputIt> void bulk_load(InputIt first, InputIt last, double fill_factor = 1.0);
 
     uint64_t size() const;
+    // the leaves of erased ranges count until their pages are reused
+    // entries the leaves hold whatever the keys, packed leaves with dense keys hold more
     uint64_t capacity() const;
     uint16_t depth() const;
+    // pages ever allocated in the segment, including the metadata page and freed pages
+    uint64_t page_count() const;
+
+    // nodes with at most `fill_factor` of their capacity are rebalanced on erase, clamped to [0, 1/3]
+    // a merge leaves the low-water mark as free space, so the node does not split again right away
+    // 0 only merges empty leaves and inner nodes with a single child
+    void set_low_water_mark(double fill_factor);
+
+    // store the tree metadata in the segment header page and commit the buffer manager
+    // waits for the inserts and erases in progress
+    void checkpoint();
+    // in-memory trees: copy all pages with the metadata to segment `segment_id` of `manager`, where a
+    // tree with the default storage and otherwise the same parameters reopens it
+    // the tree must not be accessed concurrently
+    void spill(uint16_t segment_id, BufferManager<page_size> &manager);
 
  private:
+    struct Metadata;
+    struct DroppedRoots;
     static constexpr Compare comp{};
+    static constexpr uint64_t kMetadataPage = 0;
+
+    // page 0 holds the metadata, so it doubles as the marker for an empty tree
+    static constexpr uint64_t kNoRoot = kMetadataPage;
+    // optimistic attempts before falling back to lock coupling
+    static constexpr unsigned kOptimisticAttempts = 8;
+    static constexpr double kDefaultLowWaterMark = 0.25;
+    // share of the entries a rightmost leaf keeps when an append splits it
+    static constexpr double kAppendSplit = 0.9;
+    static constexpr double kMaxLowWaterMark = 1.0 / 3;
+
+    enum class Descent { Valid, Conflict, Unavailable };
+
+    // only changes while the old root is fixed exclusively, so it is validated after fixing
+    std::atomic<uint64_t> root{kNoRoot};
+    // serializes the creation of the first leaf
+    std::mutex root_mutex;
+    std::atomic<uint64_t> next_page_id{kMetadataPage + 1};
+
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> leaf_count{0};
+    std::atomic<double> low_water_mark{kDefaultLowWaterMark};
+    // hint for increasing keys, the last leaf an insert found without a next leaf
+    // reset before the page is freed, so it is still the rightmost leaf while it matches after fixing
+    std::atomic<uint64_t> rightmost{kNoRoot};
+    // bumped by every split, merge and balance while the nodes involved are fixed exclusively
+    // a hint whose version still matches once its leaf is fixed knows which keys the leaf covers
+    std::atomic<uint64_t> structure_version{0};
+    // bumped by `erase_range` before it unlinks any leaf. The unlinked leaves still link to the live
+    // ones behind them, which may be freed and reused, so a reader that moves right checks it after
+    // fixing the next leaf and finds that leaf from the root instead if it changed since the reader
+    // left the root.
+    std::atomic<uint64_t> range_erases{0};
+
+    // freed pages are chained through their first bytes, page 0 ends the list
+    std::mutex free_mutex;
+    uint64_t free_list = kMetadataPage;
+    // roots of subtrees unlinked by `erase_range` whose pages were not reused yet, the next one at the
+    // back, guarded by `free_mutex`
+    std::vector<uint64_t> dropped;
+    // pages holding the roots that did not fit the metadata on the last checkpoint, reused by the next
+    std::vector<uint64_t> dropped_pages;
+    // set while the metadata page matches the tree, the first write after that clears it on the page
+    std::atomic<bool> metadata_current{false};
+    std::mutex metadata_mutex;
+
+    // snapshots, inserts and erases hold the latch shared, taking a snapshot holds it exclusively
+    std::shared_mutex snapshot_latch;
+    // set while a snapshot waits for the latch, so new writers let it go first
+    std::atomic<bool> snapshot_pending{false};
+    std::atomic<uint64_t> live_snapshots{0};
+    // guards the fields below
+    mutable std::mutex version_mutex;
+    // epoch of the latest snapshot, every snapshot gets a new one
+    uint64_t epoch = 0;
+    // pages allocated after the latest snapshot are not part of any snapshot
+    uint64_t snapshot_pages = 0;
+    std::set<uint64_t> snapshot_epochs;
+    // aligned like the pages of the buffer manager, nodes are read from it in place
+    struct alignas(64) PageImage {
+        std::byte data[page_size];
+    };
+    // copies of pages by page and epoch, made before the first change after a snapshot
+    // a copy holds the page for all snapshots since the previous copy up to its epoch
+    std::unordered_map<uint64_t, std::map<uint64_t, std::unique_ptr<PageImage>>> versions;
 
-    std::optional<uint64_t> root;
-    uint64_t next_page_id = 0;
+    void write_metadata();
+    // mark the stored metadata as outdated, logged before the write changes any node
+    void invalidate_metadata();
 
-    uint64_t count = 0;
-    uint64_t leaf_count = 0;
+    // exclusive fixes copy the page first if a snapshot still needs its current contents
+    ExclusiveFix fix_exclusive(uint64_t page_id);
+    ExclusiveFix fix_exclusive(const OptimisticFix &page);
+    ExclusiveFix try_fix_exclusive(uint64_t page_id);
+    void preserve(ExclusiveFix &fix);
+    // held by inserts and erases, so snapshots are only taken between them
+    std::shared_lock<std::shared_mutex> lock_writes();
+    // waits for all inserts and erases in progress, new ones wait for the lock to be released
+    std::unique_lock<std::shared_mutex> exclude_writes();
+    // drop the copies no live snapshot reads anymore
+    void release_snapshot(uint64_t snapshot_epoch);
 
+    // shared fix of the current root, empty if the tree is empty
+    Fix root_fix() const;
     // get exclusive fix, will always return fix of valid node
     ExclusiveFix root_fix_exclusive();
+    // lock couple down with shared fixes, `child` picks the next page of an inner node
+    // empty if the tree is empty
+    template<typename ChildFn> Fix find_leaf(ChildFn child) const;
+    // same, but the leaf is fixed exclusively
+    template<typename ChildFn> ExclusiveFix find_leaf_exclusive(ChildFn child);
+    // look up the keys at the indices [first, last), sorted by key, below the unfixed node
+    // the keys of a subtree that changed are looked up again with `find_batch_locked`
+    uint64_t find_batch_optimistic(const OptimisticFix &node, const Key *keys, const uint64_t *first,
+                                   const uint64_t *last, std::optional<T> *out) const;
+    // same with shared lock coupling from the root
+    uint64_t find_batch_locked(const Key *keys, const uint64_t *first, const uint64_t *last,
+                               std::optional<T> *out) const;
+    // the node stays fixed while its children are visited, so none of them splits or merges
+    uint64_t find_batch_node(const Fix &fix, const Key *keys, const uint64_t *first, const uint64_t *last,
+                             std::optional<T> *out) const;
+    // exclusive fix of the leaf that can contain the key, creates the first leaf if needed
+    ExclusiveFix insert_find_leaf(const Key &key);
+    // descend to the leaf for `key` without fixing, `parent` is empty for a root leaf
+    // `leaf` is empty for an empty tree, both still have to be validated after reading
+    // `hint` receives the separators around the leaf
+    Descent optimistic_descend(const Key &key, OptimisticFix &parent, OptimisticFix &leaf,
+                               Hint *hint = nullptr) const;
+    // shared fix of the leaf for `key`, only the leaf is fixed if there are no conflicts
+    Fix optimistic_find_leaf(const Key &key) const;
+    // exclusive fix of the leaf for `key` that contains the key or has space for it
+    // only a split latches the parent as well
+    ExclusiveFix optimistic_insert_leaf(const Key &key);
+    // exclusive fix of the rightmost leaf if `key` can be appended to it, empty otherwise
+    ExclusiveFix append_leaf(const Key &key);
+    // `append_leaf` if possible, then `optimistic_insert_leaf`, keeps the rightmost hint up to date
+    ExclusiveFix insert_leaf(const Key &key);
+    // optimistic fix of the leaf of `hint` or its right neighbour if either covers `key`, invalid
+    // otherwise, the hint moves on to the neighbour
+    OptimisticFix hint_leaf(const Key &key, Hint &hint) const;
+    // `hint_leaf`, or `optimistic_descend` from the root that records the new leaf in the hint
+    Descent hint_descend(const Key &key, Hint &hint, OptimisticFix &leaf) const;
+    // `insert_leaf` through the hint, splits reset it
+    ExclusiveFix hint_insert_leaf(const Key &key, Hint &hint);
     ExclusiveFix new_leaf();
     ExclusiveFix new_inner(uint16_t level);
+    // reuses freed pages and then the pages of dropped subtrees before growing the segment
+    ExclusiveFix allocate_page();
+    // take the next page of the dropped subtrees that nobody has fixed, an inner node leaves its
+    // children in its place, empty if there is none
+    ExclusiveFix reclaim_dropped();
+    // the page must be unreachable, readers that still know it fail their version validation
+    void free_page(ExclusiveFix &fix);
 
-    std::optional<InsertResult> insert_internal(const Key &key);
-    InsertResult insert_or_assign_internal(const Key &key);
+    // `run(const LeafNode &leaf, uint32_t begin, uint32_t end)` for the entries [begin, end) of every
+    // leaf with keys in [lo, hi] in key order, the leaves are fixed shared, returning false stops
+    template<typename Run> void scan_leaves(const Key &lo, const Key &hi, Run run) const;
+
+    // highest entry count of an underfull node
+    uint32_t low_water(uint32_t capacity) const;
+    bool underfull(const Node &node) const;
+
+    using InsertResult = std::pair<ExclusiveFix, reference>;
+    // `fix` holds the leaf for `key` with space for it
+    std::optional<InsertResult> insert_internal(const Key &key, ExclusiveFix fix);
+    InsertResult insert_or_assign_internal(const Key &key, ExclusiveFix fix);
 
     void split(ExclusiveFix &parent, ExclusiveFix &child, const Key &key);
 
     // insert in a lock coupled manner, prevent cascading splits by splitting
     // full nodes on the path in all cases
     CoupledFixes insert_lc_early_split(const Key &key);
-    // returns an exclusive fix to the leaf node which can contain the key
-    // leaf node could be full
-    CoupledFixes exclusive_find_node(const Key &key);
-    // lock the entire path down the tree to be able to split as needed
-    CoupledFixes insert_full_lock_rec_split(const Key &key);
+
+    // exclusive lock coupling that only splits full inner nodes, the parent of the leaf has space
+    // `upper` receives the separator bounding the keys of the leaf, empty for the rightmost one
+    CoupledFixes insert_batch_find_leaf(const Key &key, std::optional<Key> &upper);
+    // merge the pairs into the leaf, returns the first pair that did not fit below the parent
+    const std::pair<Key, T> *insert_batch_leaf(CoupledFixes &cf, const std::pair<Key, T> *first,
+                                               const std::pair<Key, T> *last, uint64_t &inserted);
+
+    // counted trees: exclusive fixes from the root down to the leaf for `key`
+    std::vector<ExclusiveFix> lock_path(const Key &key);
+    // add `delta` to the sizes of the children on the path
+    void resize_path(std::vector<ExclusiveFix> &path, const Key &key, int64_t delta);
+    // leaf for `key` with space for it, the sizes on the path already count the key if it is new
+    ExclusiveFix counted_insert_leaf(const Key &key);
+    // leaf for `key`, the sizes on the path no longer count the key if it is present
+    ExclusiveFix counted_erase_leaf(const Key &key);
+    // keys below `key`, or not above it for `or_equal`
+    template<bool or_equal> uint64_t count_below(const Key &key) const;
+    // keys in the subtree of `node`, the sum of the child sizes for inner nodes
+    static uint64_t subtree_size(const Node &node);
+
+    // exclusive lock coupling that rebalances every underfull node on the path and shrinks the root
+    void erase_rebalance(const Key &key);
+    // merge `child` with a sibling or move entries between them, `parent` is fixed and not empty
+    // afterwards `child` holds the node that covers `key`
+    void rebalance(ExclusiveFix &parent, ExclusiveFix &child, const Key &key);
+
+    struct RangeErase;
+    // erase the keys of the range in the subtree of `fix`, a bound that lies beyond the subtree is
+    // left out, returns the number of erased keys
+    uint64_t erase_range(ExclusiveFix fix, RangeErase &range, bool lo_bounded, bool hi_bounded);
+    // keys in the subtree of child `idx` of `inner`
+    uint64_t child_keys(const InnerNode &inner, uint32_t idx) const;
 };
 
 IMLAB_BTREE_TEMPL struct IMLAB_BTREE_CLASS::Node {
     constexpr explicit Node(uint16_t level);
     bool is_leaf() const;
+    // for unfixed reads, a concurrent writer may change the count at any time
+    uint16_t optimistic_count() const;
 
     uint16_t level;
     uint16_t count = 0;
 };
 
 
-IMLAB_BTREE_TEMPL class IMLAB_BTREE_CLASS::InnerNode : public Node {
+IMLAB_BTREE_TEMPL class IMLAB_BTREE_CLASS::InnerNode : public InnerEntries<Node, Key, page_size, layout, counted> {
+    using Entries = InnerEntries<Node, Key, page_size, layout, counted>;
+
  public:
-    static constexpr uint32_t kCapacity =
-        (page_size - sizeof(Node) - sizeof(uint64_t)) / (sizeof(Key) + sizeof(uint64_t));
+    static constexpr uint32_t kCapacity = Entries::kCapacity;
 
     constexpr InnerNode(uint16_t level);
 
     uint64_t begin() const;
+    // index of the child that covers `key`
+    uint32_t child_index(const Key &key) const;
+    // same, among the first `n` separators, for unfixed reads that load the count once
+    uint32_t child_index(const Key &key, uint32_t n) const;
+    uint64_t child(uint32_t idx) const;
+    // counted trees: keys below child `idx`
+    uint64_t child_size(uint32_t idx) const;
+    void set_child_size(uint32_t idx, uint64_t size);
+    const Key &separator(uint32_t idx) const;
+    void set_separator(uint32_t idx, const Key &key);
+    const Key *separator_data() const;
+    const PageRef *child_data() const;
     uint64_t lower_bound(const Key &key) const;
     uint64_t upper_bound(const Key &key) const;
+    // for unfixed reads, returns kMetadataPage if the node is inconsistent
+    uint64_t optimistic_lower_bound(const Key &key) const;
     bool full() const;
 
     void init(uint64_t left);
     void insert(const Key &key, uint64_t split_page);
     Key split(InnerNode &other);
+    // remove separator `idx` and the child to its right
+    void erase(uint32_t idx);
+    // remove the children [from, to) and as many separators, at least one child stays
+    void erase_children(uint32_t from, uint32_t to);
+    // append `separator` and all of the right sibling `other`
+    void merge(InnerNode &other, const Key &separator);
+    // even out the children with the right sibling `other`, returns the new separator
+    Key balance(InnerNode &other, const Key &separator);
 
  private:
-    Key keys[kCapacity];
-    uint64_t children[kCapacity + 1];
+    // first index among the first `n` keys that is not less than `key`, or greater for `upper`
+    template<bool upper> uint32_t search(const Key &key, uint32_t n) const;
+    // refresh the index levels of the blocked layout for all keys from `idx` on, or the model of
+    // the learned layout
+    void reindex(uint32_t idx);
+    // child `from` of `src` becomes child `to` of `dst`, with its size for counted trees
+    static void copy_child(InnerNode &dst, uint32_t to, const InnerNode &src, uint32_t from);
 };
 
-IMLAB_BTREE_TEMPL class IMLAB_BTREE_CLASS::LeafNode : public Node {
+IMLAB_BTREE_TEMPL class IMLAB_BTREE_CLASS::LeafNode : public LeafEntries<Node, Key, T, page_size, leaf_layout> {
+    using Entries = LeafEntries<Node, Key, T, page_size, leaf_layout>;
+    static constexpr bool kPacked = leaf_layout == LeafLayout::Packed;
+
  public:
-    using next_ptr = std::optional<uint64_t>;
-    static constexpr uint32_t kCapacity =
-        (page_size - sizeof(Node) - sizeof(next_ptr)) / (sizeof(Key) + sizeof(T));
+    using next_ptr = PageRef;
+    static constexpr uint32_t kCapacity = Entries::kCapacity;
+    // limit of `used`, bytes for packed leaves and entries otherwise
+    static constexpr uint32_t kSpace = Entries::kSpace;
+    // entries that fit whatever the keys, packed leaves hold up to kCapacity with narrow distances
+    static constexpr uint32_t kMinCapacity = Entries::kMinCapacity;
 
     constexpr LeafNode();
 
     // returns first index where keys[i] >= key
     uint32_t lower_bound(const Key &key) const;
+    // same among the indices [from, n), for unfixed reads that load the count once
+    uint32_t lower_bound(const Key &key, uint32_t from, uint32_t n) const;
     uint32_t upper_bound(const Key &key) const;
-    const T &at(uint32_t idx) const;
-    T &at(uint32_t idx);
+    Key key(uint32_t idx) const;
+    const_reference at(uint32_t idx) const;
+    reference at(uint32_t idx);
+    // copy of the value at `idx` below kCapacity, also for unfixed reads
+    T value(uint32_t idx) const;
+    void set_value(uint32_t idx, const T &value);
+    template<auto member> const member_t<member> &field(uint32_t idx) const;
+    template<auto member> member_t<member> &field(uint32_t idx);
+    // plain and columnar leaves only
+    const Key *key_data() const;
+    // the keys [from, to), packed leaves decode them to `buffer`
+    const Key *key_data(uint32_t from, uint32_t to, Key *buffer) const;
+    // plain and packed leaves only
+    const T *value_data() const;
+    T *value_data();
+    // the values [from, to), columnar leaves assemble them in `buffer`
+    const T *value_data(uint32_t from, uint32_t to, T *buffer) const;
+    // `member` of the values [from, to), copied to `buffer` unless the leaf is columnar
+    template<auto member>
+    const member_t<member> *field_data(uint32_t from, uint32_t to, member_t<member> *buffer) const;
     bool is_equal(const Key &key, uint32_t idx) const;
+    // for unfixed reads, the result is only meaningful after validation
+    std::optional<T> optimistic_find(const Key &key) const;
+    // for unfixed reads, clamped so that all entries lie within the page
+    uint16_t optimistic_count() const;
+    // same for the key at `idx` below `n`
+    Key optimistic_key(uint32_t idx, uint32_t n) const;
 
     const next_ptr &get_next() const;
+    void set_next(uint64_t page);
+    // only computes addresses, so the page may be read without a fix
+    void prefetch() const;
 
-    bool full() const;
+    // no space for `key`
+    bool full(const Key &key) const;
+    // entries, or bytes for packed leaves
+    uint32_t used() const;
+    // `used` after a merge with the right sibling `other`, above kSpace if they do not fit
+    uint32_t merged_used(const LeafNode &other) const;
 
     // make space for a new value, shift others to the right
-    T &make_space(const Key &key, uint32_t idx);
+    reference make_space(const Key &key, uint32_t idx);
     // erase a value, shift others to the left
     void erase(uint32_t idx);
+    // erase the values [from, to)
+    void erase(uint32_t from, uint32_t to);
 
-    // transfer half of the key/value pairs to `other`
+    // transfer all key/value pairs after the first `keep` to `other`
     // update traversal pointers to insert `other_page`
     // returns pivot key for new page
-    Key split(LeafNode &other, uint64_t other_page);
+    Key split(LeafNode &other, uint64_t other_page, uint32_t keep);
+    // append all pairs of the right sibling `other` and take over its next pointer
+    void merge(LeafNode &other);
+    // even out the pairs with the right sibling `other`, returns the new pivot key
+    // packed leaves move fewer pairs if an even split does not fit
+    Key balance(LeafNode &other);
 
  private:
-    Key keys[kCapacity];
-    T values[kCapacity];
-    next_ptr next;
+    // packed leaves
+    // bytes per distance for keys in [lo, hi]
+    static uint32_t width_for(const Key &lo, const Key &hi);
+    // bytes taken by `n` pairs with distances of `width` bytes
+    static uint32_t packed_bytes(uint32_t n, uint32_t width);
+    static uint64_t distance(const Key &lo, const Key &key);
+    // first index among `n` distances of `width` bytes that is not less than `delta`, or greater for `upper`
+    template<bool upper> static uint32_t search(const std::byte *deltas, uint32_t width, uint32_t n, uint64_t delta);
+    static uint64_t load(const std::byte *deltas, uint32_t width, uint32_t idx);
+    static void store(std::byte *deltas, uint32_t width, uint32_t idx, uint64_t delta);
+    // distances of `n` keys, they end with the page
+    const std::byte *deltas(uint32_t n, uint32_t width) const;
+    std::byte *deltas(uint32_t n, uint32_t width);
+    // `n` distances of `width` bytes lie within the page and leave room for their values
+    static bool consistent(uint32_t n, uint32_t width);
+    // store the keys relative to the lower `base` with distances of at least the current width
+    void widen(const Key &base, uint32_t width);
+    // replace the keys by `n` sorted keys, the values are left as they are
+    void pack(const Key *keys, uint32_t n);
+
+    // copy `n` values of `src` from `from` on to `dst` from `to` on, the ranges may overlap
+    static void move_values(LeafNode &dst, uint32_t to, const LeafNode &src, uint32_t from, uint32_t n);
+    // `f(std::integral_constant<size_t, i>{})` for every column `i` of a columnar leaf
+    template<typename F> static void for_each_column(F &&f);
+    template<typename F, size_t... i> static void for_each_column(F &&f, std::index_sequence<i...>);
+};
+
+// Reference to a value of a columnar leaf, which is assembled from the columns when it is read and
+// scattered to them when it is assigned. Valid as long as the leaf stays fixed.
+IMLAB_BTREE_TEMPL class IMLAB_BTREE_CLASS::ValueRef {
+ public:
+    ValueRef(LeafNode &leaf, uint32_t idx) : leaf(&leaf), idx(idx) {}
+    ValueRef(const ValueRef &) = default;
+
+    operator T() const { return leaf->value(idx); }
+    const ValueRef &operator=(const T &value) const {
+        leaf->set_value(idx, value);
+        return *this;
+    }
+    // assigns the value, like a reference would
+    const ValueRef &operator=(const ValueRef &other) const { return *this = static_cast<T>(other); }
+
+    template<auto member> member_t<member> &field() const { return leaf->template field<member>(idx); }
+
+ private:
+    LeafNode *leaf;
+    uint32_t idx;
+};
+
+IMLAB_BTREE_TEMPL struct IMLAB_BTREE_CLASS::Metadata {
+    static constexpr uint64_t kMagic = 0x38305f6565727462;  // "btree_08"
+    // roots of dropped subtrees stored behind the fields, further ones go to a chain of DroppedRoots
+    static constexpr uint32_t kMaxDropped = (page_size - 96) / sizeof(PageRef);
+
+    uint64_t magic;
+    uint32_t page_bytes;
+    uint16_t key_size;
+    uint16_t value_size;
+    // cleared by the first change after the fields were stored
+    uint64_t checkpointed;
+
+    uint64_t root;
+    uint64_t has_root;
+    uint64_t next_page_id;
+    uint64_t count;
+    uint64_t leaf_count;
+    uint64_t free_list;
+    // first page of the DroppedRoots chain, the metadata page ends it
+    uint64_t dropped_pages;
+    uint32_t inner_layout;
+    uint32_t counted_sizes;
+    uint32_t leaf_format;
+    uint32_t dropped_count;
+    PageRef dropped[kMaxDropped];
+
+    bool matches() const;
+};
+
+IMLAB_BTREE_TEMPL struct IMLAB_BTREE_CLASS::DroppedRoots {
+    static constexpr uint32_t kCapacity = (page_size - 16) / sizeof(PageRef);
+
+    uint64_t next;
+    uint32_t count;
+    PageRef roots[kCapacity];
 };
 
 IMLAB_BTREE_TEMPL struct IMLAB_BTREE_CLASS::CoupledFixes {
-    typename BufferManager<page_size>::ExclusiveFix fix, prev;
+    ExclusiveFix fix, prev;
 
-    void advance(typename BufferManager<page_size>::ExclusiveFix next);
+    void advance(ExclusiveFix next);
+};
+
+IMLAB_BTREE_TEMPL struct IMLAB_BTREE_CLASS::RangeErase {
+    Key lo, hi;
+    // the leaf of `lo` while the paths are apart, it is linked to the leaf of `hi` once that is reached
+    ExclusiveFix left;
+    // roots of the unlinked subtrees in key order
+    std::vector<uint64_t> dropped;
 };
 
 IMLAB_BTREE_TEMPL class IMLAB_BTREE_CLASS::iterator {
@@ -168,16 +939,104 @@ IMLAB_BTREE_TEMPL class IMLAB_BTREE_CLASS::iterator {
     iterator &operator++();
     bool operator==(const iterator &other) const;
     bool operator!=(const iterator &other) const;
+    // preserves the leaf for snapshots taken since it was fixed and marks it dirty
     reference operator*();
+    // not for columnar leaves, which have no value objects
     pointer operator->();
+    template<auto member> member_t<member> &field();
+
+ private:
+    iterator(BTree &tree, ExclusiveFix fix, uint32_t i, uint64_t erases)
+        : fix(std::move(fix)), tree(tree), i(i), erases(erases) {}
+
+    ExclusiveFix fix;
+    BTree &tree;
+    uint32_t i;
+    // `range_erases` from before the leaf was reached
+    uint64_t erases;
+};
+
+IMLAB_BTREE_TEMPL class IMLAB_BTREE_CLASS::const_iterator {
+    friend class BTree;
+
+ public:
+    const_iterator &operator++();
+    bool operator==(const const_iterator &other) const;
+    bool operator!=(const const_iterator &other) const;
+    const_reference operator*() const;
+    const_pointer operator->() const;
+    template<auto member> const member_t<member> &field() const;
 
  private:
-    iterator(Segment<page_size> &segment, typename BufferManager<page_size>::ExclusiveFix fix, uint32_t i)
-        : segment(segment), fix(std::move(fix)), i(i) {}
+    const_iterator(const BTree &tree, Fix fix, uint32_t i, uint64_t erases)
+        : fix(std::move(fix)), tree(tree), i(i), erases(erases) {}
 
-    typename BufferManager<page_size>::ExclusiveFix fix;
-    Segment<page_size> &segment;
+    Fix fix;
+    const BTree &tree;
     uint32_t i;
+    // `range_erases` from before the leaf was reached
+    uint64_t erases;
+};
+
+// Remembers the leaf of the last hinted operation and the range of keys it covers, bounded by the
+// separators on the way down or by keys of the leaf. The next hinted operation whose key lies in
+// that range, or in the right neighbour of the leaf, reads only that leaf instead of descending.
+// Splits, merges and balances anywhere in the tree change the structure version and invalidate
+// all hints, the operation then descends from the root and records the new leaf.
+// A hint is used by one thread at a time and only with the tree it was used with first.
+IMLAB_BTREE_TEMPL class IMLAB_BTREE_CLASS::Hint {
+    friend class BTree;
+
+ public:
+    Hint() = default;
+
+ private:
+    // the leaf covers `key`
+    bool covers(const Key &key) const;
+    // narrow the range to the separators around child `idx` of `inner` with `n` separators
+    void narrow(const InnerNode &inner, uint32_t idx, uint32_t n);
+
+    uint64_t page = kNoRoot;
+    uint64_t version = 0;
+    // a separator bound excludes `lo`, a key of the leaf includes it, `hi` is always included
+    std::optional<Key> lo, hi;
+    bool lo_separator = false;
+    bool hi_separator = false;
+};
+
+// A snapshot reads the pages as they were when it was taken. Writers keep changing the current
+// pages, but copy a page before its first change after a snapshot. The snapshot reads the oldest
+// copy made since it was taken, or the current page if there is none, so it never blocks writers
+// for longer than a single page read. Copies are dropped as soon as no live snapshot reads them.
+IMLAB_BTREE_TEMPL class IMLAB_BTREE_CLASS::Snapshot {
+    friend class BTree;
+
+ public:
+    Snapshot(Snapshot &&other) noexcept;
+    Snapshot(const Snapshot &) = delete;
+    Snapshot &operator=(const Snapshot &) = delete;
+    Snapshot &operator=(Snapshot &&) = delete;
+    ~Snapshot();
+
+    std::optional<T> lookup(const Key &key) const;
+    // same interface as BTree::scan
+    template<typename Callback> void scan(const Key &lo, const Key &hi, Callback callback) const;
+    // number of keys when the snapshot was taken
+    uint64_t size() const;
+
+ private:
+    Snapshot(BTree &tree, uint64_t root, uint64_t epoch, uint64_t count)
+        : tree(&tree), root(root), epoch(epoch), count(count) {}
+
+    // the page as of the snapshot, `fix` keeps a current page fixed while it is read
+    const std::byte *read(uint64_t page, Fix &fix) const;
+    // the leaf that can contain `key`, nullptr for an empty tree
+    const LeafNode *find_leaf(const Key &key, Fix &fix) const;
+
+    BTree *tree;
+    uint64_t root;
+    uint64_t epoch;
+    uint64_t count;
 };
 
 }  // namespace imlab
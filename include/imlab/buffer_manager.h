@@ -4,11 +4,22 @@
 #ifndef INCLUDE_IMLAB_BUFFER_MANAGER_H_
 #define INCLUDE_IMLAB_BUFFER_MANAGER_H_
 
+#include "imlab/buffer_statistics.h"
+#include "imlab/working_set.h"
+#include "imlab/write_ahead_log.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
 #include <exception>
+#include <future>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 // ---------------------------------------------------------------------------------------------------
 namespace imlab {
@@ -20,24 +31,66 @@ namespace imlab {
 
 BUFFER_MANAGER_TEMPL class BufferManager {
     struct Page;
+    struct Frame;
  public:
      // owned representation of a fix on a page
     class Fix;
     class ExclusiveFix;
+    // version validated access without fixing
+    class OptimisticFix;
 
-    explicit constexpr BufferManager(size_t page_count);
+    explicit BufferManager(size_t page_count);
+    // log every page modification to `wal`, replays the log before returning
+    BufferManager(size_t page_count, WriteAheadLog &wal);
     ~BufferManager();
 
     // fix interface
     Fix fix(uint64_t page_id);
     ExclusiveFix fix_exclusive(uint64_t page_id);
+    // single attempt, empty instead of waiting while the page is fixed or written back
+    ExclusiveFix try_fix_exclusive(uint64_t page_id);
+
+    // optimistic interface, never blocks and never touches the page's fix count
+    // invalid if the page is not resident or currently changing
+    OptimisticFix fix_optimistic(uint64_t page_id) const;
+    // fix a page that was read optimistically, empty if it changed in the meantime
+    Fix fix(const OptimisticFix &page);
+    ExclusiveFix fix_exclusive(const OptimisticFix &page);
+
+    // make all modifications so far durable, with a log this is a single group commit
+    void commit();
+    // write back all dirty pages, afterwards the log can be discarded
+    void checkpoint();
+
+    // temporary segments
+    // pages of a temporary segment are never logged and only written back when evicted
+    void set_temporary(uint16_t segment_id);
+    bool is_temporary(uint16_t segment_id) const;
+    // discard all pages of a segment without writing them back and remove its file
+    // none of its pages may be fixed
+    void drop_segment(uint16_t segment_id);
+
+    // warm restart
+    // store the resident pages in `path` on every checkpoint and on destruction
+    void set_working_set_file(std::string path);
+    WorkingSet working_set() const;
+    void save_working_set(const std::string &path) const;
+    // read the pages listed in `path` into free frames with batched sequential reads
+    // the queues are restored in the saved order, returns the number of pages loaded
+    size_t load_working_set(const std::string &path);
+    // load while fixes are already served, fixes of pages still in flight wait for them
+    // the manager has to outlive the returned future
+    std::future<size_t> load_working_set_async(std::string path);
 
     // access optimization info
     bool in_memory(uint64_t page_id) const;
     bool is_dirty(uint64_t page_id) const;
 
-    size_t page_reads() const { return _page_reads; }
-    size_t page_writes() const { return _page_writes; }
+    size_t page_reads() const;
+    size_t page_writes() const;
+
+    // snapshot of hit, eviction and i/o counters broken down by segment and queue
+    BufferStatistics statistics() const;
 
     // testing interface, not linked in prod code
     const std::vector<uint64_t> get_fifo() const;
@@ -45,8 +98,14 @@ BUFFER_MANAGER_TEMPL class BufferManager {
 
  private:
     // fix management
-    Page *fix(uint64_t page_id, bool exclusive);
-    void unfix(Page *page);
+    Page *fix(uint64_t page_id, bool exclusive, bool wait = true);
+    Page *fix(const OptimisticFix &page, bool exclusive);
+    ExclusiveFix make_exclusive(Page *p);
+    // `exclusive` comes from the fix, the fix count is only read under `mutex`
+    void unfix(Page *page, bool exclusive);
+    // notified whenever a fix is released, waits are bounded and re-check the page
+    std::condition_variable page_released;
+    static constexpr std::chrono::milliseconds kWaitInterval{10};
 
     using PageMap = std::unordered_map<uint64_t, Page>;
     PageMap pages;
@@ -58,6 +117,22 @@ BUFFER_MANAGER_TEMPL class BufferManager {
     const size_t page_count;
     size_t loaded_page_count = 0;
 
+    // frames are never freed while the manager lives, so optimistic readers can always touch them
+    // every resident page owns one, see Frame for the version protocol
+    std::vector<std::unique_ptr<Frame>> frames;
+    std::vector<Frame *> free_frames;
+    void assign_frame(Page &p);
+    // give the frame back and forget the page
+    void erase_page(Page &p);
+
+    // page id -> frame, written under the mutex and read without it by optimistic fixes
+    // open addressing with linear probing, lookups that race with a change may miss
+    std::unique_ptr<std::atomic<Frame *>[]> lookup;
+    size_t lookup_mask;
+    size_t lookup_slot(uint64_t page_id) const;
+    void lookup_insert(Frame *frame);
+    void lookup_erase(Frame *frame);
+
     // queue management
     void add_to_fifo(Page *p);
     void add_to_lru(Page *p);
@@ -69,12 +144,32 @@ BUFFER_MANAGER_TEMPL class BufferManager {
     void load_page(Page &p);
     void save_page(const Page &p);
 
+    // warm restart
+    // pages read with a single call during warm up
+    static constexpr size_t kWarmupBatch = 64;
+    // reserve free frames for the pages in `set`, keeping the ones that would be evicted last
+    std::vector<Page *> reserve_working_set(const WorkingSet &set);
+    std::string working_set_file;
+
+    std::unordered_set<uint16_t> temporary_segments;
+
+    // logging
+    void recover();
+    void log_changes(Page &p);
+    // write back dirty pages, returns false if a page could not be written due to an exclusive fix
+    bool write_dirty_pages();
+    WriteAheadLog *wal = nullptr;
+
     // global mutex
     // TODO finer lock granularity
-    std::mutex mutex;
-
-    size_t _page_reads = 0;
-    size_t _page_writes = 0;
+    mutable std::mutex mutex;
+
+    // statistics, only touched while holding the mutex
+    using SegmentCounters = std::array<BufferCounters, BufferStatistics::kPriorityCount>;
+    std::unordered_map<uint16_t, SegmentCounters> counters;
+    // i/o time spent by the current fix, excluded from the wait time
+    std::chrono::nanoseconds fix_io_time{0};
+    BufferCounters &counters_for(const Page &p);
 };
 
 BUFFER_MANAGER_TEMPL struct BUFFER_MANAGER_CLASS::Page {
@@ -91,11 +186,30 @@ BUFFER_MANAGER_TEMPL struct BUFFER_MANAGER_CLASS::Page {
     int32_t fix_count = 0;
 
     DataState data_state = Reading;
-    std::unique_ptr<std::byte[]> data;
+    BufferStatistics::Priority priority = BufferStatistics::Fifo;
+    bool temporary = false;
+    Frame *frame = nullptr;
+
+    // page contents at the start of the current exclusive fix, diffed against on unfix
+    std::unique_ptr<std::byte[]> before_image;
+    bool modified = false;
+    // end of the last log record for this page, must be durable before writeback
+    uint64_t lsn = 0;
 
     Page *prev = nullptr, *next = nullptr;
 };
 
+BUFFER_MANAGER_TEMPL struct BUFFER_MANAGER_CLASS::Frame {
+    // odd while the contents may change, i.e. while the page is fixed exclusively,
+    // being loaded or the frame is unused, every change bumps the version
+    std::atomic<uint64_t> version{1};
+    std::atomic<uint64_t> page_id{0};
+    // set by optimistic reads, which bypass the replacement queues
+    mutable std::atomic<bool> referenced{false};
+
+    alignas(64) std::byte data[page_size];
+};
+
 BUFFER_MANAGER_TEMPL class BufferManager<page_size>::Fix {
     friend class BufferManager;
  public:
@@ -121,11 +235,35 @@ BUFFER_MANAGER_TEMPL class BufferManager<page_size>::Fix {
  protected:
     constexpr Fix(Page *page, BufferManager *manager) noexcept;
     Page *page = nullptr;
+    bool exclusive = false;
 
  private:
     BufferManager *manager;
 };
 
+BUFFER_MANAGER_TEMPL class BUFFER_MANAGER_CLASS::OptimisticFix {
+    friend class BufferManager;
+ public:
+    OptimisticFix() = default;
+
+    bool valid() const;
+    uint64_t page_id() const;
+
+    // the contents may change at any time, only trust what was read before a successful `validate`
+    const std::byte *data() const;
+    template<typename T> const T *as() const;
+
+    // true if the page did not change since the optimistic fix
+    bool validate() const;
+
+ private:
+    OptimisticFix(const Frame *frame, uint64_t page_id, uint64_t version) noexcept;
+
+    const Frame *frame = nullptr;
+    uint64_t expected_page_id = 0;
+    uint64_t version = 0;
+};
+
 BUFFER_MANAGER_TEMPL class BUFFER_MANAGER_CLASS::ExclusiveFix : public Fix {
     friend class BufferManager;
  public:
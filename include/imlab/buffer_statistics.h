@@ -0,0 +1,92 @@
+// ---------------------------------------------------------------------------------------------------
+// IMLAB
+// ---------------------------------------------------------------------------------------------------
+#ifndef INCLUDE_IMLAB_BUFFER_STATISTICS_H_
+#define INCLUDE_IMLAB_BUFFER_STATISTICS_H_
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+// ---------------------------------------------------------------------------------------------------
+namespace imlab {
+
+// log2 bucketed latency histogram, bucket i counts samples below 2^i microseconds
+class LatencyHistogram {
+ public:
+    static constexpr size_t kBuckets = 24;
+
+    void record(std::chrono::nanoseconds latency);
+
+    uint64_t count() const { return _count; }
+    uint64_t sum_ns() const { return _sum_ns; }
+    uint64_t bucket(size_t idx) const { return buckets[idx]; }
+    // upper bound of a bucket in seconds, last bucket is unbounded
+    static double bucket_bound(size_t idx);
+
+    LatencyHistogram &operator+=(const LatencyHistogram &other);
+    LatencyHistogram &operator-=(const LatencyHistogram &other);
+
+ private:
+    std::array<uint64_t, kBuckets> buckets = {};
+    uint64_t _count = 0;
+    uint64_t _sum_ns = 0;
+};
+
+struct BufferCounters {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t clean_evictions = 0;
+    uint64_t dirty_evictions = 0;
+    // time spent in `fix` not doing own I/O, i.e. waiting for the manager or other fixes
+    uint64_t fix_wait_ns = 0;
+
+    LatencyHistogram read_latency;
+    LatencyHistogram write_latency;
+
+    BufferCounters &operator+=(const BufferCounters &other);
+    BufferCounters &operator-=(const BufferCounters &other);
+};
+
+struct BufferGauges {
+    size_t resident_pages = 0;
+    size_t dirty_pages = 0;
+};
+
+// point in time copy of the buffer manager statistics
+// counters accumulate since construction, gauges are sampled when taking the snapshot
+struct BufferStatistics {
+    // replacement queue a page belongs to, new pages start out in the fifo
+    enum Priority { Fifo, Lru, kPriorityCount };
+    static const char *priority_name(Priority priority);
+
+    struct Segment {
+        std::array<BufferCounters, kPriorityCount> counters;
+        std::array<BufferGauges, kPriorityCount> gauges;
+    };
+
+    size_t capacity_pages = 0;
+    std::map<uint16_t, Segment> segments;
+
+    // aggregates over the breakdown
+    BufferCounters total() const;
+    BufferCounters segment(uint16_t segment_id) const;
+    BufferCounters priority(Priority priority) const;
+    BufferGauges gauges() const;
+    BufferGauges gauges(uint16_t segment_id) const;
+
+    // counters accumulated since `earlier`, gauges are kept from this snapshot
+    BufferStatistics operator-(const BufferStatistics &earlier) const;
+
+    // prometheus text exposition format
+    void write_prometheus(std::ostream &os) const;
+    // write to `path` atomically so scrapers never observe a partial file
+    void dump_prometheus(const std::string &path) const;
+};
+
+}  // namespace imlab
+// ---------------------------------------------------------------------------------------------------
+#endif  // INCLUDE_IMLAB_BUFFER_STATISTICS_H_
@@ -0,0 +1,62 @@
+// ---------------------------------------------------------------------------------------------------
+// IMLAB
+// ---------------------------------------------------------------------------------------------------
+#ifndef INCLUDE_IMLAB_NODE_SEARCH_H_
+#define INCLUDE_IMLAB_NODE_SEARCH_H_
+
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+// ---------------------------------------------------------------------------------------------------
+namespace imlab {
+
+// Search kernels for the sorted key arrays of tree nodes.
+// Arithmetic keys with the default comparator use a branchless binary search down to a small
+// window, which is then counted with the widest vector instructions enabled at compile time
+// (AVX-512, AVX2 or SSE, see IMLAB_NATIVE) for integers of any width, byte and word keys need
+// AVX-512BW in the AVX-512 case. Other keys use std::lower_bound/upper_bound.
+template<typename Key, typename Compare>
+inline constexpr bool kVectorizedSearch = std::is_arithmetic_v<Key> && std::is_same_v<Compare, std::less<Key>>;
+
+// index of the first key that is not less than `key`
+template<typename Key, typename Compare>
+uint32_t search_lower_bound(const Key *keys, uint32_t count, const Key &key, Compare comp);
+// index of the first key that is greater than `key`
+template<typename Key, typename Compare>
+uint32_t search_upper_bound(const Key *keys, uint32_t count, const Key &key, Compare comp);
+
+// Piecewise linear model of the positions of unique sorted integer keys. The keys are cut into up to
+// kSegments runs of equal length, each run guesses the position of a key from its distance to the
+// first key of the run and remembers its largest miss. A search picks the run among the first keys,
+// then only counts the window of twice the miss around the guess, which usually spans a cache line
+// or two even for skewed keys where a binary search touches a new line with almost every probe.
+// Models are read without latches like the keys, so an inconsistent one only yields wrong indices
+// within the keys, never reads outside of them.
+template<typename Key>
+struct LearnedModel {
+    static_assert(std::is_integral_v<Key>, "learned models need integer keys");
+    static constexpr uint32_t kSegments = 8;
+
+    // fit the model to `n` keys
+    void build(const Key *keys, uint32_t n);
+    // same as search_lower_bound or, for `upper`, search_upper_bound on the keys the model was built for
+    template<bool upper> uint32_t search(const Key *keys, uint32_t n, const Key &key) const;
+
+ private:
+    // guessed position of `key` in `segment`, which starts at `start`, clamped to `n`
+    uint32_t guess(uint32_t segment, uint32_t start, const Key &key, uint32_t n) const;
+
+    // first key of every run
+    Key firsts[kSegments];
+    // positions per unit of distance to the first key
+    float slopes[kSegments];
+    // largest distance of a guess from the actual position of a key in the run
+    uint16_t errors[kSegments];
+    uint8_t segments = 0;
+};
+
+}  // namespace imlab
+// ---------------------------------------------------------------------------------------------------
+#include "node_search.hpp"
+// ---------------------------------------------------------------------------------------------------
+#endif  // INCLUDE_IMLAB_NODE_SEARCH_H_
@@ -7,13 +7,76 @@
 #include "imlab/buffer_manager.h"
 
 #include <cassert>
+#include <cstdint>
+#include <exception>
 // ---------------------------------------------------------------------------------------------------
 namespace imlab {
 
+// tag to attach to the data structure already stored in a segment
+struct reopen_t { explicit reopen_t() = default; };
+inline constexpr reopen_t reopen{};
+// tag for scratch data structures, their pages are discarded on destruction
+struct temporary_t { explicit temporary_t() = default; };
+inline constexpr temporary_t temporary{};
+
+// page id of a segment in the six bytes its 48 bit ids need, without alignment
+// the largest id is reserved to mark no page, so the reference can replace std::optional<uint64_t>
+class PageRef {
+ public:
+    static constexpr uint64_t kNone = (1ull << 48) - 1;
+
+    constexpr PageRef() : PageRef(kNone) {}
+    constexpr PageRef(uint64_t page_id) : bytes{} {
+        assert(page_id <= kNone);
+        for (uint32_t i = 0; i < sizeof(bytes); ++i)
+            bytes[i] = static_cast<uint8_t>(page_id >> (8 * i));
+    }
+
+    constexpr operator uint64_t() const {
+        uint64_t page_id = 0;
+        for (uint32_t i = 0; i < sizeof(bytes); ++i)
+            page_id |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+        return page_id;
+    }
+    constexpr bool has_value() const {
+        return static_cast<uint64_t>(*this) != kNone;
+    }
+    constexpr explicit operator bool() const {
+        return has_value();
+    }
+    constexpr uint64_t operator*() const {
+        assert(has_value());
+        return static_cast<uint64_t>(*this);
+    }
+
+ private:
+    uint8_t bytes[6];
+};
+static_assert(sizeof(PageRef) == 6 && alignof(PageRef) == 1);
+
 template <size_t page_size> class Segment {
  public:
+    using Fix = typename BufferManager<page_size>::Fix;
+    using ExclusiveFix = typename BufferManager<page_size>::ExclusiveFix;
+    using OptimisticFix = typename BufferManager<page_size>::OptimisticFix;
+
     constexpr Segment(uint16_t segment_id, BufferManager<page_size> &manager)
         : segment_id_mask(((uint64_t) segment_id) << 48), manager(manager) {}
+    Segment(temporary_t, uint16_t segment_id, BufferManager<page_size> &manager)
+        : Segment(segment_id, manager) {
+        temporary = true;
+        manager.set_temporary(segment_id);
+    }
+
+    ~Segment() {
+        if (!temporary)
+            return;
+        // best effort, a leftover file of a temporary segment is only dead space
+        try {
+            manager.drop_segment(segment_id_mask >> 48);
+        } catch (...) {
+        }
+    }
 
     typename BufferManager<page_size>::Fix fix(uint64_t page_id) const {
         return manager.fix(segment_page_id(page_id));
@@ -23,7 +86,30 @@ template <size_t page_size> class Segment {
         return manager.fix_exclusive(segment_page_id(page_id));
     }
 
-    uint64_t page_id(typename BufferManager<page_size>::Fix &fix) {
+    // empty instead of waiting for other fixes of the page
+    typename BufferManager<page_size>::ExclusiveFix try_fix_exclusive(uint64_t page_id) {
+        return manager.try_fix_exclusive(segment_page_id(page_id));
+    }
+
+    // version snapshot without fixing, ids read from unvalidated pages are only masked
+    typename BufferManager<page_size>::OptimisticFix fix_optimistic(uint64_t page_id) const {
+        return manager.fix_optimistic(segment_id_mask | (page_id & ((1ull << 48) - 1)));
+    }
+
+    // empty if the page changed since the snapshot
+    typename BufferManager<page_size>::Fix fix(const typename BufferManager<page_size>::OptimisticFix &page) const {
+        return manager.fix(page);
+    }
+
+    typename BufferManager<page_size>::ExclusiveFix fix_exclusive(const typename BufferManager<page_size>::OptimisticFix &page) {
+        return manager.fix_exclusive(page);
+    }
+
+    uint64_t page_id(const typename BufferManager<page_size>::Fix &fix) const {
+        return fix.page_id() & ((1ull << 48) - 1);
+    }
+
+    uint64_t page_id(const typename BufferManager<page_size>::OptimisticFix &fix) const {
         return fix.page_id() & ((1ull << 48) - 1);
     }
 
@@ -31,16 +117,39 @@ template <size_t page_size> class Segment {
         return manager.is_dirty(segment_page_id(page_id));
     }
 
+    void commit() {
+        manager.commit();
+    }
+
+    bool is_temporary() const {
+        return temporary;
+    }
+
  private:
     BufferManager<page_size>& manager;
     uint64_t segment_id_mask;
+    bool temporary = false;
 
     uint64_t segment_page_id(uint64_t id) const {
-        assert((id & ((1ull << 16) - 1) << 48) == 0);
+        assert((id & ((1ull << 16) - 1) << 48) == 0 && id != PageRef::kNone);
         return segment_id_mask | id;
     }
 };
 
+class segment_format_error : public std::exception {
+ public:
+    const char* what() const noexcept override {
+        return "segment does not contain a matching data structure";
+    }
+};
+
+class stale_metadata_error : public std::exception {
+ public:
+    const char* what() const noexcept override {
+        return "segment changed after its metadata was stored";
+    }
+};
+
 }  // namespace imlab
 // ---------------------------------------------------------------------------------------------------
 #endif  // INCLUDE_IMLAB_SEGMENT_H_
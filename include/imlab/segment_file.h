@@ -11,18 +11,22 @@ namespace imlab {
 
 class SegmentFile {
  public:
-    SegmentFile(uint64_t page_id, size_t page_size);
+    // access `page_count` consecutive pages starting at `page_id` with a single call
+    SegmentFile(uint64_t page_id, size_t page_size, size_t page_count = 1);
     ~SegmentFile();
 
     void read(std::byte *data);
     void write(std::byte *data);
 
+    // delete the file backing a segment, if there is one
+    static void remove(uint16_t segment_id);
+
  private:
     template<typename Op> void prw_loop(Op op, std::byte *data);
 
     int fd;
     uint64_t pos;
-    size_t page_size;
+    size_t length;
 };
 
 }  // namespace imlab
@@ -0,0 +1,248 @@
+// ---------------------------------------------------------------------------------------------------
+// IMLAB
+// ---------------------------------------------------------------------------------------------------
+#ifndef INCLUDE_IMLAB_VAR_BTREE_H_
+#define INCLUDE_IMLAB_VAR_BTREE_H_
+
+#include "imlab/segment.h"
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+// ---------------------------------------------------------------------------------------------------
+namespace imlab {
+
+#define IMLAB_VAR_BTREE_TEMPL \
+    template<size_t page_size>
+#define IMLAB_VAR_BTREE_CLASS \
+    VarBTree<page_size>
+
+// B+-tree for variable length byte string keys and values, ordered like std::string.
+// Nodes are slotted pages, the slots grow from the front and the key/value bytes from the back.
+// Every node stores fence keys bounding its keys, the common prefix of the fences is stored once
+// and stripped from all keys of the node. Leaf splits pick the shortest separator and every slot
+// caches the first bytes of its key, so most comparisons are a single integer compare.
+template<size_t page_size>
+class VarBTree : private Segment<page_size> {
+    using Fix = typename BufferManager<page_size>::Fix;
+    using ExclusiveFix = typename BufferManager<page_size>::ExclusiveFix;
+
+ public:
+    class Node;
+    class const_iterator;
+
+    VarBTree(uint16_t segment_id, BufferManager<page_size> &manager)
+        : Segment<page_size>(segment_id, manager) {}
+    // attach to the tree stored in the segment by the last `checkpoint`
+    // throws stale_metadata_error if the tree changed after it, e.g. before a crash
+    VarBTree(reopen_t, uint16_t segment_id, BufferManager<page_size> &manager);
+    // scratch tree, dropped without any writeback on destruction
+    VarBTree(temporary_t, uint16_t segment_id, BufferManager<page_size> &manager)
+        : Segment<page_size>(temporary, segment_id, manager) {}
+    // tries to store the metadata for a later reopen, errors are ignored
+    ~VarBTree();
+
+    // all operations are thread safe, readers lock couple with shared fixes
+    // iterators share the fix of their leaf
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator lower_bound(std::string_view key) const;
+    const_iterator find(std::string_view key) const;
+    std::optional<std::string> lookup(std::string_view key) const;
+
+    // throw entry_too_large_error if key and value together exceed kMaxEntry bytes
+    void insert(std::string_view key, std::string_view value);
+    void insert_or_assign(std::string_view key, std::string_view value);
+    void erase(std::string_view key);
+
+    uint64_t size() const;
+    uint16_t depth() const;
+    uint64_t leaf_count() const;
+    uint64_t inner_count() const;
+
+    // store the tree metadata in the segment header page and commit the buffer manager
+    void checkpoint();
+
+ private:
+    struct Metadata;
+    static constexpr uint64_t kMetadataPage = 0;
+    static constexpr uint64_t kNoRoot = kMetadataPage;
+
+    std::atomic<uint64_t> root{kNoRoot};
+    std::mutex root_mutex;
+    std::atomic<uint64_t> next_page_id{kMetadataPage + 1};
+
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> leaves{0};
+    std::atomic<uint64_t> inners{0};
+    // set while the metadata page matches the tree, the first write after that clears it on the page
+    std::atomic<bool> metadata_current{false};
+    std::mutex metadata_mutex;
+
+    void write_metadata();
+    // mark the stored metadata as outdated, logged before the write changes any node
+    void invalidate_metadata();
+
+    Fix root_fix() const;
+    ExclusiveFix root_fix_exclusive();
+    // lock couple down with shared fixes to the leaf that can contain `key`, empty for an empty tree
+    // `first` picks the leftmost leaf instead
+    Fix find_leaf(std::string_view key, bool first = false) const;
+    // same, but the leaf is fixed exclusively
+    ExclusiveFix find_leaf_exclusive(std::string_view key);
+    ExclusiveFix new_node(uint16_t level);
+
+    void insert_internal(std::string_view key, std::string_view value, bool assign);
+    // exclusive lock coupling that splits every node without space for a maximal entry
+    ExclusiveFix insert_lc_early_split(std::string_view key);
+    // split `child`, `parent` is fixed and has space or is empty for a new root
+    // afterwards `child` holds the half that covers `key`
+    void split(ExclusiveFix &parent, ExclusiveFix &child, std::string_view key);
+
+    static constexpr uint32_t kNodeHeader = 32;
+    static constexpr uint32_t kSlotSize = 12;
+
+ public:
+    // an inner entry with a maximal separator, its child and slot takes an eighth of a node
+    // so a split always leaves enough space for the new fences
+    static constexpr uint32_t kMaxEntry = (page_size - kNodeHeader) / 8 - sizeof(uint64_t) - kSlotSize;
+};
+
+IMLAB_VAR_BTREE_TEMPL class IMLAB_VAR_BTREE_CLASS::Node {
+ public:
+    // first key bytes cached in the slot, big endian so they compare like the bytes
+    using Head = uint32_t;
+
+    struct Slot {
+        uint16_t offset;
+        uint16_t key_length;
+        uint16_t value_length;
+        Head head;
+    };
+
+    // empty node, keys are bounded by (lower, upper], missing fences are unbounded
+    void init(uint16_t level, std::optional<std::string_view> lower, std::optional<std::string_view> upper);
+
+    bool is_leaf() const;
+    uint16_t get_level() const;
+    uint16_t size() const;
+
+    std::string_view prefix() const;
+    std::optional<std::string_view> lower_fence() const;
+    std::optional<std::string_view> upper_fence() const;
+
+    // first index with a key not less than `key`, and whether it is equal
+    std::pair<uint32_t, bool> lower_bound(std::string_view key) const;
+    // key without the node prefix
+    std::string_view suffix(uint32_t idx) const;
+    std::string key(uint32_t idx) const;
+    std::string_view value(uint32_t idx) const;
+
+    // inner nodes: child for `idx` in [0, size()], size() refers to the last child
+    uint64_t child(uint32_t idx) const;
+    void set_child(uint32_t idx, uint64_t page);
+    uint64_t child_for(std::string_view key) const;
+    // leaves: next leaf, kMetadataPage if none
+    uint64_t get_next() const;
+    void set_next(uint64_t page);
+
+    // whether a new entry with `payload` key and value bytes fits, possibly after compacting
+    bool fits(uint32_t payload) const;
+    // `key` is the full key, it must lie within the fences
+    void insert(uint32_t idx, std::string_view key, std::string_view value);
+    void erase(uint32_t idx);
+
+    // key that separates `left` from a greater `right`, left <= separator < right
+    static std::string separator(std::string_view left, std::string_view right);
+    // inner node values are child page ids
+    static std::string encode_page(uint64_t page);
+    static uint64_t decode_page(std::string_view value);
+
+ private:
+    static constexpr uint32_t kHeapEnd = page_size;
+    static_assert(page_size <= (1 << 15));
+
+    uint16_t level;
+    uint16_t count;
+    // lowest used heap offset, the heap grows down from the page end
+    uint16_t heap_begin;
+    // heap bytes of erased entries, reclaimed by `compact`
+    uint16_t garbage;
+    uint16_t prefix_length;
+    uint16_t lower_offset, lower_length;
+    uint16_t upper_offset, upper_length;
+    uint8_t has_lower, has_upper;
+    // next leaf or last child
+    uint64_t link;
+
+    static Head make_head(std::string_view suffix);
+
+    Slot *slots();
+    const Slot *slots() const;
+    const char *bytes() const;
+    char *bytes();
+    uint32_t contiguous_space() const;
+
+    uint16_t push_heap(std::string_view data);
+    // append an entry whose key is already stripped of the prefix
+    void append_suffix(std::string_view suffix, std::string_view value, Head head);
+    void compact();
+};
+
+IMLAB_VAR_BTREE_TEMPL struct IMLAB_VAR_BTREE_CLASS::Metadata {
+    static constexpr uint64_t kMagic = 0x32305f6565727476;  // "vtree_02"
+
+    uint64_t magic;
+    uint32_t page_bytes;
+    // cleared by the first change after the fields were stored
+    uint64_t checkpointed;
+
+    uint64_t root;
+    uint64_t has_root;
+    uint64_t next_page_id;
+    uint64_t count;
+    uint64_t leaf_count;
+    uint64_t inner_count;
+
+    bool matches() const;
+};
+
+IMLAB_VAR_BTREE_TEMPL class IMLAB_VAR_BTREE_CLASS::const_iterator {
+    friend class VarBTree;
+
+ public:
+    const_iterator &operator++();
+    bool operator==(const const_iterator &other) const;
+    bool operator!=(const const_iterator &other) const;
+
+    std::string key() const;
+    std::string_view value() const;
+
+ private:
+    const_iterator(const Segment<page_size> &segment, Fix fix, uint32_t i)
+        : fix(std::move(fix)), segment(segment), i(i) {}
+
+    // move on to the next leaf while past the end of the current one
+    void skip_empty();
+
+    Fix fix;
+    const Segment<page_size> &segment;
+    uint32_t i;
+};
+
+class entry_too_large_error : public std::exception {
+ public:
+    const char* what() const noexcept override {
+        return "key and value exceed the maximum entry size";
+    }
+};
+
+}  // namespace imlab
+// ---------------------------------------------------------------------------------------------------
+#include "var_btree.hpp"
+// ---------------------------------------------------------------------------------------------------
+#endif  // INCLUDE_IMLAB_VAR_BTREE_H_
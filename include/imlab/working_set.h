@@ -0,0 +1,29 @@
+// ---------------------------------------------------------------------------------------------------
+// IMLAB
+// ---------------------------------------------------------------------------------------------------
+#ifndef INCLUDE_IMLAB_WORKING_SET_H_
+#define INCLUDE_IMLAB_WORKING_SET_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+// ---------------------------------------------------------------------------------------------------
+namespace imlab {
+
+// resident page ids of a buffer manager, each queue from the next eviction to the most recent use
+struct WorkingSet {
+    std::vector<uint64_t> fifo;
+    std::vector<uint64_t> lru;
+
+    size_t size() const { return fifo.size() + lru.size(); }
+
+    // write to `path` atomically, a crash leaves the previous list in place
+    void save(const std::string &path) const;
+    // an empty set if there is no readable list at `path`
+    static WorkingSet load(const std::string &path);
+};
+
+}  // namespace imlab
+// ---------------------------------------------------------------------------------------------------
+#endif  // INCLUDE_IMLAB_WORKING_SET_H_
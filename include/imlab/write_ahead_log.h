@@ -0,0 +1,68 @@
+// ---------------------------------------------------------------------------------------------------
+// IMLAB
+// ---------------------------------------------------------------------------------------------------
+#ifndef INCLUDE_IMLAB_WRITE_AHEAD_LOG_H_
+#define INCLUDE_IMLAB_WRITE_AHEAD_LOG_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+// ---------------------------------------------------------------------------------------------------
+namespace imlab {
+
+// Physical redo log, every record holds the after image of a byte range of a page.
+// Records are buffered in memory and made durable by `flush`, concurrent flushes are
+// grouped so one fdatasync covers all records appended up to that point.
+class WriteAheadLog {
+ public:
+    using RedoFn = std::function<void(uint64_t page_id, uint32_t offset, const std::byte *data, uint32_t length)>;
+
+    explicit WriteAheadLog(const std::string &path);
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+    // buffer a record, returns its lsn
+    uint64_t append(uint64_t page_id, uint32_t offset, const std::byte *data, uint32_t length);
+
+    // make all records up to `lsn` durable
+    void flush(uint64_t lsn);
+    void flush();
+
+    // apply all complete records in log order, returns the number of records
+    size_t replay(const RedoFn &redo) const;
+    // discard all records, only valid once every logged page has been written back
+    void truncate();
+
+    uint64_t appended_lsn() const;
+    uint64_t flushed_lsn() const;
+    size_t syncs() const;
+
+ private:
+    // scan the records in the file, calls `redo` for each and returns the end of the valid prefix
+    uint64_t scan(const RedoFn *redo) const;
+    void write_batch(const std::vector<std::byte> &batch, uint64_t offset);
+
+    int fd;
+
+    mutable std::mutex mutex;
+    std::condition_variable flushed;
+    bool flushing = false;
+
+    // lsns keep growing across truncations, the file starts at `lsn_base`
+    uint64_t lsn_base = 0;
+    uint64_t next_lsn = 0;
+    uint64_t durable_lsn = 0;
+    std::vector<std::byte> buffer;
+
+    size_t sync_count = 0;
+};
+
+}  // namespace imlab
+// ---------------------------------------------------------------------------------------------------
+#endif  // INCLUDE_IMLAB_WRITE_AHEAD_LOG_H_
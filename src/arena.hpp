@@ -0,0 +1,258 @@
+// ---------------------------------------------------------------------------------------------------
+// IMLAB
+// ---------------------------------------------------------------------------------------------------
+#ifndef SRC_ARENA_HPP_
+#define SRC_ARENA_HPP_
+// ---------------------------------------------------------------------------------------------------
+#include "imlab/arena.h"
+
+#include <cstring>
+#include <thread>
+#include <utility>
+// ---------------------------------------------------------------------------------------------------
+namespace imlab {
+
+ARENA_TEMPL ARENA_CLASS::Arena()
+    : directory(new std::atomic<Chunk *>[1ull << kChunkBits]()) {}
+
+ARENA_TEMPL ARENA_CLASS::~Arena() {
+    for (uint64_t i = 0; i < (1ull << kChunkBits); ++i) {
+        Chunk *chunk = directory[i].load();
+        if (!chunk)
+            continue;
+        for (auto &page : chunk->pages)
+            delete page.load();
+        delete chunk;
+    }
+}
+
+ARENA_TEMPL typename ARENA_CLASS::Fix ARENA_CLASS::fix(uint64_t page_id) const {
+    Page &page = get(page_id);
+    page.lock_shared();
+    return Fix(&page);
+}
+
+ARENA_TEMPL typename ARENA_CLASS::ExclusiveFix ARENA_CLASS::fix_exclusive(uint64_t page_id) {
+    Page &page = get(page_id);
+    page.lock();
+    page.version.fetch_add(1);
+    return ExclusiveFix(&page);
+}
+
+ARENA_TEMPL typename ARENA_CLASS::ExclusiveFix ARENA_CLASS::try_fix_exclusive(uint64_t page_id) {
+    Page &page = get(page_id);
+    if (!page.try_lock())
+        return {};
+    page.version.fetch_add(1);
+    return ExclusiveFix(&page);
+}
+
+ARENA_TEMPL typename ARENA_CLASS::OptimisticFix ARENA_CLASS::fix_optimistic(uint64_t page_id) const {
+    // ids read from unvalidated pages may be anything
+    const Page *page = page_id < kMaxPages ? find(page_id) : nullptr;
+    if (!page)
+        return {};
+    uint64_t version = page->version.load(std::memory_order_acquire);
+    if (version & 1)
+        return {};
+    return OptimisticFix(page, version);
+}
+
+ARENA_TEMPL typename ARENA_CLASS::Fix ARENA_CLASS::fix(const OptimisticFix &page) const {
+    if (!page.valid())
+        return {};
+    Page *p = const_cast<Page *>(page.page);
+    p->lock_shared();
+    Fix fix(p);
+    if (p->version.load() != page.version)
+        return {};
+    return fix;
+}
+
+ARENA_TEMPL typename ARENA_CLASS::ExclusiveFix ARENA_CLASS::fix_exclusive(const OptimisticFix &page) {
+    if (!page.valid())
+        return {};
+    Page *p = const_cast<Page *>(page.page);
+    p->lock();
+    if (p->version.load() != page.version) {
+        // release without a version change, the page was not touched
+        p->fix_count.store(0, std::memory_order_release);
+        return {};
+    }
+    p->version.fetch_add(1);
+    return ExclusiveFix(p);
+}
+
+ARENA_TEMPL uint64_t ARENA_CLASS::page_id(const Fix &fix) const {
+    return fix.page_id();
+}
+
+ARENA_TEMPL uint64_t ARENA_CLASS::page_id(const OptimisticFix &fix) const {
+    return fix.page_id();
+}
+
+ARENA_TEMPL bool ARENA_CLASS::is_dirty(uint64_t) const {
+    return true;
+}
+
+ARENA_TEMPL uint64_t ARENA_CLASS::page_count() const {
+    return pages.load();
+}
+
+ARENA_TEMPL void ARENA_CLASS::spill(uint16_t segment_id, BufferManager<page_size> &manager) const {
+    Segment<page_size> segment(segment_id, manager);
+    for (uint64_t page_id = 0, n = page_count(); page_id < n; ++page_id) {
+        auto fix = segment.fix_exclusive(page_id);
+        if (const Page *page = find(page_id))
+            std::memcpy(fix.data(), page->data, page_size);
+        else
+            std::memset(fix.data(), 0, page_size);
+        fix.set_dirty();
+    }
+    segment.commit();
+}
+
+ARENA_TEMPL typename ARENA_CLASS::Page &ARENA_CLASS::get(uint64_t page_id) const {
+    if (page_id >= kMaxPages)
+        throw arena_full_error();
+    auto &slot = directory[page_id >> kChunkBits];
+    Chunk *chunk = slot.load(std::memory_order_acquire);
+    if (!chunk) {
+        // on a lost race the winner's chunk is loaded to `chunk`
+        auto created = std::make_unique<Chunk>();
+        if (slot.compare_exchange_strong(chunk, created.get()))
+            chunk = created.release();
+    }
+
+    auto &entry = chunk->pages[page_id & ((1ull << kChunkBits) - 1)];
+    Page *page = entry.load(std::memory_order_acquire);
+    if (!page) {
+        auto created = std::make_unique<Page>(page_id);
+        if (entry.compare_exchange_strong(page, created.get()))
+            page = created.release();
+
+        uint64_t n = pages.load();
+        while (n <= page_id && !pages.compare_exchange_weak(n, page_id + 1)) {}
+    }
+    return *page;
+}
+
+ARENA_TEMPL typename ARENA_CLASS::Page *ARENA_CLASS::find(uint64_t page_id) const {
+    Chunk *chunk = directory[page_id >> kChunkBits].load(std::memory_order_acquire);
+    if (!chunk)
+        return nullptr;
+    return chunk->pages[page_id & ((1ull << kChunkBits) - 1)].load(std::memory_order_acquire);
+}
+
+// ---------------------------------------------------------------------------------------------------
+
+ARENA_TEMPL void ARENA_CLASS::Page::lock_shared() {
+    for (;;) {
+        int32_t count = fix_count.load(std::memory_order_relaxed);
+        if (count >= 0 && fix_count.compare_exchange_weak(count, count + 1, std::memory_order_acquire))
+            return;
+        std::this_thread::yield();
+    }
+}
+
+ARENA_TEMPL void ARENA_CLASS::Page::lock() {
+    while (!try_lock())
+        std::this_thread::yield();
+}
+
+ARENA_TEMPL bool ARENA_CLASS::Page::try_lock() {
+    int32_t count = 0;
+    return fix_count.compare_exchange_strong(count, -1, std::memory_order_acquire);
+}
+
+ARENA_TEMPL void ARENA_CLASS::Page::unfix() {
+    // only the exclusive owner sees -1
+    if (fix_count.load(std::memory_order_relaxed) < 0) {
+        version.fetch_add(1, std::memory_order_release);
+        fix_count.store(0, std::memory_order_release);
+    } else {
+        fix_count.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------
+
+ARENA_TEMPL ARENA_CLASS::Fix::Fix(Fix &&o) noexcept {
+    *this = std::move(o);
+}
+
+ARENA_TEMPL typename ARENA_CLASS::Fix &ARENA_CLASS::Fix::operator=(Fix &&o) noexcept {
+    if (this != &o) {
+        unfix();
+        page = o.page;
+        o.page = nullptr;
+    }
+    return *this;
+}
+
+ARENA_TEMPL ARENA_CLASS::Fix::~Fix() {
+    unfix();
+}
+
+ARENA_TEMPL void ARENA_CLASS::Fix::unfix() {
+    if (page)
+        page->unfix();
+    page = nullptr;
+}
+
+ARENA_TEMPL uint64_t ARENA_CLASS::Fix::page_id() const {
+    return page->page_id;
+}
+
+ARENA_TEMPL const std::byte *ARENA_CLASS::Fix::data() const {
+    if (page)
+        return page->data;
+    return nullptr;
+}
+
+ARENA_TEMPL template<typename T> const T *ARENA_CLASS::Fix::as() const {
+    static_assert(sizeof(T) <= page_size);
+    return reinterpret_cast<const T*>(data());
+}
+
+ARENA_TEMPL std::byte *ARENA_CLASS::ExclusiveFix::data() {
+    if (this->page)
+        return this->page->data;
+    return nullptr;
+}
+
+ARENA_TEMPL template<typename T> T *ARENA_CLASS::ExclusiveFix::as() {
+    static_assert(sizeof(T) <= page_size);
+    return reinterpret_cast<T*>(data());
+}
+
+// ---------------------------------------------------------------------------------------------------
+
+ARENA_TEMPL bool ARENA_CLASS::OptimisticFix::valid() const {
+    return page != nullptr;
+}
+
+ARENA_TEMPL uint64_t ARENA_CLASS::OptimisticFix::page_id() const {
+    return page->page_id;
+}
+
+ARENA_TEMPL const std::byte *ARENA_CLASS::OptimisticFix::data() const {
+    if (page)
+        return page->data;
+    return nullptr;
+}
+
+ARENA_TEMPL template<typename T> const T *ARENA_CLASS::OptimisticFix::as() const {
+    static_assert(sizeof(T) <= page_size);
+    return reinterpret_cast<const T*>(data());
+}
+
+ARENA_TEMPL bool ARENA_CLASS::OptimisticFix::validate() const {
+    // order the optimistic reads before the version check
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return page && page->version.load(std::memory_order_relaxed) == version;
+}
+
+}  // namespace imlab
+// ---------------------------------------------------------------------------------------------------
+#endif  // SRC_ARENA_HPP_
@@ -38,14 +38,14 @@ IMLAB_BETREE_TEMPL uint64_t IMLAB_BETREE_CLASS::InnerNode::lower_bound(const Key
     assert(this->count > 0);
     if (comp(keys[this->count - 1], key))
         return children[this->count];
-    return children[std::lower_bound(keys, keys + this->count, key, comp) - keys];
+    return children[search_lower_bound(keys, this->count, key, comp)];
 }
 
 IMLAB_BETREE_TEMPL uint64_t IMLAB_BETREE_CLASS::InnerNode::upper_bound(const Key &key) const {
     assert(this->count > 0);
     if (!comp(key, keys[this->count - 1]))
         return children[this->count];
-    return children[std::upper_bound(keys, keys + this->count, key, comp) - keys];
+    return children[search_upper_bound(keys, this->count, key, comp)];
 }
 
 IMLAB_BETREE_TEMPL uint64_t IMLAB_BETREE_CLASS::InnerNode::at(uint32_t idx) const {
@@ -114,7 +114,7 @@ IMLAB_BETREE_TEMPL uint32_t IMLAB_BETREE_CLASS::InnerNode::map_start_index() con
     const auto &key = msgs.begin()->key().key;
     if (comp(keys[this->count - 1], key))
         return this->count;
-    return std::lower_bound(keys, keys + this->count, key, comp) - keys;
+    return search_lower_bound(keys, this->count, key, comp);
 }
 
 IMLAB_BETREE_TEMPL typename IMLAB_BETREE_CLASS::MessageRange IMLAB_BETREE_CLASS::InnerNode::map_get_range(uint32_t idx) const {
@@ -202,14 +202,14 @@ IMLAB_BETREE_TEMPL uint32_t IMLAB_BETREE_CLASS::LeafNode::lower_bound(const Key
     assert(this->count > 0);
     if (comp(keys[this->count - 1], key))
         return this->count;
-    return std::lower_bound(keys, keys + this->count, key, comp) - keys;
+    return search_lower_bound(keys, this->count, key, comp);
 }
 
 IMLAB_BETREE_TEMPL uint32_t IMLAB_BETREE_CLASS::LeafNode::upper_bound(const Key &key) const {
     assert(this->count > 0);
     if (!comp(key, keys[this->count - 1]))
         return this->count;
-    return std::upper_bound(keys, keys + this->count, key, comp) - keys;
+    return search_upper_bound(keys, this->count, key, comp);
 }
 
 IMLAB_BETREE_TEMPL const T &IMLAB_BETREE_CLASS::LeafNode::at(uint32_t idx) const {
@@ -277,7 +277,42 @@ IMLAB_BETREE_TEMPL Key IMLAB_BETREE_CLASS::LeafNode::split(LeafNode &other) {
 
     return keys[this->count - 1];  // NOTE maybe use inbetween key
 }
+// ---------------------------------------------------------------------------------------------------
+IMLAB_BETREE_TEMPL bool IMLAB_BETREE_CLASS::Metadata::matches() const {
+    return magic == kMagic && page_bytes == page_size && epsilon_bytes == epsilon
+        && key_size == sizeof(Key) && value_size == sizeof(T);
+}
 // ---------------------------------------------------------o------------------------------------------
+IMLAB_BETREE_TEMPL IMLAB_BETREE_CLASS::BeTree(reopen_t, uint16_t segment_id, BufferManager<page_size> &manager)
+    : Storage<page_size>(segment_id, manager) {
+    auto fix = this->fix(kMetadataPage);
+    const auto &meta = *fix.template as<Metadata>();
+    if (!meta.matches())
+        throw segment_format_error();
+    // the nodes may be ahead of the fields, their pages were written back or replayed from the log
+    if (!meta.checkpointed)
+        throw stale_metadata_error();
+
+    if (meta.has_root)
+        root = meta.root;
+    next_page_id = meta.next_page_id;
+    next_timestamp = meta.next_timestamp;
+    count = meta.count;
+    leaf_count = meta.leaf_count;
+    pending = meta.pending;
+    metadata_current = true;
+}
+
+IMLAB_BETREE_TEMPL IMLAB_BETREE_CLASS::~BeTree() {
+    if (this->is_temporary())
+        return;
+    // best effort, a tree that cannot be stored does not reopen
+    try {
+        write_metadata();
+    } catch (...) {
+    }
+}
+
 IMLAB_BETREE_TEMPL typename IMLAB_BETREE_CLASS::const_iterator IMLAB_BETREE_CLASS::end() const {
     return const_iterator(*this, {}, {}, 0);
 }
@@ -332,6 +367,8 @@ IMLAB_BETREE_TEMPL typename IMLAB_BETREE_CLASS::const_iterator IMLAB_BETREE_CLAS
 }
 
 IMLAB_BETREE_TEMPL void IMLAB_BETREE_CLASS::insert(const Key &key, const T &value) {
+    if (metadata_current)
+        invalidate_metadata();
     auto root = root_fix_exclusive();
 
     if (root.template as<Node>()->is_leaf()) {
@@ -392,6 +429,46 @@ IMLAB_BETREE_TEMPL uint16_t IMLAB_BETREE_CLASS::depth() const {
     return 0;
 }
 
+IMLAB_BETREE_TEMPL void IMLAB_BETREE_CLASS::checkpoint() {
+    write_metadata();
+    this->commit();
+}
+
+IMLAB_BETREE_TEMPL void IMLAB_BETREE_CLASS::spill(uint16_t segment_id, BufferManager<page_size> &manager) {
+    write_metadata();
+    Storage<page_size>::spill(segment_id, manager);
+}
+
+IMLAB_BETREE_TEMPL void IMLAB_BETREE_CLASS::write_metadata() {
+    auto fix = this->fix_exclusive(kMetadataPage);
+    auto &meta = *fix.template as<Metadata>();
+    meta.magic = Metadata::kMagic;
+    meta.page_bytes = page_size;
+    meta.key_size = sizeof(Key);
+    meta.value_size = sizeof(T);
+    meta.epsilon_bytes = epsilon;
+    meta.checkpointed = true;
+
+    meta.root = root.value_or(0);
+    meta.has_root = root.has_value();
+    meta.next_page_id = next_page_id;
+    meta.next_timestamp = next_timestamp;
+    meta.count = count;
+    meta.leaf_count = leaf_count;
+    meta.pending = pending;
+    fix.set_dirty();
+    metadata_current = !this->is_temporary();
+}
+
+IMLAB_BETREE_TEMPL void IMLAB_BETREE_CLASS::invalidate_metadata() {
+    // the log record precedes those of the insert, so a replay never gets its nodes without it
+    auto fix = this->fix_exclusive(kMetadataPage);
+    fix.template as<Metadata>()->checkpointed = false;
+    fix.set_dirty();
+    fix.unfix();
+    metadata_current = false;
+}
+
 IMLAB_BETREE_TEMPL typename IMLAB_BETREE_CLASS::ExclusiveFix IMLAB_BETREE_CLASS::root_fix_exclusive() {
     if (root)
         return this->fix_exclusive(*root);
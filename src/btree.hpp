@@ -8,6 +8,12 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
 #include <vector>
 #include <utility>
 
@@ -19,29 +25,131 @@ IMLAB_BTREE_TEMPL constexpr IMLAB_BTREE_CLASS::Node::Node(uint16_t level)
 IMLAB_BTREE_TEMPL bool IMLAB_BTREE_CLASS::Node::is_leaf() const {
     return level == 0;
 }
+
+IMLAB_BTREE_TEMPL uint16_t IMLAB_BTREE_CLASS::Node::optimistic_count() const {
+    return *static_cast<const volatile uint16_t *>(&count);
+}
 // ---------------------------------------------------------------------------------------------------
 IMLAB_BTREE_TEMPL constexpr IMLAB_BTREE_CLASS::InnerNode::InnerNode(uint16_t level)
-    : Node(level) {
+    : Entries(level) {
     static_assert(sizeof(*this) <= page_size);
     assert(level > 0);
 }
 
 IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::InnerNode::begin() const {
-    return children[0];
+    return this->children[0];
+}
+
+IMLAB_BTREE_TEMPL uint32_t IMLAB_BTREE_CLASS::InnerNode::child_index(const Key &key) const {
+    return child_index(key, this->count);
+}
+
+IMLAB_BTREE_TEMPL uint32_t IMLAB_BTREE_CLASS::InnerNode::child_index(const Key &key, uint32_t n) const {
+    // merges can leave a node with a single child
+    if (n == 0 || comp(this->keys[n - 1], key))
+        return n;
+    return search<false>(key, n);
+}
+
+IMLAB_BTREE_TEMPL template<bool upper>
+uint32_t IMLAB_BTREE_CLASS::InnerNode::search(const Key &key, uint32_t n) const {
+    auto bound = [&key](const Key *keys, uint32_t count) {
+        return upper ? search_upper_bound(keys, count, key, comp) : search_lower_bound(keys, count, key, comp);
+    };
+    if constexpr (layout == InnerLayout::Sorted) {
+        return bound(this->keys, n);
+    } else if constexpr (layout == InnerLayout::Learned) {
+        return this->model.template search<upper>(this->keys, n, key);
+    } else {
+        // descend from the top level, the block below entry i starts at i * kBlock
+        // past the last full block only the partial block at the end of the level is left
+        using Shape = typename Entries::Shape;
+        constexpr uint32_t block = Shape::kBlock;
+        uint32_t first = 0;
+        for (uint32_t level = Entries::kLevels; level > 0; --level) {
+            const Key *entries = this->index + Entries::kLevelOffsets[level];
+            uint32_t size = Shape::level_size(n, level);
+            first = (first + bound(entries + first, std::min(block, size - first))) * block;
+        }
+        return first + bound(this->keys + first, std::min(block, n - first));
+    }
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::InnerNode::reindex(uint32_t idx) {
+    if constexpr (layout == InnerLayout::Blocked) {
+        using Shape = typename Entries::Shape;
+        constexpr uint32_t block = Shape::kBlock;
+        const Key *below = this->keys;
+        for (uint32_t level = 1; level <= Entries::kLevels; ++level) {
+            Key *entries = this->index + Entries::kLevelOffsets[level];
+            idx /= block;
+            for (uint32_t i = idx; i < Shape::level_size(this->count, level); ++i)
+                entries[i] = below[(i + 1) * block - 1];
+            below = entries;
+        }
+    } else if constexpr (layout == InnerLayout::Learned) {
+        this->model.build(this->keys, this->count);
+    }
+}
+
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::InnerNode::child(uint32_t idx) const {
+    assert(idx <= this->count);
+    return this->children[idx];
+}
+
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::InnerNode::child_size(uint32_t idx) const {
+    static_assert(counted);
+    assert(idx <= this->count);
+    return this->sizes[idx];
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::InnerNode::set_child_size(uint32_t idx, uint64_t size) {
+    static_assert(counted);
+    assert(idx <= this->count);
+    this->sizes[idx] = size;
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::InnerNode::copy_child(InnerNode &dst, uint32_t to, const InnerNode &src, uint32_t from) {
+    dst.children[to] = src.children[from];
+    if constexpr (counted)
+        dst.sizes[to] = src.sizes[from];
+}
+
+IMLAB_BTREE_TEMPL const Key &IMLAB_BTREE_CLASS::InnerNode::separator(uint32_t idx) const {
+    assert(idx < this->count);
+    return this->keys[idx];
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::InnerNode::set_separator(uint32_t idx, const Key &key) {
+    assert(idx < this->count);
+    this->keys[idx] = key;
+    reindex(idx);
+}
+
+IMLAB_BTREE_TEMPL const Key *IMLAB_BTREE_CLASS::InnerNode::separator_data() const {
+    return this->keys;
+}
+
+IMLAB_BTREE_TEMPL const PageRef *IMLAB_BTREE_CLASS::InnerNode::child_data() const {
+    return this->children;
 }
 
 IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::InnerNode::lower_bound(const Key &key) const {
-    assert(this->count > 0);
-    if (comp(keys[this->count - 1], key))
-        return children[this->count];
-    return children[std::lower_bound(keys, keys + this->count, key, comp) - keys];
+    return this->children[child_index(key)];
 }
 
 IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::InnerNode::upper_bound(const Key &key) const {
-    assert(this->count > 0);
-    if (!comp(key, keys[this->count - 1]))
-        return children[this->count];
-    return children[std::upper_bound(keys, keys + this->count, key, comp) - keys];
+    if (this->count == 0 || !comp(key, this->keys[this->count - 1]))
+        return this->children[this->count];
+    return this->children[search<true>(key, this->count)];
+}
+
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::InnerNode::optimistic_lower_bound(const Key &key) const {
+    // read the count once, a concurrent writer may change it at any time
+    uint16_t n = this->optimistic_count();
+    if (n > kCapacity)
+        return kMetadataPage;
+    return this->children[child_index(key, n)];
 }
 
 IMLAB_BTREE_TEMPL bool IMLAB_BTREE_CLASS::InnerNode::full() const {
@@ -49,7 +157,7 @@ IMLAB_BTREE_TEMPL bool IMLAB_BTREE_CLASS::InnerNode::full() const {
 }
 
 IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::InnerNode::init(uint64_t left) {
-    children[0] = left;
+    this->children[0] = left;
 }
 
 IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::InnerNode::insert(const Key &key, uint64_t split_page) {
@@ -60,19 +168,20 @@ IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::InnerNode::insert(const Key &key, uint
     // loop invariant: i is current free space
     for (i = this->count; i > 0; --i) {
         // left of free space is smaller -> insert here
-        if (comp(keys[i - 1], key))
+        if (comp(this->keys[i - 1], key))
             break;
 
         // otherwise move free space to the left
-        keys[i] = keys[i - 1];
-        children[i + 1] = children[i];
+        this->keys[i] = this->keys[i - 1];
+        copy_child(*this, i + 1, *this, i);
     }
 
     // insert in new space
-    keys[i] = key;
-    children[i + 1] = split_page;
+    this->keys[i] = key;
+    this->children[i + 1] = split_page;
 
     ++this->count;
+    reindex(i);
 }
 
 IMLAB_BTREE_TEMPL Key IMLAB_BTREE_CLASS::InnerNode::split(InnerNode &other) {
@@ -90,392 +199,2362 @@ IMLAB_BTREE_TEMPL Key IMLAB_BTREE_CLASS::InnerNode::split(InnerNode &other) {
     uint32_t start = this->count / 2;
     uint32_t i;
     for (i = start + 1; i < this->count; ++i) {
-        other.keys[i - start - 1] = keys[i];
-        other.children[i - start - 1] = children[i];
+        other.keys[i - start - 1] = this->keys[i];
+        copy_child(other, i - start - 1, *this, i);
     }
-    other.children[i - start - 1] = children[i];
+    copy_child(other, i - start - 1, *this, i);
 
     other.count = this->count - start - 1;
     this->count = start;
+    reindex(start);
+    other.reindex(0);
 
-    return keys[start];
+    return this->keys[start];
 }
-// ---------------------------------------------------------------------------------------------------
-IMLAB_BTREE_TEMPL constexpr IMLAB_BTREE_CLASS::LeafNode::LeafNode()
-    : Node(0) {}
 
-IMLAB_BTREE_TEMPL uint32_t IMLAB_BTREE_CLASS::LeafNode::lower_bound(const Key &key) const {
-    assert(this->count > 0);
-    if (comp(keys[this->count - 1], key))
-        return this->count;
-    return std::lower_bound(keys, keys + this->count, key, comp) - keys;
-}
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::InnerNode::erase(uint32_t idx) {
+    assert(idx < this->count);
 
-IMLAB_BTREE_TEMPL uint32_t IMLAB_BTREE_CLASS::LeafNode::upper_bound(const Key &key) const {
-    assert(this->count > 0);
-    if (!comp(key, keys[this->count - 1]))
-        return this->count;
-    return std::upper_bound(keys, keys + this->count, key, comp) - keys;
-}
+    uint32_t start = idx;
+    for (; idx < this->count - 1; ++idx) {
+        this->keys[idx] = this->keys[idx + 1];
+        copy_child(*this, idx + 1, *this, idx + 2);
+    }
 
-IMLAB_BTREE_TEMPL const T &IMLAB_BTREE_CLASS::LeafNode::at(uint32_t idx) const {
-    assert(idx < this->count);
-    return values[idx];
+    --this->count;
+    reindex(start);
 }
 
-IMLAB_BTREE_TEMPL T &IMLAB_BTREE_CLASS::LeafNode::at(uint32_t idx) {
-    assert(idx < this->count);
-    return values[idx];
-}
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::InnerNode::erase_children(uint32_t from, uint32_t to) {
+    assert(from < to && to - from <= this->count);
 
-IMLAB_BTREE_TEMPL bool IMLAB_BTREE_CLASS::LeafNode::is_equal(const Key &key, uint32_t idx) const {
-    return idx < this->count && keys[idx] == key;
-}
+    // the separator left of the children stays, unless they end the node
+    uint32_t n = to - from;
+    uint32_t start = to <= this->count ? from : from - 1;
+    for (uint32_t i = start; i + n < this->count; ++i)
+        this->keys[i] = this->keys[i + n];
+    for (uint32_t i = from; i + n <= this->count; ++i)
+        copy_child(*this, i, *this, i + n);
 
-IMLAB_BTREE_TEMPL bool IMLAB_BTREE_CLASS::LeafNode::full() const {
-    return this->count >= kCapacity;
+    this->count -= n;
+    reindex(start);
 }
 
-IMLAB_BTREE_TEMPL const typename IMLAB_BTREE_CLASS::LeafNode::next_ptr &IMLAB_BTREE_CLASS::LeafNode::get_next() const {
-    return next;
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::InnerNode::merge(InnerNode &other, const Key &separator) {
+    assert(this->count + other.count < kCapacity);
+    assert(other.level == this->level);
+
+    //   k0      s      l0       ->   k0  s  l0
+    // c0  c1       d0  d1       -> c0  c1  d0  d1
+    this->keys[this->count] = separator;
+    for (uint32_t i = 0; i < other.count; ++i)
+        this->keys[this->count + 1 + i] = other.keys[i];
+    for (uint32_t i = 0; i <= other.count; ++i)
+        copy_child(*this, this->count + 1 + i, other, i);
+
+    uint32_t start = this->count;
+    this->count += other.count + 1;
+    other.count = 0;
+    reindex(start);
 }
 
-IMLAB_BTREE_TEMPL T &IMLAB_BTREE_CLASS::LeafNode::make_space(const Key &key, uint32_t idx) {
-    assert(idx < kCapacity);
+IMLAB_BTREE_TEMPL Key IMLAB_BTREE_CLASS::InnerNode::balance(InnerNode &other, const Key &separator) {
+    assert(other.level == this->level);
 
-    // move to the right
-    for (uint32_t j = this->count; j > idx; --j) {
-        keys[j] = keys[j - 1];
-        values[j] = values[j - 1];
+    // the separator moves down, the key at the middle of both nodes moves up
+    uint32_t total = this->count + other.count + 1;
+    uint32_t left = total / 2;
+    Key result = separator;
+
+    if (this->count < left) {
+        // take the first n children of `other`
+        uint32_t n = left - this->count;
+        this->keys[this->count] = separator;
+        for (uint32_t i = 0; i + 1 < n; ++i)
+            this->keys[this->count + 1 + i] = other.keys[i];
+        for (uint32_t i = 0; i < n; ++i)
+            copy_child(*this, this->count + 1 + i, other, i);
+        result = other.keys[n - 1];
+
+        for (uint32_t i = n; i < other.count; ++i)
+            other.keys[i - n] = other.keys[i];
+        for (uint32_t i = n; i <= other.count; ++i)
+            copy_child(other, i - n, other, i);
+    } else if (this->count > left) {
+        // hand the last n children to `other`
+        uint32_t n = this->count - left;
+        for (uint32_t i = other.count; i > 0; --i)
+            other.keys[i - 1 + n] = other.keys[i - 1];
+        for (uint32_t i = other.count + 1; i > 0; --i)
+            copy_child(other, i - 1 + n, other, i - 1);
+
+        other.keys[n - 1] = separator;
+        for (uint32_t i = 0; i + 1 < n; ++i)
+            other.keys[i] = this->keys[left + 1 + i];
+        for (uint32_t i = 0; i < n; ++i)
+            copy_child(other, i, *this, left + 1 + i);
+        result = this->keys[left];
     }
 
-    // insert
-    keys[idx] = key;
-    ++this->count;
-    return values[idx];
+    uint32_t start = std::min<uint32_t>(this->count, left);
+    this->count = left;
+    other.count = total - left - 1;
+    reindex(start);
+    other.reindex(0);
+    return result;
 }
+// ---------------------------------------------------------------------------------------------------
+IMLAB_BTREE_TEMPL constexpr IMLAB_BTREE_CLASS::LeafNode::LeafNode()
+    : Entries(0) {}
 
-IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::LeafNode::erase(uint32_t idx) {
-    assert(idx < this->count);
-
-    // move to the left
-    for (; idx < this->count - 1; ++idx) {
-        keys[idx] = keys[idx + 1];
-        values[idx] = values[idx + 1];
+IMLAB_BTREE_TEMPL uint32_t IMLAB_BTREE_CLASS::LeafNode::lower_bound(const Key &key) const {
+    assert(this->count > 0);
+    if constexpr (kPacked) {
+        return lower_bound(key, 0, this->count);
+    } else {
+        if (comp(this->keys[this->count - 1], key))
+            return this->count;
+        return search_lower_bound(this->keys, this->count, key, comp);
     }
-
-    // last element can stay in memory
-    --this->count;
 }
 
-IMLAB_BTREE_TEMPL Key IMLAB_BTREE_CLASS::LeafNode::split(LeafNode &other, uint64_t other_page) {
-    assert(this->count > 1);
-    uint32_t start = this->count - (this->count / 2);
-
-    for (uint32_t i = start; i < this->count; ++i) {
-        other.keys[i - start] = keys[i];
-        other.values[i - start] = values[i];
+IMLAB_BTREE_TEMPL uint32_t IMLAB_BTREE_CLASS::LeafNode::lower_bound(const Key &key, uint32_t from, uint32_t n) const {
+    if constexpr (kPacked) {
+        uint32_t width = this->width;
+        if (!consistent(n, width))
+            return n;
+        if (comp(key, this->base))
+            return from;
+        return from + search<false>(deltas(n, width) + from * width, width, n - from, distance(this->base, key));
+    } else {
+        return from + search_lower_bound(this->keys + from, n - from, key, comp);
     }
-
-    other.count = this->count - start;
-    this->count = start;
-
-    other.next = this->next;
-    this->next = other_page;
-
-    return keys[this->count - 1];  // NOTE maybe use inbetween key
 }
-// ---------------------------------------------------------------------------------------------------
-IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::iterator IMLAB_BTREE_CLASS::begin() {
-    if (!root)
-        return end();
 
-    auto fix = this->fix_exclusive(*root);
-    while (!fix.template as<Node>()->is_leaf()) {
-        assert(fix.template as<Node>()->count > 0);
-        fix = this->fix_exclusive(fix.template as<InnerNode>()->begin());
+IMLAB_BTREE_TEMPL uint32_t IMLAB_BTREE_CLASS::LeafNode::upper_bound(const Key &key) const {
+    assert(this->count > 0);
+    if constexpr (kPacked) {
+        if (comp(key, this->base))
+            return 0;
+        return search<true>(deltas(this->count, this->width), this->width, this->count, distance(this->base, key));
+    } else {
+        if (!comp(key, this->keys[this->count - 1]))
+            return this->count;
+        return search_upper_bound(this->keys, this->count, key, comp);
     }
-    assert(fix.template as<Node>()->count > 0);
+}
 
-    return iterator(*this, std::move(fix), 0);
+IMLAB_BTREE_TEMPL Key IMLAB_BTREE_CLASS::LeafNode::key(uint32_t idx) const {
+    assert(idx < this->count);
+    if constexpr (kPacked) {
+        using Unsigned = std::make_unsigned_t<Key>;
+        uint64_t delta = load(deltas(this->count, this->width), this->width, idx);
+        return static_cast<Key>(static_cast<Unsigned>(static_cast<Unsigned>(this->base) + delta));
+    } else {
+        return this->keys[idx];
+    }
 }
 
-IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::iterator IMLAB_BTREE_CLASS::end() {
-    return iterator(*this, {}, 0);
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::const_reference IMLAB_BTREE_CLASS::LeafNode::at(uint32_t idx) const {
+    assert(idx < this->count);
+    if constexpr (kColumnar)
+        return value(idx);
+    else
+        return value_data()[idx];
 }
 
-IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::iterator IMLAB_BTREE_CLASS::find(const Key &key) {
-    if (!root)
-        return end();
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::reference IMLAB_BTREE_CLASS::LeafNode::at(uint32_t idx) {
+    assert(idx < this->count);
+    if constexpr (kColumnar)
+        return ValueRef(*this, idx);
+    else
+        return value_data()[idx];
+}
 
-    auto fix = this->fix_exclusive(*root);
-    while (!fix.template as<Node>()->is_leaf()) {
-        assert(fix.template as<Node>()->count > 0);
-        fix = this->fix_exclusive(fix.template as<InnerNode>()->lower_bound(key));
+IMLAB_BTREE_TEMPL T IMLAB_BTREE_CLASS::LeafNode::value(uint32_t idx) const {
+    assert(idx < kCapacity);
+    if constexpr (kColumnar) {
+        T result{};
+        for_each_column([&](auto i) {
+            constexpr size_t column = decltype(i)::value;
+            result.*std::get<column>(Columns<T>::members) = this->template column<column>()[idx];
+        });
+        return result;
+    } else {
+        return value_data()[idx];
     }
-    assert(fix.template as<Node>()->count > 0);
-
-    auto &leaf = *fix.template as<LeafNode>();
-    auto i = leaf.lower_bound(key);
-
-    return leaf.is_equal(key, i) ? iterator(*this, std::move(fix), i) : end();
 }
 
-IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::iterator IMLAB_BTREE_CLASS::lower_bound(const Key &key) {
-    if (!root)
-        return end();
-
-    auto fix = this->fix_exclusive(*root);
-    while (!fix.template as<Node>()->is_leaf()) {
-        assert(fix.template as<Node>()->count > 0);
-        fix = this->fix_exclusive(fix.template as<InnerNode>()->lower_bound(key));
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::LeafNode::set_value(uint32_t idx, const T &value) {
+    assert(idx < this->count);
+    if constexpr (kColumnar) {
+        for_each_column([&](auto i) {
+            constexpr size_t column = decltype(i)::value;
+            this->template column<column>()[idx] = value.*std::get<column>(Columns<T>::members);
+        });
+    } else {
+        value_data()[idx] = value;
     }
-    assert(fix.template as<Node>()->count > 0);
+}
 
-    auto &leaf = *fix.template as<LeafNode>();
-    auto i = leaf.lower_bound(key);
+IMLAB_BTREE_TEMPL template<auto member>
+const member_t<member> &IMLAB_BTREE_CLASS::LeafNode::field(uint32_t idx) const {
+    assert(idx < this->count);
+    if constexpr (kColumnar)
+        return this->template column<Entries::Layout::template index<member>()>()[idx];
+    else
+        return value_data()[idx].*member;
+}
 
-    return i < leaf.count ? iterator(*this, std::move(fix), i) : end();
+IMLAB_BTREE_TEMPL template<auto member>
+member_t<member> &IMLAB_BTREE_CLASS::LeafNode::field(uint32_t idx) {
+    return const_cast<member_t<member> &>(std::as_const(*this).template field<member>(idx));
 }
 
-IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::iterator IMLAB_BTREE_CLASS::upper_bound(const Key &key) {
-    if (!root)
-        return end();
+IMLAB_BTREE_TEMPL const Key *IMLAB_BTREE_CLASS::LeafNode::key_data() const {
+    static_assert(!kPacked, "packed leaves have no key array");
+    return this->keys;
+}
 
-    auto fix = this->fix_exclusive(*root);
-    while (!fix.template as<Node>()->is_leaf()) {
-        assert(fix.template as<Node>()->count > 0);
-        fix = this->fix_exclusive(fix.template as<InnerNode>()->upper_bound(key));
+IMLAB_BTREE_TEMPL const Key *IMLAB_BTREE_CLASS::LeafNode::key_data(uint32_t from, uint32_t to, Key *buffer) const {
+    if constexpr (kPacked) {
+        for (uint32_t i = from; i < to; ++i)
+            buffer[i - from] = key(i);
+        return buffer;
+    } else {
+        return this->keys + from;
     }
-    assert(fix.template as<Node>()->count > 0);
-
-    auto &leaf = *fix.template as<LeafNode>();
-    auto i = leaf.upper_bound(key);
+}
 
-    return i < leaf.count ? iterator(*this, std::move(fix), i) : end();
+IMLAB_BTREE_TEMPL const T *IMLAB_BTREE_CLASS::LeafNode::value_data() const {
+    static_assert(!kColumnar, "columnar leaves have no value array");
+    if constexpr (kPacked)
+        return reinterpret_cast<const T *>(this->data);
+    else
+        return this->values;
 }
 
-IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::insert(const Key &key, const T &value) {
-    auto ir = insert_internal(key);
-    if (ir)
-        ir->second = value;
+IMLAB_BTREE_TEMPL T *IMLAB_BTREE_CLASS::LeafNode::value_data() {
+    return const_cast<T *>(std::as_const(*this).value_data());
 }
 
-IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::insert(const Key &key, T &&value) {
-    auto ir = insert_internal(key);
-    if (ir)
-        ir->second = value;
+IMLAB_BTREE_TEMPL const T *IMLAB_BTREE_CLASS::LeafNode::value_data(uint32_t from, uint32_t to, T *buffer) const {
+    if constexpr (kColumnar) {
+        for (uint32_t i = from; i < to; ++i)
+            buffer[i - from] = value(i);
+        return buffer;
+    } else {
+        return value_data() + from;
+    }
 }
 
-IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::insert_or_assign(const Key &key, const T &value) {
-    insert_or_assign_internal(key).second = value;
+IMLAB_BTREE_TEMPL template<auto member>
+const member_t<member> *IMLAB_BTREE_CLASS::LeafNode::field_data(uint32_t from, uint32_t to,
+                                                               member_t<member> *buffer) const {
+    if constexpr (kColumnar) {
+        return this->template column<Entries::Layout::template index<member>()>() + from;
+    } else {
+        const T *values = value_data();
+        for (uint32_t i = from; i < to; ++i)
+            buffer[i - from] = values[i].*member;
+        return buffer;
+    }
 }
 
-IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::insert_or_assign(const Key &key, T &&value) {
-    insert_or_assign_internal(key).second = value;
+IMLAB_BTREE_TEMPL bool IMLAB_BTREE_CLASS::LeafNode::is_equal(const Key &key, uint32_t idx) const {
+    return idx < this->count && this->key(idx) == key;
 }
 
-IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::erase(const Key &key) {
-    auto ir = exclusive_find_node(key);
-    auto &leaf = *ir.fix.template as<LeafNode>();
-    auto idx = leaf.lower_bound(key);
-    if (leaf.is_equal(key, idx)) {
-        leaf.erase(idx);
-        ir.fix.set_dirty();
-    }
+IMLAB_BTREE_TEMPL std::optional<T> IMLAB_BTREE_CLASS::LeafNode::optimistic_find(const Key &key) const {
+    uint16_t n = this->Node::optimistic_count();
+    if (n > kCapacity)
+        return {};
 
-    // TODO join ?
+    uint32_t i = lower_bound(key, 0, n);
+    if (i < n && optimistic_key(i, n) == key)
+        return value(i);
+    return {};
 }
 
-IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::ExclusiveFix IMLAB_BTREE_CLASS::root_fix_exclusive() {
-    if (root)
-        return this->fix_exclusive(*root);
+IMLAB_BTREE_TEMPL uint16_t IMLAB_BTREE_CLASS::LeafNode::optimistic_count() const {
+    // every packed pair takes at least one byte for the distance
+    constexpr uint32_t limit = kPacked ? std::min<uint32_t>(kCapacity, kSpace / (sizeof(T) + 1)) : kCapacity;
+    return std::min<uint32_t>(this->Node::optimistic_count(), limit);
+}
 
-    root = next_page_id;
-    return new_leaf();
+IMLAB_BTREE_TEMPL Key IMLAB_BTREE_CLASS::LeafNode::optimistic_key(uint32_t idx, uint32_t n) const {
+    if constexpr (kPacked) {
+        using Unsigned = std::make_unsigned_t<Key>;
+        uint32_t width = this->width;
+        if (idx >= n || !consistent(n, width))
+            return this->base;
+        uint64_t delta = load(deltas(n, width), width, idx);
+        return static_cast<Key>(static_cast<Unsigned>(static_cast<Unsigned>(this->base) + delta));
+    } else {
+        return idx < kCapacity ? this->keys[idx] : Key{};
+    }
 }
 
-IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::ExclusiveFix IMLAB_BTREE_CLASS::new_leaf() {
-    auto fix = this->fix_exclusive(next_page_id++);
-    new (fix.data()) LeafNode();
-    fix.set_dirty();
-    ++leaf_count;
+IMLAB_BTREE_TEMPL bool IMLAB_BTREE_CLASS::LeafNode::full(const Key &key) const {
+    if constexpr (kPacked) {
+        uint32_t n = this->count;
+        if (n == 0)
+            return false;
+        if (n >= kCapacity)
+            return true;
+
+        const Key last = this->key(n - 1);
+        uint32_t width = width_for(comp(key, this->base) ? key : this->base, comp(last, key) ? key : last);
+        return packed_bytes(n + 1, std::max<uint32_t>(width, this->width)) > kSpace;
+    } else {
+        return this->count >= kCapacity;
+    }
+}
 
-    return fix;
+IMLAB_BTREE_TEMPL uint32_t IMLAB_BTREE_CLASS::LeafNode::used() const {
+    if constexpr (kPacked)
+        return packed_bytes(this->count, this->width);
+    else
+        return this->count;
 }
 
-IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::ExclusiveFix IMLAB_BTREE_CLASS::new_inner(uint16_t level) {
-    auto fix = this->fix_exclusive(next_page_id++);
-    new (fix.data()) InnerNode(level);
-    fix.set_dirty();
+IMLAB_BTREE_TEMPL uint32_t IMLAB_BTREE_CLASS::LeafNode::merged_used(const LeafNode &other) const {
+    uint32_t n = this->count + other.count;
+    if constexpr (kPacked) {
+        if (n > kCapacity)
+            return kSpace + 1;
+        if (n == 0)
+            return 0;
+        const Key first = this->count > 0 ? key(0) : other.key(0);
+        const Key last = other.count > 0 ? other.key(other.count - 1) : key(this->count - 1);
+        return packed_bytes(n, width_for(first, last));
+    } else {
+        return n;
+    }
+}
 
-    return fix;
+IMLAB_BTREE_TEMPL const typename IMLAB_BTREE_CLASS::LeafNode::next_ptr &IMLAB_BTREE_CLASS::LeafNode::get_next() const {
+    return this->next;
 }
 
-IMLAB_BTREE_TEMPL std::optional<typename IMLAB_BTREE_CLASS::InsertResult> IMLAB_BTREE_CLASS::insert_internal(const Key &key) {
-    // TODO early split when really full
-    auto ir = exclusive_find_node(key);
-    auto *leaf = ir.fix.template as<LeafNode>();
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::LeafNode::set_next(uint64_t page) {
+    this->next = page;
+}
 
-    if (leaf->count == 0) {
-        ++count;
-        ir.fix.set_dirty();
-        return {{std::move(ir.fix), leaf->make_space(key, 0)}};
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::LeafNode::prefetch() const {
+    // the start of both arrays, the hardware prefetcher follows once they are read sequentially
+    // the distances end with the page
+    if constexpr (kPacked) {
+        __builtin_prefetch(this->data);
+        __builtin_prefetch(this->data + kSpace - 1);
+    } else if constexpr (kColumnar) {
+        __builtin_prefetch(this->keys);
+        __builtin_prefetch(this->columns);
+    } else {
+        __builtin_prefetch(this->keys);
+        __builtin_prefetch(this->values);
     }
+}
 
-    // check for key
-    auto idx = leaf->lower_bound(key);
-    if (leaf->is_equal(key, idx))
-        return {};
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::reference IMLAB_BTREE_CLASS::LeafNode::make_space(const Key &key,
+                                                                                               uint32_t idx) {
+    assert(idx < kCapacity);
+    if constexpr (kPacked) {
+        assert(!full(key));
+        uint32_t n = this->count;
+        if (n == 0) {
+            this->base = key;
+            this->width = 1;
+        } else {
+            // a key outside the range of the leaf may need a lower base or wider distances
+            const Key last = this->key(n - 1);
+            const Key base = comp(key, this->base) ? key : this->base;
+            uint32_t width = std::max<uint32_t>(width_for(base, comp(last, key) ? key : last), this->width);
+            if (width != this->width || comp(key, this->base))
+                widen(base, width);
+        }
 
-    // check for space, split if unavailable
-    if (leaf->count >= LeafNode::kCapacity) {
-        ir = {};
-        ir = insert_full_lock_rec_split(key);
-        leaf = ir.fix.template as<LeafNode>();
-        idx = leaf->lower_bound(key);
+        // the distances grow towards the front
+        uint32_t width = this->width;
+        const std::byte *from = deltas(n, width);
+        std::byte *to = deltas(n + 1, width);
+        for (uint32_t j = 0; j < idx; ++j)
+            store(to, width, j, load(from, width, j));
+        store(to, width, idx, distance(this->base, key));
+    } else {
+        for (uint32_t j = this->count; j > idx; --j)
+            this->keys[j] = this->keys[j - 1];
+        this->keys[idx] = key;
     }
 
-    assert(leaf->count < LeafNode::kCapacity);
-    ++count;
-    ir.fix.set_dirty();
-    return {{std::move(ir.fix), leaf->make_space(key, idx)}};
-}
-
-IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::InsertResult IMLAB_BTREE_CLASS::insert_or_assign_internal(const Key &key) {
-    // TODO try no split if really empty
-    auto ir = insert_lc_early_split(key);
+    // move to the right
+    move_values(*this, idx + 1, *this, idx, this->count - idx);
 
-    auto &leaf = *ir.fix.template as<LeafNode>();
+    ++this->count;
+    return at(idx);
+}
 
-    if (leaf.count == 0) {
-        ++count;
-        ir.fix.set_dirty();
-        return {std::move(ir.fix), leaf.make_space(key, 0)};
-    }
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::LeafNode::erase(uint32_t idx) {
+    assert(idx < this->count);
 
-    auto idx = leaf.lower_bound(key);
-    ir.fix.set_dirty();
-    if (leaf.is_equal(key, idx)) {
-        return {std::move(ir.fix), leaf.at(idx)};
+    if constexpr (kPacked) {
+        // the distances before `idx` move back by one
+        uint32_t width = this->width;
+        const std::byte *from = deltas(this->count, width);
+        std::byte *to = deltas(this->count - 1, width);
+        for (uint32_t j = idx; j > 0; --j)
+            store(to, width, j - 1, load(from, width, j - 1));
     } else {
-        ++count;
-        return {std::move(ir.fix), leaf.make_space(key, idx)};
+        for (uint32_t j = idx; j < this->count - 1; ++j)
+            this->keys[j] = this->keys[j + 1];
     }
+
+    // move to the left
+    move_values(*this, idx, *this, idx + 1, this->count - idx - 1);
+
+    // last element can stay in memory
+    --this->count;
 }
 
-IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::split(ExclusiveFix &parent, ExclusiveFix &child, const Key &key) {
-    if (!parent.data()) {
-        root = next_page_id;
-        parent = new_inner(child.template as<Node>()->level + 1);
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::LeafNode::erase(uint32_t from, uint32_t to) {
+    assert(from <= to && to <= this->count);
+    uint32_t n = to - from;
+    if (n == 0)
+        return;
+
+    move_values(*this, from, *this, to, this->count - to);
+    if constexpr (kPacked) {
+        // the remaining keys may fit narrower distances
+        std::vector<Key> keys(this->count);
+        key_data(0, this->count, keys.data());
+        keys.erase(keys.begin() + from, keys.begin() + to);
+        pack(keys.data(), keys.size());
+    } else {
+        for (uint32_t j = from; j + n < this->count; ++j)
+            this->keys[j] = this->keys[j + n];
+        this->count -= n;
     }
-    assert(!parent.template as<Node>()->is_leaf());
+}
 
-    auto &pnode = *parent.template as<InnerNode>();
+IMLAB_BTREE_TEMPL Key IMLAB_BTREE_CLASS::LeafNode::split(LeafNode &other, uint64_t other_page, uint32_t keep) {
+    assert(0 < keep && keep < this->count);
+    uint32_t start = keep;
+    move_values(other, 0, *this, start, this->count - start);
 
-    Key split_key;
-    ExclusiveFix split;
-    uint64_t split_page = next_page_id;
-    if (child.template as<Node>()->is_leaf()) {
-        auto &cnode = *child.template as<LeafNode>();
-        split = new_leaf();
-        split_key = cnode.split(*split.template as<LeafNode>(), split_page);
+    if constexpr (kPacked) {
+        std::vector<Key> keys(this->count);
+        key_data(0, this->count, keys.data());
+        other.pack(keys.data() + start, this->count - start);
+        pack(keys.data(), start);
     } else {
-        auto &cnode = *child.template as<InnerNode>();
-        split = new_inner(cnode.level);
-        split_key = cnode.split(*split.template as<InnerNode>());
+        for (uint32_t i = start; i < this->count; ++i)
+            other.keys[i - start] = this->keys[i];
+        other.count = this->count - start;
+        this->count = start;
     }
 
-    parent.set_dirty();
-    child.set_dirty();
-    split.set_dirty();
+    other.next = this->next;
+    this->next = other_page;
 
-    if (pnode.count == 0)
-        pnode.init(this->page_id(child));
-    pnode.insert(split_key, split_page);
-    if (!comp(key, split_key))
-        child = std::move(split);
+    return key(this->count - 1);  // NOTE maybe use inbetween key
 }
 
-IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::CoupledFixes IMLAB_BTREE_CLASS::insert_lc_early_split(const Key &key) {
-    CoupledFixes cf = { root_fix_exclusive() };
-
-    while (!cf.fix.template as<Node>()->is_leaf()) {
-        auto &inner = *cf.fix.template as<InnerNode>();
-        if (inner.full())
-            split(cf.prev, cf.fix, key);
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::LeafNode::merge(LeafNode &other) {
+    assert(merged_used(other) <= kSpace);
+    move_values(*this, this->count, other, 0, other.count);
 
-        cf.advance(this->fix_exclusive(cf.fix.template as<InnerNode>()->lower_bound(key)));
+    if constexpr (kPacked) {
+        std::vector<Key> keys(this->count + other.count);
+        key_data(0, this->count, keys.data());
+        other.key_data(0, other.count, keys.data() + this->count);
+        pack(keys.data(), keys.size());
+    } else {
+        for (uint32_t i = 0; i < other.count; ++i)
+            this->keys[this->count + i] = other.keys[i];
+        this->count += other.count;
     }
 
-    if (cf.fix.template as<LeafNode>()->full())
-        split(cf.prev, cf.fix, key);
+    other.count = 0;
+    this->next = other.next;
+}
 
-    return cf;
+IMLAB_BTREE_TEMPL Key IMLAB_BTREE_CLASS::LeafNode::balance(LeafNode &other) {
+    // same distribution as a split
+    uint32_t total = this->count + other.count;
+    uint32_t left = total - total / 2;
+
+    if constexpr (kPacked) {
+        std::vector<Key> keys(total);
+        std::vector<T> values(total);
+        key_data(0, this->count, keys.data());
+        other.key_data(0, other.count, keys.data() + this->count);
+        std::copy(value_data(), value_data() + this->count, values.begin());
+        std::copy(other.value_data(), other.value_data() + other.count, values.begin() + this->count);
+
+        // the current distribution always fits, so approach it until both sides do
+        auto fits = [&keys, total](uint32_t split) {
+            return packed_bytes(split, width_for(keys[0], keys[split - 1])) <= kSpace
+                && packed_bytes(total - split, width_for(keys[split], keys[total - 1])) <= kSpace;
+        };
+        while (left != this->count && !fits(left))
+            left = left < this->count ? left + 1 : left - 1;
+
+        std::copy(values.begin(), values.begin() + left, value_data());
+        std::copy(values.begin() + left, values.end(), other.value_data());
+        pack(keys.data(), left);
+        other.pack(keys.data() + left, total - left);
+        return keys[left - 1];
+    } else {
+        if (this->count < left) {
+            // take the first n pairs of `other`
+            uint32_t n = left - this->count;
+            for (uint32_t i = 0; i < n; ++i)
+                this->keys[this->count + i] = other.keys[i];
+            for (uint32_t i = n; i < other.count; ++i)
+                other.keys[i - n] = other.keys[i];
+            move_values(*this, this->count, other, 0, n);
+            move_values(other, 0, other, n, other.count - n);
+        } else if (this->count > left) {
+            // hand the last n pairs to `other`
+            uint32_t n = this->count - left;
+            for (uint32_t i = other.count; i > 0; --i)
+                other.keys[i - 1 + n] = other.keys[i - 1];
+            for (uint32_t i = 0; i < n; ++i)
+                other.keys[i] = this->keys[left + i];
+            move_values(other, n, other, 0, other.count);
+            move_values(other, 0, *this, left, n);
+        }
+
+        this->count = left;
+        other.count = total - left;
+        return this->keys[this->count - 1];
+    }
 }
 
-IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::CoupledFixes IMLAB_BTREE_CLASS::exclusive_find_node(const Key &key) {
-    CoupledFixes cf = { root_fix_exclusive() };
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::LeafNode::move_values(LeafNode &dst, uint32_t to, const LeafNode &src,
+                                                                uint32_t from, uint32_t n) {
+    if constexpr (kColumnar) {
+        for_each_column([&](auto i) {
+            constexpr size_t column = decltype(i)::value;
+            std::memmove(dst.template column<column>() + to, src.template column<column>() + from,
+                         sizeof(typename Entries::Layout::template type<column>) * n);
+        });
+    } else {
+        const T *in = src.value_data() + from;
+        T *out = dst.value_data() + to;
+        if (&dst == &src && to > from)
+            std::copy_backward(in, in + n, out + n);
+        else
+            std::copy(in, in + n, out);
+    }
+}
 
-    while (!cf.fix.template as<Node>()->is_leaf())
-        cf.advance(this->fix_exclusive(cf.fix.template as<InnerNode>()->lower_bound(key)));
+IMLAB_BTREE_TEMPL template<typename F> void IMLAB_BTREE_CLASS::LeafNode::for_each_column(F &&f) {
+    for_each_column(std::forward<F>(f), std::make_index_sequence<Entries::Layout::kCount>{});
+}
 
-    return cf;
+IMLAB_BTREE_TEMPL template<typename F, size_t... i>
+void IMLAB_BTREE_CLASS::LeafNode::for_each_column(F &&f, std::index_sequence<i...>) {
+    (f(std::integral_constant<size_t, i>{}), ...);
+}
+
+IMLAB_BTREE_TEMPL uint32_t IMLAB_BTREE_CLASS::LeafNode::width_for(const Key &lo, const Key &hi) {
+    uint64_t range = distance(lo, hi);
+    uint32_t width = range <= 0xff ? 1 : range <= 0xffff ? 2 : range <= 0xffffffff ? 4 : 8;
+    return std::min<uint32_t>(width, sizeof(Key));
 }
 
-IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::CoupledFixes IMLAB_BTREE_CLASS::insert_full_lock_rec_split(const Key &key) {
-    std::vector<ExclusiveFix> fixes;
-    fixes.push_back(root_fix_exclusive());
+IMLAB_BTREE_TEMPL uint32_t IMLAB_BTREE_CLASS::LeafNode::packed_bytes(uint32_t n, uint32_t width) {
+    return n * (width + sizeof(T));
+}
 
-    while (!fixes.back().template as<Node>()->is_leaf())
-        fixes.push_back(this->fix_exclusive(fixes.back().template as<InnerNode>()->lower_bound(key)));
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::LeafNode::distance(const Key &lo, const Key &key) {
+    using Unsigned = std::make_unsigned_t<Key>;
+    return static_cast<Unsigned>(static_cast<Unsigned>(key) - static_cast<Unsigned>(lo));
+}
 
-    auto it = fixes.rbegin();
-    auto split_it = [this, &fixes, &key, &it] () {
-        ExclusiveFix dummy;
-        it + 1 == fixes.rend() ? split(dummy, *it, key) : split(*(it + 1), *it, key);
+IMLAB_BTREE_TEMPL template<bool upper>
+uint32_t IMLAB_BTREE_CLASS::LeafNode::search(const std::byte *deltas, uint32_t width, uint32_t n, uint64_t delta) {
+    // a distance beyond the width is above all keys
+    auto narrow = [deltas, n, delta](auto max) -> uint32_t {
+        using Delta = decltype(max);
+        if (delta > max)
+            return n;
+        const auto *keys = reinterpret_cast<const Delta *>(deltas);
+        if constexpr (upper)
+            return search_upper_bound(keys, n, static_cast<Delta>(delta), std::less<Delta>());
+        else
+            return search_lower_bound(keys, n, static_cast<Delta>(delta), std::less<Delta>());
     };
 
-    if (it->template as<LeafNode>()->full()) {
-        for (++it; it != fixes.rend(); ++it) {
-            if (!it->template as<InnerNode>()->full())
-                break;
-        }
-        for (--it; it != fixes.rbegin(); --it)
-            split_it();
-        split_it();
+    switch (width) {
+        case 1: return narrow(std::numeric_limits<uint8_t>::max());
+        case 2: return narrow(std::numeric_limits<uint16_t>::max());
+        case 4: return narrow(std::numeric_limits<uint32_t>::max());
+        default: return narrow(std::numeric_limits<uint64_t>::max());
     }
+}
 
-    if (fixes.size() > 1)
-        return { std::move(fixes.back()), std::move(*++fixes.rbegin()) };
-    return { std::move(fixes.back()) };
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::LeafNode::load(const std::byte *deltas, uint32_t width, uint32_t idx) {
+    switch (width) {
+        case 1: return reinterpret_cast<const uint8_t *>(deltas)[idx];
+        case 2: return reinterpret_cast<const uint16_t *>(deltas)[idx];
+        case 4: return reinterpret_cast<const uint32_t *>(deltas)[idx];
+        default: return reinterpret_cast<const uint64_t *>(deltas)[idx];
+    }
 }
 
-IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::size() const {
-    return count;
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::LeafNode::store(std::byte *deltas, uint32_t width, uint32_t idx, uint64_t delta) {
+    switch (width) {
+        case 1: reinterpret_cast<uint8_t *>(deltas)[idx] = static_cast<uint8_t>(delta); break;
+        case 2: reinterpret_cast<uint16_t *>(deltas)[idx] = static_cast<uint16_t>(delta); break;
+        case 4: reinterpret_cast<uint32_t *>(deltas)[idx] = static_cast<uint32_t>(delta); break;
+        default: reinterpret_cast<uint64_t *>(deltas)[idx] = delta; break;
+    }
 }
 
-IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::capacity() const {
-    return leaf_count * LeafNode::kCapacity;
+IMLAB_BTREE_TEMPL const std::byte *IMLAB_BTREE_CLASS::LeafNode::deltas(uint32_t n, uint32_t width) const {
+    return this->data + kSpace - n * width;
 }
 
-IMLAB_BTREE_TEMPL uint16_t IMLAB_BTREE_CLASS::depth() const {
-    if (root)
-        return this->fix(*root).template as<Node>()->level;
-    return 0;
+IMLAB_BTREE_TEMPL std::byte *IMLAB_BTREE_CLASS::LeafNode::deltas(uint32_t n, uint32_t width) {
+    return this->data + kSpace - n * width;
 }
-// ---------------------------------------------------------------------------------------------------
-IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::iterator &IMLAB_BTREE_CLASS::iterator::operator++() {
+
+IMLAB_BTREE_TEMPL bool IMLAB_BTREE_CLASS::LeafNode::consistent(uint32_t n, uint32_t width) {
+    bool valid_width = width == 1 || width == 2 || width == 4 || width == 8;
+    return valid_width && width <= sizeof(Key) && n <= kCapacity && packed_bytes(n, width) <= kSpace;
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::LeafNode::widen(const Key &base, uint32_t width) {
+    assert(!comp(this->base, base) && width >= this->width);
+    uint32_t n = this->count;
+    uint64_t shift = distance(base, this->base);
+
+    // front to back, a wider distance never ends behind the next narrower one
+    const std::byte *from = deltas(n, this->width);
+    std::byte *to = deltas(n, width);
+    for (uint32_t i = 0; i < n; ++i)
+        store(to, width, i, load(from, this->width, i) + shift);
+
+    this->base = base;
+    this->width = width;
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::LeafNode::pack(const Key *keys, uint32_t n) {
+    this->count = n;
+    if (n == 0)
+        return;
+
+    this->base = keys[0];
+    this->width = width_for(keys[0], keys[n - 1]);
+    std::byte *to = deltas(n, this->width);
+    for (uint32_t i = 0; i < n; ++i)
+        store(to, this->width, i, distance(this->base, keys[i]));
+}
+// ---------------------------------------------------------------------------------------------------
+IMLAB_BTREE_TEMPL bool IMLAB_BTREE_CLASS::Metadata::matches() const {
+    return magic == kMagic && page_bytes == page_size
+        && key_size == sizeof(Key) && value_size == sizeof(T)
+        && inner_layout == static_cast<uint32_t>(layout) && counted_sizes == counted
+        && leaf_format == static_cast<uint32_t>(leaf_layout);
+}
+// ---------------------------------------------------------------------------------------------------
+IMLAB_BTREE_TEMPL IMLAB_BTREE_CLASS::BTree(reopen_t, uint16_t segment_id, BufferManager<page_size> &manager)
+    : Storage<page_size>(segment_id, manager) {
+    auto fix = this->fix(kMetadataPage);
+    const auto &meta = *fix.template as<Metadata>();
+    if (!meta.matches())
+        throw segment_format_error();
+    // the nodes may be ahead of the fields, their pages were written back or replayed from the log
+    if (!meta.checkpointed)
+        throw stale_metadata_error();
+
+    if (meta.has_root)
+        root = meta.root;
+    next_page_id = meta.next_page_id;
+    count = meta.count;
+    leaf_count = meta.leaf_count;
+    free_list = meta.free_list;
+    dropped.assign(meta.dropped, meta.dropped + meta.dropped_count);
+    for (uint64_t page = meta.dropped_pages; page != kMetadataPage;) {
+        auto chain = this->fix(page);
+        const auto &roots = *chain.template as<DroppedRoots>();
+        dropped.insert(dropped.end(), roots.roots, roots.roots + roots.count);
+        dropped_pages.push_back(page);
+        page = roots.next;
+    }
+    metadata_current = true;
+}
+
+IMLAB_BTREE_TEMPL IMLAB_BTREE_CLASS::~BTree() {
+    assert(live_snapshots == 0);
+    if (this->is_temporary())
+        return;
+    // best effort, a tree that cannot be stored does not reopen
+    try {
+        write_metadata();
+    } catch (...) {
+    }
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::iterator IMLAB_BTREE_CLASS::begin() {
+    uint64_t erases = range_erases.load();
+    auto fix = find_leaf_exclusive([](const InnerNode &inner) { return inner.begin(); });
+    if (!fix.data() || fix.template as<Node>()->count == 0)
+        return end();
+
+    return iterator(*this, std::move(fix), 0, erases);
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::iterator IMLAB_BTREE_CLASS::end() {
+    return iterator(*this, {}, 0, 0);
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::const_iterator IMLAB_BTREE_CLASS::begin() const {
+    uint64_t erases = range_erases.load();
+    auto fix = find_leaf([](const InnerNode &inner) { return inner.begin(); });
+    if (!fix.data() || fix.template as<Node>()->count == 0)
+        return end();
+
+    return const_iterator(*this, std::move(fix), 0, erases);
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::const_iterator IMLAB_BTREE_CLASS::end() const {
+    return const_iterator(*this, {}, 0, 0);
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::iterator IMLAB_BTREE_CLASS::find(const Key &key) {
+    uint64_t erases = range_erases.load();
+    auto fix = find_leaf_exclusive([&key](const InnerNode &inner) { return inner.lower_bound(key); });
+    if (!fix.data() || fix.template as<Node>()->count == 0)
+        return end();
+
+    auto &leaf = *fix.template as<LeafNode>();
+    auto i = leaf.lower_bound(key);
+
+    return leaf.is_equal(key, i) ? iterator(*this, std::move(fix), i, erases) : end();
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::iterator IMLAB_BTREE_CLASS::lower_bound(const Key &key) {
+    uint64_t erases = range_erases.load();
+    auto fix = find_leaf_exclusive([&key](const InnerNode &inner) { return inner.lower_bound(key); });
+    if (!fix.data() || fix.template as<Node>()->count == 0)
+        return end();
+
+    auto &leaf = *fix.template as<LeafNode>();
+    auto i = leaf.lower_bound(key);
+
+    return i < leaf.count ? iterator(*this, std::move(fix), i, erases) : end();
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::iterator IMLAB_BTREE_CLASS::upper_bound(const Key &key) {
+    uint64_t erases = range_erases.load();
+    auto fix = find_leaf_exclusive([&key](const InnerNode &inner) { return inner.upper_bound(key); });
+    if (!fix.data() || fix.template as<Node>()->count == 0)
+        return end();
+
+    auto &leaf = *fix.template as<LeafNode>();
+    auto i = leaf.upper_bound(key);
+
+    return i < leaf.count ? iterator(*this, std::move(fix), i, erases) : end();
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::const_iterator IMLAB_BTREE_CLASS::find(const Key &key) const {
+    uint64_t erases = range_erases.load();
+    auto fix = optimistic_find_leaf(key);
+    if (!fix.data() || fix.template as<Node>()->count == 0)
+        return end();
+
+    auto &leaf = *fix.template as<LeafNode>();
+    auto i = leaf.lower_bound(key);
+
+    return leaf.is_equal(key, i) ? const_iterator(*this, std::move(fix), i, erases) : end();
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::const_iterator IMLAB_BTREE_CLASS::lower_bound(const Key &key) const {
+    uint64_t erases = range_erases.load();
+    auto fix = optimistic_find_leaf(key);
+    if (!fix.data() || fix.template as<Node>()->count == 0)
+        return end();
+
     auto &leaf = *fix.template as<LeafNode>();
-    if (++i >= leaf.count) {
-        if (leaf.get_next())
-            fix = segment.fix_exclusive(*leaf.get_next());
+    auto i = leaf.lower_bound(key);
+
+    return i < leaf.count ? const_iterator(*this, std::move(fix), i, erases) : end();
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::const_iterator IMLAB_BTREE_CLASS::upper_bound(const Key &key) const {
+    uint64_t erases = range_erases.load();
+    auto fix = find_leaf([&key](const InnerNode &inner) { return inner.upper_bound(key); });
+    if (!fix.data() || fix.template as<Node>()->count == 0)
+        return end();
+
+    auto &leaf = *fix.template as<LeafNode>();
+    auto i = leaf.upper_bound(key);
+
+    return i < leaf.count ? const_iterator(*this, std::move(fix), i, erases) : end();
+}
+
+IMLAB_BTREE_TEMPL std::optional<T> IMLAB_BTREE_CLASS::lookup(const Key &key) const {
+    for (unsigned attempt = 0; attempt < kOptimisticAttempts; ++attempt) {
+        OptimisticFix parent, leaf;
+        auto descent = optimistic_descend(key, parent, leaf);
+        if (descent == Descent::Conflict)
+            continue;
+        if (descent == Descent::Unavailable)
+            break;
+        if (!leaf.valid())
+            return {};
+
+        auto value = leaf.template as<LeafNode>()->optimistic_find(key);
+        if (leaf.validate())
+            return value;
+    }
+
+    auto it = find(key);
+    if (it == end())
+        return {};
+    return *it;
+}
+
+IMLAB_BTREE_TEMPL std::optional<T> IMLAB_BTREE_CLASS::lookup(const Key &key, Hint &hint) const {
+    for (unsigned attempt = 0; attempt < kOptimisticAttempts; ++attempt) {
+        OptimisticFix leaf;
+        auto descent = hint_descend(key, hint, leaf);
+        if (descent == Descent::Conflict)
+            continue;
+        if (descent == Descent::Unavailable)
+            break;
+        if (!leaf.valid())
+            return {};
+
+        auto value = leaf.template as<LeafNode>()->optimistic_find(key);
+        if (leaf.validate())
+            return value;
+    }
+
+    // the fixed leaf cannot change, so the version read afterwards still matches the separators
+    hint = Hint();
+    auto fix = find_leaf([&key, &hint](const InnerNode &inner) {
+        uint32_t idx = inner.child_index(key);
+        hint.narrow(inner, idx, inner.count);
+        return inner.child(idx);
+    });
+    if (!fix.data())
+        return {};
+    hint.page = this->page_id(fix);
+    hint.version = structure_version.load();
+
+    const auto &leaf = *fix.template as<LeafNode>();
+    if (leaf.count == 0)
+        return {};
+    uint32_t idx = leaf.lower_bound(key);
+    if (!leaf.is_equal(key, idx))
+        return {};
+    return leaf.at(idx);
+}
+
+IMLAB_BTREE_TEMPL template<typename Callback>
+void IMLAB_BTREE_CLASS::scan(const Key &lo, const Key &hi, Callback callback) const {
+    // packed leaves decode the keys of each run, columnar ones assemble the values
+    std::vector<Key> keys(leaf_layout == LeafLayout::Packed ? LeafNode::kCapacity : 0);
+    std::vector<T> values(kColumnar ? LeafNode::kCapacity : 0);
+    scan_leaves(lo, hi, [&](const LeafNode &leaf, uint32_t begin, uint32_t end) {
+        return callback(leaf.key_data(begin, end, keys.data()), leaf.value_data(begin, end, values.data()), end - begin);
+    });
+}
+
+IMLAB_BTREE_TEMPL template<auto member, typename Callback>
+void IMLAB_BTREE_CLASS::scan_field(const Key &lo, const Key &hi, Callback callback) const {
+    std::vector<Key> keys(leaf_layout == LeafLayout::Packed ? LeafNode::kCapacity : 0);
+    std::vector<member_t<member>> fields(kColumnar ? 0 : LeafNode::kCapacity);
+    scan_leaves(lo, hi, [&](const LeafNode &leaf, uint32_t begin, uint32_t end) {
+        return callback(leaf.key_data(begin, end, keys.data()),
+                        leaf.template field_data<member>(begin, end, fields.data()), end - begin);
+    });
+}
+
+IMLAB_BTREE_TEMPL template<typename Run>
+void IMLAB_BTREE_CLASS::scan_leaves(const Key &lo, const Key &hi, Run run) const {
+    if (comp(hi, lo))
+        return;
+
+    uint64_t erases = range_erases.load();
+    auto fix = optimistic_find_leaf(lo);
+    if (!fix.data())
+        return;
+
+    const auto *leaf = fix.template as<LeafNode>();
+    uint32_t begin = leaf->count > 0 ? leaf->lower_bound(lo) : 0;
+    // the last key passed to `run`, the scan continues above it when it starts over from the root
+    std::optional<Key> done;
+    for (;;) {
+        // start loading the next leaf into the cache while this one is processed
+        if (leaf->get_next()) {
+            auto next = this->fix_optimistic(*leaf->get_next());
+            if (next.valid())
+                next.template as<LeafNode>()->prefetch();
+        }
+
+        uint32_t end = leaf->count;
+        bool last = end > 0 && comp(hi, leaf->key(end - 1));
+        if (last)
+            end = leaf->upper_bound(hi);
+
+        if (begin < end && !run(*leaf, begin, end))
+            return;
+        if (begin < end)
+            done = leaf->key(end - 1);
+        if (last || !leaf->get_next())
+            return;
+
+        fix = this->fix(*leaf->get_next());
+        leaf = fix.template as<LeafNode>();
+        begin = 0;
+        if (range_erases.load() == erases)
+            continue;
+
+        // the leaf left may have been unlinked and the page reached through it reused
+        fix.unfix();
+        erases = range_erases.load();
+        if (done)
+            fix = find_leaf([&done](const InnerNode &inner) { return inner.upper_bound(*done); });
+        else
+            fix = optimistic_find_leaf(lo);
+        if (!fix.data())
+            return;
+        leaf = fix.template as<LeafNode>();
+        if (leaf->count == 0)
+            begin = 0;
+        else
+            begin = done ? leaf->upper_bound(*done) : leaf->lower_bound(lo);
+    }
+}
+
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::scan_batch(const Key &lo, const Key &hi, std::pair<Key, T> *out, uint64_t n) const {
+    uint64_t written = 0;
+    if (n == 0)
+        return written;
+
+    scan(lo, hi, [&](const Key *keys, const T *values, uint32_t count) {
+        auto take = static_cast<uint32_t>(std::min<uint64_t>(count, n - written));
+        for (uint32_t i = 0; i < take; ++i)
+            out[written + i] = {keys[i], values[i]};
+        written += take;
+        return written < n;
+    });
+
+    return written;
+}
+
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::find_batch(const Key *keys, uint64_t n, std::optional<T> *out) const {
+    for (uint64_t i = 0; i < n; ++i)
+        out[i].reset();
+
+    if (n == 0)
+        return 0;
+
+    // probe in key order, the results still go to the original positions
+    std::vector<uint64_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    auto key_less = [keys](uint64_t a, uint64_t b) { return comp(keys[a], keys[b]); };
+    if (!std::is_sorted(order.begin(), order.end(), key_less))
+        std::sort(order.begin(), order.end(), key_less);
+    const uint64_t *first = order.data(), *last = order.data() + n;
+
+    // the old root is fixed exclusively while the root changes, so its version covers the check
+    for (unsigned attempt = 0; attempt < kOptimisticAttempts; ++attempt) {
+        uint64_t id = root.load();
+        if (id == kNoRoot)
+            return 0;
+
+        auto node = this->fix_optimistic(id);
+        if (!node.valid())
+            break;
+        if (root.load() == id)
+            return find_batch_optimistic(node, keys, first, last, out);
+    }
+
+    return find_batch_locked(keys, first, last, out);
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::insert(const Key &key, const T &value) {
+    auto writes = lock_writes();
+    auto ir = insert_internal(key, insert_leaf(key));
+    if (ir)
+        ir->second = value;
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::insert(const Key &key, T &&value) {
+    auto writes = lock_writes();
+    auto ir = insert_internal(key, insert_leaf(key));
+    if (ir)
+        ir->second = value;
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::insert_or_assign(const Key &key, const T &value) {
+    auto writes = lock_writes();
+    insert_or_assign_internal(key, insert_leaf(key)).second = value;
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::insert_or_assign(const Key &key, T &&value) {
+    auto writes = lock_writes();
+    insert_or_assign_internal(key, insert_leaf(key)).second = value;
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::insert(const Key &key, const T &value, Hint &hint) {
+    auto writes = lock_writes();
+    auto ir = insert_internal(key, hint_insert_leaf(key, hint));
+    if (ir)
+        ir->second = value;
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::insert_or_assign(const Key &key, const T &value, Hint &hint) {
+    auto writes = lock_writes();
+    insert_or_assign_internal(key, hint_insert_leaf(key, hint)).second = value;
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::erase(const Key &key) {
+    auto writes = lock_writes();
+    ExclusiveFix fix;
+    if constexpr (counted)
+        fix = counted_erase_leaf(key);
+    else
+        fix = find_leaf_exclusive([&key](const InnerNode &inner) { return inner.lower_bound(key); });
+    if (!fix.data() || fix.template as<Node>()->count == 0)
+        return;
+
+    auto &leaf = *fix.template as<LeafNode>();
+    auto idx = leaf.lower_bound(key);
+    if (!leaf.is_equal(key, idx))
+        return;
+
+    leaf.erase(idx);
+    --count;
+    fix.set_dirty();
+
+    // a root leaf may run empty
+    if (underfull(leaf) && root.load() != this->page_id(fix)) {
+        fix.unfix();
+        erase_rebalance(key);
+    }
+}
+
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::erase_range(const Key &lo, const Key &hi) {
+    if (comp(hi, lo))
+        return 0;
+    // optimistic inserts could still fix a leaf that is about to be unlinked
+    auto writes = exclude_writes();
+    if (root.load() == kNoRoot)
+        return 0;
+    if (metadata_current.load())
+        invalidate_metadata();
+
+    // bumped while the root is held, readers that see the new value only reach leaves once the
+    // subtrees are unlinked
+    RangeErase range{lo, hi, {}, {}};
+    auto fix = root_fix_exclusive();
+    ++range_erases;
+    uint64_t erased = erase_range(std::move(fix), range, true, true);
+    count -= erased;
+    // hints may cover leaves that were unlinked without being fixed
+    ++structure_version;
+
+    // the nodes on both paths may have run underfull or empty
+    erase_rebalance(lo);
+    erase_rebalance(hi);
+
+    // the subtree with the smallest keys is reclaimed first
+    std::unique_lock<std::mutex> lock(free_mutex);
+    dropped.insert(dropped.end(), range.dropped.rbegin(), range.dropped.rend());
+    return erased;
+}
+
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::insert_batch(const std::pair<Key, T> *pairs, uint64_t n) {
+    auto writes = lock_writes();
+    // sorted without duplicates, the first value of a key wins like for repeated inserts
+    std::vector<std::pair<Key, T>> sorted(pairs, pairs + n);
+    std::stable_sort(sorted.begin(), sorted.end(),
+        [](const auto &a, const auto &b) { return comp(a.first, b.first); });
+    sorted.erase(std::unique(sorted.begin(), sorted.end(),
+        [](const auto &a, const auto &b) { return !comp(a.first, b.first); }), sorted.end());
+
+    uint64_t inserted = 0;
+    if constexpr (counted || leaf_layout == LeafLayout::Packed) {
+        // every insert updates the sizes on its path, packed leaves fill up depending on the keys
+        for (const auto &[key, value] : sorted) {
+            auto ir = insert_internal(key, insert_leaf(key));
+            if (ir) {
+                ir->second = value;
+                ++inserted;
+            }
+        }
+        return inserted;
+    } else {
+        const std::pair<Key, T> *first = sorted.data(), *last = sorted.data() + sorted.size();
+        while (first != last) {
+            std::optional<Key> upper;
+            auto cf = insert_batch_find_leaf(first->first, upper);
+
+            // the pairs up to the separator belong to this leaf
+            const std::pair<Key, T> *end = last;
+            if (upper) {
+                end = std::upper_bound(first, last, *upper,
+                    [](const Key &key, const auto &pair) { return comp(key, pair.first); });
+            }
+            first = insert_batch_leaf(cf, first, end, inserted);
+        }
+
+        count += inserted;
+        return inserted;
+    }
+}
+
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::rank(const Key &key) const {
+    return count_below<false>(key);
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::const_iterator IMLAB_BTREE_CLASS::select(uint64_t i) const {
+    static_assert(counted, "only counted trees know the size of subtrees");
+    uint64_t erases = range_erases.load();
+    auto fix = root_fix();
+    if (!fix.data())
+        return end();
+
+    // skip whole subtrees, a rank beyond the last child ends in the last leaf
+    while (!fix.template as<Node>()->is_leaf()) {
+        const auto &inner = *fix.template as<InnerNode>();
+        uint32_t idx = 0;
+        for (; idx < inner.count && i >= inner.child_size(idx); ++idx)
+            i -= inner.child_size(idx);
+        fix = this->fix(inner.child(idx));
+    }
+
+    const auto &leaf = *fix.template as<LeafNode>();
+    return i < leaf.count ? const_iterator(*this, std::move(fix), i, erases) : end();
+}
+
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::count_range(const Key &lo, const Key &hi) const {
+    if (comp(hi, lo))
+        return 0;
+
+    // two descents, concurrent erases in between may leave fewer keys up to `hi` than below `lo`
+    uint64_t upper = count_below<true>(hi);
+    uint64_t lower = count_below<false>(lo);
+    return upper > lower ? upper - lower : 0;
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::Snapshot IMLAB_BTREE_CLASS::snapshot() {
+    // no write is half done while the latch is held, so the root and all pages are consistent
+    auto latch = exclude_writes();
+
+    std::unique_lock<std::mutex> lock(version_mutex);
+    snapshot_epochs.insert(++epoch);
+    snapshot_pages = next_page_id;
+    ++live_snapshots;
+    return Snapshot(*this, root, epoch, count);
+}
+
+IMLAB_BTREE_TEMPL template<typename InputIt>
+void IMLAB_BTREE_CLASS::bulk_load(InputIt first, InputIt last, double fill_factor) {
+    // also rejects NaN, the node sizes below are converted from it
+    if (!(fill_factor > 0.0 && fill_factor <= 1.0))
+        throw std::invalid_argument("bulk_load fill_factor must be in (0, 1]");
+    if (root.load() != kNoRoot) {
+        for (; first != last; ++first)
+            insert(first->first, first->second);
+        return;
+    }
+    if (first == last)
+        return;
+    auto writes = lock_writes();
+
+    auto entries = [fill_factor](uint32_t capacity, uint32_t minimum) {
+        auto n = static_cast<uint32_t>(capacity * fill_factor);
+        return std::clamp(n, minimum, capacity);
+    };
+    uint32_t leaf_fill = entries(LeafNode::kSpace, 1);
+    // at least two keys, so the even distribution below never leaves an inner node without a key
+    uint32_t inner_fanout = entries(InnerNode::kCapacity, 2) + 1;
+
+    // fill the leaves in key order, each level remembers the largest key and page of its nodes
+    // and the number of keys below them for counted trees
+    std::vector<std::pair<Key, uint64_t>> level;
+    std::vector<uint64_t> sizes{0};
+    auto fix = new_leaf();
+    level.emplace_back(first->first, this->page_id(fix));
+
+    uint64_t loaded = 0;
+    for (; first != last; ++first) {
+        const Key &key = first->first;
+        if (loaded > 0) {
+            assert(!comp(key, level.back().first));
+            if (!comp(level.back().first, key))
+                continue;
+        }
+
+        if (fix.template as<LeafNode>()->used() >= leaf_fill || fix.template as<LeafNode>()->full(key)) {
+            auto next = new_leaf();
+            fix.template as<LeafNode>()->set_next(this->page_id(next));
+            fix = std::move(next);
+            level.emplace_back(key, this->page_id(fix));
+            sizes.push_back(0);
+        }
+
+        auto &leaf = *fix.template as<LeafNode>();
+        leaf.make_space(key, leaf.count) = first->second;
+        level.back().first = key;
+        ++sizes.back();
+        ++loaded;
+    }
+    fix.unfix();
+
+    // inner levels, the children are spread evenly so the last node is not underfull
+    for (uint16_t height = 1; level.size() > 1; ++height) {
+        std::vector<std::pair<Key, uint64_t>> parents;
+        std::vector<uint64_t> parent_sizes;
+        size_t nodes = (level.size() + inner_fanout - 1) / inner_fanout;
+
+        for (size_t i = 0, begin = 0; i < nodes; ++i) {
+            size_t end = level.size() * (i + 1) / nodes;
+            auto inner_fix = new_inner(height);
+            auto &inner = *inner_fix.template as<InnerNode>();
+
+            inner.init(level[begin].second);
+            for (size_t j = begin + 1; j < end; ++j)
+                inner.insert(level[j - 1].first, level[j].second);
+            if constexpr (counted) {
+                for (size_t j = begin; j < end; ++j)
+                    inner.set_child_size(j - begin, sizes[j]);
+            }
+
+            parents.emplace_back(level[end - 1].first, this->page_id(inner_fix));
+            parent_sizes.push_back(std::accumulate(sizes.begin() + begin, sizes.begin() + end, uint64_t{0}));
+            begin = end;
+        }
+
+        level.swap(parents);
+        sizes.swap(parent_sizes);
+    }
+
+    count += loaded;
+    root = level.front().second;
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::Fix IMLAB_BTREE_CLASS::root_fix() const {
+    for (;;) {
+        uint64_t id = root.load();
+        if (id == kNoRoot)
+            return {};
+
+        auto fix = this->fix(id);
+        if (root.load() == id)
+            return fix;
+    }
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::ExclusiveFix IMLAB_BTREE_CLASS::root_fix_exclusive() {
+    for (;;) {
+        uint64_t id = root.load();
+        if (id == kNoRoot) {
+            std::unique_lock<std::mutex> lock(root_mutex);
+            if (root.load() != kNoRoot)
+                continue;
+
+            auto fix = new_leaf();
+            root = this->page_id(fix);
+            return fix;
+        }
+
+        auto fix = this->fix_exclusive(id);
+        if (root.load() == id)
+            return fix;
+    }
+}
+
+IMLAB_BTREE_TEMPL template<typename ChildFn> typename IMLAB_BTREE_CLASS::Fix IMLAB_BTREE_CLASS::find_leaf(ChildFn child) const {
+    auto fix = root_fix();
+    if (!fix.data())
+        return fix;
+
+    while (!fix.template as<Node>()->is_leaf())
+        fix = this->fix(child(*fix.template as<InnerNode>()));
+
+    return fix;
+}
+
+IMLAB_BTREE_TEMPL template<typename ChildFn>
+typename IMLAB_BTREE_CLASS::ExclusiveFix IMLAB_BTREE_CLASS::find_leaf_exclusive(ChildFn child) {
+    for (;;) {
+        auto fix = root_fix();
+        if (!fix.data())
+            return {};
+
+        // a leaf root is refixed exclusively, it stays a leaf but might not be the root anymore
+        if (fix.template as<Node>()->is_leaf()) {
+            uint64_t id = this->page_id(fix);
+            fix.unfix();
+
+            auto leaf = this->fix_exclusive(id);
+            if (root.load() == id)
+                return leaf;
+            continue;
+        }
+
+        while (fix.template as<Node>()->level > 1)
+            fix = this->fix(child(*fix.template as<InnerNode>()));
+
+        return this->fix_exclusive(child(*fix.template as<InnerNode>()));
+    }
+}
+
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::find_batch_optimistic(const OptimisticFix &node, const Key *keys,
+                                                                     const uint64_t *first, const uint64_t *last,
+                                                                     std::optional<T> *out) const {
+    uint64_t found = 0;
+    if (node.template as<Node>()->is_leaf()) {
+        const auto &leaf = *node.template as<LeafNode>();
+        uint16_t n = leaf.optimistic_count();
+        if (n <= LeafNode::kCapacity) {
+            uint32_t pos = 0;
+            for (const uint64_t *it = first; it != last; ++it) {
+                const Key &key = keys[*it];
+                pos = leaf.lower_bound(key, pos, n);
+                if (pos < n && leaf.optimistic_key(pos, n) == key) {
+                    out[*it] = leaf.value(pos);
+                    ++found;
+                } else {
+                    out[*it].reset();
+                }
+            }
+            if (node.validate())
+                return found;
+        }
+
+        for (const uint64_t *it = first; it != last; ++it)
+            out[*it].reset();
+        return find_batch_locked(keys, first, last, out);
+    }
+
+    const auto &inner = *node.template as<InnerNode>();
+    while (first != last) {
+        uint16_t n = inner.optimistic_count();
+        if (n > InnerNode::kCapacity)
+            break;
+
+        const Key &key = keys[*first];
+        const Key *separators = inner.separator_data();
+        uint32_t idx = inner.child_index(key, n);
+        const uint64_t *end = last;
+        if (idx < n) {
+            end = std::upper_bound(first, last, separators[idx],
+                [keys](const Key &separator, uint64_t i) { return comp(separator, keys[i]); });
+        }
+        uint64_t page = inner.child_data()[idx];
+        if (!node.validate())
+            break;
+
+        // the child must still be referenced once its version is known
+        auto child = this->fix_optimistic(page);
+        if (!child.valid()) {
+            found += find_batch_locked(keys, first, end, out);
+        } else {
+            if (!node.validate())
+                break;
+            found += find_batch_optimistic(child, keys, first, end, out);
+        }
+        first = end;
+    }
+
+    if (first != last)
+        found += find_batch_locked(keys, first, last, out);
+    return found;
+}
+
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::find_batch_locked(const Key *keys, const uint64_t *first,
+                                                                 const uint64_t *last, std::optional<T> *out) const {
+    auto fix = root_fix();
+    if (!fix.data())
+        return 0;
+    return find_batch_node(fix, keys, first, last, out);
+}
+
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::find_batch_node(const Fix &fix, const Key *keys, const uint64_t *first,
+                                                               const uint64_t *last, std::optional<T> *out) const {
+    uint64_t found = 0;
+    if (fix.template as<Node>()->is_leaf()) {
+        // the search for each key starts at the previous match
+        const auto &leaf = *fix.template as<LeafNode>();
+        uint32_t pos = 0;
+        for (; first != last; ++first) {
+            const Key &key = keys[*first];
+            pos = leaf.lower_bound(key, pos, leaf.count);
+            if (leaf.is_equal(key, pos)) {
+                out[*first] = leaf.at(pos);
+                ++found;
+            }
+        }
+        return found;
+    }
+
+    // partition the keys by child, each child is visited once
+    const auto &inner = *fix.template as<InnerNode>();
+    while (first != last) {
+        uint32_t idx = inner.child_index(keys[*first]);
+        const uint64_t *end = last;
+        if (idx < inner.count) {
+            end = std::upper_bound(first, last, inner.separator(idx),
+                [keys](const Key &separator, uint64_t i) { return comp(separator, keys[i]); });
+        }
+
+        found += find_batch_node(this->fix(inner.child(idx)), keys, first, end, out);
+        first = end;
+    }
+    return found;
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::ExclusiveFix IMLAB_BTREE_CLASS::insert_find_leaf(const Key &key) {
+    for (;;) {
+        auto fix = find_leaf_exclusive([&key](const InnerNode &inner) { return inner.lower_bound(key); });
+        if (fix.data())
+            return fix;
+
+        // empty tree, someone else might create the root and split it before we get to it
+        fix = root_fix_exclusive();
+        if (fix.template as<Node>()->is_leaf())
+            return fix;
+    }
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::Descent IMLAB_BTREE_CLASS::optimistic_descend(
+        const Key &key, OptimisticFix &parent, OptimisticFix &leaf, Hint *hint) const {
+    uint64_t id = root.load();
+    if (id == kNoRoot)
+        return Descent::Valid;
+
+    // the old root is fixed exclusively while the root changes, so its version covers the check
+    auto node = this->fix_optimistic(id);
+    if (!node.valid())
+        return Descent::Unavailable;
+    if (root.load() != id)
+        return Descent::Conflict;
+
+    while (node.template as<Node>()->level != 0) {
+        const auto &inner = *node.template as<InnerNode>();
+        uint64_t child = inner.optimistic_lower_bound(key);
+        if (hint) {
+            uint16_t n = inner.optimistic_count();
+            if (n <= InnerNode::kCapacity)
+                hint->narrow(inner, inner.child_index(key, n), n);
+        }
+        if (!node.validate())
+            return Descent::Conflict;
+
+        auto next = this->fix_optimistic(child);
+        if (!next.valid())
+            return Descent::Unavailable;
+        // the child must still be referenced once its version is known
+        if (!node.validate())
+            return Descent::Conflict;
+
+        parent = node;
+        node = next;
+    }
+
+    leaf = node;
+    return Descent::Valid;
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::Fix IMLAB_BTREE_CLASS::optimistic_find_leaf(const Key &key) const {
+    for (unsigned attempt = 0; attempt < kOptimisticAttempts; ++attempt) {
+        OptimisticFix parent, leaf;
+        auto descent = optimistic_descend(key, parent, leaf);
+        if (descent == Descent::Conflict)
+            continue;
+        if (descent == Descent::Unavailable || !leaf.valid())
+            break;
+
+        auto fix = this->fix(leaf);
+        if (fix.data())
+            return fix;
+    }
+
+    return find_leaf([&key](const InnerNode &inner) { return inner.lower_bound(key); });
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::ExclusiveFix IMLAB_BTREE_CLASS::optimistic_insert_leaf(const Key &key) {
+    auto can_insert = [&key](const LeafNode &leaf) {
+        return !leaf.full(key) || leaf.is_equal(key, leaf.lower_bound(key));
+    };
+
+    for (unsigned attempt = 0; attempt < kOptimisticAttempts; ++attempt) {
+        OptimisticFix parent, leaf;
+        auto descent = optimistic_descend(key, parent, leaf);
+        if (descent == Descent::Conflict)
+            continue;
+        if (descent == Descent::Unavailable || !leaf.valid())
+            break;
+
+        auto fix = this->fix_exclusive(leaf);
+        if (!fix.data())
+            continue;
+        if (can_insert(*fix.template as<LeafNode>()))
+            return fix;
+        fix.unfix();
+
+        // latch top down, a root leaf or a full parent needs the pessimistic split
+        if (!parent.valid())
+            break;
+        auto parent_fix = this->fix_exclusive(parent);
+        if (!parent_fix.data())
+            continue;
+        if (parent_fix.template as<InnerNode>()->full())
+            break;
+
+        // the parent did not change, so the leaf still covers the key and cannot split anymore
+        fix = this->fix_exclusive(this->page_id(leaf));
+        if (!can_insert(*fix.template as<LeafNode>()))
+            split(parent_fix, fix, key);
+        return fix;
+    }
+
+    auto fix = insert_find_leaf(key);
+    if (can_insert(*fix.template as<LeafNode>()))
+        return fix;
+
+    fix.unfix();
+    return std::move(insert_lc_early_split(key).fix);
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::ExclusiveFix IMLAB_BTREE_CLASS::new_leaf() {
+    auto fix = allocate_page();
+    new (fix.data()) LeafNode();
+    fix.set_dirty();
+    ++leaf_count;
+
+    return fix;
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::ExclusiveFix IMLAB_BTREE_CLASS::new_inner(uint16_t level) {
+    auto fix = allocate_page();
+    new (fix.data()) InnerNode(level);
+    fix.set_dirty();
+
+    return fix;
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::ExclusiveFix IMLAB_BTREE_CLASS::allocate_page() {
+    // new pages are only needed by splits, which hold the node being split exclusively
+    ++structure_version;
+    {
+        std::unique_lock<std::mutex> lock(free_mutex);
+        if (free_list != kMetadataPage) {
+            auto fix = this->fix_exclusive(free_list);
+            free_list = *fix.template as<uint64_t>();
+            return fix;
+        }
+    }
+    if (auto fix = reclaim_dropped(); fix.data())
+        return fix;
+
+    return this->fix_exclusive(next_page_id++);
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::ExclusiveFix IMLAB_BTREE_CLASS::reclaim_dropped() {
+    // readers that were inside a subtree when it was dropped may still hold its pages and wait for
+    // a page the caller holds, so fixed pages are skipped. Children are only exposed once their
+    // parent is reclaimed, so readers that move down never reach a reused page.
+    std::vector<uint64_t> busy;
+    ExclusiveFix fix;
+    std::unique_lock<std::mutex> lock(free_mutex);
+    while (!fix.data() && !dropped.empty()) {
+        uint64_t page = dropped.back();
+        dropped.pop_back();
+        lock.unlock();
+        try {
+            fix = try_fix_exclusive(page);
+        } catch (...) {
+            lock.lock();
+            busy.push_back(page);
+            dropped.insert(dropped.end(), busy.rbegin(), busy.rend());
+            throw;
+        }
+        lock.lock();
+        if (!fix.data())
+            busy.push_back(page);
+    }
+
+    if (fix.data()) {
+        const auto &node = *fix.template as<Node>();
+        if (node.is_leaf()) {
+            --leaf_count;
+        } else {
+            const auto &inner = *fix.template as<InnerNode>();
+            for (uint32_t i = inner.count + 1; i > 0; --i)
+                dropped.push_back(inner.child(i - 1));
+        }
+    }
+    dropped.insert(dropped.end(), busy.rbegin(), busy.rend());
+    return fix;
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::free_page(ExclusiveFix &fix) {
+    ++structure_version;
+    if (fix.template as<Node>()->is_leaf())
+        --leaf_count;
+    uint64_t page = this->page_id(fix);
+    rightmost.compare_exchange_strong(page, kNoRoot);
+
+    // unfixed under the lock, so allocations never wait for the page
+    std::unique_lock<std::mutex> lock(free_mutex);
+    *fix.template as<uint64_t>() = free_list;
+    fix.set_dirty();
+    free_list = this->page_id(fix);
+    fix.unfix();
+}
+
+IMLAB_BTREE_TEMPL uint32_t IMLAB_BTREE_CLASS::low_water(uint32_t capacity) const {
+    return static_cast<uint32_t>(capacity * low_water_mark.load());
+}
+
+IMLAB_BTREE_TEMPL bool IMLAB_BTREE_CLASS::underfull(const Node &node) const {
+    if (node.is_leaf())
+        return static_cast<const LeafNode &>(node).used() <= low_water(LeafNode::kSpace);
+    return node.count <= low_water(InnerNode::kCapacity);
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::ExclusiveFix IMLAB_BTREE_CLASS::append_leaf(const Key &key) {
+    uint64_t id = rightmost.load();
+    if (id == kNoRoot)
+        return {};
+
+    // cheap check without fixing, random keys rarely pass it
+    auto leaf = this->fix_optimistic(id);
+    if (!leaf.valid())
+        return {};
+    const auto &node = *leaf.template as<LeafNode>();
+    uint16_t n = node.optimistic_count();
+    bool append = node.is_leaf() && n > 0 && n < LeafNode::kCapacity && !node.get_next()
+        && comp(node.optimistic_key(n - 1, n), key);
+    if (!append || !leaf.validate())
+        return {};
+
+    // the fix fails if the leaf changed since the check
+    // a packed leaf may still need wider distances for the key
+    auto fix = this->fix_exclusive(leaf);
+    if (!fix.data() || rightmost.load() != id || fix.template as<LeafNode>()->full(key))
+        return {};
+    return fix;
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::ExclusiveFix IMLAB_BTREE_CLASS::insert_leaf(const Key &key) {
+    if constexpr (counted)
+        return counted_insert_leaf(key);
+
+    auto fix = append_leaf(key);
+    if (fix.data())
+        return fix;
+
+    fix = optimistic_insert_leaf(key);
+    uint64_t id = this->page_id(fix);
+    if (!fix.template as<LeafNode>()->get_next() && rightmost.load() != id)
+        rightmost = id;
+    return fix;
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::OptimisticFix IMLAB_BTREE_CLASS::hint_leaf(const Key &key, Hint &hint) const {
+    if (hint.page == kNoRoot)
+        return {};
+    // the structure version is read after the page version, so any change of the leaf before its
+    // fix is seen, later ones fail the validation
+    auto leaf = this->fix_optimistic(hint.page);
+    if (!leaf.valid() || hint.version != structure_version.load())
+        return {};
+    if (hint.covers(key))
+        return leaf;
+    if (!hint.hi || !comp(*hint.hi, key))
+        return {};
+
+    const auto &next_ref = leaf.template as<LeafNode>()->get_next();
+    bool has_next = next_ref.has_value();
+    uint64_t page = next_ref;
+    if (!leaf.validate() || !has_next)
+        return {};
+    auto next = this->fix_optimistic(page);
+    // the leaf must still link to the neighbour once its version is known
+    if (!next.valid() || !leaf.validate() || hint.version != structure_version.load())
+        return {};
+
+    // the neighbour covers the keys above the separator of the leaf, without the separator only the
+    // keys from its first key on are known to belong to it
+    const auto &node = *next.template as<LeafNode>();
+    uint32_t n = node.optimistic_count();
+    bool last = !node.get_next().has_value();
+    Key first = node.optimistic_key(0, n), back = node.optimistic_key(n - 1, n);
+    if (!next.validate())
+        return {};
+    bool above = hint.hi_separator || (n > 0 && !comp(key, first));
+    bool below = last || (n > 0 && !comp(back, key));
+    if (!above || !below)
+        return {};
+
+    hint.lo = hint.hi_separator ? *hint.hi : first;
+    hint.lo_separator = hint.hi_separator;
+    hint.hi = last ? std::nullopt : std::optional<Key>(back);
+    hint.hi_separator = false;
+    hint.page = page;
+    return next;
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::Descent IMLAB_BTREE_CLASS::hint_descend(const Key &key, Hint &hint,
+                                                                                      OptimisticFix &leaf) const {
+    leaf = hint_leaf(key, hint);
+    if (leaf.valid())
+        return Descent::Valid;
+
+    // read before the descent, so changes during it invalidate the new hint
+    hint = Hint();
+    uint64_t version = structure_version.load();
+    OptimisticFix parent;
+    auto descent = optimistic_descend(key, parent, leaf, &hint);
+    if (descent == Descent::Valid && leaf.valid()) {
+        hint.page = this->page_id(leaf);
+        hint.version = version;
+    }
+    return descent;
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::ExclusiveFix IMLAB_BTREE_CLASS::hint_insert_leaf(const Key &key, Hint &hint) {
+    // counted trees update the sizes on the whole path anyway
+    if constexpr (counted)
+        return counted_insert_leaf(key);
+
+    for (unsigned attempt = 0; attempt < kOptimisticAttempts; ++attempt) {
+        OptimisticFix leaf;
+        auto descent = hint_descend(key, hint, leaf);
+        if (descent == Descent::Conflict)
+            continue;
+        if (descent == Descent::Unavailable || !leaf.valid())
+            break;
+
+        auto fix = fix_exclusive(leaf);
+        if (!fix.data())
+            continue;
+        if (!fix.template as<LeafNode>()->full(key))
+            return fix;
+        break;
+    }
+
+    // the leaf has to be split or the tree is still empty
+    hint.page = kNoRoot;
+    return insert_leaf(key);
+}
+
+IMLAB_BTREE_TEMPL std::optional<typename IMLAB_BTREE_CLASS::InsertResult> IMLAB_BTREE_CLASS::insert_internal(const Key &key,
+                                                                                                            ExclusiveFix fix) {
+    // only the leaf is fixed exclusively, unless it has to be split
+    auto *leaf = fix.template as<LeafNode>();
+    uint32_t idx = leaf->count > 0 ? leaf->lower_bound(key) : 0;
+
+    // check for key
+    if (leaf->is_equal(key, idx))
+        return {};
+
+    ++count;
+    fix.set_dirty();
+    return {{std::move(fix), leaf->make_space(key, idx)}};
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::InsertResult IMLAB_BTREE_CLASS::insert_or_assign_internal(const Key &key,
+                                                                                                  ExclusiveFix fix) {
+    auto *leaf = fix.template as<LeafNode>();
+    uint32_t idx = leaf->count > 0 ? leaf->lower_bound(key) : 0;
+
+    fix.set_dirty();
+    if (leaf->is_equal(key, idx))
+        return {std::move(fix), leaf->at(idx)};
+
+    ++count;
+    return {std::move(fix), leaf->make_space(key, idx)};
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::split(ExclusiveFix &parent, ExclusiveFix &child, const Key &key) {
+    bool new_root = !parent.data();
+    if (new_root)
+        parent = new_inner(child.template as<Node>()->level + 1);
+    assert(!parent.template as<Node>()->is_leaf());
+
+    auto &pnode = *parent.template as<InnerNode>();
+
+    Key split_key;
+    ExclusiveFix split = child.template as<Node>()->is_leaf() ? new_leaf() : new_inner(child.template as<Node>()->level);
+    uint64_t split_page = this->page_id(split);
+    if (child.template as<Node>()->is_leaf()) {
+        auto &cnode = *child.template as<LeafNode>();
+        // appends to the rightmost leaf leave little space behind, the next appends go to the new leaf
+        uint32_t keep = cnode.count - cnode.count / 2;
+        if (!cnode.get_next() && comp(cnode.key(cnode.count - 1), key))
+            keep = std::clamp<uint32_t>(cnode.count * kAppendSplit, 1, cnode.count - 1);
+        split_key = cnode.split(*split.template as<LeafNode>(), split_page, keep);
+    } else {
+        auto &cnode = *child.template as<InnerNode>();
+        split_key = cnode.split(*split.template as<InnerNode>());
+    }
+
+    parent.set_dirty();
+    child.set_dirty();
+    split.set_dirty();
+
+    if (pnode.count == 0)
+        pnode.init(this->page_id(child));
+    pnode.insert(split_key, split_page);
+    if constexpr (counted) {
+        uint32_t idx = pnode.child_index(split_key);
+        pnode.set_child_size(idx, subtree_size(*child.template as<Node>()));
+        pnode.set_child_size(idx + 1, subtree_size(*split.template as<Node>()));
+    }
+    // readers validate the root after fixing it, the old root is still fixed here
+    if (new_root)
+        root = this->page_id(parent);
+    if (!comp(key, split_key))
+        child = std::move(split);
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::CoupledFixes IMLAB_BTREE_CLASS::insert_lc_early_split(const Key &key) {
+    CoupledFixes cf = { root_fix_exclusive() };
+
+    while (!cf.fix.template as<Node>()->is_leaf()) {
+        auto &inner = *cf.fix.template as<InnerNode>();
+        if (inner.full())
+            split(cf.prev, cf.fix, key);
+
+        cf.advance(this->fix_exclusive(cf.fix.template as<InnerNode>()->lower_bound(key)));
+    }
+
+    if (cf.fix.template as<LeafNode>()->full(key))
+        split(cf.prev, cf.fix, key);
+
+    return cf;
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::CoupledFixes IMLAB_BTREE_CLASS::insert_batch_find_leaf(
+        const Key &key, std::optional<Key> &upper) {
+    CoupledFixes cf = { root_fix_exclusive() };
+    upper.reset();
+
+    // separators further down are always tighter bounds
+    while (!cf.fix.template as<Node>()->is_leaf()) {
+        if (cf.fix.template as<InnerNode>()->full()) {
+            split(cf.prev, cf.fix, key);
+            const auto &parent = *cf.prev.template as<InnerNode>();
+            uint32_t idx = parent.child_index(key);
+            if (idx < parent.count)
+                upper = parent.separator(idx);
+        }
+
+        const auto &inner = *cf.fix.template as<InnerNode>();
+        uint32_t idx = inner.child_index(key);
+        if (idx < inner.count)
+            upper = inner.separator(idx);
+        cf.advance(this->fix_exclusive(inner.child(idx)));
+    }
+
+    return cf;
+}
+
+IMLAB_BTREE_TEMPL const std::pair<Key, T> *IMLAB_BTREE_CLASS::insert_batch_leaf(
+        CoupledFixes &cf, const std::pair<Key, T> *first, const std::pair<Key, T> *last, uint64_t &inserted) {
+    auto &leaf = *cf.fix.template as<LeafNode>();
+
+    // every leaf beyond the first one takes a slot in the parent, a root leaf gets a new root
+    uint32_t slots = InnerNode::kCapacity;
+    if (cf.prev.data())
+        slots -= cf.prev.template as<InnerNode>()->count;
+    uint64_t room = uint64_t{slots + 1} * LeafNode::kCapacity - leaf.count;
+    if (static_cast<uint64_t>(last - first) > room)
+        last = first + room;
+
+    // single merge pass, keys already in the leaf keep their value
+    std::vector<std::pair<Key, T>> merged;
+    merged.reserve(leaf.count + (last - first));
+    uint32_t i = 0;
+    for (const std::pair<Key, T> *pair = first; i < leaf.count || pair != last;) {
+        if (pair == last || (i < leaf.count && !comp(pair->first, leaf.key_data()[i]))) {
+            if (pair != last && !comp(leaf.key_data()[i], pair->first))
+                ++pair;
+            merged.emplace_back(leaf.key_data()[i], leaf.value(i));
+            ++i;
+        } else {
+            merged.push_back(*pair++);
+        }
+    }
+    inserted += merged.size() - leaf.count;
+
+    // spread the pairs evenly over as few leaves as possible
+    uint64_t leaves = (merged.size() + LeafNode::kCapacity - 1) / LeafNode::kCapacity;
+    if (leaves > 1 && !cf.prev.data()) {
+        // readers wait for the new root until all leaves are linked
+        cf.prev = new_inner(1);
+        cf.prev.template as<InnerNode>()->init(this->page_id(cf.fix));
+        root = this->page_id(cf.prev);
+    }
+
+    auto next = leaf.get_next();
+    ExclusiveFix current = std::move(cf.fix);
+    for (uint64_t j = 0; j < leaves; ++j) {
+        size_t begin = merged.size() * j / leaves;
+        size_t end = merged.size() * (j + 1) / leaves;
+        if (j > 0) {
+            auto fix = new_leaf();
+            cf.prev.template as<InnerNode>()->insert(merged[begin - 1].first, this->page_id(fix));
+            current.template as<LeafNode>()->set_next(this->page_id(fix));
+            current = std::move(fix);
+        }
+
+        auto &node = *current.template as<LeafNode>();
+        node.count = 0;
+        for (size_t k = begin; k < end; ++k)
+            node.make_space(merged[k].first, node.count) = merged[k].second;
+        current.set_dirty();
+    }
+
+    if (leaves > 1) {
+        if (next)
+            current.template as<LeafNode>()->set_next(*next);
+        cf.prev.set_dirty();
+    }
+    return last;
+}
+
+IMLAB_BTREE_TEMPL std::vector<typename IMLAB_BTREE_CLASS::ExclusiveFix> IMLAB_BTREE_CLASS::lock_path(const Key &key) {
+    std::vector<ExclusiveFix> path;
+    path.push_back(root_fix_exclusive());
+    while (!path.back().template as<Node>()->is_leaf())
+        path.push_back(this->fix_exclusive(path.back().template as<InnerNode>()->lower_bound(key)));
+    return path;
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::resize_path(std::vector<ExclusiveFix> &path, const Key &key, int64_t delta) {
+    for (size_t i = 0; i + 1 < path.size(); ++i) {
+        auto &inner = *path[i].template as<InnerNode>();
+        uint32_t idx = inner.child_index(key);
+        inner.set_child_size(idx, inner.child_size(idx) + delta);
+        path[i].set_dirty();
+    }
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::ExclusiveFix IMLAB_BTREE_CLASS::counted_insert_leaf(const Key &key) {
+    auto path = lock_path(key);
+    const auto &leaf = *path.back().template as<LeafNode>();
+    if (leaf.count > 0 && leaf.is_equal(key, leaf.lower_bound(key)))
+        return std::move(path.back());
+
+    if (leaf.full(key)) {
+        // split top down from below the lowest ancestor with space, a full root gets a new root
+        size_t top = path.size() - 1;
+        while (top > 0 && path[top - 1].template as<InnerNode>()->full())
+            --top;
+        if (top == 0) {
+            path.emplace(path.begin());
+            ++top;
+        }
+        for (size_t i = top; i < path.size(); ++i)
+            split(path[i - 1], path[i], key);
+        if (!path.front().data())
+            path.erase(path.begin());
+    }
+
+    // the splits took the sizes from the nodes, the key is inserted right after
+    resize_path(path, key, 1);
+    return std::move(path.back());
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::ExclusiveFix IMLAB_BTREE_CLASS::counted_erase_leaf(const Key &key) {
+    if (root.load() == kNoRoot)
+        return {};
+
+    auto path = lock_path(key);
+    const auto &leaf = *path.back().template as<LeafNode>();
+    if (leaf.count > 0 && leaf.is_equal(key, leaf.lower_bound(key)))
+        resize_path(path, key, -1);
+    return std::move(path.back());
+}
+
+IMLAB_BTREE_TEMPL template<bool or_equal> uint64_t IMLAB_BTREE_CLASS::count_below(const Key &key) const {
+    static_assert(counted, "only counted trees know the size of subtrees");
+    auto fix = root_fix();
+    if (!fix.data())
+        return 0;
+
+    // all children left of the path hold smaller keys, child i holds the keys up to separator i
+    uint64_t result = 0;
+    while (!fix.template as<Node>()->is_leaf()) {
+        const auto &inner = *fix.template as<InnerNode>();
+        uint32_t idx = inner.child_index(key);
+        for (uint32_t i = 0; i < idx; ++i)
+            result += inner.child_size(i);
+        fix = this->fix(inner.child(idx));
+    }
+
+    const auto &leaf = *fix.template as<LeafNode>();
+    if (leaf.count > 0)
+        result += or_equal ? leaf.upper_bound(key) : leaf.lower_bound(key);
+    return result;
+}
+
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::subtree_size(const Node &node) {
+    if (node.is_leaf())
+        return node.count;
+
+    const auto &inner = static_cast<const InnerNode &>(node);
+    uint64_t size = 0;
+    for (uint32_t i = 0; i <= inner.count; ++i)
+        size += inner.child_size(i);
+    return size;
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::erase_rebalance(const Key &key) {
+    CoupledFixes cf = { root_fix_exclusive() };
+
+    while (!cf.fix.template as<Node>()->is_leaf()) {
+        cf.advance(this->fix_exclusive(cf.fix.template as<InnerNode>()->lower_bound(key)));
+        if (!underfull(*cf.fix.template as<Node>()))
+            continue;
+
+        rebalance(cf.prev, cf.fix, key);
+        // an inner root with a single child is replaced by it, readers validate the root after fixing it
+        if (cf.prev.template as<Node>()->count == 0 && root.load() == this->page_id(cf.prev)) {
+            root = this->page_id(cf.fix);
+            free_page(cf.prev);
+        }
+    }
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::rebalance(ExclusiveFix &parent, ExclusiveFix &child, const Key &key) {
+    auto &pnode = *parent.template as<InnerNode>();
+    uint32_t idx = pnode.child_index(key);
+    assert(pnode.child(idx) == this->page_id(child));
+    if (pnode.count == 0)
+        return;
+
+    // siblings are fixed from left to right like iterators do, splits of both need the parent
+    ExclusiveFix left, right;
+    if (idx < pnode.count) {
+        left = std::move(child);
+        right = this->fix_exclusive(pnode.child(idx + 1));
+    } else {
+        uint64_t page = this->page_id(child);
+        child.unfix();
+        --idx;
+        left = this->fix_exclusive(pnode.child(idx));
+        right = this->fix_exclusive(page);
+    }
+
+    parent.set_dirty();
+    left.set_dirty();
+    right.set_dirty();
+
+    bool leaf = left.template as<Node>()->is_leaf();
+    uint32_t capacity = leaf ? LeafNode::kSpace : InnerNode::kCapacity;
+    // an inner merge pulls the separator down
+    uint32_t entries = leaf
+        ? left.template as<LeafNode>()->merged_used(*right.template as<LeafNode>())
+        : left.template as<Node>()->count + right.template as<Node>()->count + 1;
+
+    // merge only if the low-water mark stays free, otherwise the next inserts split again
+    if (entries + low_water(capacity) <= capacity) {
+        if (leaf)
+            left.template as<LeafNode>()->merge(*right.template as<LeafNode>());
         else
-            fix.unfix();
+            left.template as<InnerNode>()->merge(*right.template as<InnerNode>(), pnode.separator(idx));
+        if constexpr (counted)
+            pnode.set_child_size(idx, pnode.child_size(idx) + pnode.child_size(idx + 1));
+        pnode.erase(idx);
+        free_page(right);
+        child = std::move(left);
+        return;
+    }
 
-        i = 0;
+    ++structure_version;
+    Key separator = leaf
+        ? left.template as<LeafNode>()->balance(*right.template as<LeafNode>())
+        : left.template as<InnerNode>()->balance(*right.template as<InnerNode>(), pnode.separator(idx));
+    pnode.set_separator(idx, separator);
+    if constexpr (counted) {
+        pnode.set_child_size(idx, subtree_size(*left.template as<Node>()));
+        pnode.set_child_size(idx + 1, subtree_size(*right.template as<Node>()));
+    }
+    child = comp(separator, key) ? std::move(right) : std::move(left);
+}
+
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::erase_range(ExclusiveFix fix, RangeErase &range, bool lo_bounded,
+                                                          bool hi_bounded) {
+    fix.set_dirty();
+    if (fix.template as<Node>()->is_leaf()) {
+        auto &leaf = *fix.template as<LeafNode>();
+        uint32_t n = leaf.count;
+        uint32_t from = lo_bounded && n > 0 ? leaf.lower_bound(range.lo) : 0;
+        uint32_t to = hi_bounded && n > 0 ? leaf.upper_bound(range.hi) : n;
+        leaf.erase(from, to);
+
+        // the leaves in between are unlinked, the next pointer skips them
+        if (!hi_bounded) {
+            range.left = std::move(fix);
+        } else if (!lo_bounded) {
+            range.left.template as<LeafNode>()->set_next(this->page_id(fix));
+            range.left.unfix();
+        }
+        return to - from;
+    }
+
+    auto &inner = *fix.template as<InnerNode>();
+    // children `first` and `last` hold the bounds, all in between lie within the range
+    uint32_t first = lo_bounded ? inner.child_index(range.lo) : 0;
+    uint32_t last = hi_bounded ? inner.child_index(range.hi) : inner.count;
+    bool split = !lo_bounded || !hi_bounded || first != last;
+
+    uint64_t erased = 0;
+    auto erase_child = [&](uint32_t idx, bool child_lo, bool child_hi) {
+        uint64_t n = erase_range(this->fix_exclusive(inner.child(idx)), range, child_lo, child_hi);
+        if constexpr (counted)
+            inner.set_child_size(idx, inner.child_size(idx) - n);
+        erased += n;
+    };
+    if (lo_bounded)
+        erase_child(first, true, !split);
+
+    // only the root of a covered subtree is unlinked, its pages are reused later
+    uint32_t drop_from = first + lo_bounded;
+    uint32_t drop_to = last + !hi_bounded;
+    for (uint32_t i = drop_from; i < drop_to; ++i) {
+        erased += child_keys(inner, i);
+        range.dropped.push_back(inner.child(i));
     }
 
+    if (hi_bounded && split)
+        erase_child(last, false, true);
+    if (drop_from < drop_to)
+        inner.erase_children(drop_from, drop_to);
+    return erased;
+}
+
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::child_keys(const InnerNode &inner, uint32_t idx) const {
+    if constexpr (counted) {
+        return inner.child_size(idx);
+    } else {
+        // only the node headers are read
+        auto fix = this->fix(inner.child(idx));
+        const auto &node = *fix.template as<Node>();
+        if (node.is_leaf())
+            return node.count;
+        uint64_t keys = 0;
+        for (uint32_t i = 0; i <= node.count; ++i)
+            keys += child_keys(static_cast<const InnerNode &>(node), i);
+        return keys;
+    }
+}
+
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::size() const {
+    return count;
+}
+
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::capacity() const {
+    return leaf_count * LeafNode::kMinCapacity;
+}
+
+IMLAB_BTREE_TEMPL uint16_t IMLAB_BTREE_CLASS::depth() const {
+    auto fix = root_fix();
+    if (fix.data())
+        return fix.template as<Node>()->level;
+    return 0;
+}
+
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::page_count() const {
+    return next_page_id;
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::set_low_water_mark(double fill_factor) {
+    low_water_mark = std::clamp(fill_factor, 0.0, kMaxLowWaterMark);
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::checkpoint() {
+    {
+        auto writes = exclude_writes();
+        write_metadata();
+    }
+    this->commit();
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::spill(uint16_t segment_id, BufferManager<page_size> &manager) {
+    write_metadata();
+    Storage<page_size>::spill(segment_id, manager);
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::write_metadata() {
+    auto fix = this->fix_exclusive(kMetadataPage);
+    auto &meta = *fix.template as<Metadata>();
+    meta.magic = Metadata::kMagic;
+    meta.page_bytes = page_size;
+    meta.key_size = sizeof(Key);
+    meta.value_size = sizeof(T);
+    meta.checkpointed = true;
+
+    meta.root = root;
+    meta.has_root = root != kNoRoot;
+    meta.count = count;
+    meta.leaf_count = leaf_count;
+    meta.inner_layout = static_cast<uint32_t>(layout);
+    meta.counted_sizes = counted;
+    meta.leaf_format = static_cast<uint32_t>(leaf_layout);
+    std::vector<uint64_t> roots;
+    {
+        std::unique_lock<std::mutex> lock(free_mutex);
+        meta.free_list = free_list;
+        roots = dropped;
+    }
+    meta.dropped_count = std::min<size_t>(roots.size(), Metadata::kMaxDropped);
+    std::copy(roots.begin(), roots.begin() + meta.dropped_count, meta.dropped);
+
+    // the remaining roots are chained through pages of their own, all pages of the chain stay in it
+    // so none of them is lost on a reopen
+    size_t rest = roots.size() - meta.dropped_count;
+    while (dropped_pages.size() * DroppedRoots::kCapacity < rest)
+        dropped_pages.push_back(next_page_id++);
+    meta.dropped_pages = dropped_pages.empty() ? kMetadataPage : dropped_pages.front();
+    auto from = roots.begin() + meta.dropped_count;
+    for (size_t i = 0; i < dropped_pages.size(); ++i) {
+        auto chain = this->fix_exclusive(dropped_pages[i]);
+        auto &page = *chain.template as<DroppedRoots>();
+        page.next = i + 1 < dropped_pages.size() ? dropped_pages[i + 1] : kMetadataPage;
+        page.count = std::min<size_t>(roots.end() - from, DroppedRoots::kCapacity);
+        std::copy(from, from + page.count, page.roots);
+        from += page.count;
+        chain.set_dirty();
+    }
+    meta.next_page_id = next_page_id;
+    fix.set_dirty();
+    metadata_current = !this->is_temporary();
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::invalidate_metadata() {
+    std::unique_lock<std::mutex> lock(metadata_mutex);
+    if (!metadata_current.load())
+        return;
+    // the log record precedes those of the write, so a replay never gets its nodes without it
+    auto fix = this->fix_exclusive(kMetadataPage);
+    fix.template as<Metadata>()->checkpointed = false;
+    fix.set_dirty();
+    fix.unfix();
+    metadata_current = false;
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::ExclusiveFix IMLAB_BTREE_CLASS::fix_exclusive(uint64_t page_id) {
+    auto fix = Storage<page_size>::fix_exclusive(page_id);
+    preserve(fix);
+    return fix;
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::ExclusiveFix IMLAB_BTREE_CLASS::fix_exclusive(const OptimisticFix &page) {
+    auto fix = Storage<page_size>::fix_exclusive(page);
+    if (fix.data())
+        preserve(fix);
+    return fix;
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::ExclusiveFix IMLAB_BTREE_CLASS::try_fix_exclusive(uint64_t page_id) {
+    auto fix = Storage<page_size>::try_fix_exclusive(page_id);
+    if (fix.data())
+        preserve(fix);
+    return fix;
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::preserve(ExclusiveFix &fix) {
+    if (live_snapshots.load() == 0)
+        return;
+
+    uint64_t page = this->page_id(fix);
+    std::unique_lock<std::mutex> lock(version_mutex);
+    if (snapshot_epochs.empty() || page == kMetadataPage || page >= snapshot_pages)
+        return;
+
+    // one copy per page and epoch, later changes in the same epoch are seen by no snapshot
+    auto &images = versions[page];
+    if (!images.empty() && images.rbegin()->first == epoch)
+        return;
+    auto image = std::make_unique<PageImage>();
+    std::memcpy(image->data, fix.data(), page_size);
+    images.emplace(epoch, std::move(image));
+}
+
+IMLAB_BTREE_TEMPL std::shared_lock<std::shared_mutex> IMLAB_BTREE_CLASS::lock_writes() {
+    while (snapshot_pending.load())
+        std::this_thread::yield();
+    std::shared_lock<std::shared_mutex> latch(snapshot_latch);
+    if (metadata_current.load())
+        invalidate_metadata();
+    return latch;
+}
+
+IMLAB_BTREE_TEMPL std::unique_lock<std::shared_mutex> IMLAB_BTREE_CLASS::exclude_writes() {
+    snapshot_pending = true;
+    std::unique_lock<std::shared_mutex> latch(snapshot_latch);
+    snapshot_pending = false;
+    return latch;
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::release_snapshot(uint64_t snapshot_epoch) {
+    std::unique_lock<std::mutex> lock(version_mutex);
+    snapshot_epochs.erase(snapshot_epoch);
+    --live_snapshots;
+    if (snapshot_epochs.empty()) {
+        versions.clear();
+        return;
+    }
+
+    // a copy is read by the snapshots taken after the previous copy of the page up to its epoch
+    // new snapshots only read copies made after them
+    for (auto it = versions.begin(); it != versions.end();) {
+        auto &images = it->second;
+        uint64_t previous = 0;
+        for (auto image = images.begin(); image != images.end();) {
+            auto reader = snapshot_epochs.upper_bound(previous);
+            previous = image->first;
+            if (reader != snapshot_epochs.end() && *reader <= image->first)
+                ++image;
+            else
+                image = images.erase(image);
+        }
+        it = images.empty() ? versions.erase(it) : std::next(it);
+    }
+}
+// ---------------------------------------------------------------------------------------------------
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::iterator &IMLAB_BTREE_CLASS::iterator::operator++() {
+    const auto *leaf = fix.template as<LeafNode>();
+    if (++i < leaf->count)
+        return *this;
+
+    // after a range erase the leaf may be unlinked, the next one is found from the root then
+    Key last = leaf->key(leaf->count - 1);
+    do {
+        i = 0;
+        if (!leaf->get_next()) {
+            fix.unfix();
+            break;
+        }
+        fix = tree.fix_exclusive(*leaf->get_next());
+        if (tree.range_erases.load() != erases) {
+            fix.unfix();
+            erases = tree.range_erases.load();
+            fix = tree.find_leaf_exclusive([&last](const InnerNode &inner) { return inner.upper_bound(last); });
+            if (!fix.data())
+                break;
+            leaf = fix.template as<LeafNode>();
+            i = leaf->count > 0 ? leaf->upper_bound(last) : 0;
+        }
+        leaf = fix.template as<LeafNode>();
+    } while (i >= leaf->count);
+
     return *this;
 }
 
@@ -488,14 +2567,188 @@ IMLAB_BTREE_TEMPL bool IMLAB_BTREE_CLASS::iterator::operator!=(const iterator &o
 }
 
 IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::reference IMLAB_BTREE_CLASS::iterator::operator*() {
+    tree.preserve(fix);
+    fix.set_dirty();
     return fix.template as<LeafNode>()->at(i);
 }
 
 IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::pointer IMLAB_BTREE_CLASS::iterator::operator->() {
+    static_assert(!kColumnar, "columnar leaves have no value objects, use field");
+    tree.preserve(fix);
+    fix.set_dirty();
+    return &fix.template as<LeafNode>()->at(i);
+}
+
+IMLAB_BTREE_TEMPL template<auto member> member_t<member> &IMLAB_BTREE_CLASS::iterator::field() {
+    tree.preserve(fix);
+    fix.set_dirty();
+    return fix.template as<LeafNode>()->template field<member>(i);
+}
+// ---------------------------------------------------------------------------------------------------
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::const_iterator &IMLAB_BTREE_CLASS::const_iterator::operator++() {
+    const auto *leaf = fix.template as<LeafNode>();
+    if (++i < leaf->count)
+        return *this;
+
+    // after a range erase the leaf may be unlinked, the next one is found from the root then
+    Key last = leaf->key(leaf->count - 1);
+    do {
+        i = 0;
+        if (!leaf->get_next()) {
+            fix.unfix();
+            break;
+        }
+        fix = tree.fix(*leaf->get_next());
+        if (tree.range_erases.load() != erases) {
+            fix.unfix();
+            erases = tree.range_erases.load();
+            fix = tree.find_leaf([&last](const InnerNode &inner) { return inner.upper_bound(last); });
+            if (!fix.data())
+                break;
+            leaf = fix.template as<LeafNode>();
+            i = leaf->count > 0 ? leaf->upper_bound(last) : 0;
+        }
+        leaf = fix.template as<LeafNode>();
+    } while (i >= leaf->count);
+
+    return *this;
+}
+
+IMLAB_BTREE_TEMPL bool IMLAB_BTREE_CLASS::const_iterator::operator==(const const_iterator &other) const {
+    return fix.data() == other.fix.data() && i == other.i;
+}
+
+IMLAB_BTREE_TEMPL bool IMLAB_BTREE_CLASS::const_iterator::operator!=(const const_iterator &other) const {
+    return !(*this == other);
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::const_reference IMLAB_BTREE_CLASS::const_iterator::operator*() const {
+    return fix.template as<LeafNode>()->at(i);
+}
+
+IMLAB_BTREE_TEMPL typename IMLAB_BTREE_CLASS::const_pointer IMLAB_BTREE_CLASS::const_iterator::operator->() const {
+    static_assert(!kColumnar, "columnar leaves have no value objects, use field");
     return &fix.template as<LeafNode>()->at(i);
 }
+
+IMLAB_BTREE_TEMPL template<auto member> const member_t<member> &IMLAB_BTREE_CLASS::const_iterator::field() const {
+    return fix.template as<LeafNode>()->template field<member>(i);
+}
+// ---------------------------------------------------------------------------------------------------
+IMLAB_BTREE_TEMPL IMLAB_BTREE_CLASS::Snapshot::Snapshot(Snapshot &&other) noexcept
+    : tree(other.tree), root(other.root), epoch(other.epoch), count(other.count) {
+    other.tree = nullptr;
+}
+
+IMLAB_BTREE_TEMPL IMLAB_BTREE_CLASS::Snapshot::~Snapshot() {
+    if (tree)
+        tree->release_snapshot(epoch);
+}
+
+IMLAB_BTREE_TEMPL std::optional<T> IMLAB_BTREE_CLASS::Snapshot::lookup(const Key &key) const {
+    Fix fix;
+    const auto *leaf = find_leaf(key, fix);
+    if (!leaf || leaf->count == 0)
+        return {};
+
+    auto idx = leaf->lower_bound(key);
+    if (!leaf->is_equal(key, idx))
+        return {};
+    return leaf->at(idx);
+}
+
+IMLAB_BTREE_TEMPL template<typename Callback>
+void IMLAB_BTREE_CLASS::Snapshot::scan(const Key &lo, const Key &hi, Callback callback) const {
+    if (comp(hi, lo))
+        return;
+
+    Fix fix;
+    const auto *leaf = find_leaf(lo, fix);
+    if (!leaf)
+        return;
+
+    uint32_t begin = leaf->count > 0 ? leaf->lower_bound(lo) : 0;
+    std::vector<Key> keys(leaf_layout == LeafLayout::Packed ? LeafNode::kCapacity : 0);
+    std::vector<T> values(kColumnar ? LeafNode::kCapacity : 0);
+    for (;;) {
+        uint32_t end = leaf->count;
+        bool last = end > 0 && comp(hi, leaf->key(end - 1));
+        if (last)
+            end = leaf->upper_bound(hi);
+
+        if (begin < end && !callback(leaf->key_data(begin, end, keys.data()), leaf->value_data(begin, end, values.data()),
+                                     end - begin))
+            return;
+        if (last || !leaf->get_next())
+            return;
+
+        leaf = reinterpret_cast<const LeafNode *>(read(*leaf->get_next(), fix));
+        begin = 0;
+    }
+}
+
+IMLAB_BTREE_TEMPL uint64_t IMLAB_BTREE_CLASS::Snapshot::size() const {
+    return count;
+}
+
+IMLAB_BTREE_TEMPL const std::byte *IMLAB_BTREE_CLASS::Snapshot::read(uint64_t page, Fix &fix) const {
+    auto copy = [this, page]() -> const std::byte * {
+        std::unique_lock<std::mutex> lock(tree->version_mutex);
+        auto it = tree->versions.find(page);
+        if (it == tree->versions.end())
+            return nullptr;
+        auto image = it->second.lower_bound(epoch);
+        return image != it->second.end() ? image->second->data : nullptr;
+    };
+
+    // copies never change, so they are read without fixing the page
+    fix.unfix();
+    if (const auto *data = copy())
+        return data;
+
+    // no writer holds the page while it is fixed, a writer that copied it in the meantime is
+    // seen by the second check
+    fix = tree->fix(page);
+    if (const auto *data = copy()) {
+        fix.unfix();
+        return data;
+    }
+    return fix.data();
+}
+
+IMLAB_BTREE_TEMPL const typename IMLAB_BTREE_CLASS::LeafNode *IMLAB_BTREE_CLASS::Snapshot::find_leaf(const Key &key, Fix &fix) const {
+    if (root == kNoRoot)
+        return nullptr;
+
+    const auto *node = reinterpret_cast<const Node *>(read(root, fix));
+    while (!node->is_leaf()) {
+        uint64_t child = static_cast<const InnerNode *>(node)->lower_bound(key);
+        node = reinterpret_cast<const Node *>(read(child, fix));
+    }
+    return static_cast<const LeafNode *>(node);
+}
 // ---------------------------------------------------------------------------------------------------
-IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::CoupledFixes::advance(typename BufferManager<page_size>::ExclusiveFix next) {
+IMLAB_BTREE_TEMPL bool IMLAB_BTREE_CLASS::Hint::covers(const Key &key) const {
+    if (lo && (lo_separator ? !comp(*lo, key) : comp(key, *lo)))
+        return false;
+    return !hi || !comp(*hi, key);
+}
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::Hint::narrow(const InnerNode &inner, uint32_t idx, uint32_t n) {
+    // the separators of lower levels lie within the ones above
+    if (idx > 0) {
+        lo = inner.separator_data()[idx - 1];
+        lo_separator = true;
+    }
+    if (idx < n) {
+        hi = inner.separator_data()[idx];
+        hi_separator = true;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------
+
+IMLAB_BTREE_TEMPL void IMLAB_BTREE_CLASS::CoupledFixes::advance(ExclusiveFix next) {
     prev = std::move(fix);
     fix = std::move(next);
 }
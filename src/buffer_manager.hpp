@@ -8,18 +8,52 @@
 
 #include "imlab/segment_file.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cstring>
 #include <utility>
 // ---------------------------------------------------------------------------------------------------
 namespace imlab {
 
-BUFFER_MANAGER_TEMPL constexpr BUFFER_MANAGER_CLASS::BufferManager(size_t page_count)
-: page_count(page_count) {}
+BUFFER_MANAGER_TEMPL BUFFER_MANAGER_CLASS::BufferManager(size_t page_count)
+: page_count(page_count) {
+    // keep the table at most half full
+    size_t slots = 2;
+    while (slots < 2 * page_count)
+        slots *= 2;
+
+    lookup.reset(new std::atomic<Frame *>[slots]);
+    for (size_t i = 0; i < slots; ++i)
+        lookup[i].store(nullptr);
+    lookup_mask = slots - 1;
+}
+
+BUFFER_MANAGER_TEMPL BUFFER_MANAGER_CLASS::BufferManager(size_t page_count, WriteAheadLog &wal)
+: BufferManager(page_count) {
+    this->wal = &wal;
+    recover();
+}
 
 BUFFER_MANAGER_TEMPL BUFFER_MANAGER_CLASS::~BufferManager() {
+    // best effort, without a list the next start is only slower
+    if (!working_set_file.empty()) {
+        try {
+            save_working_set(working_set_file);
+        } catch (...) {
+        }
+    }
+
+    if (wal)
+        wal->flush();
+
     for (auto &entry : pages) {
-        if (entry.second.data_state == Page::Dirty)
+        if (entry.second.data_state == Page::Dirty && !entry.second.temporary)
             save_page(entry.second);
     }
+
+    // every logged change is on disk now
+    if (wal)
+        wal->truncate();
 }
 
 BUFFER_MANAGER_TEMPL typename BUFFER_MANAGER_CLASS::Fix BUFFER_MANAGER_CLASS::fix(uint64_t page_id) {
@@ -27,14 +61,68 @@ BUFFER_MANAGER_TEMPL typename BUFFER_MANAGER_CLASS::Fix BUFFER_MANAGER_CLASS::fi
 }
 
 BUFFER_MANAGER_TEMPL typename BUFFER_MANAGER_CLASS::ExclusiveFix BUFFER_MANAGER_CLASS::fix_exclusive(uint64_t page_id) {
-    return ExclusiveFix(fix(page_id, true), this);
+    return make_exclusive(fix(page_id, true));
+}
+
+BUFFER_MANAGER_TEMPL typename BUFFER_MANAGER_CLASS::ExclusiveFix BUFFER_MANAGER_CLASS::try_fix_exclusive(uint64_t page_id) {
+    Page *p = fix(page_id, true, false);
+    if (!p)
+        return {};
+    return make_exclusive(p);
+}
+
+BUFFER_MANAGER_TEMPL typename BUFFER_MANAGER_CLASS::OptimisticFix BUFFER_MANAGER_CLASS::fix_optimistic(uint64_t page_id) const {
+    for (size_t i = lookup_slot(page_id), probes = 0; probes <= lookup_mask; i = (i + 1) & lookup_mask, ++probes) {
+        const Frame *frame = lookup[i].load(std::memory_order_acquire);
+        if (!frame)
+            break;
+        if (frame->page_id.load(std::memory_order_acquire) != page_id)
+            continue;
+
+        // the owner only changes while the version is odd
+        uint64_t version = frame->version.load(std::memory_order_acquire);
+        if ((version & 1) || frame->page_id.load(std::memory_order_acquire) != page_id)
+            return {};
+
+        // avoid writing the shared cache line on every read
+        if (!frame->referenced.load(std::memory_order_relaxed))
+            frame->referenced.store(true, std::memory_order_relaxed);
+        return OptimisticFix(frame, page_id, version);
+    }
+
+    return {};
+}
+
+BUFFER_MANAGER_TEMPL typename BUFFER_MANAGER_CLASS::Fix BUFFER_MANAGER_CLASS::fix(const OptimisticFix &page) {
+    return Fix(fix(page, false), this);
+}
+
+BUFFER_MANAGER_TEMPL typename BUFFER_MANAGER_CLASS::ExclusiveFix BUFFER_MANAGER_CLASS::fix_exclusive(const OptimisticFix &page) {
+    Page *p = fix(page, true);
+    if (!p)
+        return {};
+    return make_exclusive(p);
+}
+
+BUFFER_MANAGER_TEMPL typename BUFFER_MANAGER_CLASS::ExclusiveFix BUFFER_MANAGER_CLASS::make_exclusive(Page *p) {
+    // remember the old contents to log only the modified range
+    if (wal && !p->temporary) {
+        if (!p->before_image)
+            p->before_image.reset(new std::byte[page_size]);
+        std::memcpy(p->before_image.get(), p->frame->data, page_size);
+    }
+
+    return ExclusiveFix(p, this);
 }
 
-BUFFER_MANAGER_TEMPL typename BUFFER_MANAGER_CLASS::Page *BUFFER_MANAGER_CLASS::fix(uint64_t page_id, bool exclusive) {
+BUFFER_MANAGER_TEMPL typename BUFFER_MANAGER_CLASS::Page *BUFFER_MANAGER_CLASS::fix(uint64_t page_id, bool exclusive, bool wait) {
+    auto start = std::chrono::steady_clock::now();
     std::unique_lock<std::mutex> lock(mutex);
 
     Page *p = nullptr;
     while (!p) {
+        // only the i/o of the successful attempt counts, others might have run while waiting
+        fix_io_time = std::chrono::nanoseconds{0};
         auto it = pages.find(page_id);
         if (it != pages.end()) {
             p = try_fix_existing(it, exclusive);
@@ -44,11 +132,45 @@ BUFFER_MANAGER_TEMPL typename BUFFER_MANAGER_CLASS::Page *BUFFER_MANAGER_CLASS::
                 std::forward_as_tuple(page_id),
                 std::forward_as_tuple(page_id)), exclusive);
         }
+
+        // page is held by another fix or still being read
+        if (!p && !wait)
+            return nullptr;
+        if (!p)
+            page_released.wait_for(lock, kWaitInterval);
     }
 
+    auto waited = std::chrono::steady_clock::now() - start - fix_io_time;
+    counters_for(*p).fix_wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count();
+
     return p;
 }
 
+BUFFER_MANAGER_TEMPL typename BUFFER_MANAGER_CLASS::Page *BUFFER_MANAGER_CLASS::fix(const OptimisticFix &page, bool exclusive) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;) {
+        // an unchanged even version means the frame still holds the same, fully loaded page
+        if (!page.valid() || page.frame->version.load() != page.version)
+            return nullptr;
+
+        auto it = pages.find(page.expected_page_id);
+        assert(it != pages.end() && it->second.frame == page.frame);
+        Page &p = it->second;
+
+        if (p.can_fix(exclusive)) {
+            p.fix(exclusive);
+            if (exclusive)
+                p.frame->version.fetch_add(1);
+            ++counters_for(p).hits;
+            add_to_lru(&p);
+            return &p;
+        }
+
+        page_released.wait_for(lock, kWaitInterval);
+    }
+}
+
 BUFFER_MANAGER_TEMPL bool BUFFER_MANAGER_CLASS::in_memory(uint64_t page_id) const {
     auto it = pages.find(page_id);
     if (it != pages.end())
@@ -63,9 +185,256 @@ BUFFER_MANAGER_TEMPL bool BUFFER_MANAGER_CLASS::is_dirty(uint64_t page_id) const
     return false;
 }
 
-BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::unfix(Page *page) {
+BUFFER_MANAGER_TEMPL size_t BUFFER_MANAGER_CLASS::page_reads() const {
+    std::unique_lock<std::mutex> lock(mutex);
+    size_t result = 0;
+    for (const auto &entry : counters) {
+        for (const auto &c : entry.second)
+            result += c.read_latency.count();
+    }
+    return result;
+}
+
+BUFFER_MANAGER_TEMPL size_t BUFFER_MANAGER_CLASS::page_writes() const {
+    std::unique_lock<std::mutex> lock(mutex);
+    size_t result = 0;
+    for (const auto &entry : counters) {
+        for (const auto &c : entry.second)
+            result += c.write_latency.count();
+    }
+    return result;
+}
+
+BUFFER_MANAGER_TEMPL BufferStatistics BUFFER_MANAGER_CLASS::statistics() const {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    BufferStatistics result;
+    result.capacity_pages = page_count;
+    for (const auto &entry : counters)
+        result.segments[entry.first].counters = entry.second;
+
+    for (const auto &entry : pages) {
+        const Page &p = entry.second;
+        auto &gauges = result.segments[p.page_id >> 48].gauges[p.priority];
+        ++gauges.resident_pages;
+        if (p.data_state == Page::Dirty)
+            ++gauges.dirty_pages;
+    }
+
+    return result;
+}
+
+BUFFER_MANAGER_TEMPL BufferCounters &BUFFER_MANAGER_CLASS::counters_for(const Page &p) {
+    return counters[p.page_id >> 48][p.priority];
+}
+
+BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::unfix(Page *page, bool exclusive) {
+    // still exclusively fixed, so the page can not change under us
+    if (exclusive && page->modified) {
+        page->modified = false;
+        if (wal && !page->temporary)
+            log_changes(*page);
+    }
+
     std::unique_lock<std::mutex> lock(mutex);
     page->unfix();
+    if (exclusive)
+        page->frame->version.fetch_add(1);
+    page_released.notify_all();
+}
+
+BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::commit() {
+    if (wal)
+        wal->flush();
+    else
+        checkpoint();
+}
+
+BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::checkpoint() {
+    if (wal)
+        wal->flush();
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (write_dirty_pages() && wal)
+            wal->truncate();
+    }
+
+    if (!working_set_file.empty())
+        save_working_set(working_set_file);
+}
+
+BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::set_temporary(uint16_t segment_id) {
+    std::unique_lock<std::mutex> lock(mutex);
+    temporary_segments.insert(segment_id);
+
+    for (auto &entry : pages) {
+        if ((entry.first >> 48) == segment_id)
+            entry.second.temporary = true;
+    }
+}
+
+BUFFER_MANAGER_TEMPL bool BUFFER_MANAGER_CLASS::is_temporary(uint16_t segment_id) const {
+    std::unique_lock<std::mutex> lock(mutex);
+    return temporary_segments.count(segment_id) > 0;
+}
+
+BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::drop_segment(uint16_t segment_id) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (auto it = pages.begin(); it != pages.end();) {
+        Page &p = it->second;
+        if ((p.page_id >> 48) != segment_id) {
+            ++it;
+            continue;
+        }
+
+        assert(p.fix_count == 0);
+        ++it;
+        remove_from_queues(&p);
+        --loaded_page_count;
+        erase_page(p);
+    }
+
+    temporary_segments.erase(segment_id);
+    SegmentFile::remove(segment_id);
+}
+
+BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::set_working_set_file(std::string path) {
+    working_set_file = std::move(path);
+}
+
+BUFFER_MANAGER_TEMPL WorkingSet BUFFER_MANAGER_CLASS::working_set() const {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // temporary pages are gone after a restart
+    WorkingSet result;
+    for (Page *p = fifo_head; p; p = p->next) {
+        if (!p->temporary)
+            result.fifo.push_back(p->page_id);
+    }
+    for (Page *p = lru_head; p; p = p->next) {
+        if (!p->temporary)
+            result.lru.push_back(p->page_id);
+    }
+    return result;
+}
+
+BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::save_working_set(const std::string &path) const {
+    working_set().save(path);
+}
+
+BUFFER_MANAGER_TEMPL size_t BUFFER_MANAGER_CLASS::load_working_set(const std::string &path) {
+    std::vector<Page *> reserved = reserve_working_set(WorkingSet::load(path));
+    std::sort(reserved.begin(), reserved.end(), [](const Page *a, const Page *b) {
+        return a->page_id < b->page_id;
+    });
+
+    // the frames are fixed exclusively, so they can be read without holding the mutex
+    std::vector<std::byte> buffer;
+    size_t done = 0;
+    try {
+        while (done < reserved.size()) {
+            size_t run = 1;
+            while (done + run < reserved.size() && run < kWarmupBatch
+                    && reserved[done + run]->page_id == reserved[done]->page_id + run)
+                ++run;
+
+            auto start = std::chrono::steady_clock::now();
+            buffer.resize(run * page_size);
+            SegmentFile f{reserved[done]->page_id, page_size, run};
+            f.read(buffer.data());
+            for (size_t i = 0; i < run; ++i)
+                std::memcpy(reserved[done + i]->frame->data, buffer.data() + i * page_size, page_size);
+            auto latency = std::chrono::steady_clock::now() - start;
+
+            std::unique_lock<std::mutex> lock(mutex);
+            counters_for(*reserved[done]).read_latency.record(latency);
+            for (size_t i = 0; i < run; ++i) {
+                Page *p = reserved[done + i];
+                p->data_state = Page::Clean;
+                p->unfix();
+                p->frame->version.fetch_add(1);
+            }
+            page_released.notify_all();
+            done += run;
+        }
+    } catch (...) {
+        // give the frames of unread pages back
+        std::unique_lock<std::mutex> lock(mutex);
+        for (size_t i = done; i < reserved.size(); ++i) {
+            remove_from_queues(reserved[i]);
+            --loaded_page_count;
+            erase_page(*reserved[i]);
+        }
+        page_released.notify_all();
+        throw;
+    }
+
+    return reserved.size();
+}
+
+BUFFER_MANAGER_TEMPL std::future<size_t> BUFFER_MANAGER_CLASS::load_working_set_async(std::string path) {
+    return std::async(std::launch::async, [this, path = std::move(path)] {
+        return load_working_set(path);
+    });
+}
+
+BUFFER_MANAGER_TEMPL std::vector<typename BUFFER_MANAGER_CLASS::Page *> BUFFER_MANAGER_CLASS::reserve_working_set(
+        const WorkingSet &set) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // walk from the most recently used page, pages that would be evicted first are dropped
+    std::vector<Page *> reserved;
+    for (size_t i = set.size(); i > 0 && loaded_page_count < page_count; --i) {
+        bool lru = i > set.fifo.size();
+        uint64_t page_id = lru ? set.lru[i - 1 - set.fifo.size()] : set.fifo[i - 1];
+
+        auto inserted = pages.emplace(std::piecewise_construct,
+            std::forward_as_tuple(page_id),
+            std::forward_as_tuple(page_id));
+        if (!inserted.second)
+            continue;
+
+        Page &p = inserted.first->second;
+        assign_frame(p);
+        p.fix(true);
+        p.temporary = temporary_segments.count(page_id >> 48) > 0;
+        p.priority = lru ? BufferStatistics::Lru : BufferStatistics::Fifo;
+        ++loaded_page_count;
+        reserved.push_back(&p);
+    }
+
+    // thread into the queues in the saved order
+    std::reverse(reserved.begin(), reserved.end());
+    for (Page *p : reserved) {
+        if (p->priority == BufferStatistics::Lru)
+            add_to_lru(p);
+        else
+            add_to_fifo(p);
+    }
+
+    return reserved;
+}
+
+BUFFER_MANAGER_TEMPL bool BUFFER_MANAGER_CLASS::write_dirty_pages() {
+    bool complete = true;
+    for (auto &entry : pages) {
+        Page &p = entry.second;
+        if (p.data_state != Page::Dirty || p.temporary)
+            continue;
+
+        // exclusive fixes might be halfway through a modification
+        if (p.fix_count < 0) {
+            complete = false;
+            continue;
+        }
+
+        save_page(p);
+        p.data_state = Page::Clean;
+    }
+
+    return complete;
 }
 
 BUFFER_MANAGER_TEMPL
@@ -85,6 +454,9 @@ typename BUFFER_MANAGER_CLASS::Page *BUFFER_MANAGER_CLASS::try_fix_existing(type
     }
 
     p.fix(exclusive);
+    if (exclusive)
+        p.frame->version.fetch_add(1);
+    ++counters_for(p).hits;
     add_to_lru(&p);
 
     // page was still reading -> wait
@@ -104,13 +476,19 @@ typename BUFFER_MANAGER_CLASS::Page *BUFFER_MANAGER_CLASS::try_fix_new(typename
         throw buffer_full_error();
     }
 
+    assign_frame(p);
     p.fix(exclusive);
+    p.temporary = temporary_segments.count(p.page_id >> 48) > 0;
     add_to_fifo(&p);
+    ++counters_for(p).misses;
 
     // TODO unlock
     load_page(p);
     // TODO relock
     p.data_state = Page::Clean;
+    // an exclusive fix keeps the version odd until it is released
+    if (!exclusive)
+        p.frame->version.fetch_add(1);
     // TODO notify?
 
     return &p;
@@ -125,6 +503,11 @@ BUFFER_MANAGER_TEMPL bool BUFFER_MANAGER_CLASS::try_reserve_space() {
             return false;
 
         remove_from_queues(steal);
+        if (steal->data_state == Page::Dirty)
+            ++counters_for(*steal).dirty_evictions;
+        else
+            ++counters_for(*steal).clean_evictions;
+
         if (steal->data_state == Page::Dirty) {
             steal->data_state = Page::Writing;
             // TODO unlock
@@ -133,14 +516,77 @@ BUFFER_MANAGER_TEMPL bool BUFFER_MANAGER_CLASS::try_reserve_space() {
             // TODO notify ?
         }
 
-        pages.erase(steal->page_id);
+        erase_page(*steal);
     }
 
     return true;
 }
 
+BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::assign_frame(Page &p) {
+    Frame *frame;
+    if (!free_frames.empty()) {
+        frame = free_frames.back();
+        free_frames.pop_back();
+    } else {
+        frames.push_back(std::make_unique<Frame>());
+        frame = frames.back().get();
+    }
+
+    // unused frames have an odd version, optimistic readers ignore the frame until the page is loaded
+    assert(frame->version.load() & 1);
+    frame->page_id.store(p.page_id);
+    frame->referenced.store(false, std::memory_order_relaxed);
+    p.frame = frame;
+    lookup_insert(frame);
+}
+
+BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::erase_page(Page &p) {
+    if (Frame *frame = p.frame) {
+        lookup_erase(frame);
+        if (!(frame->version.load() & 1))
+            frame->version.fetch_add(1);
+        free_frames.push_back(frame);
+    }
+
+    pages.erase(p.page_id);
+}
+
+BUFFER_MANAGER_TEMPL size_t BUFFER_MANAGER_CLASS::lookup_slot(uint64_t page_id) const {
+    uint64_t hash = page_id * 0x9e3779b97f4a7c15ull;
+    return (hash ^ (hash >> 32)) & lookup_mask;
+}
+
+BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::lookup_insert(Frame *frame) {
+    size_t i = lookup_slot(frame->page_id.load());
+    while (lookup[i].load(std::memory_order_relaxed))
+        i = (i + 1) & lookup_mask;
+    lookup[i].store(frame, std::memory_order_release);
+}
+
+BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::lookup_erase(Frame *frame) {
+    size_t hole = lookup_slot(frame->page_id.load());
+    while (lookup[hole].load(std::memory_order_relaxed) != frame)
+        hole = (hole + 1) & lookup_mask;
+
+    // backward shift deletion, move later entries of the cluster into the hole if they may live there
+    for (size_t i = (hole + 1) & lookup_mask;; i = (i + 1) & lookup_mask) {
+        Frame *entry = lookup[i].load(std::memory_order_relaxed);
+        if (!entry)
+            break;
+
+        size_t home = lookup_slot(entry->page_id.load());
+        if (((i - home) & lookup_mask) >= ((i - hole) & lookup_mask)) {
+            lookup[hole].store(entry, std::memory_order_release);
+            hole = i;
+        }
+    }
+
+    lookup[hole].store(nullptr, std::memory_order_release);
+}
+
 BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::add_to_fifo(Page *p) {
     remove_from_queues(p);
+    p->priority = BufferStatistics::Fifo;
 
     if (!fifo_tail) {
         fifo_head = fifo_tail = p;
@@ -153,6 +599,7 @@ BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::add_to_fifo(Page *p) {
 
 BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::add_to_lru(Page *p) {
     remove_from_queues(p);
+    p->priority = BufferStatistics::Lru;
 
     if (!lru_tail) {
       lru_head = lru_tail = p;
@@ -191,41 +638,87 @@ BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::remove_from_queues(Page *p) {
 }
 
 BUFFER_MANAGER_TEMPL typename BUFFER_MANAGER_CLASS::Page *BUFFER_MANAGER_CLASS::find_unfixed() {
-    Page *p = fifo_head;
-
-    if (p) {
-        do {
-            if (p->fix_count == 0)
-                break;
-        } while ((p = p->next));
+    // pages read optimistically since the last pass get a second chance,
+    // from the fifo they move to the lru like on a hit
+    for (Page *p = fifo_head, *next; p; p = next) {
+        next = p->next;
+        if (p->fix_count != 0)
+            continue;
+        if (!p->frame->referenced.exchange(false, std::memory_order_relaxed))
+            return p;
+        add_to_lru(p);
     }
 
-    if (!p && (p = lru_head)) {
-        do {
-            if (p->fix_count == 0)
-                break;
-        } while ((p = p->next));
+    Page *fallback = nullptr;
+    for (Page *p = lru_head; p; p = p->next) {
+        if (p->fix_count != 0)
+            continue;
+        if (!p->frame->referenced.exchange(false, std::memory_order_relaxed))
+            return p;
+        if (!fallback)
+            fallback = p;
     }
 
-    return p;
+    return fallback;
 }
 
 BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::load_page(Page &p) {
-    ++_page_reads;
+    auto start = std::chrono::steady_clock::now();
     SegmentFile f{p.page_id, page_size};
-    f.read(p.data.get());
+    f.read(p.frame->data);
+
+    auto latency = std::chrono::steady_clock::now() - start;
+    fix_io_time += latency;
+    counters_for(p).read_latency.record(latency);
 }
 
 BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::save_page(const Page &p) {
-    ++_page_writes;
+    auto start = std::chrono::steady_clock::now();
+    // write ahead rule, the log has to cover the page before it hits the disk
+    if (wal)
+        wal->flush(p.lsn);
+
     SegmentFile f{p.page_id, page_size};
-    f.write(p.data.get());
+    f.write(p.frame->data);
+
+    auto latency = std::chrono::steady_clock::now() - start;
+    fix_io_time += latency;
+    counters_for(p).write_latency.record(latency);
+}
+
+BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::recover() {
+    wal->replay([this](uint64_t page_id, uint32_t offset, const std::byte *data, uint32_t length) {
+        // apply without logging again, the record is already in the log
+        Page *p = fix(page_id, true);
+        std::memcpy(p->frame->data + offset, data, length);
+        p->data_state = Page::Dirty;
+        unfix(p, true);
+    });
+
+    checkpoint();
+}
+
+BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::log_changes(Page &p) {
+    const std::byte *before = p.before_image.get();
+    const std::byte *after = p.frame->data;
+
+    size_t first = 0;
+    while (first < page_size && before[first] == after[first])
+        ++first;
+    if (first == page_size)
+        return;
+
+    size_t last = page_size;
+    while (before[last - 1] == after[last - 1])
+        --last;
+
+    p.lsn = wal->append(p.page_id, first, after + first, last - first);
 }
 
 // ---------------------------------------------------------------------------------------------------
 
 BUFFER_MANAGER_TEMPL constexpr BUFFER_MANAGER_CLASS::Page::Page(uint64_t page_id)
-    : page_id(page_id), data(new std::byte[page_size]) {}
+    : page_id(page_id) {}
 
 BUFFER_MANAGER_TEMPL bool BUFFER_MANAGER_CLASS::Page::can_fix(bool exclusive) {
     if (exclusive)
@@ -262,6 +755,7 @@ BUFFER_MANAGER_TEMPL constexpr typename BUFFER_MANAGER_CLASS::Fix &BUFFER_MANAGE
 
         this->manager = o.manager;
         this->page = o.page;
+        this->exclusive = o.exclusive;
 
         o.page = nullptr;
     }
@@ -269,8 +763,38 @@ BUFFER_MANAGER_TEMPL constexpr typename BUFFER_MANAGER_CLASS::Fix &BUFFER_MANAGE
     return *this;
 }
 
+BUFFER_MANAGER_TEMPL BUFFER_MANAGER_CLASS::OptimisticFix::OptimisticFix(const Frame *frame, uint64_t page_id, uint64_t version) noexcept
+    : frame(frame), expected_page_id(page_id), version(version) {}
+
+BUFFER_MANAGER_TEMPL bool BUFFER_MANAGER_CLASS::OptimisticFix::valid() const {
+    return frame != nullptr;
+}
+
+BUFFER_MANAGER_TEMPL uint64_t BUFFER_MANAGER_CLASS::OptimisticFix::page_id() const {
+    return expected_page_id;
+}
+
+BUFFER_MANAGER_TEMPL const std::byte *BUFFER_MANAGER_CLASS::OptimisticFix::data() const {
+    if (frame)
+        return frame->data;
+    return nullptr;
+}
+
+BUFFER_MANAGER_TEMPL template<typename T> const T *BUFFER_MANAGER_CLASS::OptimisticFix::as() const {
+    static_assert(sizeof(T) <= page_size);
+    return reinterpret_cast<const T*>(data());
+}
+
+BUFFER_MANAGER_TEMPL bool BUFFER_MANAGER_CLASS::OptimisticFix::validate() const {
+    // order the optimistic reads before the version check
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return frame && frame->version.load(std::memory_order_relaxed) == version;
+}
+
 BUFFER_MANAGER_TEMPL constexpr BUFFER_MANAGER_CLASS::ExclusiveFix::ExclusiveFix(Page *page, BufferManager *manager) noexcept
-        : Fix(page, manager) {}
+        : Fix(page, manager) {
+    this->exclusive = true;
+}
 
 BUFFER_MANAGER_TEMPL BUFFER_MANAGER_CLASS::Fix::~Fix() {
     unfix();
@@ -278,7 +802,7 @@ BUFFER_MANAGER_TEMPL BUFFER_MANAGER_CLASS::Fix::~Fix() {
 
 BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::Fix::unfix() {
     if (page)
-    manager->unfix(page);
+    manager->unfix(page, exclusive);
     page = nullptr;
 }
 
@@ -288,13 +812,13 @@ BUFFER_MANAGER_TEMPL uint64_t BUFFER_MANAGER_CLASS::Fix::page_id() const {
 
 BUFFER_MANAGER_TEMPL const std::byte *BUFFER_MANAGER_CLASS::Fix::data() const {
     if (page)
-        return page->data.get();
+        return page->frame->data;
     return nullptr;
 }
 
 BUFFER_MANAGER_TEMPL std::byte *BUFFER_MANAGER_CLASS::ExclusiveFix::data() {
     if (this->page)
-        return this->page->data.get();
+        return this->page->frame->data;
     return nullptr;
 }
 
@@ -310,6 +834,7 @@ BUFFER_MANAGER_TEMPL template<typename T> T *BUFFER_MANAGER_CLASS::ExclusiveFix:
 
 BUFFER_MANAGER_TEMPL void BUFFER_MANAGER_CLASS::ExclusiveFix::set_dirty() {
     this->page->data_state = Page::Dirty;
+    this->page->modified = true;
 }
 
 }  // namespace imlab
@@ -0,0 +1,265 @@
+// ---------------------------------------------------------------------------------------------------
+#include "imlab/buffer_statistics.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <system_error>
+// ---------------------------------------------------------------------------------------------------
+namespace imlab {
+
+namespace {
+
+    using Counter = uint64_t BufferCounters::*;
+    struct CounterMetric {
+        const char *name;
+        const char *help;
+        Counter counter;
+    };
+
+    constexpr CounterMetric counter_metrics[] = {
+        {"imlab_buffer_hits_total", "Fixes served from a resident page.", &BufferCounters::hits},
+        {"imlab_buffer_misses_total", "Fixes that had to load the page.", &BufferCounters::misses},
+        {"imlab_buffer_clean_evictions_total", "Evicted pages that did not need a writeback.",
+            &BufferCounters::clean_evictions},
+        {"imlab_buffer_dirty_evictions_total", "Evicted pages that were written back.",
+            &BufferCounters::dirty_evictions},
+    };
+
+    using Histogram = LatencyHistogram BufferCounters::*;
+    struct HistogramMetric {
+        const char *name;
+        const char *help;
+        Histogram histogram;
+    };
+
+    constexpr HistogramMetric histogram_metrics[] = {
+        {"imlab_buffer_read_seconds", "Latency of page reads.", &BufferCounters::read_latency},
+        {"imlab_buffer_write_seconds", "Latency of page writes.", &BufferCounters::write_latency},
+    };
+
+    void write_header(std::ostream &os, const char *name, const char *help, const char *type) {
+        os << "# HELP " << name << ' ' << help << '\n';
+        os << "# TYPE " << name << ' ' << type << '\n';
+    }
+
+    void write_labels(std::ostream &os, uint16_t segment_id, size_t priority) {
+        os << "{segment=\"" << segment_id << "\",priority=\""
+            << BufferStatistics::priority_name(static_cast<BufferStatistics::Priority>(priority)) << '"';
+    }
+
+}  // namespace
+// ---------------------------------------------------------------------------------------------------
+void LatencyHistogram::record(std::chrono::nanoseconds latency) {
+    uint64_t ns = latency.count() > 0 ? latency.count() : 0;
+    uint64_t us = ns / 1000;
+
+    size_t idx = 0;
+    while (us && idx < kBuckets - 1) {
+        us >>= 1;
+        ++idx;
+    }
+
+    ++buckets[idx];
+    ++_count;
+    _sum_ns += ns;
+}
+
+double LatencyHistogram::bucket_bound(size_t idx) {
+    return static_cast<double>(1ull << idx) * 1e-6;
+}
+
+LatencyHistogram &LatencyHistogram::operator+=(const LatencyHistogram &other) {
+    for (size_t i = 0; i < kBuckets; ++i)
+        buckets[i] += other.buckets[i];
+    _count += other._count;
+    _sum_ns += other._sum_ns;
+    return *this;
+}
+
+LatencyHistogram &LatencyHistogram::operator-=(const LatencyHistogram &other) {
+    for (size_t i = 0; i < kBuckets; ++i)
+        buckets[i] -= other.buckets[i];
+    _count -= other._count;
+    _sum_ns -= other._sum_ns;
+    return *this;
+}
+// ---------------------------------------------------------------------------------------------------
+BufferCounters &BufferCounters::operator+=(const BufferCounters &other) {
+    for (const auto &metric : counter_metrics)
+        this->*metric.counter += other.*metric.counter;
+    fix_wait_ns += other.fix_wait_ns;
+    read_latency += other.read_latency;
+    write_latency += other.write_latency;
+    return *this;
+}
+
+BufferCounters &BufferCounters::operator-=(const BufferCounters &other) {
+    for (const auto &metric : counter_metrics)
+        this->*metric.counter -= other.*metric.counter;
+    fix_wait_ns -= other.fix_wait_ns;
+    read_latency -= other.read_latency;
+    write_latency -= other.write_latency;
+    return *this;
+}
+// ---------------------------------------------------------------------------------------------------
+const char *BufferStatistics::priority_name(Priority priority) {
+    switch (priority) {
+        case Fifo:
+            return "fifo";
+        case Lru:
+            return "lru";
+        default:
+            return "unknown";
+    }
+}
+
+BufferCounters BufferStatistics::total() const {
+    BufferCounters result;
+    for (const auto &entry : segments) {
+        for (const auto &counters : entry.second.counters)
+            result += counters;
+    }
+    return result;
+}
+
+BufferCounters BufferStatistics::segment(uint16_t segment_id) const {
+    BufferCounters result;
+    auto it = segments.find(segment_id);
+    if (it != segments.end()) {
+        for (const auto &counters : it->second.counters)
+            result += counters;
+    }
+    return result;
+}
+
+BufferCounters BufferStatistics::priority(Priority priority) const {
+    BufferCounters result;
+    for (const auto &entry : segments)
+        result += entry.second.counters[priority];
+    return result;
+}
+
+BufferGauges BufferStatistics::gauges() const {
+    BufferGauges result;
+    for (const auto &entry : segments) {
+        for (const auto &gauges : entry.second.gauges) {
+            result.resident_pages += gauges.resident_pages;
+            result.dirty_pages += gauges.dirty_pages;
+        }
+    }
+    return result;
+}
+
+BufferGauges BufferStatistics::gauges(uint16_t segment_id) const {
+    BufferGauges result;
+    auto it = segments.find(segment_id);
+    if (it != segments.end()) {
+        for (const auto &gauges : it->second.gauges) {
+            result.resident_pages += gauges.resident_pages;
+            result.dirty_pages += gauges.dirty_pages;
+        }
+    }
+    return result;
+}
+
+BufferStatistics BufferStatistics::operator-(const BufferStatistics &earlier) const {
+    BufferStatistics result = *this;
+    for (const auto &entry : earlier.segments) {
+        auto &segment = result.segments[entry.first];
+        for (size_t i = 0; i < kPriorityCount; ++i)
+            segment.counters[i] -= entry.second.counters[i];
+    }
+    return result;
+}
+
+void BufferStatistics::write_prometheus(std::ostream &os) const {
+    write_header(os, "imlab_buffer_capacity_pages", "Number of frames in the buffer pool.", "gauge");
+    os << "imlab_buffer_capacity_pages " << capacity_pages << '\n';
+
+    write_header(os, "imlab_buffer_resident_pages", "Pages currently held in the buffer pool.", "gauge");
+    for (const auto &entry : segments) {
+        for (size_t p = 0; p < kPriorityCount; ++p) {
+            os << "imlab_buffer_resident_pages";
+            write_labels(os, entry.first, p);
+            os << "} " << entry.second.gauges[p].resident_pages << '\n';
+        }
+    }
+
+    write_header(os, "imlab_buffer_dirty_pages", "Resident pages awaiting writeback.", "gauge");
+    for (const auto &entry : segments) {
+        for (size_t p = 0; p < kPriorityCount; ++p) {
+            os << "imlab_buffer_dirty_pages";
+            write_labels(os, entry.first, p);
+            os << "} " << entry.second.gauges[p].dirty_pages << '\n';
+        }
+    }
+
+    for (const auto &metric : counter_metrics) {
+        write_header(os, metric.name, metric.help, "counter");
+        for (const auto &entry : segments) {
+            for (size_t p = 0; p < kPriorityCount; ++p) {
+                os << metric.name;
+                write_labels(os, entry.first, p);
+                os << "} " << entry.second.counters[p].*metric.counter << '\n';
+            }
+        }
+    }
+
+    write_header(os, "imlab_buffer_fix_wait_seconds_total", "Time spent waiting inside fix.", "counter");
+    for (const auto &entry : segments) {
+        for (size_t p = 0; p < kPriorityCount; ++p) {
+            os << "imlab_buffer_fix_wait_seconds_total";
+            write_labels(os, entry.first, p);
+            os << "} " << static_cast<double>(entry.second.counters[p].fix_wait_ns) * 1e-9 << '\n';
+        }
+    }
+
+    for (const auto &metric : histogram_metrics) {
+        write_header(os, metric.name, metric.help, "histogram");
+        for (const auto &entry : segments) {
+            for (size_t p = 0; p < kPriorityCount; ++p) {
+                const auto &histogram = entry.second.counters[p].*metric.histogram;
+
+                uint64_t cumulative = 0;
+                for (size_t b = 0; b < LatencyHistogram::kBuckets; ++b) {
+                    cumulative += histogram.bucket(b);
+                    os << metric.name << "_bucket";
+                    write_labels(os, entry.first, p);
+                    if (b + 1 < LatencyHistogram::kBuckets)
+                        os << ",le=\"" << LatencyHistogram::bucket_bound(b) << "\"} ";
+                    else
+                        os << ",le=\"+Inf\"} ";
+                    os << cumulative << '\n';
+                }
+
+                os << metric.name << "_sum";
+                write_labels(os, entry.first, p);
+                os << "} " << static_cast<double>(histogram.sum_ns()) * 1e-9 << '\n';
+
+                os << metric.name << "_count";
+                write_labels(os, entry.first, p);
+                os << "} " << histogram.count() << '\n';
+            }
+        }
+    }
+}
+
+void BufferStatistics::dump_prometheus(const std::string &path) const {
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::trunc);
+        if (!out)
+            throw std::system_error{errno, std::system_category()};
+        write_prometheus(out);
+        out.flush();
+        if (!out)
+            throw std::system_error{errno, std::system_category()};
+    }
+
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+        throw std::system_error{errno, std::system_category()};
+}
+
+}  // namespace imlab
+// ---------------------------------------------------------------------------------------------------
@@ -0,0 +1,313 @@
+// ---------------------------------------------------------------------------------------------------
+// IMLAB
+// ---------------------------------------------------------------------------------------------------
+#ifndef SRC_NODE_SEARCH_HPP_
+#define SRC_NODE_SEARCH_HPP_
+// ---------------------------------------------------------------------------------------------------
+#include "imlab/node_search.h"
+
+#include <algorithm>
+#include <limits>
+
+#if defined(__AVX512F__) || defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+// ---------------------------------------------------------------------------------------------------
+namespace imlab {
+
+namespace node_search {
+
+#if defined(__AVX512F__)
+    constexpr uint32_t kVectorBytes = 64;
+#elif defined(__AVX2__)
+    constexpr uint32_t kVectorBytes = 32;
+#elif defined(__SSE2__)
+    constexpr uint32_t kVectorBytes = 16;
+#else
+    constexpr uint32_t kVectorBytes = 8;
+#endif
+
+    // keys that fit the integer compare instructions
+    template<typename Key>
+    inline constexpr bool kVectorKey = std::is_integral_v<Key> && !std::is_same_v<Key, bool>;
+
+    // the binary search stops at two vectors worth of keys
+    template<typename Key>
+    inline constexpr uint32_t kWindow = std::max<uint32_t>(2 * kVectorBytes / sizeof(Key), 8);
+
+    // number of keys below `key`, or not above it for `or_equal`
+    template<bool or_equal, typename Key>
+    inline uint32_t count_scalar(const Key *keys, uint32_t count, Key key) {
+        uint32_t result = 0;
+        for (uint32_t i = 0; i < count; ++i)
+            result += or_equal ? !(key < keys[i]) : keys[i] < key;
+        return result;
+    }
+
+#if defined(__AVX512F__)
+    template<bool or_equal, typename Key>
+    inline uint32_t count_vector(const Key *keys, uint32_t count, Key key) {
+        uint32_t result = 0;
+        if constexpr (sizeof(Key) == 8) {
+            __m512i k = _mm512_set1_epi64(static_cast<int64_t>(key));
+            for (uint32_t i = 0; i < count; i += 8) {
+                // masked loads cover the tail, the lanes outside the mask never match
+                __mmask8 lanes = count - i >= 8 ? 0xff : (1u << (count - i)) - 1;
+                __m512i v = _mm512_maskz_loadu_epi64(lanes, keys + i);
+                __mmask8 match;
+                if constexpr (std::is_signed_v<Key>)
+                    match = or_equal ? _mm512_mask_cmple_epi64_mask(lanes, v, k) : _mm512_mask_cmplt_epi64_mask(lanes, v, k);
+                else
+                    match = or_equal ? _mm512_mask_cmple_epu64_mask(lanes, v, k) : _mm512_mask_cmplt_epu64_mask(lanes, v, k);
+                result += __builtin_popcount(match);
+            }
+        } else if constexpr (sizeof(Key) == 4) {
+            __m512i k = _mm512_set1_epi32(static_cast<int32_t>(key));
+            for (uint32_t i = 0; i < count; i += 16) {
+                __mmask16 lanes = count - i >= 16 ? 0xffff : (1u << (count - i)) - 1;
+                __m512i v = _mm512_maskz_loadu_epi32(lanes, keys + i);
+                __mmask16 match;
+                if constexpr (std::is_signed_v<Key>)
+                    match = or_equal ? _mm512_mask_cmple_epi32_mask(lanes, v, k) : _mm512_mask_cmplt_epi32_mask(lanes, v, k);
+                else
+                    match = or_equal ? _mm512_mask_cmple_epu32_mask(lanes, v, k) : _mm512_mask_cmplt_epu32_mask(lanes, v, k);
+                result += __builtin_popcount(match);
+            }
+        } else {
+#if defined(__AVX512BW__)
+            // byte and word compares, lane masks of up to 64 bits
+            constexpr uint32_t width = 64 / sizeof(Key);
+            __m512i k = sizeof(Key) == 2 ? _mm512_set1_epi16(static_cast<int16_t>(key))
+                                         : _mm512_set1_epi8(static_cast<int8_t>(key));
+            for (uint32_t i = 0; i < count; i += width) {
+                uint64_t lanes = count - i >= width ? ~0ull >> (64 - width) : (1ull << (count - i)) - 1;
+                uint64_t match;
+                if constexpr (sizeof(Key) == 2) {
+                    __m512i v = _mm512_maskz_loadu_epi16(lanes, keys + i);
+                    if constexpr (std::is_signed_v<Key>)
+                        match = or_equal ? _mm512_mask_cmple_epi16_mask(lanes, v, k) : _mm512_mask_cmplt_epi16_mask(lanes, v, k);
+                    else
+                        match = or_equal ? _mm512_mask_cmple_epu16_mask(lanes, v, k) : _mm512_mask_cmplt_epu16_mask(lanes, v, k);
+                } else {
+                    __m512i v = _mm512_maskz_loadu_epi8(lanes, keys + i);
+                    if constexpr (std::is_signed_v<Key>)
+                        match = or_equal ? _mm512_mask_cmple_epi8_mask(lanes, v, k) : _mm512_mask_cmplt_epi8_mask(lanes, v, k);
+                    else
+                        match = or_equal ? _mm512_mask_cmple_epu8_mask(lanes, v, k) : _mm512_mask_cmplt_epu8_mask(lanes, v, k);
+                }
+                result += __builtin_popcountll(match);
+            }
+#else
+            result = count_scalar<or_equal>(keys, count, key);
+#endif
+        }
+        return result;
+    }
+#elif defined(__AVX2__)
+    template<bool or_equal, typename Key>
+    inline uint32_t count_vector(const Key *keys, uint32_t count, Key key) {
+        constexpr uint32_t lanes = 32 / sizeof(Key);
+        // only signed compares exist, flipping the sign bit keeps the order of unsigned keys
+        constexpr Key bias = std::is_signed_v<Key> ? 0 : Key(1) << (8 * sizeof(Key) - 1);
+
+        __m256i flip, k;
+        if constexpr (sizeof(Key) == 8) {
+            flip = _mm256_set1_epi64x(static_cast<int64_t>(bias));
+            k = _mm256_set1_epi64x(static_cast<int64_t>(key ^ bias));
+        } else if constexpr (sizeof(Key) == 4) {
+            flip = _mm256_set1_epi32(static_cast<int32_t>(bias));
+            k = _mm256_set1_epi32(static_cast<int32_t>(key ^ bias));
+        } else if constexpr (sizeof(Key) == 2) {
+            flip = _mm256_set1_epi16(static_cast<int16_t>(bias));
+            k = _mm256_set1_epi16(static_cast<int16_t>(key ^ bias));
+        } else {
+            flip = _mm256_set1_epi8(static_cast<int8_t>(bias));
+            k = _mm256_set1_epi8(static_cast<int8_t>(key ^ bias));
+        }
+
+        // counts keys below, or above for `or_equal`
+        uint32_t i = 0, result = 0;
+        for (; i + lanes <= count; i += lanes) {
+            __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i)), flip);
+            if constexpr (sizeof(Key) == 8) {
+                __m256i match = or_equal ? _mm256_cmpgt_epi64(v, k) : _mm256_cmpgt_epi64(k, v);
+                result += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(match)));
+            } else if constexpr (sizeof(Key) == 4) {
+                __m256i match = or_equal ? _mm256_cmpgt_epi32(v, k) : _mm256_cmpgt_epi32(k, v);
+                result += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(match)));
+            } else if constexpr (sizeof(Key) == 2) {
+                // two mask bits per lane
+                __m256i match = or_equal ? _mm256_cmpgt_epi16(v, k) : _mm256_cmpgt_epi16(k, v);
+                result += __builtin_popcount(_mm256_movemask_epi8(match)) / 2;
+            } else {
+                __m256i match = or_equal ? _mm256_cmpgt_epi8(v, k) : _mm256_cmpgt_epi8(k, v);
+                result += __builtin_popcount(_mm256_movemask_epi8(match));
+            }
+        }
+
+        if (or_equal)
+            result = i - result;
+        return result + count_scalar<or_equal>(keys + i, count - i, key);
+    }
+#elif defined(__SSE2__)
+    template<bool or_equal, typename Key>
+    inline uint32_t count_vector(const Key *keys, uint32_t count, Key key) {
+#if !defined(__SSE4_2__)
+        // 64 bit compares need SSE4.2
+        if constexpr (sizeof(Key) == 8)
+            return count_scalar<or_equal>(keys, count, key);
+#endif
+        constexpr uint32_t lanes = 16 / sizeof(Key);
+        constexpr Key bias = std::is_signed_v<Key> ? 0 : Key(1) << (8 * sizeof(Key) - 1);
+
+        __m128i flip, k;
+        if constexpr (sizeof(Key) == 8) {
+            flip = _mm_set1_epi64x(static_cast<int64_t>(bias));
+            k = _mm_set1_epi64x(static_cast<int64_t>(key ^ bias));
+        } else if constexpr (sizeof(Key) == 4) {
+            flip = _mm_set1_epi32(static_cast<int32_t>(bias));
+            k = _mm_set1_epi32(static_cast<int32_t>(key ^ bias));
+        } else if constexpr (sizeof(Key) == 2) {
+            flip = _mm_set1_epi16(static_cast<int16_t>(bias));
+            k = _mm_set1_epi16(static_cast<int16_t>(key ^ bias));
+        } else {
+            flip = _mm_set1_epi8(static_cast<int8_t>(bias));
+            k = _mm_set1_epi8(static_cast<int8_t>(key ^ bias));
+        }
+
+        uint32_t i = 0, result = 0;
+        for (; i + lanes <= count; i += lanes) {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i)), flip);
+            if constexpr (sizeof(Key) == 8) {
+#if defined(__SSE4_2__)
+                __m128i match = or_equal ? _mm_cmpgt_epi64(v, k) : _mm_cmpgt_epi64(k, v);
+                result += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(match)));
+#endif
+            } else if constexpr (sizeof(Key) == 4) {
+                __m128i match = or_equal ? _mm_cmpgt_epi32(v, k) : _mm_cmpgt_epi32(k, v);
+                result += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(match)));
+            } else if constexpr (sizeof(Key) == 2) {
+                // two mask bits per lane
+                __m128i match = or_equal ? _mm_cmpgt_epi16(v, k) : _mm_cmpgt_epi16(k, v);
+                result += __builtin_popcount(_mm_movemask_epi8(match)) / 2;
+            } else {
+                __m128i match = or_equal ? _mm_cmpgt_epi8(v, k) : _mm_cmpgt_epi8(k, v);
+                result += __builtin_popcount(_mm_movemask_epi8(match));
+            }
+        }
+
+        if (or_equal)
+            result = i - result;
+        return result + count_scalar<or_equal>(keys + i, count - i, key);
+    }
+#else
+    template<bool or_equal, typename Key>
+    inline uint32_t count_vector(const Key *keys, uint32_t count, Key key) {
+        return count_scalar<or_equal>(keys, count, key);
+    }
+#endif
+
+    template<bool or_equal, typename Key>
+    inline uint32_t count(const Key *keys, uint32_t count, Key key) {
+        if constexpr (kVectorKey<Key>)
+            return count_vector<or_equal>(keys, count, key);
+        else
+            return count_scalar<or_equal>(keys, count, key);
+    }
+
+    // first index where the key is not below `key`, or above it for `or_equal`
+    template<bool or_equal, typename Key>
+    inline uint32_t search(const Key *keys, uint32_t count, Key key) {
+        const Key *base = keys;
+        uint32_t length = count;
+
+        // the result stays within [base, base + length], the select compiles to a cmov
+        while (length > kWindow<Key>) {
+            uint32_t half = length / 2;
+            // both candidates for the next probe
+            __builtin_prefetch(base + half / 2);
+            __builtin_prefetch(base + half + half / 2);
+
+            bool right = or_equal ? !(key < base[half]) : base[half] < key;
+            base = right ? base + half : base;
+            length -= half;
+        }
+
+        return static_cast<uint32_t>(base - keys) + node_search::count<or_equal>(base, length, key);
+    }
+
+}  // namespace node_search
+// ---------------------------------------------------------------------------------------------------
+template<typename Key, typename Compare>
+uint32_t search_lower_bound(const Key *keys, uint32_t count, const Key &key, Compare comp) {
+    if constexpr (kVectorizedSearch<Key, Compare>)
+        return node_search::search<false>(keys, count, key);
+    else
+        return std::lower_bound(keys, keys + count, key, comp) - keys;
+}
+
+template<typename Key, typename Compare>
+uint32_t search_upper_bound(const Key *keys, uint32_t count, const Key &key, Compare comp) {
+    if constexpr (kVectorizedSearch<Key, Compare>)
+        return node_search::search<true>(keys, count, key);
+    else
+        return std::upper_bound(keys, keys + count, key, comp) - keys;
+}
+// ---------------------------------------------------------------------------------------------------
+template<typename Key>
+void LearnedModel<Key>::build(const Key *keys, uint32_t n) {
+    using Unsigned = std::make_unsigned_t<Key>;
+    segments = static_cast<uint8_t>(std::min(n, kSegments));
+    for (uint32_t j = 0; j < segments; ++j) {
+        uint32_t start = j * n / segments, end = (j + 1) * n / segments;
+        Unsigned span = static_cast<Unsigned>(keys[end - 1]) - static_cast<Unsigned>(keys[start]);
+        firsts[j] = keys[start];
+        slopes[j] = span == 0 ? 0.0f : static_cast<float>(end - 1 - start) / static_cast<float>(span);
+
+        uint32_t error = 0;
+        for (uint32_t i = start; i < end; ++i) {
+            uint32_t position = guess(j, start, keys[i], n);
+            error = std::max(error, position > i ? position - i : i - position);
+        }
+        errors[j] = static_cast<uint16_t>(std::min<uint32_t>(error, std::numeric_limits<uint16_t>::max()));
+    }
+}
+
+template<typename Key>
+template<bool upper>
+uint32_t LearnedModel<Key>::search(const Key *keys, uint32_t n, const Key &key) const {
+    // the run with the last first key not above `key`, the result lies between its start and the
+    // start of the next run
+    uint32_t m = std::min<uint32_t>(segments, kSegments);
+    uint32_t j = search_upper_bound(firsts, m, key, std::less<Key>());
+    if (j == 0 || n == 0)
+        return 0;
+    --j;
+    uint32_t start = j * n / m, end = (j + 1) * n / m;
+
+    // guesses grow with the key, so the guess for `key` misses by at most one more than the ones for
+    // its neighbours in the run
+    int64_t position = guess(j, start, key, n);
+    int64_t error = errors[j];
+    uint32_t lo = static_cast<uint32_t>(std::clamp<int64_t>(position - error, start, end));
+    uint32_t hi = static_cast<uint32_t>(std::clamp<int64_t>(position + error + 1, lo, end));
+    if constexpr (upper)
+        return lo + search_upper_bound(keys + lo, hi - lo, key, std::less<Key>());
+    else
+        return lo + search_lower_bound(keys + lo, hi - lo, key, std::less<Key>());
+}
+
+template<typename Key>
+uint32_t LearnedModel<Key>::guess(uint32_t segment, uint32_t start, const Key &key, uint32_t n) const {
+    using Unsigned = std::make_unsigned_t<Key>;
+    Unsigned distance = static_cast<Unsigned>(key) - static_cast<Unsigned>(firsts[segment]);
+    // also catches the NaN and infinite slopes of inconsistent models
+    double offset = static_cast<double>(distance) * slopes[segment];
+    if (!(offset < n - start))
+        return n;
+    return start + static_cast<uint32_t>(std::max(offset, 0.0));
+}
+// ---------------------------------------------------------------------------------------------------
+}  // namespace imlab
+// ---------------------------------------------------------------------------------------------------
+#endif  // SRC_NODE_SEARCH_HPP_
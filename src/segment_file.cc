@@ -68,7 +68,8 @@ namespace {
 #endif
 }  // namespace
 
-SegmentFile::SegmentFile(uint64_t page_id, size_t page_size) : page_size(page_size) {
+SegmentFile::SegmentFile(uint64_t page_id, size_t page_size, size_t page_count)
+    : length(page_size * page_count) {
     std::string filename = save_directory();
     filename += std::to_string(segment_id(page_id));
 
@@ -83,8 +84,8 @@ SegmentFile::SegmentFile(uint64_t page_id, size_t page_size) : page_size(page_si
         throw_errno();
     }
 
-    if (file_stat.st_size < pos + page_size) {
-        if (ftruncate(fd, pos + page_size) < 0)
+    if (file_stat.st_size < pos + length) {
+        if (ftruncate(fd, pos + length) < 0)
             throw_errno();
     }
 }
@@ -103,10 +104,18 @@ void SegmentFile::write(std::byte *data) {
 }
 
 
+void SegmentFile::remove(uint16_t segment_id) {
+    std::string filename = save_directory();
+    filename += std::to_string(segment_id);
+
+    if (unlink(filename.c_str()) < 0 && errno != ENOENT)
+        throw_errno();
+}
+
 template<typename Op> void SegmentFile::prw_loop(Op op, std::byte *data) {
     size_t total_bytes = 0;
-    while (total_bytes < page_size) {
-        ssize_t bytes = op(fd, data + total_bytes, page_size - total_bytes, pos + total_bytes);
+    while (total_bytes < length) {
+        ssize_t bytes = op(fd, data + total_bytes, length - total_bytes, pos + total_bytes);
 
         if (bytes == 0) {
             // This should probably never happen. Return here to prevent
@@ -9,8 +9,9 @@
 #include <optional>
 #include <vector>
 // ---------------------------------------------------------------------------------------------------
-template<typename Key, typename T, size_t page_size, size_t epsilon,  typename Compare>
-void imlab::BeTree<Key, T, page_size, epsilon, Compare>::check_be_invariants() const {
+template<typename Key, typename T, size_t page_size, size_t epsilon,  typename Compare,
+         template<size_t> class Storage>
+void imlab::BeTree<Key, T, page_size, epsilon, Compare, Storage>::check_be_invariants() const {
     if (!root)
         return;
 
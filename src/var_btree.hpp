@@ -0,0 +1,637 @@
+// ---------------------------------------------------------------------------------------------------
+// IMLAB
+// ---------------------------------------------------------------------------------------------------
+#ifndef SRC_VAR_BTREE_HPP_
+#define SRC_VAR_BTREE_HPP_
+// ---------------------------------------------------------------------------------------------------
+#include "imlab/var_btree.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <vector>
+#include <utility>
+
+namespace imlab {
+// ---------------------------------------------------------------------------------------------------
+IMLAB_VAR_BTREE_TEMPL void IMLAB_VAR_BTREE_CLASS::Node::init(
+        uint16_t level, std::optional<std::string_view> lower, std::optional<std::string_view> upper) {
+    static_assert(sizeof(Node) == kNodeHeader);
+    static_assert(sizeof(Slot) == kSlotSize);
+
+    this->level = level;
+    count = 0;
+    heap_begin = kHeapEnd;
+    garbage = 0;
+    link = kMetadataPage;
+
+    has_lower = lower.has_value();
+    has_upper = upper.has_value();
+    lower_offset = has_lower ? push_heap(*lower) : 0;
+    lower_length = has_lower ? lower->size() : 0;
+    upper_offset = has_upper ? push_heap(*upper) : 0;
+    upper_length = has_upper ? upper->size() : 0;
+
+    // every key within the fences starts with their common prefix
+    prefix_length = 0;
+    if (has_lower && has_upper) {
+        auto mismatch = std::mismatch(lower->begin(), lower->end(), upper->begin(), upper->end());
+        prefix_length = mismatch.first - lower->begin();
+    }
+}
+
+IMLAB_VAR_BTREE_TEMPL bool IMLAB_VAR_BTREE_CLASS::Node::is_leaf() const {
+    return level == 0;
+}
+
+IMLAB_VAR_BTREE_TEMPL uint16_t IMLAB_VAR_BTREE_CLASS::Node::get_level() const {
+    return level;
+}
+
+IMLAB_VAR_BTREE_TEMPL uint16_t IMLAB_VAR_BTREE_CLASS::Node::size() const {
+    return count;
+}
+
+IMLAB_VAR_BTREE_TEMPL std::string_view IMLAB_VAR_BTREE_CLASS::Node::prefix() const {
+    return {bytes() + lower_offset, prefix_length};
+}
+
+IMLAB_VAR_BTREE_TEMPL std::optional<std::string_view> IMLAB_VAR_BTREE_CLASS::Node::lower_fence() const {
+    if (!has_lower)
+        return {};
+    return std::string_view(bytes() + lower_offset, lower_length);
+}
+
+IMLAB_VAR_BTREE_TEMPL std::optional<std::string_view> IMLAB_VAR_BTREE_CLASS::Node::upper_fence() const {
+    if (!has_upper)
+        return {};
+    return std::string_view(bytes() + upper_offset, upper_length);
+}
+
+IMLAB_VAR_BTREE_TEMPL std::pair<uint32_t, bool> IMLAB_VAR_BTREE_CLASS::Node::lower_bound(std::string_view key) const {
+    assert(key.substr(0, prefix_length) == prefix());
+    std::string_view s = key.substr(prefix_length);
+    Head head = make_head(s);
+
+    // only equal heads need to look at the key bytes
+    const Slot *slot = slots();
+    uint32_t lo = 0, hi = count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        bool less = slot[mid].head < head || (slot[mid].head == head && suffix(mid) < s);
+        if (less)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return {lo, lo < count && slot[lo].head == head && suffix(lo) == s};
+}
+
+IMLAB_VAR_BTREE_TEMPL std::string_view IMLAB_VAR_BTREE_CLASS::Node::suffix(uint32_t idx) const {
+    assert(idx < count);
+    const Slot &slot = slots()[idx];
+    return {bytes() + slot.offset, slot.key_length};
+}
+
+IMLAB_VAR_BTREE_TEMPL std::string IMLAB_VAR_BTREE_CLASS::Node::key(uint32_t idx) const {
+    std::string result(prefix());
+    result += suffix(idx);
+    return result;
+}
+
+IMLAB_VAR_BTREE_TEMPL std::string_view IMLAB_VAR_BTREE_CLASS::Node::value(uint32_t idx) const {
+    assert(idx < count);
+    const Slot &slot = slots()[idx];
+    return {bytes() + slot.offset + slot.key_length, slot.value_length};
+}
+
+IMLAB_VAR_BTREE_TEMPL uint64_t IMLAB_VAR_BTREE_CLASS::Node::child(uint32_t idx) const {
+    assert(!is_leaf() && idx <= count);
+    if (idx == count)
+        return link;
+    return decode_page(value(idx));
+}
+
+IMLAB_VAR_BTREE_TEMPL void IMLAB_VAR_BTREE_CLASS::Node::set_child(uint32_t idx, uint64_t page) {
+    assert(!is_leaf() && idx <= count);
+    if (idx == count)
+        link = page;
+    else
+        std::memcpy(bytes() + slots()[idx].offset + slots()[idx].key_length, &page, sizeof(page));
+}
+
+IMLAB_VAR_BTREE_TEMPL uint64_t IMLAB_VAR_BTREE_CLASS::Node::child_for(std::string_view key) const {
+    return child(lower_bound(key).first);
+}
+
+IMLAB_VAR_BTREE_TEMPL uint64_t IMLAB_VAR_BTREE_CLASS::Node::get_next() const {
+    assert(is_leaf());
+    return link;
+}
+
+IMLAB_VAR_BTREE_TEMPL void IMLAB_VAR_BTREE_CLASS::Node::set_next(uint64_t page) {
+    assert(is_leaf());
+    link = page;
+}
+
+IMLAB_VAR_BTREE_TEMPL bool IMLAB_VAR_BTREE_CLASS::Node::fits(uint32_t payload) const {
+    return contiguous_space() + garbage >= payload + sizeof(Slot);
+}
+
+IMLAB_VAR_BTREE_TEMPL void IMLAB_VAR_BTREE_CLASS::Node::insert(uint32_t idx, std::string_view key, std::string_view value) {
+    assert(idx <= count);
+    assert(key.substr(0, prefix_length) == prefix());
+    std::string_view s = key.substr(prefix_length);
+
+    assert(fits(s.size() + value.size()));
+    if (contiguous_space() < s.size() + value.size() + sizeof(Slot))
+        compact();
+
+    // move the slots to the right, the heap position does not matter
+    std::memmove(slots() + idx + 1, slots() + idx, (count - idx) * sizeof(Slot));
+    uint32_t end = count;
+    count = idx;
+    append_suffix(s, value, make_head(s));
+    count = end + 1;
+}
+
+IMLAB_VAR_BTREE_TEMPL void IMLAB_VAR_BTREE_CLASS::Node::erase(uint32_t idx) {
+    assert(idx < count);
+    garbage += slots()[idx].key_length + slots()[idx].value_length;
+    std::memmove(slots() + idx, slots() + idx + 1, (count - idx - 1) * sizeof(Slot));
+    --count;
+}
+
+IMLAB_VAR_BTREE_TEMPL std::string IMLAB_VAR_BTREE_CLASS::Node::separator(std::string_view left, std::string_view right) {
+    assert(left < right);
+    auto mismatch = std::mismatch(left.begin(), left.end(), right.begin(), right.end());
+    size_t common = mismatch.first - left.begin();
+
+    // one byte past the common prefix of `right` is already greater than `left`
+    if (right.size() > common + 1)
+        return std::string(right.substr(0, common + 1));
+    return std::string(left);
+}
+
+IMLAB_VAR_BTREE_TEMPL std::string IMLAB_VAR_BTREE_CLASS::Node::encode_page(uint64_t page) {
+    return std::string(reinterpret_cast<const char *>(&page), sizeof(page));
+}
+
+IMLAB_VAR_BTREE_TEMPL uint64_t IMLAB_VAR_BTREE_CLASS::Node::decode_page(std::string_view value) {
+    assert(value.size() == sizeof(uint64_t));
+    uint64_t page;
+    std::memcpy(&page, value.data(), sizeof(page));
+    return page;
+}
+
+IMLAB_VAR_BTREE_TEMPL typename IMLAB_VAR_BTREE_CLASS::Node::Head IMLAB_VAR_BTREE_CLASS::Node::make_head(std::string_view suffix) {
+    Head head = 0;
+    for (size_t i = 0; i < sizeof(Head); ++i)
+        head = (head << 8) | (i < suffix.size() ? static_cast<uint8_t>(suffix[i]) : 0);
+    return head;
+}
+
+IMLAB_VAR_BTREE_TEMPL typename IMLAB_VAR_BTREE_CLASS::Node::Slot *IMLAB_VAR_BTREE_CLASS::Node::slots() {
+    return reinterpret_cast<Slot *>(bytes() + sizeof(Node));
+}
+
+IMLAB_VAR_BTREE_TEMPL const typename IMLAB_VAR_BTREE_CLASS::Node::Slot *IMLAB_VAR_BTREE_CLASS::Node::slots() const {
+    return reinterpret_cast<const Slot *>(bytes() + sizeof(Node));
+}
+
+IMLAB_VAR_BTREE_TEMPL const char *IMLAB_VAR_BTREE_CLASS::Node::bytes() const {
+    return reinterpret_cast<const char *>(this);
+}
+
+IMLAB_VAR_BTREE_TEMPL char *IMLAB_VAR_BTREE_CLASS::Node::bytes() {
+    return reinterpret_cast<char *>(this);
+}
+
+IMLAB_VAR_BTREE_TEMPL uint32_t IMLAB_VAR_BTREE_CLASS::Node::contiguous_space() const {
+    return heap_begin - sizeof(Node) - count * sizeof(Slot);
+}
+
+IMLAB_VAR_BTREE_TEMPL uint16_t IMLAB_VAR_BTREE_CLASS::Node::push_heap(std::string_view data) {
+    heap_begin -= data.size();
+    std::memcpy(bytes() + heap_begin, data.data(), data.size());
+    return heap_begin;
+}
+
+IMLAB_VAR_BTREE_TEMPL void IMLAB_VAR_BTREE_CLASS::Node::append_suffix(std::string_view suffix, std::string_view value, Head head) {
+    assert(contiguous_space() >= suffix.size() + value.size() + sizeof(Slot));
+    push_heap(value);
+    Slot &slot = slots()[count++];
+    slot.offset = push_heap(suffix);
+    slot.key_length = suffix.size();
+    slot.value_length = value.size();
+    slot.head = head;
+}
+
+IMLAB_VAR_BTREE_TEMPL void IMLAB_VAR_BTREE_CLASS::Node::compact() {
+    alignas(Node) char buffer[page_size];
+    std::memcpy(buffer, bytes(), page_size);
+    const Node &old = *reinterpret_cast<const Node *>(buffer);
+
+    // same fences, so the same prefix
+    init(old.level, old.lower_fence(), old.upper_fence());
+    link = old.link;
+    for (uint32_t i = 0; i < old.count; ++i)
+        append_suffix(old.suffix(i), old.value(i), old.slots()[i].head);
+}
+// ---------------------------------------------------------------------------------------------------
+IMLAB_VAR_BTREE_TEMPL bool IMLAB_VAR_BTREE_CLASS::Metadata::matches() const {
+    return magic == kMagic && page_bytes == page_size;
+}
+// ---------------------------------------------------------------------------------------------------
+IMLAB_VAR_BTREE_TEMPL IMLAB_VAR_BTREE_CLASS::VarBTree(reopen_t, uint16_t segment_id, BufferManager<page_size> &manager)
+    : Segment<page_size>(segment_id, manager) {
+    auto fix = this->fix(kMetadataPage);
+    const auto &meta = *fix.template as<Metadata>();
+    if (!meta.matches())
+        throw segment_format_error();
+    // the nodes may be ahead of the fields, their pages were written back or replayed from the log
+    if (!meta.checkpointed)
+        throw stale_metadata_error();
+
+    if (meta.has_root)
+        root = meta.root;
+    next_page_id = meta.next_page_id;
+    count = meta.count;
+    leaves = meta.leaf_count;
+    inners = meta.inner_count;
+    metadata_current = true;
+}
+
+IMLAB_VAR_BTREE_TEMPL IMLAB_VAR_BTREE_CLASS::~VarBTree() {
+    if (this->is_temporary())
+        return;
+    // best effort, a tree that cannot be stored does not reopen
+    try {
+        write_metadata();
+    } catch (...) {
+    }
+}
+
+IMLAB_VAR_BTREE_TEMPL typename IMLAB_VAR_BTREE_CLASS::const_iterator IMLAB_VAR_BTREE_CLASS::begin() const {
+    const_iterator it(*this, find_leaf({}, true), 0);
+    it.skip_empty();
+    return it;
+}
+
+IMLAB_VAR_BTREE_TEMPL typename IMLAB_VAR_BTREE_CLASS::const_iterator IMLAB_VAR_BTREE_CLASS::end() const {
+    return const_iterator(*this, {}, 0);
+}
+
+IMLAB_VAR_BTREE_TEMPL typename IMLAB_VAR_BTREE_CLASS::const_iterator IMLAB_VAR_BTREE_CLASS::lower_bound(std::string_view key) const {
+    auto fix = find_leaf(key);
+    if (!fix.data())
+        return end();
+
+    // larger than every key of the leaf, continue with the next one
+    uint32_t idx = fix.template as<Node>()->lower_bound(key).first;
+    const_iterator it(*this, std::move(fix), idx);
+    it.skip_empty();
+    return it;
+}
+
+IMLAB_VAR_BTREE_TEMPL typename IMLAB_VAR_BTREE_CLASS::const_iterator IMLAB_VAR_BTREE_CLASS::find(std::string_view key) const {
+    auto fix = find_leaf(key);
+    if (!fix.data())
+        return end();
+
+    auto [idx, found] = fix.template as<Node>()->lower_bound(key);
+    return found ? const_iterator(*this, std::move(fix), idx) : end();
+}
+
+IMLAB_VAR_BTREE_TEMPL std::optional<std::string> IMLAB_VAR_BTREE_CLASS::lookup(std::string_view key) const {
+    auto fix = find_leaf(key);
+    if (!fix.data())
+        return {};
+
+    const auto &leaf = *fix.template as<Node>();
+    auto [idx, found] = leaf.lower_bound(key);
+    if (!found)
+        return {};
+    return std::string(leaf.value(idx));
+}
+
+IMLAB_VAR_BTREE_TEMPL void IMLAB_VAR_BTREE_CLASS::insert(std::string_view key, std::string_view value) {
+    insert_internal(key, value, false);
+}
+
+IMLAB_VAR_BTREE_TEMPL void IMLAB_VAR_BTREE_CLASS::insert_or_assign(std::string_view key, std::string_view value) {
+    insert_internal(key, value, true);
+}
+
+IMLAB_VAR_BTREE_TEMPL void IMLAB_VAR_BTREE_CLASS::erase(std::string_view key) {
+    if (metadata_current.load())
+        invalidate_metadata();
+    auto fix = find_leaf_exclusive(key);
+    if (!fix.data())
+        return;
+
+    auto &leaf = *fix.template as<Node>();
+    auto [idx, found] = leaf.lower_bound(key);
+    if (found) {
+        leaf.erase(idx);
+        --count;
+        fix.set_dirty();
+    }
+}
+
+IMLAB_VAR_BTREE_TEMPL uint64_t IMLAB_VAR_BTREE_CLASS::size() const {
+    return count;
+}
+
+IMLAB_VAR_BTREE_TEMPL uint16_t IMLAB_VAR_BTREE_CLASS::depth() const {
+    auto fix = root_fix();
+    if (fix.data())
+        return fix.template as<Node>()->get_level();
+    return 0;
+}
+
+IMLAB_VAR_BTREE_TEMPL uint64_t IMLAB_VAR_BTREE_CLASS::leaf_count() const {
+    return leaves;
+}
+
+IMLAB_VAR_BTREE_TEMPL uint64_t IMLAB_VAR_BTREE_CLASS::inner_count() const {
+    return inners;
+}
+
+IMLAB_VAR_BTREE_TEMPL void IMLAB_VAR_BTREE_CLASS::checkpoint() {
+    write_metadata();
+    this->commit();
+}
+
+IMLAB_VAR_BTREE_TEMPL void IMLAB_VAR_BTREE_CLASS::write_metadata() {
+    auto fix = this->fix_exclusive(kMetadataPage);
+    auto &meta = *fix.template as<Metadata>();
+    meta.magic = Metadata::kMagic;
+    meta.page_bytes = page_size;
+    meta.checkpointed = true;
+
+    meta.root = root;
+    meta.has_root = root != kNoRoot;
+    meta.next_page_id = next_page_id;
+    meta.count = count;
+    meta.leaf_count = leaves;
+    meta.inner_count = inners;
+    fix.set_dirty();
+    metadata_current = !this->is_temporary();
+}
+
+IMLAB_VAR_BTREE_TEMPL void IMLAB_VAR_BTREE_CLASS::invalidate_metadata() {
+    std::unique_lock<std::mutex> lock(metadata_mutex);
+    if (!metadata_current.load())
+        return;
+    // the log record precedes those of the write, so a replay never gets its nodes without it
+    auto fix = this->fix_exclusive(kMetadataPage);
+    fix.template as<Metadata>()->checkpointed = false;
+    fix.set_dirty();
+    fix.unfix();
+    metadata_current = false;
+}
+
+IMLAB_VAR_BTREE_TEMPL typename IMLAB_VAR_BTREE_CLASS::Fix IMLAB_VAR_BTREE_CLASS::root_fix() const {
+    for (;;) {
+        uint64_t id = root.load();
+        if (id == kNoRoot)
+            return {};
+
+        auto fix = this->fix(id);
+        if (root.load() == id)
+            return fix;
+    }
+}
+
+IMLAB_VAR_BTREE_TEMPL typename IMLAB_VAR_BTREE_CLASS::ExclusiveFix IMLAB_VAR_BTREE_CLASS::root_fix_exclusive() {
+    for (;;) {
+        uint64_t id = root.load();
+        if (id == kNoRoot) {
+            std::unique_lock<std::mutex> lock(root_mutex);
+            if (root.load() != kNoRoot)
+                continue;
+
+            auto fix = new_node(0);
+            root = this->page_id(fix);
+            return fix;
+        }
+
+        auto fix = this->fix_exclusive(id);
+        if (root.load() == id)
+            return fix;
+    }
+}
+
+IMLAB_VAR_BTREE_TEMPL typename IMLAB_VAR_BTREE_CLASS::Fix IMLAB_VAR_BTREE_CLASS::find_leaf(std::string_view key, bool first) const {
+    auto fix = root_fix();
+    if (!fix.data())
+        return fix;
+
+    while (!fix.template as<Node>()->is_leaf()) {
+        const auto &inner = *fix.template as<Node>();
+        fix = this->fix(first ? inner.child(0) : inner.child_for(key));
+    }
+
+    return fix;
+}
+
+IMLAB_VAR_BTREE_TEMPL typename IMLAB_VAR_BTREE_CLASS::ExclusiveFix IMLAB_VAR_BTREE_CLASS::find_leaf_exclusive(std::string_view key) {
+    for (;;) {
+        auto fix = root_fix();
+        if (!fix.data())
+            return {};
+
+        // a leaf root is refixed exclusively, it stays a leaf but might not be the root anymore
+        if (fix.template as<Node>()->is_leaf()) {
+            uint64_t id = this->page_id(fix);
+            fix.unfix();
+
+            auto leaf = this->fix_exclusive(id);
+            if (root.load() == id)
+                return leaf;
+            continue;
+        }
+
+        while (fix.template as<Node>()->get_level() > 1)
+            fix = this->fix(fix.template as<Node>()->child_for(key));
+
+        return this->fix_exclusive(fix.template as<Node>()->child_for(key));
+    }
+}
+
+IMLAB_VAR_BTREE_TEMPL typename IMLAB_VAR_BTREE_CLASS::ExclusiveFix IMLAB_VAR_BTREE_CLASS::new_node(uint16_t level) {
+    auto fix = this->fix_exclusive(next_page_id++);
+    fix.template as<Node>()->init(level, {}, {});
+    fix.set_dirty();
+    ++(level == 0 ? leaves : inners);
+
+    return fix;
+}
+
+IMLAB_VAR_BTREE_TEMPL void IMLAB_VAR_BTREE_CLASS::insert_internal(std::string_view key, std::string_view value, bool assign) {
+    if (key.size() + value.size() > kMaxEntry)
+        throw entry_too_large_error();
+    if (metadata_current.load())
+        invalidate_metadata();
+
+    // only the leaf is fixed exclusively, unless it has to be split
+    ExclusiveFix fix;
+    for (;;) {
+        fix = find_leaf_exclusive(key);
+        if (fix.data())
+            break;
+
+        // empty tree, someone else might create the root and split it before we get to it
+        fix = root_fix_exclusive();
+        if (fix.template as<Node>()->is_leaf())
+            break;
+        fix.unfix();
+    }
+
+    for (bool retried = false;; retried = true) {
+        auto &leaf = *fix.template as<Node>();
+        auto [idx, found] = leaf.lower_bound(key);
+        if (found && !assign)
+            return;
+
+        if (leaf.fits(key.size() - leaf.prefix().size() + value.size())) {
+            if (found)
+                leaf.erase(idx);
+            else
+                ++count;
+            leaf.insert(idx, key, value);
+            fix.set_dirty();
+            return;
+        }
+
+        assert(!retried);
+        fix.unfix();
+        fix = insert_lc_early_split(key);
+    }
+}
+
+IMLAB_VAR_BTREE_TEMPL typename IMLAB_VAR_BTREE_CLASS::ExclusiveFix IMLAB_VAR_BTREE_CLASS::insert_lc_early_split(std::string_view key) {
+    ExclusiveFix parent;
+    auto fix = root_fix_exclusive();
+
+    for (;;) {
+        // an inner node must take a separator of the maximal size
+        if (!fix.template as<Node>()->fits(kMaxEntry + sizeof(uint64_t)))
+            split(parent, fix, key);
+        if (fix.template as<Node>()->is_leaf())
+            return fix;
+
+        uint64_t child = fix.template as<Node>()->child_for(key);
+        parent = std::move(fix);
+        fix = this->fix_exclusive(child);
+    }
+}
+
+IMLAB_VAR_BTREE_TEMPL void IMLAB_VAR_BTREE_CLASS::split(ExclusiveFix &parent, ExclusiveFix &child, std::string_view key) {
+    auto &node = *child.template as<Node>();
+    uint16_t level = node.get_level();
+    bool leaf = node.is_leaf();
+    uint32_t n = node.size();
+    assert(n >= (leaf ? 2 : 3));
+
+    bool new_root = !parent.data();
+    if (new_root)
+        parent = new_node(level + 1);
+
+    // the node is rebuilt in place, so copy everything out first
+    std::vector<std::pair<std::string, std::string>> entries;
+    size_t total = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        entries.emplace_back(node.key(i), node.value(i));
+        total += node.suffix(i).size() + node.value(i).size() + sizeof(typename Node::Slot);
+    }
+    std::optional<std::string> lower, upper;
+    if (node.lower_fence())
+        lower = std::string(*node.lower_fence());
+    if (node.upper_fence())
+        upper = std::string(*node.upper_fence());
+    uint64_t link = leaf ? node.get_next() : node.child(n);
+
+    // split by bytes, an inner split pushes the middle key up
+    uint32_t mid = 0;
+    for (size_t bytes = 0; mid < n && 2 * bytes < total; ++mid)
+        bytes += entries[mid].first.size() + entries[mid].second.size();
+    mid = std::clamp<uint32_t>(mid, 1, leaf ? n - 1 : n - 2);
+
+    std::string separator = leaf ? Node::separator(entries[mid - 1].first, entries[mid].first) : entries[mid].first;
+
+    auto split = new_node(level);
+    uint64_t split_page = this->page_id(split);
+    auto &right = *split.template as<Node>();
+    right.init(level, separator, upper);
+    for (uint32_t i = leaf ? mid : mid + 1; i < n; ++i)
+        right.insert(right.size(), entries[i].first, entries[i].second);
+    if (leaf)
+        right.set_next(link);
+    else
+        right.set_child(right.size(), link);
+
+    node.init(level, lower, separator);
+    for (uint32_t i = 0; i < mid; ++i)
+        node.insert(node.size(), entries[i].first, entries[i].second);
+    if (leaf)
+        node.set_next(split_page);
+    else
+        node.set_child(node.size(), Node::decode_page(entries[mid].second));
+
+    // the separator points to the left half, the entry that pointed to the node now to the right one
+    auto &pnode = *parent.template as<Node>();
+    uint64_t child_page = this->page_id(child);
+    uint32_t pos = pnode.lower_bound(separator).first;
+    pnode.insert(pos, separator, Node::encode_page(child_page));
+    pnode.set_child(pos + 1, split_page);
+
+    parent.set_dirty();
+    child.set_dirty();
+    split.set_dirty();
+
+    // readers validate the root after fixing it, the old root is still fixed here
+    if (new_root)
+        root = this->page_id(parent);
+    if (separator < key)
+        child = std::move(split);
+}
+// ---------------------------------------------------------------------------------------------------
+IMLAB_VAR_BTREE_TEMPL typename IMLAB_VAR_BTREE_CLASS::const_iterator &IMLAB_VAR_BTREE_CLASS::const_iterator::operator++() {
+    ++i;
+    skip_empty();
+    return *this;
+}
+
+IMLAB_VAR_BTREE_TEMPL bool IMLAB_VAR_BTREE_CLASS::const_iterator::operator==(const const_iterator &other) const {
+    return fix.data() == other.fix.data() && i == other.i;
+}
+
+IMLAB_VAR_BTREE_TEMPL bool IMLAB_VAR_BTREE_CLASS::const_iterator::operator!=(const const_iterator &other) const {
+    return !(*this == other);
+}
+
+IMLAB_VAR_BTREE_TEMPL std::string IMLAB_VAR_BTREE_CLASS::const_iterator::key() const {
+    return fix.template as<Node>()->key(i);
+}
+
+IMLAB_VAR_BTREE_TEMPL std::string_view IMLAB_VAR_BTREE_CLASS::const_iterator::value() const {
+    return fix.template as<Node>()->value(i);
+}
+
+IMLAB_VAR_BTREE_TEMPL void IMLAB_VAR_BTREE_CLASS::const_iterator::skip_empty() {
+    while (fix.data() && i >= fix.template as<Node>()->size()) {
+        uint64_t next = fix.template as<Node>()->get_next();
+        if (next == kMetadataPage)
+            fix.unfix();
+        else
+            fix = segment.fix(next);
+        i = 0;
+    }
+}
+// ---------------------------------------------------------------------------------------------------
+}  // namespace imlab
+// ---------------------------------------------------------------------------------------------------
+#endif  // SRC_VAR_BTREE_HPP_
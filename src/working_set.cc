@@ -0,0 +1,72 @@
+// ---------------------------------------------------------------------------------------------------
+#include "imlab/working_set.h"
+
+#include <cstdio>
+#include <fstream>
+#include <system_error>
+// ---------------------------------------------------------------------------------------------------
+namespace imlab {
+
+namespace {
+
+    constexpr uint64_t kMagic = 0x31305f7465736b77;  // "wkset_01"
+
+    void write_u64(std::ostream &out, uint64_t value) {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    bool read_u64(std::istream &in, uint64_t &value) {
+        return static_cast<bool>(in.read(reinterpret_cast<char *>(&value), sizeof(value)));
+    }
+
+    bool read_ids(std::istream &in, uint64_t count, std::vector<uint64_t> &ids) {
+        ids.resize(count);
+        return static_cast<bool>(in.read(reinterpret_cast<char *>(ids.data()), count * sizeof(uint64_t)));
+    }
+
+}  // namespace
+// ---------------------------------------------------------------------------------------------------
+void WorkingSet::save(const std::string &path) const {
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out)
+            throw std::system_error{errno, std::system_category()};
+
+        write_u64(out, kMagic);
+        write_u64(out, fifo.size());
+        write_u64(out, lru.size());
+        out.write(reinterpret_cast<const char *>(fifo.data()), fifo.size() * sizeof(uint64_t));
+        out.write(reinterpret_cast<const char *>(lru.data()), lru.size() * sizeof(uint64_t));
+
+        out.flush();
+        if (!out)
+            throw std::system_error{errno, std::system_category()};
+    }
+
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+        throw std::system_error{errno, std::system_category()};
+}
+
+WorkingSet WorkingSet::load(const std::string &path) {
+    WorkingSet result;
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in)
+        return result;
+    uint64_t file_size = static_cast<uint64_t>(in.tellg());
+    in.seekg(0);
+
+    // a list is only a hint, never trust a damaged one
+    uint64_t magic, fifo_count, lru_count;
+    if (!read_u64(in, magic) || magic != kMagic || !read_u64(in, fifo_count) || !read_u64(in, lru_count))
+        return {};
+    if (file_size != (3 + fifo_count + lru_count) * sizeof(uint64_t))
+        return {};
+    if (!read_ids(in, fifo_count, result.fifo) || !read_ids(in, lru_count, result.lru))
+        return {};
+
+    return result;
+}
+
+}  // namespace imlab
+// ---------------------------------------------------------------------------------------------------
@@ -0,0 +1,215 @@
+// ---------------------------------------------------------------------------------------------------
+#include "imlab/write_ahead_log.h"
+
+#include <chrono>
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// ---------------------------------------------------------------------------------------------------
+namespace imlab {
+
+namespace {
+
+    // page_id, offset, length, checksum
+    constexpr size_t kHeaderSize = sizeof(uint64_t) + 3 * sizeof(uint32_t);
+
+    // waits are bounded and re-check their condition
+    constexpr std::chrono::milliseconds kWaitInterval{10};
+
+    [[noreturn]] void throw_errno() {
+        throw std::system_error{errno, std::system_category()};
+    }
+
+    // FNV-1a, only used to detect torn records at the end of the log
+    uint32_t checksum(const std::byte *header, const std::byte *data, uint32_t length) {
+        uint32_t hash = 2166136261u;
+        auto update = [&hash](const std::byte *bytes, size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                hash ^= static_cast<uint32_t>(bytes[i]);
+                hash *= 16777619u;
+            }
+        };
+
+        update(header, kHeaderSize - sizeof(uint32_t));
+        update(data, length);
+        return hash;
+    }
+
+    void pread_all(int fd, std::byte *data, size_t size, uint64_t pos) {
+        size_t total = 0;
+        while (total < size) {
+            ssize_t bytes = pread(fd, data + total, size - total, pos + total);
+            if (bytes < 0)
+                throw_errno();
+            if (bytes == 0)
+                return;
+            total += static_cast<size_t>(bytes);
+        }
+    }
+
+}  // namespace
+// ---------------------------------------------------------------------------------------------------
+WriteAheadLog::WriteAheadLog(const std::string &path) {
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+    if (fd < 0)
+        throw_errno();
+
+    // cut off a torn tail so new records follow the valid prefix
+    next_lsn = durable_lsn = scan(nullptr);
+    if (ftruncate(fd, next_lsn) < 0)
+        throw_errno();
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    close(fd);
+}
+
+uint64_t WriteAheadLog::append(uint64_t page_id, uint32_t offset, const std::byte *data, uint32_t length) {
+    std::byte header[kHeaderSize];
+    std::memcpy(header, &page_id, sizeof(page_id));
+    std::memcpy(header + 8, &offset, sizeof(offset));
+    std::memcpy(header + 12, &length, sizeof(length));
+    uint32_t sum = checksum(header, data, length);
+    std::memcpy(header + 16, &sum, sizeof(sum));
+
+    std::unique_lock<std::mutex> lock(mutex);
+    buffer.insert(buffer.end(), header, header + kHeaderSize);
+    buffer.insert(buffer.end(), data, data + length);
+    next_lsn += kHeaderSize + length;
+
+    return next_lsn;
+}
+
+void WriteAheadLog::flush(uint64_t lsn) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (durable_lsn < lsn) {
+        // someone else is writing, their sync might already cover us
+        if (flushing) {
+            flushed.wait_for(lock, kWaitInterval);
+            continue;
+        }
+
+        // become the group leader and write everything buffered so far
+        flushing = true;
+        std::vector<std::byte> batch;
+        batch.swap(buffer);
+        uint64_t batch_end = next_lsn;
+        uint64_t offset = batch_end - batch.size() - lsn_base;
+
+        lock.unlock();
+        try {
+            write_batch(batch, offset);
+        } catch (...) {
+            lock.lock();
+            buffer.insert(buffer.begin(), batch.begin(), batch.end());
+            flushing = false;
+            flushed.notify_all();
+            throw;
+        }
+        lock.lock();
+
+        durable_lsn = batch_end;
+        ++sync_count;
+        flushing = false;
+        flushed.notify_all();
+    }
+}
+
+void WriteAheadLog::flush() {
+    flush(appended_lsn());
+}
+
+size_t WriteAheadLog::replay(const RedoFn &redo) const {
+    size_t records = 0;
+    RedoFn counting = [&](uint64_t page_id, uint32_t offset, const std::byte *data, uint32_t length) {
+        ++records;
+        redo(page_id, offset, data, length);
+    };
+
+    scan(&counting);
+    return records;
+}
+
+void WriteAheadLog::truncate() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (flushing)
+        flushed.wait_for(lock, kWaitInterval);
+
+    if (ftruncate(fd, 0) < 0)
+        throw_errno();
+    if (fdatasync(fd) < 0)
+        throw_errno();
+
+    buffer.clear();
+    lsn_base = durable_lsn = next_lsn;
+}
+
+uint64_t WriteAheadLog::appended_lsn() const {
+    std::unique_lock<std::mutex> lock(mutex);
+    return next_lsn;
+}
+
+uint64_t WriteAheadLog::flushed_lsn() const {
+    std::unique_lock<std::mutex> lock(mutex);
+    return durable_lsn;
+}
+
+size_t WriteAheadLog::syncs() const {
+    std::unique_lock<std::mutex> lock(mutex);
+    return sync_count;
+}
+
+uint64_t WriteAheadLog::scan(const RedoFn *redo) const {
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0)
+        throw_errno();
+    uint64_t file_size = static_cast<uint64_t>(file_stat.st_size);
+
+    uint64_t pos = 0;
+    std::vector<std::byte> data;
+    while (pos + kHeaderSize <= file_size) {
+        std::byte header[kHeaderSize];
+        pread_all(fd, header, kHeaderSize, pos);
+
+        uint64_t page_id;
+        uint32_t offset, length, sum;
+        std::memcpy(&page_id, header, sizeof(page_id));
+        std::memcpy(&offset, header + 8, sizeof(offset));
+        std::memcpy(&length, header + 12, sizeof(length));
+        std::memcpy(&sum, header + 16, sizeof(sum));
+
+        if (pos + kHeaderSize + length > file_size)
+            break;
+
+        data.resize(length);
+        pread_all(fd, data.data(), length, pos + kHeaderSize);
+        if (checksum(header, data.data(), length) != sum)
+            break;
+
+        if (redo)
+            (*redo)(page_id, offset, data.data(), length);
+        pos += kHeaderSize + length;
+    }
+
+    return pos;
+}
+
+void WriteAheadLog::write_batch(const std::vector<std::byte> &batch, uint64_t offset) {
+    size_t total = 0;
+    while (total < batch.size()) {
+        ssize_t bytes = pwrite(fd, batch.data() + total, batch.size() - total, offset + total);
+        if (bytes < 0)
+            throw_errno();
+        total += static_cast<size_t>(bytes);
+    }
+
+    if (fdatasync(fd) < 0)
+        throw_errno();
+}
+
+}  // namespace imlab
+// ---------------------------------------------------------------------------------------------------
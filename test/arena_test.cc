@@ -0,0 +1,114 @@
+// ---------------------------------------------------------------------------
+// IMLAB
+// ---------------------------------------------------------------------------
+#include <gtest/gtest.h>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "imlab/arena.h"
+// ---------------------------------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------------------------------
+TEST(Arena, Fix) {
+    imlab::Arena<1024> arena;
+    EXPECT_EQ(0, arena.page_count());
+
+    // pages are created zeroed on their first fix
+    {
+        auto fix = arena.fix(3);
+        EXPECT_EQ(3, arena.page_id(fix));
+        std::vector<std::byte> zero(1024);
+        EXPECT_EQ(0, std::memcmp(zero.data(), fix.data(), 1024));
+    }
+    EXPECT_EQ(4, arena.page_count());
+
+    {
+        auto fix = arena.fix_exclusive(1);
+        std::memset(fix.data(), 7, 1024);
+        fix.set_dirty();
+    }
+    // shared fixes of the same page may be held together
+    auto a = arena.fix(1);
+    auto b = arena.fix(1);
+    EXPECT_EQ(std::byte{7}, a.data()[0]);
+    EXPECT_EQ(a.data(), b.data());
+    EXPECT_FALSE(arena.try_fix_exclusive(1).data());
+    EXPECT_TRUE(arena.try_fix_exclusive(2).data());
+    EXPECT_EQ(4, arena.page_count());
+
+    // the directory has no room past kMaxPages
+    using Arena = imlab::Arena<1024>;
+    EXPECT_THROW(arena.fix_exclusive(Arena::kMaxPages), imlab::arena_full_error);
+    EXPECT_THROW(arena.fix(~0ull), imlab::arena_full_error);
+    EXPECT_EQ(4, arena.page_count());
+}
+
+TEST(Arena, OptimisticFix) {
+    imlab::Arena<1024> arena;
+    EXPECT_FALSE(arena.fix_optimistic(1).valid());
+    // ids read from unvalidated pages may be out of range
+    EXPECT_FALSE(arena.fix_optimistic(~0ull).valid());
+    arena.fix_exclusive(1);
+
+    auto page = arena.fix_optimistic(1);
+    ASSERT_TRUE(page.valid());
+    EXPECT_EQ(1, arena.page_id(page));
+    EXPECT_TRUE(page.validate());
+    EXPECT_TRUE(arena.fix(page).data());
+    EXPECT_TRUE(page.validate());
+
+    // invalid while the page is fixed exclusively, changed afterwards
+    {
+        auto fix = arena.fix_exclusive(page);
+        ASSERT_TRUE(fix.data());
+        EXPECT_FALSE(page.validate());
+        EXPECT_FALSE(arena.fix_optimistic(1).valid());
+    }
+    EXPECT_FALSE(page.validate());
+    EXPECT_FALSE(arena.fix(page).data());
+    EXPECT_FALSE(arena.fix_exclusive(page).data());
+    EXPECT_TRUE(arena.fix_optimistic(1).validate());
+}
+
+TEST(Arena, Concurrent) {
+    constexpr uint32_t kThreads = 4;
+    constexpr uint32_t kIncrements = 2000;
+    imlab::Arena<1024> arena;
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&arena, t] {
+            for (uint32_t i = 0; i < kIncrements; ++i) {
+                // every thread creates pages of its own and increments a shared counter
+                arena.fix_exclusive(100 * t + i % 64);
+                auto fix = arena.fix_exclusive(5000);
+                ++*fix.as<uint64_t>();
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    EXPECT_EQ(kThreads * kIncrements, *arena.fix(5000).as<uint64_t>());
+    EXPECT_EQ(5001, arena.page_count());
+}
+
+TEST(Arena, Spill) {
+    constexpr uint16_t segment = 43;
+    {
+        imlab::Arena<1024> arena;
+        for (uint64_t i = 0; i < 20; i += 2)
+            *arena.fix_exclusive(i).as<uint64_t>() = i + 1;
+
+        imlab::BufferManager<1024> buffer_manager{4};
+        arena.spill(segment, buffer_manager);
+    }
+
+    imlab::BufferManager<1024> buffer_manager{4};
+    imlab::Segment<1024> pages(segment, buffer_manager);
+    for (uint64_t i = 0; i < 19; ++i)
+        EXPECT_EQ(i % 2 ? 0 : i + 1, *pages.fix(i).as<uint64_t>());
+}
+
+}  // namespace
+// ---------------------------------------------------------------------------------------------------
@@ -4,6 +4,7 @@
 #include <gtest/gtest.h>
 #include "imlab/betree.h"
 #include "test/check_betree.hpp"
+#include "test/check_rbtree.hpp"
 #include "imlab/infra/random.h"
 // ---------------------------------------------------------------------------------------------------
 namespace {
@@ -120,5 +121,62 @@ TEST(BeTree, MultipleInsertsRandom) {
     // }
 }
 
+TEST(BeTree, Reopen) {
+    constexpr uint16_t segment = 30;
+    constexpr auto small = BeTreeTest<1024, 256>::LeafNode::kCapacity + 1;
+    constexpr auto ia = insert_amount<1024, 256>;
+    {
+        imlab::BufferManager<1024> buffer_manager{10};
+        BeTreeTest<1024, 256> tree(segment, buffer_manager);
+        for (uint32_t i = 0; i < small; ++i)
+            tree.insert(i, i + 1);
+        tree.checkpoint();
+    }
+
+    {
+        imlab::BufferManager<1024> buffer_manager{10};
+        BeTreeTest<1024, 256> tree(imlab::reopen, segment, buffer_manager);
+        EXPECT_EQ(small, tree.size_pending());
+        for (uint32_t i = 0; i < small; ++i)
+            ASSERT_EQ(i + 1, *tree.find(i));
+
+        for (uint32_t i = small; i < ia; ++i)
+            tree.insert(i, i + 1);
+    }
+
+    imlab::BufferManager<1024> buffer_manager{10};
+    BeTreeTest<1024, 256> tree(imlab::reopen, segment, buffer_manager);
+    EXPECT_EQ(ia, tree.size_pending());
+    tree.check_be_invariants();
+
+    EXPECT_THROW((imlab::BeTree<uint64_t, uint64_t, 1024, 128>(imlab::reopen, segment, buffer_manager)),
+        imlab::segment_format_error);
+}
+
+TEST(BeTree, Arena) {
+    constexpr uint16_t segment = 45;
+    constexpr auto small = BeTreeTest<1024, 256>::LeafNode::kCapacity + 1;
+    constexpr auto ia = insert_amount<1024, 256>;
+    {
+        imlab::BeTree<uint64_t, uint64_t, 1024, 256, std::less<uint64_t>, imlab::Arena> tree;
+        for (uint32_t i = 0; i < small; ++i)
+            tree.insert(i, i + 1);
+        for (uint32_t i = 0; i < small; ++i)
+            ASSERT_EQ(i + 1, *tree.find(i));
+        for (uint32_t i = small; i < ia; ++i)
+            tree.insert(i, i + 1);
+        EXPECT_EQ(ia, tree.size_pending());
+        tree.check_be_invariants();
+
+        imlab::BufferManager<1024> buffer_manager{10};
+        tree.spill(segment, buffer_manager);
+    }
+
+    imlab::BufferManager<1024> buffer_manager{10};
+    BeTreeTest<1024, 256> tree(imlab::reopen, segment, buffer_manager);
+    EXPECT_EQ(ia, tree.size_pending());
+    tree.check_be_invariants();
+}
+
 }  // namespace
 // ---------------------------------------------------------------------------------------------------
@@ -2,16 +2,73 @@
 // IMLAB
 // ---------------------------------------------------------------------------
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <limits>
+#include <map>
+#include <new>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
 #include "imlab/buffer_manager.h"
 #include "imlab/btree.h"
+#include "imlab/write_ahead_log.h"
 // ---------------------------------------------------------------------------------------------------
+namespace {
+// padded to 24 bytes in a plain leaf, but 20 bytes in columns
+struct Row {
+    uint64_t id;
+    uint32_t quantity;
+    double price;
+
+    bool operator==(const Row &other) const {
+        return id == other.id && quantity == other.quantity && price == other.price;
+    }
+};
+}  // namespace
+
+template<> struct imlab::Columns<Row> {
+    static constexpr auto members = std::make_tuple(&Row::id, &Row::quantity, &Row::price);
+};
+
 namespace {
 // ---------------------------------------------------------------------------------------------------
 template<size_t page_size> using BTreeTest = imlab::BTree<uint64_t, uint64_t, page_size>;
+template<size_t page_size> using PackedTest = imlab::BTree<uint64_t, uint64_t, page_size, std::less<uint64_t>,
+                                                           imlab::InnerLayout::Sorted, false, imlab::LeafLayout::Packed>;
+using CountedTest = imlab::BTree<uint64_t, uint64_t, 1024, std::less<uint64_t>, imlab::InnerLayout::Sorted, true>;
+using ArenaTest = imlab::BTree<uint64_t, uint64_t, 1024, std::less<uint64_t>, imlab::InnerLayout::Sorted, false,
+                               imlab::LeafLayout::Plain, imlab::Arena>;
+using ColumnarTest = imlab::BTree<uint64_t, Row, 1024, std::less<uint64_t>, imlab::InnerLayout::Sorted, false,
+                                  imlab::LeafLayout::Columnar>;
 
 TEST(BTree, Sizes) {
     ASSERT_GE(1024, sizeof(BTreeTest<1024>::InnerNode));
     ASSERT_GE(1024, sizeof(BTreeTest<1024>::LeafNode));
+    // children and next pointers are six byte page references
+    EXPECT_LE((1024 - 16) / (8 + 6), BTreeTest<1024>::InnerNode::kCapacity);
+    EXPECT_LE((1024 - 16) / (8 + 6 + 8), CountedTest::InnerNode::kCapacity);
+    EXPECT_LE((1024 - 16) / (8 + 8), BTreeTest<1024>::LeafNode::kCapacity);
+    // the columns of a leaf are only padded between each other
+    ASSERT_GE(1024, sizeof(ColumnarTest::LeafNode));
+    EXPECT_LE((1024 - 32) / (8 + 20), ColumnarTest::LeafNode::kCapacity);
+}
+
+TEST(BTree, PageRef) {
+    imlab::PageRef none;
+    EXPECT_FALSE(none);
+    EXPECT_EQ(imlab::PageRef::kNone, none);
+    for (uint64_t page : std::vector<uint64_t>{0, 1, 0x1234, 0xfedcba987654, imlab::PageRef::kNone - 1}) {
+        imlab::PageRef ref = page;
+        EXPECT_TRUE(ref);
+        EXPECT_EQ(page, *ref);
+        EXPECT_EQ(page, static_cast<uint64_t>(ref));
+    }
 }
 
 TEST(BTree, InsertEmptyTree) {
@@ -162,6 +219,1404 @@ TEST(BTree, MultipleInsertOrAssignsReverse) {
         EXPECT_EQ(i, *tree.upper_bound(i - 1));
     }
 }
+
+TEST(BTree, Reopen) {
+    constexpr uint16_t segment = 28;
+    {
+        imlab::BufferManager<1024> buffer_manager{10};
+        BTreeTest<1024> tree(segment, buffer_manager);
+        for (uint32_t i = 0; i < insert_amount<1024>; ++i)
+            tree.insert(i, i * 2);
+        tree.checkpoint();
+
+        // written back when the tree is destroyed
+        tree.insert(insert_amount<1024>, insert_amount<1024> * 2);
+    }
+
+    imlab::BufferManager<1024> buffer_manager{10};
+    BTreeTest<1024> tree(imlab::reopen, segment, buffer_manager);
+    EXPECT_EQ(insert_amount<1024> + 1, tree.size());
+    EXPECT_LT(0, tree.depth());
+
+    uint32_t i = 0;
+    for (auto j : tree)
+        EXPECT_EQ(2 * i++, j);
+    EXPECT_EQ(insert_amount<1024> + 1, i);
+
+    // continues to allocate after the existing pages
+    for (uint32_t i = insert_amount<1024> + 1; i < 2 * insert_amount<1024>; ++i)
+        tree.insert(i, i * 2);
+    for (uint32_t i = 0; i < 2 * insert_amount<1024>; ++i)
+        ASSERT_EQ(2 * i, *tree.find(i));
+}
+
+TEST(BTree, ReopenAfterCrash) {
+    using Manager = imlab::BufferManager<1024>;
+    constexpr uint16_t segment = 31;
+    const char *log_path = "/tmp/imlab_btree_test.log";
+    std::remove(log_path);
+
+    {
+        imlab::WriteAheadLog wal{log_path};
+        alignas(Manager) std::byte manager_storage[sizeof(Manager)];
+        alignas(BTreeTest<1024>) std::byte tree_storage[sizeof(BTreeTest<1024>)];
+        auto *manager = new (manager_storage) Manager(10, wal);
+        auto *tree = new (tree_storage) BTreeTest<1024>(segment, *manager);
+
+        for (uint32_t i = 0; i < insert_amount<1024>; ++i)
+            tree->insert(i, i * 3);
+        tree->checkpoint();
+        // crash, neither the tree nor the manager get to write anything
+    }
+
+    imlab::WriteAheadLog wal{log_path};
+    Manager buffer_manager{10, wal};
+    BTreeTest<1024> tree(imlab::reopen, segment, buffer_manager);
+    EXPECT_EQ(insert_amount<1024>, tree.size());
+    for (uint32_t i = 0; i < insert_amount<1024>; ++i)
+        ASSERT_EQ(3 * i, *tree.find(i));
+}
+
+TEST(BTree, ReopenAfterCrashWithChanges) {
+    using Manager = imlab::BufferManager<1024>;
+    constexpr uint16_t segment = 54;
+    const char *log_path = "/tmp/imlab_btree_test.log";
+    std::remove(log_path);
+
+    {
+        imlab::WriteAheadLog wal{log_path};
+        alignas(Manager) std::byte manager_storage[sizeof(Manager)];
+        alignas(BTreeTest<1024>) std::byte tree_storage[sizeof(BTreeTest<1024>)];
+        auto *manager = new (manager_storage) Manager(10, wal);
+        auto *tree = new (tree_storage) BTreeTest<1024>(segment, *manager);
+
+        for (uint32_t i = 0; i < insert_amount<1024>; ++i)
+            tree->insert(i, i * 3);
+        tree->checkpoint();
+        // splits after the checkpoint reach the log, the stored root and page count do not
+        for (uint32_t i = insert_amount<1024>; i < 2 * insert_amount<1024>; ++i)
+            tree->insert(i, i * 3);
+        manager->commit();
+    }
+
+    imlab::WriteAheadLog wal{log_path};
+    Manager buffer_manager{10, wal};
+    EXPECT_THROW(BTreeTest<1024>(imlab::reopen, segment, buffer_manager), imlab::stale_metadata_error);
+}
+
+TEST(BTree, ReopenMismatch) {
+    imlab::BufferManager<1024> buffer_manager{10};
+    {
+        BTreeTest<1024> tree(29, buffer_manager);
+        tree.insert(1, 1);
+        tree.checkpoint();
+    }
+
+    using Other = imlab::BTree<uint32_t, uint64_t, 1024>;
+    EXPECT_THROW(Other(imlab::reopen, 29, buffer_manager), imlab::segment_format_error);
+    using Blocked = imlab::BTree<uint64_t, uint64_t, 1024, std::less<uint64_t>, imlab::InnerLayout::Blocked>;
+    EXPECT_THROW(Blocked(imlab::reopen, 29, buffer_manager), imlab::segment_format_error);
+    using Learned = imlab::BTree<uint64_t, uint64_t, 1024, std::less<uint64_t>, imlab::InnerLayout::Learned>;
+    EXPECT_THROW(Learned(imlab::reopen, 29, buffer_manager), imlab::segment_format_error);
+    using Counted = imlab::BTree<uint64_t, uint64_t, 1024, std::less<uint64_t>, imlab::InnerLayout::Sorted, true>;
+    EXPECT_THROW(Counted(imlab::reopen, 29, buffer_manager), imlab::segment_format_error);
+    EXPECT_THROW(PackedTest<1024>(imlab::reopen, 29, buffer_manager), imlab::segment_format_error);
+    EXPECT_NO_THROW(BTreeTest<1024>(imlab::reopen, 29, buffer_manager));
+}
+
+TEST(BTree, Temporary) {
+    imlab::BufferManager<1024> buffer_manager{10};
+    {
+        BTreeTest<1024> tree(imlab::temporary, 35, buffer_manager);
+        for (uint32_t i = 0; i < insert_amount<1024>; ++i)
+            tree.insert(i, i);
+        for (uint32_t i = 0; i < insert_amount<1024>; ++i)
+            ASSERT_EQ(i, *tree.find(i));
+    }
+
+    // only evictions wrote pages, nothing is left behind
+    auto statistics = buffer_manager.statistics();
+    EXPECT_EQ(statistics.segment(35).dirty_evictions, buffer_manager.page_writes());
+    EXPECT_EQ(0, statistics.gauges().resident_pages);
+    EXPECT_FALSE(buffer_manager.is_temporary(35));
+}
+
+TEST(BTree, ConstIterator) {
+    imlab::BufferManager<1024> buffer_manager{10};
+    BTreeTest<1024> tree(0, buffer_manager);
+    const auto &const_tree = tree;
+    EXPECT_EQ(const_tree.end(), const_tree.begin());
+    EXPECT_EQ(const_tree.end(), const_tree.find(1));
+
+    for (uint32_t i = 0; i < insert_amount<1024>; ++i)
+        tree.insert(i, 2 * i);
+
+    uint32_t i = 0;
+    for (auto j : const_tree)
+        EXPECT_EQ(2 * i++, j);
+    EXPECT_EQ(insert_amount<1024>, i);
+
+    EXPECT_EQ(20, *const_tree.find(10));
+    EXPECT_EQ(20, *const_tree.lower_bound(10));
+    EXPECT_EQ(22, *const_tree.upper_bound(10));
+    EXPECT_EQ(const_tree.end(), const_tree.find(insert_amount<1024>));
+}
+
+TEST(BTree, Concurrent) {
+    constexpr uint32_t threads = 4;
+    constexpr uint32_t amount = insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{100};
+    BTreeTest<1024> tree(0, buffer_manager);
+
+    // writers insert interleaved keys, readers look up keys that are inserted up front
+    for (uint32_t i = 0; i < amount; ++i)
+        tree.insert(amount + i, i);
+
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&tree, t] {
+            for (uint32_t i = t; i < amount; i += threads)
+                tree.insert(i, i);
+        });
+        workers.emplace_back([&tree, t] {
+            const auto &const_tree = tree;
+            for (uint32_t i = t; i < amount; i += threads)
+                ASSERT_EQ(i, *const_tree.find(amount + i));
+        });
+    }
+    for (auto &worker : workers)
+        worker.join();
+
+    EXPECT_EQ(2 * amount, tree.size());
+    uint32_t i = 0;
+    for (auto j : tree)
+        EXPECT_EQ(i++ % amount, j);
+    EXPECT_EQ(2 * amount, i);
+}
+
+TEST(BTree, OptimisticLookup) {
+    constexpr uint32_t threads = 4;
+    constexpr uint32_t amount = insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{100};
+    BTreeTest<1024> tree(0, buffer_manager);
+    EXPECT_FALSE(tree.lookup(1));
+
+    for (uint32_t i = 0; i < amount; ++i)
+        tree.insert(2 * i, i);
+
+    // readers race with splits caused by the odd keys
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&tree, t] {
+            for (uint32_t i = t; i < amount; i += threads)
+                tree.insert(2 * i + 1, i);
+        });
+        workers.emplace_back([&tree, t] {
+            for (uint32_t i = t; i < amount; i += threads) {
+                auto value = tree.lookup(2 * i);
+                ASSERT_TRUE(value);
+                ASSERT_EQ(i, *value);
+            }
+        });
+    }
+    for (auto &worker : workers)
+        worker.join();
+
+    EXPECT_EQ(2 * amount, tree.size());
+    for (uint32_t i = 0; i < 2 * amount; ++i)
+        ASSERT_EQ(i / 2, tree.lookup(i));
+    EXPECT_FALSE(tree.lookup(2 * amount));
+}
+
+TEST(BTree, BulkLoad) {
+    constexpr uint32_t amount = insert_amount<1024>;
+    constexpr uint32_t leaf_capacity = BTreeTest<1024>::LeafNode::kCapacity;
+    imlab::BufferManager<1024> buffer_manager{10};
+
+    std::vector<std::pair<uint64_t, uint64_t>> pairs;
+    for (uint32_t i = 0; i < amount; ++i)
+        pairs.emplace_back(2 * i, i);
+
+    {
+        BTreeTest<1024> tree(0, buffer_manager);
+        tree.bulk_load(pairs.begin(), pairs.end());
+        EXPECT_EQ(amount, tree.size());
+        // full leaves, only the last one may have space left
+        EXPECT_GT(tree.size() + leaf_capacity, tree.capacity());
+        EXPECT_EQ(2, tree.depth());
+
+        for (uint32_t i = 0; i < amount; ++i) {
+            ASSERT_EQ(i, *tree.find(2 * i));
+            ASSERT_EQ(tree.end(), tree.find(2 * i + 1));
+        }
+
+        // the loaded tree takes regular inserts
+        for (uint32_t i = 0; i < amount; ++i)
+            tree.insert(2 * i + 1, i);
+        uint32_t i = 0;
+        for (auto j : tree)
+            EXPECT_EQ(i++ / 2, j);
+        EXPECT_EQ(2 * amount, i);
+    }
+
+    {
+        BTreeTest<1024> tree(0, buffer_manager);
+        pairs.insert(pairs.begin() + 1, {0, 100});
+        tree.bulk_load(pairs.begin(), pairs.end(), 0.5);
+        EXPECT_EQ(amount, tree.size());
+        EXPECT_LE(2 * tree.size(), tree.capacity());
+        EXPECT_EQ(0, *tree.find(0));
+        EXPECT_EQ(1, *tree.find(2));
+
+        // a second load is merged by inserting
+        std::vector<std::pair<uint64_t, uint64_t>> more{{1, 1}, {2, 2}, {2 * amount, amount}};
+        tree.bulk_load(more.begin(), more.end());
+        EXPECT_EQ(amount + 2, tree.size());
+        EXPECT_EQ(1, *tree.find(2));
+        EXPECT_EQ(amount, *tree.find(2 * amount));
+    }
+
+    {
+        BTreeTest<1024> tree(0, buffer_manager);
+        tree.bulk_load(pairs.begin(), pairs.begin() + 3);
+        EXPECT_EQ(2, tree.size());
+        EXPECT_EQ(0, tree.depth());
+        EXPECT_EQ(1, *tree.lookup(2));
+    }
+
+    {
+        BTreeTest<1024> tree(0, buffer_manager);
+        for (double fill : {0.0, -0.5, 1.5, std::numeric_limits<double>::quiet_NaN()})
+            EXPECT_THROW(tree.bulk_load(pairs.begin(), pairs.end(), fill), std::invalid_argument);
+        EXPECT_EQ(0, tree.size());
+        EXPECT_EQ(0, tree.depth());
+    }
+}
+
+TEST(BTree, EraseRebalance) {
+    constexpr uint16_t segment = 39;
+    constexpr uint32_t amount = insert_amount<1024>;
+    uint64_t pages;
+    {
+        imlab::BufferManager<1024> buffer_manager{10};
+        BTreeTest<1024> tree(segment, buffer_manager);
+        for (uint32_t i = 0; i < amount; ++i)
+            tree.insert(i, i);
+        EXPECT_EQ(2, tree.depth());
+        pages = tree.page_count();
+
+        // every 16th key stays, the leaves are merged to at least a quarter full
+        for (uint32_t i = 0; i < amount; ++i) {
+            if (i % 16 != 0)
+                tree.erase(i);
+        }
+        EXPECT_EQ((amount + 15) / 16, tree.size());
+        EXPECT_GE(4 * tree.size(), tree.capacity());
+
+        uint32_t i = 0;
+        for (auto j : tree)
+            ASSERT_EQ(16 * i++, j);
+        EXPECT_EQ(tree.size(), i);
+        for (uint32_t i = 0; i < amount; ++i)
+            ASSERT_EQ(i % 16 == 0, tree.lookup(i).has_value());
+
+        // the root shrinks down to a single leaf
+        for (uint32_t i = 16; i < amount; i += 16)
+            tree.erase(i);
+        EXPECT_EQ(1, tree.size());
+        EXPECT_EQ(0, tree.depth());
+        EXPECT_EQ(BTreeTest<1024>::LeafNode::kCapacity, tree.capacity());
+        tree.checkpoint();
+    }
+
+    // the freed pages survive a reopen and are reused
+    imlab::BufferManager<1024> buffer_manager{10};
+    BTreeTest<1024> tree(imlab::reopen, segment, buffer_manager);
+    EXPECT_EQ(0, *tree.lookup(0));
+    for (uint32_t i = 0; i < amount; ++i)
+        tree.insert(i, i);
+    EXPECT_EQ(amount, tree.size());
+    EXPECT_EQ(pages, tree.page_count());
+    for (uint32_t i = 0; i < amount; ++i)
+        ASSERT_EQ(i, tree.lookup(i));
+}
+
+TEST(BTree, LowWaterMark) {
+    constexpr uint32_t amount = insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{10};
+    BTreeTest<1024> tree(0, buffer_manager);
+    tree.set_low_water_mark(0);
+    for (uint32_t i = 0; i < amount; ++i)
+        tree.insert(i, i);
+    auto capacity = tree.capacity();
+
+    // sparse leaves are kept
+    for (uint32_t i = 0; i < amount; i += 2)
+        tree.erase(i);
+    EXPECT_EQ(capacity, tree.capacity());
+
+    // empty ones are merged
+    for (uint32_t i = 1; i < amount / 2; i += 2)
+        tree.erase(i);
+    EXPECT_GT(capacity * 3 / 4, tree.capacity());
+    for (uint32_t i = 0; i < amount; ++i)
+        ASSERT_EQ(i >= amount / 2 && i % 2 == 1, tree.lookup(i).has_value());
+}
+
+TEST(BTree, ConcurrentErase) {
+    constexpr uint32_t threads = 4;
+    constexpr uint32_t amount = insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{100};
+    BTreeTest<1024> tree(0, buffer_manager);
+
+    // writers erase all keys below `amount` while inserting new ones and readers look up the rest
+    for (uint32_t i = 0; i < 2 * amount; ++i)
+        tree.insert(i, i);
+
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&tree, t] {
+            for (uint32_t i = t; i < amount; i += threads) {
+                tree.erase(i);
+                tree.insert(2 * amount + i, i);
+            }
+        });
+        workers.emplace_back([&tree, t] {
+            for (uint32_t i = amount + t; i < 2 * amount; i += threads)
+                ASSERT_EQ(i, tree.lookup(i));
+        });
+    }
+    for (auto &worker : workers)
+        worker.join();
+
+    EXPECT_EQ(2 * amount, tree.size());
+    uint32_t i = amount;
+    for (auto j : tree)
+        ASSERT_EQ(i++ < 2 * amount ? i - 1 : i - 1 - 2 * amount, j);
+    EXPECT_EQ(3 * amount, i);
+    EXPECT_EQ(tree.end(), tree.find(amount - 1));
+}
+TEST(BTree, Scan) {
+    constexpr uint32_t amount = insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{10};
+    BTreeTest<1024> tree(0, buffer_manager);
+
+    auto collect = [&tree](uint64_t lo, uint64_t hi) {
+        std::vector<uint64_t> keys;
+        tree.scan(lo, hi, [&keys](const uint64_t *k, const uint64_t *v, uint32_t n) {
+            EXPECT_GE(BTreeTest<1024>::LeafNode::kCapacity, n);
+            for (uint32_t i = 0; i < n; ++i) {
+                EXPECT_EQ(k[i] / 2, v[i]);
+                keys.push_back(k[i]);
+            }
+            return true;
+        });
+        return keys;
+    };
+    EXPECT_TRUE(collect(0, 10).empty());
+
+    for (uint32_t i = 0; i < amount; ++i)
+        tree.insert(2 * i, i);
+
+    // bounds on and between keys
+    auto keys = collect(0, 2 * amount);
+    ASSERT_EQ(amount, keys.size());
+    for (uint32_t i = 0; i < amount; ++i)
+        ASSERT_EQ(2 * i, keys[i]);
+    EXPECT_EQ((std::vector<uint64_t>{100, 102, 104}), collect(99, 104));
+    EXPECT_EQ((std::vector<uint64_t>{100, 102}), collect(100, 103));
+    EXPECT_EQ((std::vector<uint64_t>{2 * amount - 2}), collect(2 * amount - 3, 3 * amount));
+    EXPECT_TRUE(collect(101, 101).empty());
+    EXPECT_TRUE(collect(104, 100).empty());
+
+    // the callback stops after the second run
+    uint32_t runs = 0;
+    tree.scan(0, 2 * amount, [&runs](const uint64_t *, const uint64_t *, uint32_t) { return ++runs < 2; });
+    EXPECT_EQ(2, runs);
+
+    // batches resume above their last key
+    std::vector<std::pair<uint64_t, uint64_t>> batch(100);
+    uint64_t lo = 1, total = 0;
+    for (;;) {
+        uint64_t n = tree.scan_batch(lo, 2 * amount - 2, batch.data(), batch.size());
+        for (uint64_t i = 0; i < n; ++i)
+            ASSERT_EQ(2 * (total + i + 1), batch[i].first);
+        total += n;
+        if (n < batch.size())
+            break;
+        lo = batch.back().first + 1;
+    }
+    EXPECT_EQ(amount - 1, total);
+    EXPECT_EQ(0, tree.scan_batch(0, 10, batch.data(), 0));
+}
+TEST(BTree, FindBatch) {
+    constexpr uint32_t amount = insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{100};
+    BTreeTest<1024> tree(0, buffer_manager);
+
+    std::vector<uint64_t> keys{5, 3, 4};
+    std::vector<std::optional<uint64_t>> values(keys.size(), 1);
+    EXPECT_EQ(0, tree.find_batch(keys.data(), keys.size(), values.data()));
+    EXPECT_FALSE(values[0]);
+
+    for (uint32_t i = 0; i < amount; ++i)
+        tree.insert(2 * i, i);
+
+    // unsorted, with duplicates and keys past the end
+    std::mt19937_64 random(0);
+    keys.clear();
+    for (uint32_t i = 0; i < 1000; ++i)
+        keys.push_back(random() % (2 * amount + 100));
+    keys.push_back(keys.front());
+    values.assign(keys.size(), {});
+
+    uint64_t found = tree.find_batch(keys.data(), keys.size(), values.data());
+    uint64_t expected = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        ASSERT_EQ(tree.lookup(keys[i]), values[i]);
+        expected += values[i].has_value();
+    }
+    EXPECT_EQ(expected, found);
+    EXPECT_EQ(0, tree.find_batch(keys.data(), 0, values.data()));
+
+    // a dense batch fixes each leaf once instead of once per key
+    keys.clear();
+    for (uint32_t i = 0; i < 1000; ++i)
+        keys.push_back(2 * i);
+    values.assign(keys.size(), {});
+    auto before = buffer_manager.statistics().segment(0);
+    EXPECT_EQ(keys.size(), tree.find_batch(keys.data(), keys.size(), values.data()));
+    auto after = buffer_manager.statistics().segment(0);
+    EXPECT_GT(keys.size() / 10, after.hits + after.misses - before.hits - before.misses);
+    for (uint32_t i = 0; i < 1000; ++i)
+        ASSERT_EQ(i, values[i]);
+
+    // batches race with splits caused by the odd keys
+    std::thread writer([&tree] {
+        for (uint32_t i = 0; i < amount; ++i)
+            tree.insert(2 * i + 1, i);
+    });
+    keys.clear();
+    for (uint32_t i = 0; i < amount; i += 7)
+        keys.push_back(2 * i);
+    values.assign(keys.size(), {});
+    for (uint32_t round = 0; round < 20; ++round)
+        ASSERT_EQ(keys.size(), tree.find_batch(keys.data(), keys.size(), values.data()));
+    writer.join();
+    for (size_t i = 0; i < keys.size(); ++i)
+        ASSERT_EQ(keys[i] / 2, values[i]);
+}
+TEST(BTree, InsertBatch) {
+    constexpr uint32_t amount = insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{10};
+    BTreeTest<1024> tree(0, buffer_manager);
+
+    // duplicates keep their first value
+    std::vector<std::pair<uint64_t, uint64_t>> pairs{{5, 1}, {3, 1}, {5, 2}, {4, 1}};
+    EXPECT_EQ(3, tree.insert_batch(pairs.data(), pairs.size()));
+    EXPECT_EQ(1, *tree.lookup(5));
+    EXPECT_EQ(0, tree.insert_batch(pairs.data(), 0));
+
+    // random batches of growing size, existing keys are not overwritten
+    std::map<uint64_t, uint64_t> expected{{3, 1}, {4, 1}, {5, 1}};
+    std::mt19937_64 random(0);
+    for (uint32_t size = 1; size <= 4 * amount; size *= 4) {
+        pairs.clear();
+        for (uint32_t i = 0; i < size; ++i)
+            pairs.emplace_back(random() % (8 * amount), size);
+
+        uint64_t inserted = 0;
+        for (const auto &[key, value] : pairs)
+            inserted += expected.emplace(key, value).second;
+        ASSERT_EQ(inserted, tree.insert_batch(pairs.data(), pairs.size()));
+    }
+    EXPECT_EQ(expected.size(), tree.size());
+    EXPECT_LT(1, tree.depth());
+
+    auto it = expected.begin();
+    tree.scan(0, 8 * amount, [&](const uint64_t *keys, const uint64_t *values, uint32_t n) {
+        for (uint32_t i = 0; i < n; ++i, ++it) {
+            EXPECT_EQ(it->first, keys[i]);
+            EXPECT_EQ(it->second, values[i]);
+        }
+        return true;
+    });
+    EXPECT_EQ(expected.end(), it);
+    for (const auto &[key, value] : expected)
+        ASSERT_EQ(value, tree.lookup(key));
+}
+
+TEST(BTree, ConcurrentInsertBatch) {
+    constexpr uint32_t threads = 4;
+    constexpr uint32_t amount = insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{100};
+    BTreeTest<1024> tree(0, buffer_manager);
+
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&tree, t] {
+            std::vector<std::pair<uint64_t, uint64_t>> pairs;
+            for (uint32_t i = t; i < amount; i += threads) {
+                pairs.emplace_back(i, i);
+                if (pairs.size() == 100) {
+                    tree.insert_batch(pairs.data(), pairs.size());
+                    pairs.clear();
+                }
+            }
+            tree.insert_batch(pairs.data(), pairs.size());
+            for (uint32_t i = t; i < amount; i += threads)
+                ASSERT_EQ(i, tree.lookup(i));
+        });
+    }
+    for (auto &worker : workers)
+        worker.join();
+
+    EXPECT_EQ(amount, tree.size());
+    uint32_t i = 0;
+    for (auto j : tree)
+        ASSERT_EQ(i++, j);
+    EXPECT_EQ(amount, i);
+}
+TEST(BTree, BlockedInnerLayout) {
+    using Blocked = imlab::BTree<uint64_t, uint64_t, 1024, std::less<uint64_t>, imlab::InnerLayout::Blocked>;
+    constexpr uint32_t amount = 4 * insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{100};
+    Blocked tree(imlab::temporary, 40, buffer_manager);
+
+    // the key blocks start on a cache line of the page
+    {
+        alignas(64) std::byte page[1024];
+        auto *node = new (page) Blocked::InnerNode(1);
+        EXPECT_EQ(0, reinterpret_cast<uintptr_t>(node->separator_data()) % 64);
+        // the index takes one key per block, its levels and the alignment less than another block
+        EXPECT_LE(BTreeTest<1024>::InnerNode::kCapacity * 7 / 8, Blocked::InnerNode::kCapacity);
+    }
+
+    // random inserts and erases split, merge and balance inner nodes
+    std::mt19937_64 gen(41);
+    std::map<uint64_t, uint64_t> expected;
+    for (uint32_t i = 0; i < amount; ++i) {
+        uint64_t key = gen() % (2 * amount);
+        tree.insert_or_assign(key, i);
+        expected[key] = i;
+    }
+    EXPECT_LE(2, tree.depth());
+    for (uint32_t i = 0; i < amount; ++i) {
+        uint64_t key = gen() % (2 * amount);
+        tree.erase(key);
+        expected.erase(key);
+    }
+
+    EXPECT_EQ(expected.size(), tree.size());
+    for (uint64_t key = 0; key < 2 * amount; ++key) {
+        auto it = expected.find(key);
+        ASSERT_EQ(it != expected.end() ? std::optional<uint64_t>(it->second) : std::nullopt, tree.lookup(key));
+    }
+    {
+        // the iterator keeps its leaf fixed
+        auto upper = tree.upper_bound(amount);
+        ASSERT_NE(tree.end(), upper);
+        EXPECT_EQ(expected.upper_bound(amount)->second, *upper);
+    }
+
+    std::vector<uint64_t> keys;
+    for (uint64_t key = 0; key < 2 * amount; key += 3)
+        keys.push_back(key);
+    std::vector<std::optional<uint64_t>> out(keys.size());
+    uint64_t found = tree.find_batch(keys.data(), keys.size(), out.data());
+    uint64_t present = 0;
+    for (uint64_t i = 0; i < keys.size(); ++i) {
+        auto it = expected.find(keys[i]);
+        present += it != expected.end();
+        ASSERT_EQ(it != expected.end() ? std::optional<uint64_t>(it->second) : std::nullopt, out[i]);
+    }
+    EXPECT_EQ(present, found);
+}
+
+TEST(BTree, LearnedInnerLayout) {
+    using Learned = imlab::BTree<uint64_t, uint64_t, 1024, std::less<uint64_t>, imlab::InnerLayout::Learned>;
+    constexpr uint32_t amount = 4 * insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{100};
+    // the model takes a few separators
+    EXPECT_LE(BTreeTest<1024>::InnerNode::kCapacity * 7 / 8, Learned::InnerNode::kCapacity);
+
+    // skewed keys, dense at the start and sparse at the end, split, merge and balance inner nodes
+    // as well as the bulk load
+    auto skewed = [](uint64_t i) { return i * i * i; };
+    std::mt19937_64 gen(48);
+    std::map<uint64_t, uint64_t> expected;
+    std::vector<std::pair<uint64_t, uint64_t>> pairs;
+    for (uint64_t i = 0; i < amount; i += 2)
+        pairs.emplace_back(skewed(i), i);
+    Learned tree(imlab::temporary, 47, buffer_manager);
+    tree.bulk_load(pairs.begin(), pairs.end(), 0.7);
+    expected.insert(pairs.begin(), pairs.end());
+    for (uint32_t i = 0; i < amount; ++i) {
+        uint64_t key = skewed(gen() % amount);
+        tree.insert_or_assign(key, i);
+        expected[key] = i;
+    }
+    EXPECT_LE(2, tree.depth());
+    for (uint32_t i = 0; i < amount; ++i) {
+        uint64_t key = skewed(gen() % amount);
+        tree.erase(key);
+        expected.erase(key);
+    }
+
+    EXPECT_EQ(expected.size(), tree.size());
+    for (uint64_t i = 0; i < amount; ++i) {
+        for (uint64_t key : {skewed(i), skewed(i) + 1}) {
+            auto it = expected.find(key);
+            ASSERT_EQ(it != expected.end() ? std::optional<uint64_t>(it->second) : std::nullopt, tree.lookup(key));
+        }
+    }
+    auto upper = tree.upper_bound(skewed(amount / 2));
+    ASSERT_NE(tree.end(), upper);
+    EXPECT_EQ(expected.upper_bound(skewed(amount / 2))->second, *upper);
+}
+
+// rank, select and count_range against the sorted keys, the values equal the keys
+void expect_counts(const CountedTest &tree, const std::vector<uint64_t> &keys, uint64_t max_key) {
+    ASSERT_EQ(keys.size(), tree.size());
+    for (uint64_t key = 0; key <= max_key; key += 7)
+        ASSERT_EQ(std::lower_bound(keys.begin(), keys.end(), key) - keys.begin(), tree.rank(key));
+    for (uint64_t i = 0; i < keys.size(); i += 5)
+        ASSERT_EQ(keys[i], *tree.select(i));
+    EXPECT_EQ(tree.end(), tree.select(keys.size()));
+    for (uint64_t lo = 0; lo <= max_key; lo += max_key / 16) {
+        uint64_t hi = lo + max_key / 5;
+        auto expected = std::upper_bound(keys.begin(), keys.end(), hi) - std::lower_bound(keys.begin(), keys.end(), lo);
+        ASSERT_EQ(expected, tree.count_range(lo, hi));
+        ASSERT_EQ(0, tree.count_range(hi, lo));
+    }
+}
+
+TEST(BTree, Counted) {
+    constexpr uint32_t amount = 4 * insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{100};
+    // the sizes take space from the separators
+    EXPECT_GT(BTreeTest<1024>::InnerNode::kCapacity, CountedTest::InnerNode::kCapacity);
+
+    {
+        CountedTest tree(imlab::temporary, 40, buffer_manager);
+        EXPECT_EQ(0, tree.rank(1));
+        EXPECT_EQ(std::as_const(tree).end(), tree.select(0));
+
+        // splits, merges and balances move the sizes along
+        std::mt19937_64 gen(42);
+        std::map<uint64_t, uint64_t> expected;
+        for (uint32_t i = 0; i < amount; ++i) {
+            uint64_t key = gen() % (2 * amount);
+            tree.insert(key, key);
+            expected.emplace(key, key);
+        }
+        EXPECT_LE(2, tree.depth());
+        for (uint32_t i = 0; i < amount; ++i) {
+            uint64_t key = gen() % (2 * amount);
+            if (i % 3 == 0) {
+                tree.insert_or_assign(key, key);
+                expected[key] = key;
+            } else {
+                tree.erase(key);
+                expected.erase(key);
+            }
+        }
+
+        std::vector<uint64_t> keys;
+        for (auto &[key, value] : expected)
+            keys.push_back(key);
+        expect_counts(tree, keys, 2 * amount);
+    }
+
+    {
+        // bulk loaded sizes, then batched inserts on top
+        std::vector<std::pair<uint64_t, uint64_t>> pairs;
+        std::vector<uint64_t> keys;
+        for (uint64_t i = 0; i < amount; ++i) {
+            pairs.emplace_back(4 * i, 4 * i);
+            keys.push_back(4 * i);
+        }
+        CountedTest tree(imlab::temporary, 40, buffer_manager);
+        tree.bulk_load(pairs.begin(), pairs.end(), 0.5);
+        expect_counts(tree, keys, 4 * amount);
+
+        pairs.clear();
+        for (uint64_t i = 0; i < amount; i += 3)
+            pairs.emplace_back(4 * i + 1, 4 * i + 1);
+        EXPECT_EQ(pairs.size(), tree.insert_batch(pairs.data(), pairs.size()));
+        for (auto &pair : pairs)
+            keys.push_back(pair.first);
+        std::sort(keys.begin(), keys.end());
+        expect_counts(tree, keys, 4 * amount);
+    }
+}
+
+TEST(BTree, ConcurrentCounted) {
+    constexpr uint32_t threads = 4;
+    constexpr uint32_t amount = insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{100};
+    CountedTest tree(imlab::temporary, 40, buffer_manager);
+
+    // odd keys are inserted and erased again, even keys stay
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&tree, t] {
+            for (uint64_t i = t; i < amount; i += threads)
+                tree.insert(i, i);
+            for (uint64_t i = t; i < amount; i += threads) {
+                if (i % 2 == 1)
+                    tree.erase(i);
+            }
+        });
+    }
+    workers.emplace_back([&] {
+        uint64_t last = 0;
+        while (last < amount / 2) {
+            uint64_t n = tree.count_range(0, amount);
+            ASSERT_GE(amount, n);
+            last = tree.rank(amount);
+        }
+    });
+    for (auto &worker : workers)
+        worker.join();
+
+    std::vector<uint64_t> keys;
+    for (uint64_t i = 0; i < amount; i += 2)
+        keys.push_back(i);
+    expect_counts(tree, keys, amount);
+}
+
+TEST(BTree, Append) {
+    constexpr uint32_t amount = insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{100};
+    BTreeTest<1024> tree(0, buffer_manager);
+
+    // increasing keys split the rightmost leaf 90/10 instead of in half
+    for (uint32_t i = 0; i < amount; ++i)
+        tree.insert(2 * i, i);
+    EXPECT_EQ(amount, tree.size());
+    EXPECT_GE(10 * tree.size(), 8 * tree.capacity());
+
+    // random keys in between fall back to the regular descent
+    std::mt19937_64 gen(40);
+    std::map<uint64_t, uint64_t> expected;
+    for (uint32_t i = 0; i < amount; ++i)
+        expected.emplace(2 * i, i);
+    for (uint32_t i = 0; i < amount; ++i) {
+        uint64_t key = gen() % (4 * amount);
+        tree.insert_or_assign(key, key);
+        expected[key] = key;
+        if (i % 4 == 0) {
+            tree.insert(4 * amount + i, i);
+            expected.emplace(4 * amount + i, i);
+        }
+    }
+    EXPECT_EQ(expected.size(), tree.size());
+    auto it = expected.begin();
+    for (auto j : tree)
+        ASSERT_EQ((it++)->second, j);
+    EXPECT_EQ(expected.end(), it);
+
+    // the hint is dropped with a freed rightmost leaf
+    for (auto &[key, value] : expected)
+        if (key >= 2 * amount)
+            tree.erase(key);
+    for (uint32_t i = 0; i < amount; ++i)
+        tree.insert(2 * amount + i, i);
+    for (uint32_t i = 0; i < amount; ++i)
+        ASSERT_EQ(i, tree.lookup(2 * amount + i));
+}
+
+TEST(BTree, ConcurrentAppend) {
+    constexpr uint32_t threads = 4;
+    constexpr uint32_t amount = insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{100};
+    BTreeTest<1024> tree(0, buffer_manager);
+
+    // interleaved increasing keys race for the rightmost leaf
+    std::atomic<uint64_t> next{0};
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&tree, &next] {
+            for (uint64_t i; (i = next++) < amount;)
+                tree.insert(i, i);
+        });
+    }
+    for (auto &worker : workers)
+        worker.join();
+
+    EXPECT_EQ(amount, tree.size());
+    uint32_t i = 0;
+    for (auto j : tree)
+        ASSERT_EQ(i++, j);
+    EXPECT_EQ(amount, i);
+}
+
+TEST(BTree, Snapshot) {
+    constexpr uint32_t amount = insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{100};
+    BTreeTest<1024> tree(0, buffer_manager);
+
+    auto collect = [](const BTreeTest<1024>::Snapshot &snapshot) {
+        std::map<uint64_t, uint64_t> pairs;
+        snapshot.scan(0, ~0ull, [&pairs](const uint64_t *k, const uint64_t *v, uint32_t n) {
+            for (uint32_t i = 0; i < n; ++i)
+                pairs.emplace(k[i], v[i]);
+            return true;
+        });
+        return pairs;
+    };
+
+    auto empty = tree.snapshot();
+    std::map<uint64_t, uint64_t> expected;
+    for (uint32_t i = 0; i < amount; ++i) {
+        tree.insert(2 * i, i);
+        expected.emplace(2 * i, i);
+    }
+    EXPECT_EQ(0, empty.size());
+    EXPECT_TRUE(collect(empty).empty());
+    EXPECT_EQ(std::nullopt, empty.lookup(0));
+
+    // splits, merges, reused pages and writes through iterators stay invisible to the snapshot
+    auto first = tree.snapshot();
+    for (uint32_t i = 0; i < amount; i += 2)
+        tree.erase(2 * i);
+    for (uint32_t i = 0; i < amount; ++i)
+        tree.insert_or_assign(2 * i + 1, i);
+    *tree.find(2) = 42;
+
+    auto second = tree.snapshot();
+    auto current = collect(second);
+    for (uint32_t i = 0; i < amount; ++i)
+        tree.erase(2 * i + 1);
+
+    EXPECT_EQ(amount, first.size());
+    EXPECT_EQ(expected, collect(first));
+    for (uint32_t i = 0; i < amount; ++i) {
+        ASSERT_EQ(i, first.lookup(2 * i));
+        ASSERT_EQ(std::nullopt, first.lookup(2 * i + 1));
+    }
+
+    // releasing the older snapshot keeps the copies the newer one reads
+    { auto moved = std::move(first); }
+    EXPECT_EQ(amount + amount / 2, second.size());
+    EXPECT_EQ(current, collect(second));
+    EXPECT_EQ(42, second.lookup(2));
+    EXPECT_EQ(0, second.lookup(1));
+    EXPECT_EQ(std::nullopt, second.lookup(0));
+    EXPECT_EQ(amount / 2, tree.size());
+}
+
+TEST(BTree, ConcurrentSnapshot) {
+    constexpr uint32_t threads = 4;
+    constexpr uint32_t amount = insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{100};
+    BTreeTest<1024> tree(0, buffer_manager);
+
+    // writers append new keys and replace old ones, every snapshot sees the keys of a single point
+    // in time, the values of a key only increase
+    for (uint32_t i = 0; i < amount; ++i)
+        tree.insert(i, 0);
+
+    std::atomic<bool> done{false};
+    std::vector<std::thread> writers;
+    for (uint32_t t = 0; t < threads; ++t) {
+        writers.emplace_back([&tree, t] {
+            for (uint32_t i = t; i < amount; i += threads) {
+                tree.erase(i);
+                tree.insert(i, i + 1);
+                tree.insert(amount + i, i);
+            }
+        });
+    }
+    std::thread reader([&tree, &done] {
+        while (!done) {
+            auto snapshot = tree.snapshot();
+            uint64_t keys = 0;
+            snapshot.scan(0, 2 * amount, [&keys](const uint64_t *k, const uint64_t *v, uint32_t n) {
+                for (uint32_t i = 0; i < n; ++i)
+                    EXPECT_TRUE(k[i] >= amount ? v[i] == k[i] - amount : v[i] == 0 || v[i] == k[i] + 1);
+                keys += n;
+                return true;
+            });
+            EXPECT_EQ(snapshot.size(), keys);
+        }
+    });
+    for (auto &writer : writers)
+        writer.join();
+    done = true;
+    reader.join();
+
+    EXPECT_EQ(2 * amount, tree.size());
+    auto snapshot = tree.snapshot();
+    for (uint32_t i = 0; i < amount; ++i)
+        ASSERT_EQ(i + 1, snapshot.lookup(i));
+}
+
+TEST(BTree, PackedLeaves) {
+    constexpr uint32_t amount = 4 * insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{200};
+    EXPECT_LE(2 * BTreeTest<1024>::LeafNode::kCapacity - 4, PackedTest<1024>::LeafNode::kCapacity);
+
+    // dense keys take one or two bytes each, so the leaves hold about twice the pairs
+    std::vector<uint64_t> keys(amount);
+    std::iota(keys.begin(), keys.end(), 1ull << 40);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(44));
+    {
+        BTreeTest<1024> plain(imlab::temporary, 41, buffer_manager);
+        PackedTest<1024> packed(imlab::temporary, 42, buffer_manager);
+        for (auto key : keys) {
+            plain.insert(key, key);
+            packed.insert(key, key);
+        }
+        EXPECT_LT(3 * packed.page_count(), 2 * plain.page_count());
+        // the capacity only counts the pairs that fit with full width distances
+        EXPECT_LT(packed.capacity(), packed.size());
+    }
+
+    // sparse keys in between need wider distances, the leaves split as their pairs no longer fit
+    PackedTest<1024> tree(imlab::temporary, 41, buffer_manager);
+    std::mt19937_64 gen(45);
+    std::map<uint64_t, uint64_t> expected;
+    for (uint32_t i = 0; i < amount; ++i) {
+        uint64_t key = i % 3 == 0 ? gen() : (1ull << 40) + gen() % amount;
+        tree.insert_or_assign(key, i);
+        expected[key] = i;
+    }
+    for (uint32_t i = 0; i < amount / 2; ++i) {
+        auto it = expected.lower_bound(gen());
+        if (it == expected.end())
+            continue;
+        tree.erase(it->first);
+        expected.erase(it);
+    }
+
+    ASSERT_EQ(expected.size(), tree.size());
+    auto it = expected.begin();
+    for (auto value : tree)
+        ASSERT_EQ((it++)->second, value);
+    EXPECT_EQ(expected.end(), it);
+    for (auto &[key, value] : expected)
+        ASSERT_EQ(value, tree.lookup(key));
+
+    uint64_t lo = (1ull << 40) + amount / 4, hi = (1ull << 40) + amount / 2;
+    std::vector<std::pair<uint64_t, uint64_t>> scanned;
+    tree.scan(lo, hi, [&scanned](const uint64_t *k, const uint64_t *v, uint32_t n) {
+        for (uint32_t i = 0; i < n; ++i)
+            scanned.emplace_back(k[i], v[i]);
+        return true;
+    });
+    std::vector<std::pair<uint64_t, uint64_t>> in_range(expected.lower_bound(lo), expected.upper_bound(hi));
+    EXPECT_EQ(in_range, scanned);
+
+    std::vector<std::optional<uint64_t>> found(keys.size());
+    uint64_t hits = tree.find_batch(keys.data(), keys.size(), found.data());
+    uint64_t present = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        auto entry = expected.find(keys[i]);
+        present += entry != expected.end();
+        ASSERT_EQ(entry != expected.end() ? std::optional(entry->second) : std::nullopt, found[i]);
+    }
+    EXPECT_EQ(present, hits);
+
+    // bulk loads cut the leaves where the next key would not fit anymore
+    std::vector<std::pair<uint64_t, uint64_t>> pairs(expected.begin(), expected.end());
+    PackedTest<1024> loaded(imlab::temporary, 42, buffer_manager);
+    loaded.bulk_load(pairs.begin(), pairs.end());
+    EXPECT_EQ(0, loaded.insert_batch(pairs.data(), pairs.size()));
+    ASSERT_EQ(pairs.size(), loaded.size());
+    for (auto &[key, value] : pairs)
+        ASSERT_EQ(value, loaded.lookup(key));
+}
+
+TEST(BTree, Arena) {
+    constexpr uint16_t segment = 44;
+    constexpr uint32_t amount = 4 * insert_amount<1024>;
+    std::map<uint64_t, uint64_t> expected;
+    {
+        ArenaTest tree;
+        std::mt19937_64 gen(46);
+        for (uint32_t i = 0; i < amount; ++i) {
+            uint64_t key = gen() % (2 * amount);
+            tree.insert_or_assign(key, i);
+            expected[key] = i;
+        }
+        for (uint32_t i = 0; i < amount / 2; ++i) {
+            uint64_t key = gen() % (2 * amount);
+            tree.erase(key);
+            expected.erase(key);
+        }
+
+        // concurrent inserts latch the pages of the arena like buffer frames
+        std::vector<std::thread> threads;
+        for (uint32_t t = 0; t < 4; ++t) {
+            threads.emplace_back([&tree, t] {
+                for (uint32_t i = 0; i < amount; ++i)
+                    tree.insert(2 * amount + 4 * i + t, i);
+            });
+        }
+        for (auto &thread : threads)
+            thread.join();
+        for (uint32_t i = 0; i < 4 * amount; ++i)
+            expected.emplace(2 * amount + i, i / 4);
+
+        ASSERT_EQ(expected.size(), tree.size());
+        auto it = expected.begin();
+        for (auto value : tree)
+            ASSERT_EQ((it++)->second, value);
+        for (auto &[key, value] : expected)
+            ASSERT_EQ(value, tree.lookup(key));
+
+        imlab::BufferManager<1024> buffer_manager{10};
+        tree.spill(segment, buffer_manager);
+    }
+
+    // the spilled tree is reopened from the segment
+    imlab::BufferManager<1024> buffer_manager{10};
+    BTreeTest<1024> tree(imlab::reopen, segment, buffer_manager);
+    ASSERT_EQ(expected.size(), tree.size());
+    for (auto &[key, value] : expected)
+        ASSERT_EQ(value, tree.lookup(key));
+    tree.insert(~0ull, 1);
+    EXPECT_EQ(expected.size() + 1, tree.size());
+}
+
+TEST(BTree, Hint) {
+    constexpr uint16_t segment = 46;
+    constexpr uint32_t amount = 4 * insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{1000};
+    BTreeTest<1024> tree(segment, buffer_manager);
+    std::map<uint64_t, uint64_t> expected;
+
+    // nearly sorted runs, the jumps and the erases move the hint around and invalidate it
+    BTreeTest<1024>::Hint hint;
+    std::mt19937_64 gen(47);
+    uint64_t key = 0;
+    for (uint32_t i = 0; i < amount; ++i) {
+        key = gen() % 50 == 0 ? gen() % (4 * amount) : key + 1 + gen() % 3;
+        if (i % 3 == 0) {
+            tree.insert_or_assign(key, i, hint);
+            expected[key] = i;
+        } else {
+            tree.insert(key, i, hint);
+            expected.emplace(key, i);
+        }
+        ASSERT_EQ(expected[key], tree.lookup(key, hint));
+        if (i % 5 == 0) {
+            uint64_t erased = gen() % (4 * amount);
+            tree.erase(erased);
+            expected.erase(erased);
+        }
+    }
+    ASSERT_EQ(expected.size(), tree.size());
+    for (auto &[key, value] : expected)
+        ASSERT_EQ(value, tree.lookup(key));
+    for (uint64_t key = 0; key < 4 * amount; ++key) {
+        auto it = expected.find(key);
+        ASSERT_EQ(it == expected.end() ? std::nullopt : std::optional(it->second), tree.lookup(key, hint));
+    }
+
+    // a sorted stream reads the leaves optimistically like `lookup` and fixes no page at all
+    BTreeTest<1024>::Hint scan;
+    ASSERT_LT(1, tree.depth());
+    auto before = buffer_manager.statistics().segment(segment);
+    for (auto &[key, value] : expected)
+        ASSERT_EQ(value, tree.lookup(key, scan));
+    auto after = buffer_manager.statistics().segment(segment);
+    EXPECT_EQ(before.hits + before.misses, after.hits + after.misses);
+
+    // every thread streams its own keys past splits of the others
+    uint64_t base = expected.rbegin()->first + 1;
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&tree, base, t] {
+            BTreeTest<1024>::Hint hint;
+            for (uint32_t i = 0; i < amount; ++i) {
+                uint64_t key = base + 4 * i + t;
+                tree.insert(key, i, hint);
+                ASSERT_EQ(i, tree.lookup(key, hint));
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    EXPECT_EQ(expected.size() + 4 * amount, tree.size());
+    for (uint32_t i = 0; i < 4 * amount; ++i)
+        ASSERT_EQ(i / 4, tree.lookup(base + i, hint));
+}
+
+TEST(BTree, ColumnarLeaves) {
+    constexpr uint32_t amount = 4 * insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{200};
+    using PlainRows = imlab::BTree<uint64_t, Row, 1024>;
+    EXPECT_LT(PlainRows::LeafNode::kCapacity, ColumnarTest::LeafNode::kCapacity);
+
+    auto row = [](uint64_t key, uint32_t i) { return Row{key, i, 0.5 * i}; };
+    ColumnarTest tree(imlab::temporary, 48, buffer_manager);
+    std::mt19937_64 gen(49);
+    std::map<uint64_t, Row> expected;
+    for (uint32_t i = 0; i < amount; ++i) {
+        uint64_t key = gen() % (2 * amount);
+        tree.insert_or_assign(key, row(key, i));
+        expected[key] = row(key, i);
+    }
+    for (uint32_t i = 0; i < amount / 2; ++i) {
+        uint64_t key = gen() % (2 * amount);
+        tree.erase(key);
+        expected.erase(key);
+    }
+
+    // values are assembled from the columns, members are reached in place
+    ASSERT_EQ(expected.size(), tree.size());
+    auto it = expected.begin();
+    for (auto tree_it = std::as_const(tree).begin(); tree_it != std::as_const(tree).end(); ++tree_it, ++it) {
+        ASSERT_EQ(it->second, *tree_it);
+        ASSERT_EQ(it->second.price, tree_it.field<&Row::price>());
+    }
+    EXPECT_EQ(expected.end(), it);
+    for (auto &[key, value] : expected)
+        ASSERT_EQ(value, tree.lookup(key));
+
+    // writes through references and fields land in the columns
+    for (auto tree_it = tree.begin(); tree_it != tree.end(); ++tree_it) {
+        Row value = *tree_it;
+        tree_it.field<&Row::quantity>() += 1;
+        value.quantity += 1;
+        ASSERT_EQ(value, static_cast<Row>(*tree_it));
+        expected[value.id].quantity += 1;
+    }
+    *tree.find(expected.begin()->first) = row(expected.begin()->first, 7);
+    expected.begin()->second = row(expected.begin()->first, 7);
+
+    uint64_t lo = amount / 4, hi = amount;
+    std::vector<std::pair<uint64_t, Row>> scanned;
+    tree.scan(lo, hi, [&scanned](const uint64_t *k, const Row *v, uint32_t n) {
+        for (uint32_t i = 0; i < n; ++i)
+            scanned.emplace_back(k[i], v[i]);
+        return true;
+    });
+    std::vector<std::pair<uint64_t, Row>> in_range(expected.lower_bound(lo), expected.upper_bound(hi));
+    EXPECT_EQ(in_range, scanned);
+
+    double total = 0, expected_total = 0;
+    tree.scan_field<&Row::price>(lo, hi, [&total](const uint64_t *, const double *prices, uint32_t n) {
+        for (uint32_t i = 0; i < n; ++i)
+            total += prices[i];
+        return true;
+    });
+    for (auto &[key, value] : in_range)
+        expected_total += value.price;
+    EXPECT_EQ(expected_total, total);
+
+    // plain leaves copy the field of every value for the same scan
+    PlainRows plain(imlab::temporary, 49, buffer_manager);
+    plain.bulk_load(in_range.begin(), in_range.end());
+    total = 0;
+    plain.scan_field<&Row::price>(lo, hi, [&total](const uint64_t *, const double *prices, uint32_t n) {
+        for (uint32_t i = 0; i < n; ++i)
+            total += prices[i];
+        return true;
+    });
+    EXPECT_EQ(expected_total, total);
+
+    std::vector<uint64_t> keys(2 * amount);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::vector<std::optional<Row>> found(keys.size());
+    EXPECT_EQ(expected.size(), tree.find_batch(keys.data(), keys.size(), found.data()));
+    for (auto key : keys) {
+        auto entry = expected.find(key);
+        ASSERT_EQ(entry != expected.end() ? std::optional(entry->second) : std::nullopt, found[key]);
+    }
+
+    std::vector<std::pair<uint64_t, Row>> pairs(expected.begin(), expected.end());
+    ColumnarTest loaded(imlab::temporary, 52, buffer_manager);
+    loaded.bulk_load(pairs.begin(), pairs.end());
+    EXPECT_EQ(0, loaded.insert_batch(pairs.data(), pairs.size()));
+    ASSERT_EQ(pairs.size(), loaded.size());
+    for (auto &[key, value] : pairs)
+        ASSERT_EQ(value, loaded.lookup(key));
+}
+
+TEST(BTree, EraseRange) {
+    constexpr uint16_t segment = 50;
+    constexpr uint32_t amount = 4 * insert_amount<1024>;
+    std::map<uint64_t, uint64_t> expected;
+    uint64_t pages;
+    {
+        imlab::BufferManager<1024> buffer_manager{100};
+        BTreeTest<1024> tree(segment, buffer_manager);
+        std::mt19937_64 gen(51);
+        for (uint32_t i = 0; i < amount; ++i) {
+            uint64_t key = gen() % (4 * amount);
+            tree.insert_or_assign(key, i);
+            expected[key] = i;
+        }
+        ASSERT_LT(1, tree.depth());
+
+        auto erase_range = [&](uint64_t lo, uint64_t hi) {
+            auto first = expected.lower_bound(lo), last = expected.upper_bound(hi);
+            uint64_t erased = std::distance(first, last);
+            expected.erase(first, last);
+            EXPECT_EQ(erased, tree.erase_range(lo, hi));
+            ASSERT_EQ(expected.size(), tree.size());
+            // the leaf chain skips the unlinked leaves
+            auto it = expected.begin();
+            for (auto value : tree)
+                ASSERT_EQ((it++)->second, value);
+            ASSERT_EQ(expected.end(), it);
+        };
+        // more unlinked subtrees than fit the metadata page
+        for (uint64_t lo = 4 * amount; lo > 1700; lo -= 1700)
+            erase_range(lo - 1500, lo);
+        // within a leaf, across a few leaves and across whole subtrees, then both ends
+        erase_range(100, 110);
+        erase_range(1000, 1400);
+        erase_range(amount / 2, 3 * amount);
+        erase_range(0, 50);
+        erase_range(7 * amount / 2, ~0ull);
+        EXPECT_EQ(0, tree.erase_range(5, 4));
+        for (uint64_t key = 0; key < 4 * amount; ++key)
+            ASSERT_EQ(expected.count(key) ? std::optional(expected[key]) : std::nullopt, tree.lookup(key));
+        pages = tree.page_count();
+        tree.checkpoint();
+    }
+
+    // the dropped subtrees survive a reopen, all their pages are reused before the segment grows
+    imlab::BufferManager<1024> buffer_manager{100};
+    BTreeTest<1024> tree(imlab::reopen, segment, buffer_manager);
+    pages = tree.page_count();
+    uint32_t reused = 0;
+    for (; tree.page_count() == pages; ++reused) {
+        ASSERT_GT(amount, reused);
+        uint64_t key = amount / 2 + 2 * reused;
+        tree.insert(key, reused);
+        expected.emplace(key, reused);
+    }
+    EXPECT_LT(amount / 2, reused);
+    ASSERT_EQ(expected.size(), tree.size());
+    for (auto &[key, value] : expected)
+        ASSERT_EQ(value, tree.lookup(key));
+
+    // erasing everything leaves a single leaf
+    EXPECT_EQ(expected.size(), tree.erase_range(0, ~0ull));
+    EXPECT_EQ(0, tree.size());
+    EXPECT_EQ(0, tree.depth());
+    EXPECT_EQ(tree.end(), tree.begin());
+}
+
+TEST(BTree, CountedEraseRange) {
+    constexpr uint16_t segment = 51;
+    constexpr uint32_t amount = 16 * insert_amount<1024>;
+    imlab::BufferManager<1024> buffer_manager{1000};
+    CountedTest tree(imlab::temporary, segment, buffer_manager);
+    for (uint32_t i = 0; i < amount; ++i)
+        tree.insert(i, i);
+    ASSERT_LT(2, tree.depth());
+
+    // the sizes of the covered subtrees come from their parents, only the two paths are fixed
+    auto before = buffer_manager.statistics().segment(segment);
+    EXPECT_EQ(amount / 2, tree.erase_range(amount / 4, 3 * amount / 4 - 1));
+    auto after = buffer_manager.statistics().segment(segment);
+    uint64_t leaves = amount / 2 / CountedTest::LeafNode::kCapacity;
+    EXPECT_GT(leaves / 4, after.hits + after.misses - before.hits - before.misses);
+
+    EXPECT_EQ(amount / 2, tree.size());
+    EXPECT_EQ(amount / 4, tree.rank(3 * amount / 4));
+    EXPECT_EQ(3 * amount / 4, *tree.select(amount / 4));
+    EXPECT_EQ(0, tree.count_range(amount / 4, 3 * amount / 4 - 1));
+    uint64_t i = 0;
+    for (auto value : std::as_const(tree)) {
+        ASSERT_EQ(i, value);
+        i = i + 1 == amount / 4 ? 3 * amount / 4 : i + 1;
+    }
+    EXPECT_EQ(amount, i);
+
+    // concurrent readers outside of the range and inserts into it
+    std::vector<std::thread> threads;
+    threads.emplace_back([&tree] {
+        for (uint32_t i = 0; i < 16; ++i)
+            tree.erase_range(amount / 4 + i * amount / 64, amount / 4 + (i + 1) * amount / 64 - 1);
+    });
+    threads.emplace_back([&tree] {
+        for (uint32_t i = 0; i < amount / 4; ++i)
+            ASSERT_EQ(i, tree.lookup(i));
+    });
+    threads.emplace_back([&tree] {
+        for (uint32_t i = 0; i < amount / 4; i += 16)
+            tree.insert(3 * amount / 4 - 1 - i, i);
+    });
+    for (auto &thread : threads)
+        thread.join();
+    EXPECT_EQ(tree.count_range(0, ~0ull), tree.size());
+    EXPECT_EQ(amount / 2, tree.count_range(0, amount / 4 - 1) + tree.count_range(3 * amount / 4, amount));
+}
+
+TEST(BTree, EraseRangeConcurrentScans) {
+    constexpr uint32_t amount = 8 * insert_amount<1024>;
+    constexpr uint32_t chunk = amount / 32, rounds = 24;
+    imlab::BufferManager<1024> buffer_manager{1000};
+    BTreeTest<1024> tree(imlab::temporary, 53, buffer_manager);
+    for (uint32_t i = 0; i < amount; ++i)
+        tree.insert(i, i);
+
+    // the middle half is unlinked chunk by chunk and partly refilled, so the pages of unlinked leaves
+    // are reused while scans may still be on their way through them
+    std::atomic<bool> done{false};
+    std::vector<std::thread> threads;
+    threads.emplace_back([&tree, &done] {
+        for (uint32_t round = 0; round < rounds; ++round) {
+            for (uint32_t lo = amount / 4; lo < 3 * amount / 4; lo += chunk) {
+                tree.erase_range(lo, lo + chunk - 1);
+                for (uint32_t i = lo + round % 3; i < lo + chunk; i += 3)
+                    tree.insert(i, i);
+            }
+        }
+        done = true;
+    });
+    // keys stay in order and the keys outside of the middle are all seen
+    auto kept = [](uint64_t key) { return key < amount / 4 || key >= 3 * amount / 4; };
+    threads.emplace_back([&tree, &done, &kept] {
+        while (!done) {
+            std::optional<uint64_t> previous;
+            uint64_t seen = 0;
+            tree.scan(0, amount, [&](const uint64_t *keys, const uint64_t *values, uint32_t n) {
+                for (uint32_t i = 0; i < n; ++i) {
+                    EXPECT_TRUE(!previous || *previous < keys[i]);
+                    EXPECT_EQ(keys[i], values[i]);
+                    previous = keys[i];
+                    seen += kept(keys[i]);
+                }
+                return true;
+            });
+            ASSERT_EQ(amount / 2, seen);
+        }
+    });
+    threads.emplace_back([&tree, &done, &kept] {
+        while (!done) {
+            std::optional<uint64_t> previous;
+            uint64_t seen = 0;
+            for (auto value : std::as_const(tree)) {
+                EXPECT_TRUE(!previous || *previous < value);
+                previous = value;
+                seen += kept(value);
+            }
+            ASSERT_EQ(amount / 2, seen);
+        }
+    });
+    for (auto &thread : threads)
+        thread.join();
+
+    // the last round refilled every third key
+    std::vector<uint64_t> expected, keys;
+    for (uint64_t key = 0; key < amount; ++key) {
+        if (kept(key) || key % chunk % 3 == (rounds - 1) % 3)
+            expected.push_back(key);
+    }
+    for (auto value : std::as_const(tree))
+        keys.push_back(value);
+    EXPECT_EQ(expected, keys);
+    EXPECT_EQ(expected.size(), tree.size());
+}
 // ---------------------------------------------------------------------------------------------------
 }  // namespace
 // ---------------------------------------------------------------------------------------------------
@@ -2,7 +2,10 @@
 // IMLAB
 // ---------------------------------------------------------------------------
 #include <gtest/gtest.h>
+#include <cstdio>
 #include <cstring>
+#include <sstream>
+#include <string>
 #include "imlab/buffer_manager.h"
 // ---------------------------------------------------------------------------------------------------
 BUFFER_MANAGER_TEMPL const std::vector<uint64_t> imlab::BUFFER_MANAGER_CLASS::get_fifo() const {
@@ -53,6 +56,13 @@ TEST(BufferManager, FixSingle) {
     EXPECT_TRUE(manager.in_memory(1));
     EXPECT_TRUE(manager.is_dirty(1));
 
+    // a try does not wait for other fixes
+    {
+        auto fix = manager.fix(1);
+        EXPECT_EQ(nullptr, manager.try_fix_exclusive(1).data());
+    }
+    EXPECT_NE(nullptr, manager.try_fix_exclusive(1).data());
+
     {
         std::vector<uint64_t> values(1024 / sizeof(uint64_t));
         auto fix = manager.fix(1);
@@ -163,6 +173,209 @@ TEST(BufferManager, LRURefresh) {
     EXPECT_TRUE(manager.get_fifo().empty());
     EXPECT_EQ((std::vector<uint64_t>{2, 1}), manager.get_lru());
 }
+
+TEST(BufferManager, Statistics) {
+    imlab::BufferManager<1024> manager{2};
+    uint64_t other_segment = 1ull << 48;
+
+    {
+        auto fix = manager.fix_exclusive(1);
+        fix.set_dirty();
+    }
+    manager.fix(other_segment);
+    manager.fix(other_segment);
+
+    auto before = manager.statistics();
+    EXPECT_EQ(2, before.capacity_pages);
+    EXPECT_EQ(2, before.total().misses);
+    EXPECT_EQ(1, before.total().hits);
+    EXPECT_EQ(1, before.segment(0).misses);
+    EXPECT_EQ(1, before.segment(1).hits);
+    EXPECT_EQ(1, before.priority(imlab::BufferStatistics::Fifo).hits);
+    EXPECT_EQ(2, before.gauges().resident_pages);
+    EXPECT_EQ(1, before.gauges(0).dirty_pages);
+    EXPECT_EQ(0, before.gauges(1).dirty_pages);
+
+    // evict the dirty page and then a clean one from the fifo
+    manager.fix(2);
+    manager.fix(3);
+    {
+        // fifo is pinned, evict segment 1 from the lru
+        auto fix = manager.fix(3);
+        manager.fix(4);
+    }
+
+    auto after = manager.statistics();
+    auto diff = after - before;
+    EXPECT_EQ(3, diff.total().misses);
+    EXPECT_EQ(1, diff.total().hits);
+    EXPECT_EQ(1, diff.segment(0).dirty_evictions);
+    EXPECT_EQ(1, diff.segment(0).clean_evictions);
+    EXPECT_EQ(1, diff.segment(1).clean_evictions);
+    EXPECT_EQ(1, diff.priority(imlab::BufferStatistics::Lru).clean_evictions);
+    EXPECT_EQ(1, diff.total().write_latency.count());
+    EXPECT_EQ(3, diff.total().read_latency.count());
+    EXPECT_EQ(0, after.gauges().dirty_pages);
+    EXPECT_EQ(2, after.gauges(0).resident_pages);
+    EXPECT_EQ(manager.page_reads(), after.total().read_latency.count());
+    EXPECT_EQ(manager.page_writes(), after.total().write_latency.count());
+
+    std::ostringstream os;
+    after.write_prometheus(os);
+    EXPECT_NE(std::string::npos, os.str().find("# TYPE imlab_buffer_hits_total counter"));
+    EXPECT_NE(std::string::npos, os.str().find("imlab_buffer_misses_total{segment=\"1\",priority=\"fifo\"} 1"));
+    EXPECT_NE(std::string::npos, os.str().find("imlab_buffer_read_seconds_bucket{segment=\"0\",priority=\"fifo\",le=\"+Inf\"} 4"));
+}
+
+TEST(BufferManager, WarmRestart) {
+    using Manager = imlab::BufferManager<1024>;
+    const std::string path = "/tmp/imlab_working_set_test";
+    constexpr uint64_t segment = 32ull << 48;
+    std::remove(path.c_str());
+
+    std::vector<uint64_t> expected_fifo, expected_lru;
+    {
+        Manager manager{8};
+        manager.set_working_set_file(path);
+        for (uint64_t i = 0; i < 12; ++i) {
+            auto fix = manager.fix_exclusive(segment | i);
+            *fix.as<uint64_t>() = i * 7;
+            fix.set_dirty();
+        }
+        manager.fix(segment | 9);
+        manager.fix(segment | 5);
+
+        expected_fifo = manager.get_fifo();
+        expected_lru = manager.get_lru();
+        EXPECT_EQ((std::vector<uint64_t>{segment | 9, segment | 5}), expected_lru);
+    }
+
+    {
+        Manager manager{8};
+        EXPECT_EQ(8, manager.load_working_set(path));
+        EXPECT_EQ(expected_fifo, manager.get_fifo());
+        EXPECT_EQ(expected_lru, manager.get_lru());
+        // pages 4 to 11 are adjacent
+        EXPECT_EQ(1, manager.page_reads());
+
+        for (uint64_t i = 4; i < 12; ++i)
+            EXPECT_EQ(i * 7, *manager.fix(segment | i).as<uint64_t>());
+        EXPECT_EQ(0, manager.statistics().total().misses);
+    }
+
+    {
+        // a smaller pool keeps the pages that would be evicted last
+        Manager manager{3};
+        auto loaded = manager.load_working_set_async(path);
+        EXPECT_EQ(3, loaded.get());
+        EXPECT_EQ((std::vector<uint64_t>{segment | 11}), manager.get_fifo());
+        EXPECT_EQ(expected_lru, manager.get_lru());
+        EXPECT_EQ(3, manager.page_reads());
+        EXPECT_EQ(35, *manager.fix(segment | 5).as<uint64_t>());
+    }
+
+    Manager manager{8};
+    EXPECT_EQ(0, manager.load_working_set(path + ".missing"));
+}
+
+TEST(BufferManager, TemporarySegment) {
+    imlab::BufferManager<1024> manager{4};
+    constexpr uint64_t scratch = 33ull << 48;
+    constexpr uint64_t persistent = 34ull << 48;
+    manager.set_temporary(33);
+    EXPECT_TRUE(manager.is_temporary(33));
+    EXPECT_FALSE(manager.is_temporary(34));
+
+    for (uint64_t i = 0; i < 3; ++i) {
+        auto fix = manager.fix_exclusive(scratch | i);
+        fix.set_dirty();
+    }
+    {
+        auto fix = manager.fix_exclusive(persistent);
+        fix.set_dirty();
+    }
+
+    // only the persistent page is written
+    manager.checkpoint();
+    EXPECT_EQ(1, manager.page_writes());
+    EXPECT_TRUE(manager.is_dirty(scratch));
+
+    // memory pressure still forces temporary pages out
+    for (uint64_t i = 3; i < 6; ++i) {
+        auto fix = manager.fix_exclusive(scratch | i);
+        fix.set_dirty();
+    }
+    EXPECT_EQ(4, manager.page_writes());
+    EXPECT_EQ(3, manager.statistics().segment(33).dirty_evictions);
+
+    manager.drop_segment(33);
+    EXPECT_EQ(4, manager.page_writes());
+    EXPECT_FALSE(manager.is_temporary(33));
+    EXPECT_EQ(0, manager.statistics().gauges(33).resident_pages);
+    EXPECT_TRUE(manager.get_lru().empty());
+    EXPECT_EQ(std::vector<uint64_t>{persistent}, manager.get_fifo());
+
+    // the frames are free again
+    for (uint64_t i = 1; i < 4; ++i)
+        manager.fix(persistent | i);
+    EXPECT_EQ(4, manager.page_writes());
+}
+
+TEST(BufferManager, OptimisticFix) {
+    imlab::BufferManager<1024> manager{2};
+    constexpr uint64_t segment = 36ull << 48;
+    manager.set_temporary(36);
+
+    // only resident pages can be read optimistically
+    EXPECT_FALSE(manager.fix_optimistic(segment | 1).valid());
+    {
+        auto fix = manager.fix_exclusive(segment | 1);
+        *fix.as<uint64_t>() = 42;
+        fix.set_dirty();
+
+        // not while the page is modified
+        EXPECT_FALSE(manager.fix_optimistic(segment | 1).valid());
+    }
+
+    auto page = manager.fix_optimistic(segment | 1);
+    ASSERT_TRUE(page.valid());
+    EXPECT_EQ(segment | 1, page.page_id());
+    EXPECT_EQ(42, *page.as<uint64_t>());
+    EXPECT_TRUE(page.validate());
+
+    // shared fixes keep the version
+    manager.fix(segment | 1);
+    EXPECT_TRUE(page.validate());
+    {
+        auto fix = manager.fix(page);
+        ASSERT_NE(nullptr, fix.data());
+        EXPECT_EQ(42, *fix.as<uint64_t>());
+    }
+
+    // upgrading takes the exclusive fix and invalidates the snapshot
+    {
+        auto fix = manager.fix_exclusive(page);
+        ASSERT_NE(nullptr, fix.data());
+        *fix.as<uint64_t>() = 43;
+        fix.set_dirty();
+    }
+    EXPECT_FALSE(page.validate());
+    EXPECT_EQ(nullptr, manager.fix(page).data());
+    EXPECT_EQ(nullptr, manager.fix_exclusive(page).data());
+
+    // eviction reuses the frame for another page
+    manager.fix(segment | 2);
+    page = manager.fix_optimistic(segment | 2);
+    ASSERT_TRUE(page.valid());
+    manager.fix(segment | 3);
+    EXPECT_FALSE(manager.in_memory(segment | 2));
+    EXPECT_FALSE(page.validate());
+    EXPECT_FALSE(manager.fix_optimistic(segment | 2).valid());
+    EXPECT_TRUE(manager.fix_optimistic(segment | 3).valid());
+
+    manager.drop_segment(36);
+    EXPECT_FALSE(manager.fix_optimistic(segment | 3).valid());
+}
 // ---------------------------------------------------------------------------------------------------
 }  // namespace
 // ---------------------------------------------------------------------------------------------------
@@ -0,0 +1,131 @@
+// ---------------------------------------------------------------------------
+// IMLAB
+// ---------------------------------------------------------------------------
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <random>
+#include <vector>
+#include "imlab/node_search.h"
+// ---------------------------------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------------------------------
+// compare against the standard library for every size up to `max_count` and keys around each entry
+template<typename Key> void check_search(uint32_t max_count) {
+    static_assert(imlab::kVectorizedSearch<Key, std::less<Key>>);
+    std::mt19937_64 random(42);
+    std::uniform_int_distribution<int64_t> steps(0, 3);
+
+    for (uint32_t count = 0; count <= max_count; ++count) {
+        // sorted with duplicates, starting at the smallest value
+        std::vector<Key> keys;
+        Key key = std::is_floating_point_v<Key> ? Key(-100) : std::numeric_limits<Key>::lowest();
+        for (uint32_t i = 0; i < count; ++i) {
+            keys.push_back(key);
+            key += static_cast<Key>(steps(random));
+        }
+        if (count > 0)
+            keys.back() = std::numeric_limits<Key>::max();
+
+        std::vector<Key> probes = {std::numeric_limits<Key>::lowest(), std::numeric_limits<Key>::max(), 0};
+        for (auto k : keys) {
+            probes.push_back(k);
+            if (k < std::numeric_limits<Key>::max())
+                probes.push_back(k + 1);
+            if (k > std::numeric_limits<Key>::lowest())
+                probes.push_back(k - 1);
+        }
+
+        for (auto probe : probes) {
+            auto lower = std::lower_bound(keys.begin(), keys.end(), probe) - keys.begin();
+            auto upper = std::upper_bound(keys.begin(), keys.end(), probe) - keys.begin();
+            ASSERT_EQ(lower, imlab::search_lower_bound(keys.data(), count, probe, std::less<Key>()));
+            ASSERT_EQ(upper, imlab::search_upper_bound(keys.data(), count, probe, std::less<Key>()));
+        }
+    }
+}
+
+TEST(NodeSearch, Unsigned64) {
+    check_search<uint64_t>(200);
+}
+
+TEST(NodeSearch, Signed64) {
+    check_search<int64_t>(200);
+}
+
+TEST(NodeSearch, Unsigned32) {
+    check_search<uint32_t>(200);
+}
+
+TEST(NodeSearch, Signed32) {
+    check_search<int32_t>(200);
+}
+
+TEST(NodeSearch, Unsigned16) {
+    check_search<uint16_t>(200);
+}
+
+TEST(NodeSearch, Signed16) {
+    check_search<int16_t>(200);
+}
+
+// at most three per step, so the keys stay in range
+TEST(NodeSearch, Bytes) {
+    check_search<uint8_t>(80);
+    check_search<int8_t>(80);
+}
+
+TEST(NodeSearch, Scalar) {
+    check_search<double>(100);
+}
+
+TEST(NodeSearch, CustomCompare) {
+    static_assert(!imlab::kVectorizedSearch<uint64_t, std::greater<uint64_t>>);
+    std::vector<uint64_t> keys = {9, 7, 7, 3, 1};
+    EXPECT_EQ(1, imlab::search_lower_bound(keys.data(), 5, uint64_t{7}, std::greater<uint64_t>()));
+    EXPECT_EQ(3, imlab::search_upper_bound(keys.data(), 5, uint64_t{7}, std::greater<uint64_t>()));
+    EXPECT_EQ(5, imlab::search_lower_bound(keys.data(), 5, uint64_t{0}, std::greater<uint64_t>()));
+}
+
+// unique keys from `next`, then every key and its neighbours against the standard library
+template<typename Key, typename Next> void check_model(uint32_t max_count, Next next) {
+    for (uint32_t count = 0; count <= max_count; ++count) {
+        std::vector<Key> keys;
+        Key key = std::numeric_limits<Key>::lowest();
+        for (uint32_t i = 0; i < count; ++i) {
+            keys.push_back(key);
+            key = next(key, i);
+        }
+        imlab::LearnedModel<Key> model;
+        model.build(keys.data(), count);
+
+        std::vector<Key> probes = {std::numeric_limits<Key>::lowest(), std::numeric_limits<Key>::max(), 0};
+        for (auto k : keys) {
+            probes.push_back(k);
+            if (k < std::numeric_limits<Key>::max())
+                probes.push_back(k + 1);
+            if (k > std::numeric_limits<Key>::lowest())
+                probes.push_back(k - 1);
+        }
+        for (auto probe : probes) {
+            auto lower = std::lower_bound(keys.begin(), keys.end(), probe) - keys.begin();
+            auto upper = std::upper_bound(keys.begin(), keys.end(), probe) - keys.begin();
+            ASSERT_EQ(lower, model.template search<false>(keys.data(), count, probe)) << count << " " << probe;
+            ASSERT_EQ(upper, model.template search<true>(keys.data(), count, probe)) << count << " " << probe;
+        }
+    }
+}
+
+TEST(NodeSearch, LearnedModel) {
+    std::mt19937_64 random(43);
+    // evenly spaced, random gaps and gaps that grow quickly, which one line fits badly
+    check_model<uint64_t>(300, [](uint64_t key, uint32_t) { return key + 16; });
+    check_model<uint64_t>(300, [&random](uint64_t key, uint32_t) { return key + 1 + random() % 1000; });
+    check_model<int64_t>(300, [](int64_t key, uint32_t i) { return key + 1 + (int64_t{1} << (i / 6)); });
+    check_model<uint32_t>(300, [](uint32_t key, uint32_t i) { return key + 1 + i * i; });
+    check_model<int16_t>(200, [&random](int16_t key, uint32_t) { return static_cast<int16_t>(key + 1 + random() % 100); });
+}
+// ---------------------------------------------------------------------------------------------------
+}  // namespace
+// ---------------------------------------------------------------------------------------------------
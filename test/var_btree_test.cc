@@ -0,0 +1,201 @@
+// ---------------------------------------------------------------------------
+// IMLAB
+// ---------------------------------------------------------------------------
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "imlab/btree.h"
+#include "imlab/buffer_manager.h"
+#include "imlab/var_btree.h"
+// ---------------------------------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------------------------------
+using VarBTreeTest = imlab::VarBTree<1024>;
+
+// long common prefixes like most real world string keys
+std::string url(uint32_t i) {
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "https://example.com/users/%08u/profile", i);
+    return buffer;
+}
+
+std::vector<uint32_t> shuffled(uint32_t amount) {
+    std::vector<uint32_t> ids(amount);
+    for (uint32_t i = 0; i < amount; ++i)
+        ids[i] = i;
+    std::shuffle(ids.begin(), ids.end(), std::mt19937(42));
+    return ids;
+}
+
+TEST(VarBTree, Separator) {
+    EXPECT_EQ("b", VarBTreeTest::Node::separator("abc", "bcd"));
+    EXPECT_EQ("abd", VarBTreeTest::Node::separator("abc", "abdzz"));
+    // no shorter key fits in between
+    EXPECT_EQ("abc", VarBTreeTest::Node::separator("abc", "abd"));
+    EXPECT_EQ("ab", VarBTreeTest::Node::separator("ab", "abc"));
+    EXPECT_EQ("a", VarBTreeTest::Node::separator("", "ab"));
+}
+
+TEST(VarBTree, InsertLookupErase) {
+    imlab::BufferManager<1024> buffer_manager{10};
+    VarBTreeTest tree(0, buffer_manager);
+    EXPECT_FALSE(tree.lookup("a"));
+    EXPECT_EQ(tree.end(), tree.begin());
+
+    tree.insert("banana", "yellow");
+    tree.insert("apple", "red");
+    tree.insert("", "empty");
+    tree.insert(std::string("a\0b", 3), "zero");
+    EXPECT_EQ(4, tree.size());
+
+    // insert does not overwrite, insert_or_assign does
+    tree.insert("apple", "green");
+    EXPECT_EQ("red", tree.lookup("apple"));
+    tree.insert_or_assign("apple", "green and longer");
+    EXPECT_EQ("green and longer", tree.lookup("apple"));
+    EXPECT_EQ("empty", tree.lookup(""));
+    EXPECT_EQ("zero", tree.lookup(std::string("a\0b", 3)));
+    EXPECT_FALSE(tree.lookup("a"));
+    EXPECT_EQ(4, tree.size());
+
+    std::vector<std::string> keys;
+    for (auto it = tree.begin(); it != tree.end(); ++it)
+        keys.push_back(it.key());
+    EXPECT_EQ((std::vector<std::string>{"", std::string("a\0b", 3), "apple", "banana"}), keys);
+
+    tree.erase("apple");
+    tree.erase("cherry");
+    EXPECT_EQ(3, tree.size());
+    EXPECT_FALSE(tree.lookup("apple"));
+    EXPECT_EQ("banana", tree.lower_bound("apple").key());
+
+    std::string too_large(VarBTreeTest::kMaxEntry, 'x');
+    EXPECT_THROW(tree.insert(too_large, "x"), imlab::entry_too_large_error);
+    EXPECT_NO_THROW(tree.insert(too_large, ""));
+}
+
+TEST(VarBTree, MultipleInserts) {
+    constexpr uint32_t amount = 20000;
+    imlab::BufferManager<1024> buffer_manager{10};
+    VarBTreeTest tree(0, buffer_manager);
+
+    std::map<std::string, std::string> expected;
+    for (auto i : shuffled(amount)) {
+        // values of varying length
+        std::string value(i % 17, static_cast<char>('a' + i % 26));
+        tree.insert(url(i), value);
+        expected.emplace(url(i), value);
+    }
+    EXPECT_EQ(amount, tree.size());
+    EXPECT_LT(1, tree.depth());
+
+    auto it = tree.begin();
+    for (const auto &[key, value] : expected) {
+        ASSERT_NE(tree.end(), it);
+        ASSERT_EQ(key, it.key());
+        ASSERT_EQ(value, it.value());
+        ++it;
+    }
+    EXPECT_EQ(tree.end(), it);
+
+    // erase every other key, the rest stays reachable
+    for (uint32_t i = 0; i < amount; i += 2)
+        tree.erase(url(i));
+    EXPECT_EQ(amount / 2, tree.size());
+    for (uint32_t i = 0; i < amount; ++i) {
+        if (i % 2 == 0) {
+            ASSERT_FALSE(tree.lookup(url(i)));
+            ASSERT_EQ(url(i + 1), tree.lower_bound(url(i)).key());
+        } else {
+            ASSERT_EQ(expected[url(i)], tree.lookup(url(i)));
+        }
+    }
+
+    // the freed space is reused
+    for (uint32_t i = 0; i < amount; i += 2)
+        tree.insert_or_assign(url(i), "again");
+    EXPECT_EQ(amount, tree.size());
+    EXPECT_EQ("again", tree.lookup(url(0)));
+}
+
+TEST(VarBTree, Fanout) {
+    using Node = imlab::VarBTree<4096>::Node;
+    // the same keys padded to a fixed size
+    using Padded = imlab::BTree<std::array<char, 64>, uint64_t, 4096>;
+    alignas(Node) char page[4096];
+    auto *node = reinterpret_cast<Node *>(page);
+
+    // fill single nodes with keys from the middle of a large tree
+    node->init(0, url(1000), url(99999));
+    uint32_t leaf_entries = 0;
+    for (uint32_t i = 1001; node->fits(url(i).size() + 8); ++i)
+        node->insert(leaf_entries++, url(i), "8 bytes!");
+
+    node->init(1, url(1000), url(99999));
+    uint32_t inner_entries = 0;
+    for (uint32_t i = 1001; node->fits(Node::separator(url(i), url(i + 1)).size() + 8); ++i)
+        node->insert(inner_entries++, Node::separator(url(i), url(i + 1)), Node::encode_page(i));
+
+    EXPECT_LT(2 * Padded::LeafNode::kCapacity, leaf_entries);
+    EXPECT_LT(2.5 * Padded::InnerNode::kCapacity, inner_entries);
+
+    // splits keep the leaves well above half full
+    constexpr uint32_t amount = 20000;
+    imlab::BufferManager<4096> buffer_manager{20};
+    imlab::VarBTree<4096> tree(imlab::temporary, 38, buffer_manager);
+    for (auto i : shuffled(amount))
+        tree.insert(url(i), "8 bytes!");
+    EXPECT_LT(leaf_entries / 2, amount / tree.leaf_count());
+}
+
+TEST(VarBTree, Reopen) {
+    constexpr uint16_t segment = 37;
+    constexpr uint32_t amount = 5000;
+    {
+        imlab::BufferManager<1024> buffer_manager{10};
+        VarBTreeTest tree(segment, buffer_manager);
+        for (auto i : shuffled(amount))
+            tree.insert(url(i), std::to_string(i));
+        tree.checkpoint();
+    }
+
+    imlab::BufferManager<1024> buffer_manager{10};
+    VarBTreeTest tree(imlab::reopen, segment, buffer_manager);
+    EXPECT_EQ(amount, tree.size());
+    for (uint32_t i = 0; i < amount; ++i)
+        ASSERT_EQ(std::to_string(i), tree.lookup(url(i)));
+}
+
+TEST(VarBTree, Concurrent) {
+    constexpr uint32_t threads = 4;
+    constexpr uint32_t amount = 8000;
+    imlab::BufferManager<1024> buffer_manager{100};
+    VarBTreeTest tree(imlab::temporary, 38, buffer_manager);
+
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&tree, t] {
+            for (uint32_t i = t; i < amount; i += threads)
+                tree.insert(url(i), std::to_string(i));
+            for (uint32_t i = t; i < amount; i += threads)
+                ASSERT_EQ(std::to_string(i), tree.lookup(url(i)));
+        });
+    }
+    for (auto &worker : workers)
+        worker.join();
+
+    EXPECT_EQ(amount, tree.size());
+    uint32_t i = 0;
+    for (auto it = tree.begin(); it != tree.end(); ++it)
+        ASSERT_EQ(url(i++), it.key());
+    EXPECT_EQ(amount, i);
+}
+// ---------------------------------------------------------------------------------------------------
+}  // namespace
+// ---------------------------------------------------------------------------------------------------
@@ -0,0 +1,197 @@
+// ---------------------------------------------------------------------------
+// IMLAB
+// ---------------------------------------------------------------------------
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "imlab/buffer_manager.h"
+#include "imlab/write_ahead_log.h"
+// ---------------------------------------------------------------------------------------------------
+namespace {
+// ---------------------------------------------------------------------------------------------------
+const std::string log_path = "/tmp/imlab_wal_test.log";
+
+struct Record {
+    uint64_t page_id;
+    uint32_t offset;
+    std::string data;
+};
+
+std::vector<Record> read_log(const imlab::WriteAheadLog &wal) {
+    std::vector<Record> records;
+    wal.replay([&](uint64_t page_id, uint32_t offset, const std::byte *data, uint32_t length) {
+        records.push_back({page_id, offset, std::string(reinterpret_cast<const char *>(data), length)});
+    });
+    return records;
+}
+
+void append(imlab::WriteAheadLog &wal, uint64_t page_id, uint32_t offset, const std::string &data) {
+    wal.append(page_id, offset, reinterpret_cast<const std::byte *>(data.data()), data.size());
+}
+
+TEST(WriteAheadLog, AppendReplay) {
+    std::remove(log_path.c_str());
+    {
+        imlab::WriteAheadLog wal{log_path};
+        append(wal, 1, 0, "abc");
+        append(wal, 2, 10, "defg");
+        wal.flush();
+
+        // buffered but never flushed, lost in the crash
+        append(wal, 3, 0, "lost");
+    }
+
+    imlab::WriteAheadLog wal{log_path};
+    auto records = read_log(wal);
+    ASSERT_EQ(2, records.size());
+    EXPECT_EQ(1, records[0].page_id);
+    EXPECT_EQ(0, records[0].offset);
+    EXPECT_EQ("abc", records[0].data);
+    EXPECT_EQ(2, records[1].page_id);
+    EXPECT_EQ(10, records[1].offset);
+    EXPECT_EQ("defg", records[1].data);
+}
+
+TEST(WriteAheadLog, TornTail) {
+    std::remove(log_path.c_str());
+    {
+        imlab::WriteAheadLog wal{log_path};
+        append(wal, 1, 0, "complete");
+        append(wal, 2, 0, "torn");
+        wal.flush();
+    }
+
+    // cut the last record in half
+    std::FILE *f = std::fopen(log_path.c_str(), "r+");
+    std::fseek(f, 0, SEEK_END);
+    long size = std::ftell(f);
+    std::fclose(f);
+    ASSERT_EQ(0, truncate(log_path.c_str(), size - 2));
+
+    imlab::WriteAheadLog wal{log_path};
+    auto records = read_log(wal);
+    ASSERT_EQ(1, records.size());
+    EXPECT_EQ("complete", records[0].data);
+
+    // new records continue after the valid prefix
+    append(wal, 3, 0, "new");
+    wal.flush();
+    records = read_log(wal);
+    ASSERT_EQ(2, records.size());
+    EXPECT_EQ("new", records[1].data);
+}
+
+TEST(WriteAheadLog, GroupCommit) {
+    std::remove(log_path.c_str());
+    imlab::WriteAheadLog wal{log_path};
+
+    std::vector<uint64_t> lsns;
+    for (uint64_t i = 0; i < 100; ++i)
+        lsns.push_back(wal.append(i, 0, reinterpret_cast<const std::byte *>(&i), sizeof(i)));
+
+    // one sync covers all earlier records
+    wal.flush(lsns.back());
+    for (auto lsn : lsns)
+        wal.flush(lsn);
+    EXPECT_EQ(1, wal.syncs());
+    EXPECT_EQ(lsns.back(), wal.flushed_lsn());
+
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t < 8; ++t) {
+        threads.emplace_back([&wal, t] {
+            for (uint64_t i = 0; i < 16; ++i)
+                wal.flush(wal.append(t, i, reinterpret_cast<const std::byte *>(&i), sizeof(i)));
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    EXPECT_EQ(wal.appended_lsn(), wal.flushed_lsn());
+    EXPECT_LE(wal.syncs(), 1 + 8 * 16);
+    EXPECT_EQ(100 + 8 * 16, read_log(wal).size());
+
+    wal.truncate();
+    EXPECT_TRUE(read_log(wal).empty());
+}
+
+TEST(WriteAheadLog, BufferManagerRecovery) {
+    using Manager = imlab::BufferManager<1024>;
+    constexpr uint64_t segment = 27ull << 48;
+    std::remove(log_path.c_str());
+
+    // known state on disk
+    {
+        Manager manager{10};
+        for (uint64_t i = 0; i < 4; ++i) {
+            auto fix = manager.fix_exclusive(segment | i);
+            std::memset(fix.data(), 0, 1024);
+            fix.set_dirty();
+        }
+    }
+
+    // modify with logging and crash before any page is written back
+    {
+        imlab::WriteAheadLog wal{log_path};
+        alignas(Manager) std::byte storage[sizeof(Manager)];
+        Manager *manager = new (storage) Manager(10, wal);
+
+        for (uint64_t i = 0; i < 4; ++i) {
+            auto fix = manager->fix_exclusive(segment | i);
+            fix.as<uint64_t>()[i] = 100 + i;
+            fix.set_dirty();
+        }
+        {
+            // exclusive fix without changes is not logged
+            auto fix = manager->fix_exclusive(segment);
+            fix.set_dirty();
+        }
+        manager->commit();
+
+        EXPECT_EQ(4, read_log(wal).size());
+        EXPECT_EQ(0, manager->page_writes());
+        EXPECT_EQ(1, wal.syncs());
+    }
+
+    {
+        imlab::WriteAheadLog wal{log_path};
+        Manager manager{10, wal};
+
+        // recovery wrote the pages and discarded the log
+        EXPECT_TRUE(read_log(wal).empty());
+        for (uint64_t i = 0; i < 4; ++i) {
+            auto fix = manager.fix(segment | i);
+            EXPECT_EQ(100 + i, fix.as<uint64_t>()[i]);
+            EXPECT_EQ(0, fix.as<uint64_t>()[(i + 1) % 4]);
+        }
+    }
+}
+
+TEST(WriteAheadLog, WriteAheadRule) {
+    using Manager = imlab::BufferManager<1024>;
+    constexpr uint64_t segment = 27ull << 48;
+    std::remove(log_path.c_str());
+
+    imlab::WriteAheadLog wal{log_path};
+    Manager manager{2, wal};
+
+    {
+        auto fix = manager.fix_exclusive(segment | 10);
+        *fix.as<uint64_t>() += 1;
+        fix.set_dirty();
+    }
+    EXPECT_LT(wal.flushed_lsn(), wal.appended_lsn());
+
+    // evicting the dirty page forces the log to disk first
+    manager.fix(segment | 11);
+    manager.fix(segment | 12);
+    EXPECT_EQ(1, manager.page_writes());
+    EXPECT_EQ(wal.appended_lsn(), wal.flushed_lsn());
+}
+// ---------------------------------------------------------------------------------------------------
+}  // namespace
+// ---------------------------------------------------------------------------------------------------